@@ -0,0 +1,595 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <jack/jack.h>
+#include <sndfile.h>
+
+#include "crypto_common.h"
+#include "jack_common.h"
+#include "audio_backend.h"
+
+using namespace std;
+
+// Enough for every port jack_crypto_rx can register
+static const int MAX_BACKEND_PORTS = 16;
+
+class jack_backend : public audio_backend
+{
+public:
+    explicit jack_backend(jack_client_t* client)
+        : m_client(client),
+          m_server_gone(false),
+          m_num_ports(0),
+          m_process(nullptr),
+          m_xrun(nullptr),
+          m_shutdown(nullptr),
+          m_arg(nullptr)
+    {
+    }
+
+    ~jack_backend() override
+    {
+        // The shutdown callback may exit() from a JACK thread, which then
+        // can't close its own client
+        if (!m_server_gone)
+        {
+            jack_client_close(m_client);
+        }
+    }
+
+    int register_port(const char* name, bool output) override
+    {
+        if (m_num_ports == MAX_BACKEND_PORTS)
+        {
+            return -1;
+        }
+
+        jack_port_t* port = jack_port_register(m_client,
+                                               name,
+                                               JACK_DEFAULT_AUDIO_TYPE,
+                                               output ? JackPortIsOutput : JackPortIsInput,
+                                               0);
+        if (port == nullptr)
+        {
+            return -1;
+        }
+
+        m_ports[m_num_ports] = port;
+        m_outputs[m_num_ports] = output;
+        return m_num_ports++;
+    }
+
+    audio_sample_t* port_buffer(int port, uint nframes) override
+    {
+        return (audio_sample_t*)jack_port_get_buffer(m_ports[port], nframes);
+    }
+
+    uint sample_rate() const override
+    {
+        return jack_get_sample_rate(m_client);
+    }
+
+    uint buffer_size() const override
+    {
+        return jack_get_buffer_size(m_client);
+    }
+
+    void set_buffer_size(uint nframes) override
+    {
+        if (jack_get_buffer_size(m_client) != nframes)
+        {
+            jack_set_buffer_size(m_client, nframes);
+        }
+    }
+
+    int realtime_priority() const override
+    {
+        return jack_client_real_time_priority(m_client);
+    }
+
+    void set_callbacks(audio_process_callback  process,
+                       audio_xrun_callback     xrun,
+                       audio_shutdown_callback shutdown,
+                       void*                   arg) override
+    {
+        m_process = process;
+        m_xrun = xrun;
+        m_shutdown = shutdown;
+        m_arg = arg;
+
+        jack_set_process_callback(m_client, jack_process, this);
+        jack_set_xrun_callback(m_client, jack_xrun, this);
+        jack_on_shutdown(m_client, jack_shutdown, this);
+    }
+
+    bool activate() override
+    {
+        return jack_activate(m_client) == 0;
+    }
+
+    void deactivate() override
+    {
+        jack_deactivate(m_client);
+    }
+
+    bool connect(int port, const char* target) override
+    {
+        if (m_outputs[port])
+        {
+            return connect_input_ports(m_client, m_ports[port], target);
+        }
+
+        // Ports stay connected when the config is reloaded
+        const int ret = jack_connect(m_client, target, jack_port_name(m_ports[port]));
+        return ret == 0 || ret == EEXIST;
+    }
+
+    void disconnect(int port) override
+    {
+        jack_port_disconnect(m_client, m_ports[port]);
+    }
+
+private:
+    static int jack_process(jack_nframes_t nframes, void* arg)
+    {
+        jack_backend* backend = static_cast<jack_backend*>(arg);
+        return backend->m_process(nframes, backend->m_arg);
+    }
+
+    static int jack_xrun(void* arg)
+    {
+        jack_backend* backend = static_cast<jack_backend*>(arg);
+        return backend->m_xrun != nullptr ? backend->m_xrun(backend->m_arg) : 0;
+    }
+
+    /**
+     * JACK calls this shutdown_callback if the server ever shuts down or
+     * decides to disconnect the client.
+     */
+    static void jack_shutdown(void* arg)
+    {
+        jack_backend* backend = static_cast<jack_backend*>(arg);
+        backend->m_server_gone = true;
+        if (backend->m_shutdown != nullptr)
+        {
+            backend->m_shutdown(false, backend->m_arg);
+        }
+    }
+
+private:
+    jack_client_t*          m_client;
+    std::atomic<bool>       m_server_gone;
+    jack_port_t*            m_ports[MAX_BACKEND_PORTS];
+    bool                    m_outputs[MAX_BACKEND_PORTS];
+    int                     m_num_ports;
+
+    audio_process_callback  m_process;
+    audio_xrun_callback     m_xrun;
+    audio_shutdown_callback m_shutdown;
+    void*                   m_arg;
+};
+
+// Runs the cycles on a thread of its own. Subclasses fill the input ports
+// before each cycle and take the output ports after it
+class thread_backend : public audio_backend
+{
+public:
+    explicit thread_backend(uint sample_rate)
+        : m_sample_rate(sample_rate),
+          m_buffer_size(1024),
+          m_num_ports(0),
+          m_process(nullptr),
+          m_xrun(nullptr),
+          m_shutdown(nullptr),
+          m_arg(nullptr),
+          m_stop(false)
+    {
+    }
+
+    // Subclasses must call deactivate() in their destructors, before the
+    // ports go away
+    ~thread_backend() override
+    {
+    }
+
+    audio_sample_t* port_buffer(int port, uint nframes) override
+    {
+        // A port registered during the cycle is silent until the next one
+        audio_buffer_t& buffer = m_ports[port].buffer;
+        if (buffer.size() != nframes)
+        {
+            buffer.assign(nframes, 0.0f);
+        }
+        return buffer.data();
+    }
+
+    uint sample_rate() const override
+    {
+        return m_sample_rate;
+    }
+
+    uint buffer_size() const override
+    {
+        return m_buffer_size;
+    }
+
+    void set_buffer_size(uint nframes) override
+    {
+        m_buffer_size = nframes;
+    }
+
+    int realtime_priority() const override
+    {
+        return 0;
+    }
+
+    void set_callbacks(audio_process_callback  process,
+                       audio_xrun_callback     xrun,
+                       audio_shutdown_callback shutdown,
+                       void*                   arg) override
+    {
+        m_process = process;
+        m_xrun = xrun;
+        m_shutdown = shutdown;
+        m_arg = arg;
+    }
+
+    bool activate() override
+    {
+        if (m_thread.joinable())
+        {
+            return false;
+        }
+
+        m_stop = false;
+        m_thread = thread(&thread_backend::run, this);
+        return true;
+    }
+
+    void deactivate() override
+    {
+        m_stop = true;
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+protected:
+    struct port
+    {
+        std::string    name;
+        bool           output = false;
+        SNDFILE*       file = nullptr;
+        // Only touched by the cycle thread
+        audio_buffer_t buffer;
+    };
+
+    // Takes a slot in the port table. The cycle thread only sees the port
+    // once add_port() is called
+    port* new_port(const char* name, bool output)
+    {
+        const int idx = m_num_ports.load(memory_order_relaxed);
+        if (idx == MAX_BACKEND_PORTS)
+        {
+            return nullptr;
+        }
+
+        m_ports[idx].name = name;
+        m_ports[idx].output = output;
+        return &m_ports[idx];
+    }
+
+    int add_port()
+    {
+        return m_num_ports.fetch_add(1, memory_order_release);
+    }
+
+    int num_ports() const
+    {
+        return m_num_ports.load(memory_order_acquire);
+    }
+
+    // Fills the input buffers of the first n_ports ports. Returns false
+    // once the input has run out
+    virtual bool begin_cycle(uint nframes, int n_ports) = 0;
+    virtual void end_cycle(uint nframes, int n_ports) = 0;
+
+    // Called after a cycle when the next one starts late
+    void xrun()
+    {
+        if (m_xrun != nullptr)
+        {
+            m_xrun(m_arg);
+        }
+    }
+
+protected:
+    port m_ports[MAX_BACKEND_PORTS];
+
+private:
+    void run()
+    {
+        bool finished = false;
+        while (!m_stop)
+        {
+            const uint nframes = m_buffer_size;
+            const int n_ports = num_ports();
+            for (int i = 0; i < n_ports; ++i)
+            {
+                m_ports[i].buffer.resize(nframes);
+            }
+
+            if (!begin_cycle(nframes, n_ports))
+            {
+                finished = true;
+                break;
+            }
+
+            m_process(nframes, m_arg);
+            end_cycle(nframes, n_ports);
+        }
+
+        if (finished && m_shutdown != nullptr)
+        {
+            m_shutdown(true, m_arg);
+        }
+    }
+
+private:
+    const uint              m_sample_rate;
+    std::atomic<uint>       m_buffer_size;
+    std::atomic<int>        m_num_ports;
+
+    audio_process_callback  m_process;
+    audio_xrun_callback     m_xrun;
+    audio_shutdown_callback m_shutdown;
+    void*                   m_arg;
+
+    std::atomic<bool>       m_stop;
+    thread                  m_thread;
+};
+
+class file_backend : public thread_backend
+{
+public:
+    file_backend(const char* dir, uint sample_rate)
+        : thread_backend(sample_rate),
+          m_dir(dir)
+    {
+    }
+
+    ~file_backend() override
+    {
+        deactivate();
+
+        for (int i = 0; i < num_ports(); ++i)
+        {
+            sf_close(m_ports[i].file);
+        }
+    }
+
+    int register_port(const char* name, bool output) override
+    {
+        port* p = new_port(name, output);
+        if (p == nullptr)
+        {
+            return -1;
+        }
+
+        const std::string path = m_dir + "/" + name + ".wav";
+        SF_INFO sfinfo;
+        memset(&sfinfo, 0, sizeof(sfinfo));
+        if (output)
+        {
+            sfinfo.samplerate = sample_rate();
+            sfinfo.channels = 1;
+            sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+            p->file = sf_open(path.c_str(), SFM_WRITE, &sfinfo);
+        }
+        else
+        {
+            p->file = sf_open(path.c_str(), SFM_READ, &sfinfo);
+            if (p->file != nullptr && (sfinfo.channels != 1 || (uint)sfinfo.samplerate != sample_rate()))
+            {
+                fprintf(stderr,
+                        "%s must be mono at %u Hz, it has %d channels at %d Hz\n",
+                        path.c_str(),
+                        sample_rate(),
+                        sfinfo.channels,
+                        sfinfo.samplerate);
+                sf_close(p->file);
+                p->file = nullptr;
+                return -1;
+            }
+        }
+
+        if (p->file == nullptr)
+        {
+            fprintf(stderr, "Could not open %s\n", path.c_str());
+            return -1;
+        }
+
+        return add_port();
+    }
+
+protected:
+    bool begin_cycle(uint nframes, int n_ports) override
+    {
+        // Only whole cycles are processed, a partial one at the end of the
+        // input is dropped
+        for (int i = 0; i < n_ports; ++i)
+        {
+            port& p = m_ports[i];
+            if (!p.output && sf_readf_float(p.file, p.buffer.data(), nframes) < nframes)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void end_cycle(uint nframes, int n_ports) override
+    {
+        for (int i = 0; i < n_ports; ++i)
+        {
+            port& p = m_ports[i];
+            if (p.output)
+            {
+                sf_writef_float(p.file, p.buffer.data(), nframes);
+            }
+        }
+    }
+
+private:
+    const std::string m_dir;
+};
+
+class null_backend : public thread_backend
+{
+public:
+    explicit null_backend(uint sample_rate)
+        : thread_backend(sample_rate),
+          m_deadline_ns(0)
+    {
+    }
+
+    ~null_backend() override
+    {
+        deactivate();
+    }
+
+    int register_port(const char* name, bool output) override
+    {
+        return new_port(name, output) != nullptr ? add_port() : -1;
+    }
+
+protected:
+    bool begin_cycle(uint nframes, int n_ports) override
+    {
+        for (int i = 0; i < n_ports; ++i)
+        {
+            port& p = m_ports[i];
+            if (!p.output)
+            {
+                zeroize_frames(p.buffer.data(), nframes);
+            }
+        }
+
+        // A cycle every nframes samples, like a sound card would run them
+        const uint64_t now_ns = monotonic_ns();
+        if (m_deadline_ns == 0)
+        {
+            m_deadline_ns = now_ns;
+        }
+        else if (now_ns > m_deadline_ns + period_ns(nframes))
+        {
+            // Late by more than a cycle. Start counting again from now
+            // rather than running a burst of cycles to catch up
+            xrun();
+            m_deadline_ns = now_ns;
+        }
+        else
+        {
+            struct timespec deadline;
+            deadline.tv_sec = m_deadline_ns / 1000000000ull;
+            deadline.tv_nsec = m_deadline_ns % 1000000000ull;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR)
+            {
+            }
+        }
+
+        m_deadline_ns += period_ns(nframes);
+        return true;
+    }
+
+    void end_cycle(uint nframes, int n_ports) override
+    {
+    }
+
+private:
+    uint64_t period_ns(uint nframes) const
+    {
+        return nframes * 1000000000ull / sample_rate();
+    }
+
+    static uint64_t monotonic_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+private:
+    // Only touched by the cycle thread
+    uint64_t m_deadline_ns;
+};
+
+std::unique_ptr<audio_backend> open_jack_backend(const char* client_name,
+                                                 const char* server_name)
+{
+    jack_options_t options = JackNullOption;
+    jack_status_t status;
+    if (server_name != nullptr)
+    {
+        options = (jack_options_t)(JackNullOption | JackServerName | JackNoStartServer);
+    }
+
+    fprintf(stderr, "Server name: %s\n", server_name ? server_name : "");
+
+    /* open a client connection to the JACK server */
+    jack_client_t* client = jack_client_open(client_name, options, &status, server_name);
+    if (client == NULL)
+    {
+        fprintf (stderr,
+                 "jack_client_open() failed, "
+                 "status = 0x%2.0x\n",
+                 status);
+        if (status & JackServerFailed)
+        {
+            fprintf (stderr, "Unable to connect to JACK server\n");
+        }
+        return nullptr;
+    }
+    if (status & JackServerStarted)
+    {
+        fprintf (stderr, "JACK server started\n");
+    }
+    if (status & JackNameNotUnique)
+    {
+        fprintf (stderr, "unique name `%s' assigned\n", jack_get_client_name(client));
+    }
+
+    return std::unique_ptr<audio_backend>(new jack_backend(client));
+}
+
+std::unique_ptr<audio_backend> open_file_backend(const char* dir, uint sample_rate)
+{
+    return std::unique_ptr<audio_backend>(new file_backend(dir, sample_rate));
+}
+
+std::unique_ptr<audio_backend> open_null_backend(uint sample_rate)
+{
+    return std::unique_ptr<audio_backend>(new null_backend(sample_rate));
+}
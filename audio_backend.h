@@ -0,0 +1,86 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AUDIO_BACKEND_H
+#define AUDIO_BACKEND_H
+
+#include <sys/types.h>
+
+#include <memory>
+#include <vector>
+
+typedef float                       audio_sample_t;
+typedef std::vector<audio_sample_t> audio_buffer_t;
+
+// Called once per cycle on the backend's audio thread
+typedef int  (*audio_process_callback)(uint nframes, void* arg);
+typedef int  (*audio_xrun_callback)(void* arg);
+// finished is true when the backend ran out of input, false when it failed,
+// eg. because the JACK server shut down
+typedef void (*audio_shutdown_callback)(bool finished, void* arg);
+
+// Where jack_crypto_tx and jack_crypto_rx get their cycles and port buffers
+// from. The JACK backend is what runs on the radio. The others run the same
+// process() code without a JACK server: the file backend reads and writes a
+// WAV file per port as fast as it can, the null backend runs cycles off a
+// timer with silent inputs
+class audio_backend
+{
+public:
+    virtual ~audio_backend() {}
+
+    // Returns a port index for port_buffer(), or -1 on failure. Ports can
+    // be registered while the backend is active
+    virtual int register_port(const char* name, bool output) = 0;
+
+    // Only valid in the process callback, for the nframes it was called with
+    virtual audio_sample_t* port_buffer(int port, uint nframes) = 0;
+
+    virtual uint sample_rate() const = 0;
+    virtual uint buffer_size() const = 0;
+    // Takes effect from the next cycle
+    virtual void set_buffer_size(uint nframes) = 0;
+    // The SCHED_FIFO priority of the audio thread, or 0 if it isn't realtime
+    virtual int  realtime_priority() const = 0;
+
+    // Must be called before activate()
+    virtual void set_callbacks(audio_process_callback  process,
+                               audio_xrun_callback     xrun,
+                               audio_shutdown_callback shutdown,
+                               void*                   arg) = 0;
+
+    virtual bool activate() = 0;
+    // Returns once the process callback has stopped running
+    virtual void deactivate() = 0;
+
+    // Connects an input port to the named source port, or an output port to
+    // every input port matching a regex. Backends without a patchbay accept
+    // any connection
+    virtual bool connect(int port, const char* target) { return true; }
+    virtual void disconnect(int port) {}
+};
+
+// All of these return null and print why on failure
+
+std::unique_ptr<audio_backend> open_jack_backend(const char* client_name,
+                                                 const char* server_name);
+
+// Input ports read <dir>/<port name>.wav, which must be mono at sample_rate,
+// output ports write <dir>/<port name>.wav. The backend finishes when any
+// input runs out
+std::unique_ptr<audio_backend> open_file_backend(const char* dir, uint sample_rate);
+
+std::unique_ptr<audio_backend> open_null_backend(uint sample_rate);
+
+#endif
@@ -0,0 +1,387 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "freedv_api.h"
+#include "crypto_cfg.h"
+#include "crypto_rx_common.h"
+#include "crypto_tx_common.h"
+#include "speech_synth.h"
+
+// Measures how fast crypto_tx_common::transmit() and
+// crypto_rx_common::receive() run in every mode, with and without
+// encryption, and prints the results as JSON. Every case runs in a child
+// process of its own so its peak RSS can be measured
+
+struct bench_mode
+{
+    const char* name;
+    int         mode;
+};
+
+static const bench_mode BENCH_MODES[] =
+{
+    { "700C",  FREEDV_MODE_700C },
+    { "700D",  FREEDV_MODE_700D },
+    { "700E",  FREEDV_MODE_700E },
+    { "800XA", FREEDV_MODE_800XA },
+    { "1600",  FREEDV_MODE_1600 },
+    { "2400B", FREEDV_MODE_2400B },
+};
+
+struct frame_stats
+{
+    unsigned long long frames;
+    // Seconds of audio the frames represent
+    double             audio_seconds;
+    double             busy_seconds;
+    double             ns_per_frame;
+    double             p99_ns;
+};
+
+struct case_result
+{
+    int         ok;
+    frame_stats tx;
+    frame_stats rx;
+};
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static frame_stats summarize(std::vector<long long>& frame_ns, double audio_seconds)
+{
+    frame_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.frames = frame_ns.size();
+    stats.audio_seconds = audio_seconds;
+    if (frame_ns.empty())
+    {
+        return stats;
+    }
+
+    long long total_ns = 0;
+    for (long long ns : frame_ns)
+    {
+        total_ns += ns;
+    }
+    std::sort(frame_ns.begin(), frame_ns.end());
+
+    stats.busy_seconds = total_ns / 1e9;
+    stats.ns_per_frame = static_cast<double>(total_ns) / frame_ns.size();
+    stats.p99_ns = frame_ns[std::min(frame_ns.size() - 1, frame_ns.size() * 99 / 100)];
+    return stats;
+}
+
+static case_result run_case(const char* config_file, unsigned long long frames)
+{
+    case_result result;
+    memset(&result, 0, sizeof(result));
+
+    crypto_tx_common tx("bench_codec", config_file);
+    crypto_rx_common rx("bench_codec", config_file);
+
+    // Transmit synthetic speech, keeping the modem signal for the receiver
+    const size_t n_speech = tx.speech_samples_per_frame();
+    const size_t n_modem = tx.modem_samples_per_frame();
+    std::vector<short> speech(n_speech);
+    std::vector<short> modem(n_modem * frames);
+    std::vector<long long> frame_ns;
+    frame_ns.reserve(frames);
+    speech_synth synth(tx.speech_sample_rate());
+
+    for (unsigned long long i = 0; i < frames; ++i)
+    {
+        synth.generate(speech.data(), n_speech);
+
+        const long long start = now_ns();
+        tx.transmit(&modem[i * n_modem], speech.data());
+        frame_ns.push_back(now_ns() - start);
+    }
+    result.tx = summarize(frame_ns, static_cast<double>(frames * n_speech) / tx.speech_sample_rate());
+
+    // Receive it again until it runs out. The receiver asks for a varying
+    // number of samples per frame
+    std::vector<short> speech_out(rx.max_speech_samples_per_frame());
+    frame_ns.clear();
+    size_t pos = 0;
+    size_t nin;
+    while ((nin = rx.needed_modem_samples()) <= modem.size() - pos)
+    {
+        const long long start = now_ns();
+        rx.receive(speech_out.data(), &modem[pos]);
+        frame_ns.push_back(now_ns() - start);
+        pos += nin;
+    }
+    result.rx = summarize(frame_ns, static_cast<double>(pos) / rx.modem_sample_rate());
+
+    result.ok = 1;
+    return result;
+}
+
+// Writes a config image for one case next to an empty text file, so the
+// key file can be set directly instead of through KeyIndex
+static bool write_case_config(const char* config_file,
+                              const struct config& base,
+                              int mode,
+                              int crypto_enabled,
+                              const char* key_file)
+{
+    FILE* f = fopen(config_file, "w");
+    if (f == nullptr || fclose(f) != 0)
+    {
+        return false;
+    }
+
+    struct config cfg = base;
+    cfg.freedv_enabled = 1;
+    cfg.freedv_mode = mode;
+    cfg.crypto_enabled = crypto_enabled;
+    cfg.iq_enabled = 0;
+    strncpy(cfg.key_file, key_file, sizeof(cfg.key_file) - 1);
+    strncpy(cfg.log_file, "/dev/null", sizeof(cfg.log_file) - 1);
+    cfg.telemetry_file[0] = '\0';
+    cfg.trace_file[0] = '\0';
+
+    return write_config_blob(config_file, &cfg) != 0;
+}
+
+static bool write_key_file(const char* key_file)
+{
+    unsigned char key[FREEDV_MASTER_KEY_LENGTH];
+    for (size_t i = 0; i < sizeof(key); ++i)
+    {
+        key[i] = static_cast<unsigned char>(i * 37 + 11);
+    }
+
+    FILE* f = fopen(key_file, "wb");
+    if (f == nullptr)
+    {
+        return false;
+    }
+    const bool ok = fwrite(key, sizeof(key), 1, f) == 1;
+    return fclose(f) == 0 && ok;
+}
+
+// Runs the case in a child process. Returns false if it failed
+static bool fork_case(const char* config_file,
+                      unsigned long long frames,
+                      case_result* result,
+                      long* peak_rss_kb)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return false;
+    }
+
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        case_result child_result;
+        memset(&child_result, 0, sizeof(child_result));
+        try
+        {
+            child_result = run_case(config_file, frames);
+        }
+        catch (...)
+        {
+        }
+        const bool ok = write(fds[1], &child_result, sizeof(child_result)) == sizeof(child_result);
+        _exit(ok ? 0 : 1);
+    }
+
+    close(fds[1]);
+    memset(result, 0, sizeof(*result));
+    const bool read_ok = read(fds[0], result, sizeof(*result)) == sizeof(*result);
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid)
+    {
+        return false;
+    }
+    *peak_rss_kb = usage.ru_maxrss;
+
+    return read_ok && result->ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void print_stats(FILE* f, const char* name, const frame_stats& stats)
+{
+    fprintf(f,
+            "      \"%s\": {\"frames\": %llu, \"audio_seconds\": %.3f, \"busy_seconds\": %.6f, "
+            "\"real_time_factor\": %.6f, \"ns_per_frame\": %.0f, \"p99_ns\": %.0f}",
+            name,
+            stats.frames,
+            stats.audio_seconds,
+            stats.busy_seconds,
+            stats.audio_seconds > 0.0 ? stats.busy_seconds / stats.audio_seconds : 0.0,
+            stats.ns_per_frame,
+            stats.p99_ns);
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n <frames>] [-o <json file>] ConfigFile\n"
+            "  -n  Speech frames to transmit per case. The default is 1000\n"
+            "  -o  Write the results to this file instead of stdout\n"
+            "  Every mode is run with encryption off and on, starting from the\n"
+            "  settings in ConfigFile. The real time factor is the time spent\n"
+            "  in the codec divided by the duration of the audio, so below 1\n"
+            "  is faster than real time. peak_rss_kb is the peak RSS of the\n"
+            "  process that ran the case\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long long frames = 1000;
+    const char* output_file = nullptr;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': frames = strtoull(optarg, nullptr, 0); break;
+        case 'o': output_file = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc || frames == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct config base;
+    read_config(argv[optind], &base);
+
+    char work_dir[] = "/tmp/bench_codec.XXXXXX";
+    if (mkdtemp(work_dir) == nullptr)
+    {
+        fprintf(stderr, "Could not create a work directory\n");
+        return 1;
+    }
+    const std::string key_file = std::string(work_dir) + "/key";
+    const std::string config_file = std::string(work_dir) + "/bench.ini";
+    char blob_file[PATH_MAX];
+    get_config_blob_path(blob_file, sizeof(blob_file), config_file.c_str());
+
+    FILE* out = output_file != nullptr ? fopen(output_file, "w") : stdout;
+    if (out == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", output_file);
+        rmdir(work_dir);
+        return 1;
+    }
+
+    bool ok = write_key_file(key_file.c_str());
+    if (!ok)
+    {
+        fprintf(stderr, "Could not write %s\n", key_file.c_str());
+    }
+
+    fprintf(out, "{\n  \"frames\": %llu,\n  \"cases\": [", frames);
+    bool first = true;
+    bool failed = !ok;
+    for (const bench_mode& mode : BENCH_MODES)
+    {
+        for (int crypto_enabled = 0; crypto_enabled <= 1; ++crypto_enabled)
+        {
+            fprintf(stderr, "%s, encryption %s\n", mode.name, crypto_enabled ? "on" : "off");
+
+            case_result result;
+            long peak_rss_kb = 0;
+            const bool case_ok = ok &&
+                                 write_case_config(config_file.c_str(),
+                                                   base,
+                                                   mode.mode,
+                                                   crypto_enabled,
+                                                   key_file.c_str()) &&
+                                 fork_case(config_file.c_str(), frames, &result, &peak_rss_kb);
+            if (!case_ok)
+            {
+                fprintf(stderr, "%s, encryption %s failed\n", mode.name, crypto_enabled ? "on" : "off");
+            }
+
+            fprintf(out,
+                    "%s\n    {\"mode\": \"%s\", \"crypto\": %s, \"ok\": %s, \"peak_rss_kb\": %ld",
+                    first ? "" : ",",
+                    mode.name,
+                    crypto_enabled ? "true" : "false",
+                    case_ok ? "true" : "false",
+                    peak_rss_kb);
+            if (case_ok)
+            {
+                fprintf(out, ",\n");
+                print_stats(out, "tx", result.tx);
+                fprintf(out, ",\n");
+                print_stats(out, "rx", result.rx);
+                fprintf(out, "\n    }");
+            }
+            else
+            {
+                fprintf(out, "}");
+            }
+            first = false;
+            failed = failed || !case_ok;
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    ok = fflush(out) == 0 && !failed;
+    if (out != stdout)
+    {
+        ok = fclose(out) == 0 && ok;
+    }
+
+    unlink(blob_file);
+    unlink(config_file.c_str());
+    unlink(key_file.c_str());
+    rmdir(work_dir);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+
+#include <cstring>
+
+#include "crypto_metrics.h"
+#include "capture.h"
+
+using namespace std;
+
+// How often the writer thread drains the ring. The default ring holds
+// several seconds of audio
+static const long WRITER_PERIOD_NS = 20000000;
+
+capture_writer::capture_writer()
+    : m_file(nullptr),
+      m_num_ports(0),
+      m_ring_mask(0),
+      m_head(0),
+      m_tail(0),
+      m_seq(0),
+      m_xrun(false),
+      m_dropped(0),
+      m_write_error(false),
+      m_running(false)
+{
+}
+
+capture_writer::~capture_writer()
+{
+    close();
+}
+
+bool capture_writer::open(const char*                 path,
+                          const char*                 client,
+                          uint                        sample_rate,
+                          const vector<capture_port>& ports,
+                          size_t                      ring_size)
+{
+    if (m_running || ports.size() > CAPTURE_MAX_PORTS)
+    {
+        return false;
+    }
+
+    capture_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.sample_rate = sample_rate;
+    header.num_ports = ports.size();
+    strncpy(header.client, client, sizeof(header.client) - 1);
+    for (size_t i = 0; i < ports.size(); ++i)
+    {
+        strncpy(header.port_names[i], ports[i].name.c_str(), sizeof(header.port_names[i]) - 1);
+        if (ports[i].output)
+        {
+            header.output_mask |= 1u << i;
+        }
+    }
+
+    m_file = fopen(path, "wb");
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+    if (fwrite(&header, sizeof(header), 1, m_file) != 1)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+        return false;
+    }
+
+    size_t size = 1;
+    while (size < ring_size)
+    {
+        size <<= 1;
+    }
+    // Assigning faults every page in now, so the realtime thread never
+    // has to
+    m_ring.assign(size, 0);
+    m_ring_mask = size - 1;
+    m_num_ports = ports.size();
+    m_head = 0;
+    m_tail = 0;
+    m_seq = 0;
+    m_dropped = 0;
+    m_write_error = false;
+
+    m_running = true;
+    m_writer = thread(&capture_writer::writer_main, this);
+    return true;
+}
+
+bool capture_writer::close()
+{
+    if (!m_running)
+    {
+        return true;
+    }
+
+    m_running = false;
+    m_writer.join();
+
+    const bool ok = drain() && !m_write_error;
+    const bool close_ok = fclose(m_file) == 0;
+    m_file = nullptr;
+    m_ring.clear();
+    m_ring.shrink_to_fit();
+
+    return ok && close_ok;
+}
+
+void capture_writer::write_cycle(uint                         nframes,
+                                 uint32_t                     flags,
+                                 uint32_t                     process_ns,
+                                 const audio_sample_t* const* buffers)
+{
+    capture_cycle cycle;
+    cycle.seq = m_seq++;
+    cycle.time_ns = metric_now_ns();
+    cycle.process_ns = process_ns;
+    cycle.nframes = nframes;
+    cycle.port_mask = 0;
+    cycle.flags = flags;
+
+    size_t size = sizeof(cycle);
+    for (uint32_t i = 0; i < m_num_ports; ++i)
+    {
+        if (buffers[i] != nullptr)
+        {
+            cycle.port_mask |= 1u << i;
+            size += nframes * sizeof(audio_sample_t);
+        }
+    }
+
+    const uint64_t head = m_head.load(memory_order_relaxed);
+    const uint64_t tail = m_tail.load(memory_order_acquire);
+    if (size > m_ring.size() - (head - tail))
+    {
+        // Keep the xrun flag for the next cycle that fits
+        m_dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    if (m_xrun.exchange(false, memory_order_relaxed))
+    {
+        cycle.flags |= CAPTURE_XRUN;
+    }
+
+    // Copies into the ring, wrapping around the end
+    uint64_t pos = head;
+    auto copy_in = [&](const void* data, size_t len)
+    {
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        while (len > 0)
+        {
+            const size_t offset = pos & m_ring_mask;
+            const size_t chunk = min(len, m_ring.size() - offset);
+            memcpy(&m_ring[offset], src, chunk);
+            src += chunk;
+            pos += chunk;
+            len -= chunk;
+        }
+    };
+
+    copy_in(&cycle, sizeof(cycle));
+    for (uint32_t i = 0; i < m_num_ports; ++i)
+    {
+        if (buffers[i] != nullptr)
+        {
+            copy_in(buffers[i], nframes * sizeof(audio_sample_t));
+        }
+    }
+
+    m_head.store(pos, memory_order_release);
+}
+
+void capture_writer::xrun()
+{
+    m_xrun.store(true, memory_order_relaxed);
+}
+
+bool capture_writer::drain()
+{
+    const uint64_t head = m_head.load(memory_order_acquire);
+    uint64_t tail = m_tail.load(memory_order_relaxed);
+    while (tail != head)
+    {
+        const size_t offset = tail & m_ring_mask;
+        const size_t chunk = min<uint64_t>(head - tail, m_ring.size() - offset);
+        if (!m_write_error && fwrite(&m_ring[offset], chunk, 1, m_file) != 1)
+        {
+            // Keep draining so the realtime thread isn't stuck dropping
+            // cycles, the capture is lost anyway
+            m_write_error = true;
+        }
+        tail += chunk;
+        m_tail.store(tail, memory_order_release);
+    }
+
+    return !m_write_error;
+}
+
+void capture_writer::writer_main()
+{
+    const struct timespec period = { 0, WRITER_PERIOD_NS };
+    while (m_running)
+    {
+        nanosleep(&period, nullptr);
+        drain();
+    }
+}
+
+capture_reader::capture_reader()
+    : m_file(nullptr)
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+capture_reader::~capture_reader()
+{
+    if (m_file != nullptr)
+    {
+        fclose(m_file);
+    }
+}
+
+bool capture_reader::open(const char* path)
+{
+    m_file = fopen(path, "rb");
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+
+    return fread(&m_header, sizeof(m_header), 1, m_file) == 1 &&
+           memcmp(m_header.magic, CAPTURE_MAGIC, sizeof(m_header.magic)) == 0 &&
+           m_header.version == CAPTURE_VERSION &&
+           m_header.num_ports <= CAPTURE_MAX_PORTS;
+}
+
+bool capture_reader::next(capture_cycle& cycle, vector<audio_buffer_t>& buffers)
+{
+    if (fread(&cycle, sizeof(cycle), 1, m_file) != 1)
+    {
+        return false;
+    }
+
+    buffers.resize(m_header.num_ports);
+    for (uint32_t i = 0; i < m_header.num_ports; ++i)
+    {
+        if ((cycle.port_mask & (1u << i)) == 0)
+        {
+            buffers[i].clear();
+            continue;
+        }
+
+        buffers[i].resize(cycle.nframes);
+        if (fread(buffers[i].data(), sizeof(audio_sample_t), cycle.nframes, m_file) != cycle.nframes)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
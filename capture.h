@@ -0,0 +1,159 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_backend.h"
+
+// A capture file holds every port buffer of every cycle of jack_crypto_tx
+// or jack_crypto_rx, so crypto_replay can run the same cycles through the
+// engine again. It starts with a capture_header and is followed by one
+// capture_cycle per cycle, each followed by nframes float samples for every
+// port in port_mask, in port order. Everything is in host byte order
+
+#define CAPTURE_MAGIC      "JCCAPTR"
+#define CAPTURE_VERSION    1
+#define CAPTURE_MAX_PORTS  16
+#define CAPTURE_NAME_SIZE  32
+
+// capture_cycle flags
+// The PTT input keyed the microphone this cycle
+#define CAPTURE_MIC_ENABLED 0x01
+// The PTT output was keyed at the end of this cycle
+#define CAPTURE_PTT_OUT     0x02
+// The backend reported an xrun since the previous cycle
+#define CAPTURE_XRUN        0x04
+
+struct capture_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t num_ports;
+    // Bit i is set if port i is an output
+    uint32_t output_mask;
+    char     client[CAPTURE_NAME_SIZE];
+    char     port_names[CAPTURE_MAX_PORTS][CAPTURE_NAME_SIZE];
+};
+
+struct capture_cycle
+{
+    // Counts every cycle, including the ones the writer had to drop, so
+    // gaps show up on replay
+    uint64_t seq;
+    // CLOCK_MONOTONIC at the end of the cycle
+    uint64_t time_ns;
+    // Time spent in the cycle
+    uint32_t process_ns;
+    uint32_t nframes;
+    // Ports that are included. Ports that aren't registered yet are left
+    // out
+    uint32_t port_mask;
+    uint32_t flags;
+};
+
+struct capture_port
+{
+    std::string name;
+    bool        output;
+};
+
+// Records cycles from the realtime thread into a lock free ring, which a
+// writer thread drains into the capture file. When the ring is full the
+// cycle is dropped rather than blocking the realtime thread
+class capture_writer
+{
+public:
+    capture_writer();
+    ~capture_writer();
+
+    // ring_size is rounded up to a power of two
+    bool open(const char*                      path,
+              const char*                      client,
+              uint                             sample_rate,
+              const std::vector<capture_port>& ports,
+              size_t                           ring_size = 8 << 20);
+    // Writes out what is left in the ring. The realtime thread must not
+    // call write_cycle() anymore
+    bool close();
+
+    bool is_open() const { return m_running; }
+
+    // Realtime thread. buffers holds a buffer for each port, null for the
+    // ports to leave out
+    void write_cycle(uint                         nframes,
+                     uint32_t                     flags,
+                     uint32_t                     process_ns,
+                     const audio_sample_t* const* buffers);
+
+    // Any thread. Flags the next cycle
+    void xrun();
+
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    void writer_main();
+    // Writes whatever is in the ring. Returns false on a write error
+    bool drain();
+
+private:
+    FILE*                 m_file;
+    uint32_t              m_num_ports;
+
+    std::vector<uint8_t>  m_ring;
+    size_t                m_ring_mask;
+    // Bytes ever written and read. The realtime thread only moves m_head,
+    // the writer thread only moves m_tail
+    std::atomic<uint64_t> m_head;
+    std::atomic<uint64_t> m_tail;
+
+    uint64_t              m_seq;
+    std::atomic<bool>     m_xrun;
+    std::atomic<uint64_t> m_dropped;
+    bool                  m_write_error;
+
+    std::thread           m_writer;
+    std::atomic<bool>     m_running;
+};
+
+class capture_reader
+{
+public:
+    capture_reader();
+    ~capture_reader();
+
+    bool open(const char* path);
+
+    const capture_header& header() const { return m_header; }
+
+    // Reads the next cycle. buffers gets a buffer for every port, empty for
+    // the ports left out of the cycle. Returns false at the end of the file
+    // or on a truncated cycle
+    bool next(capture_cycle& cycle, std::vector<audio_buffer_t>& buffers);
+
+private:
+    FILE*          m_file;
+    capture_header m_header;
+};
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef CHANNEL_SIM_H
+#define CHANNEL_SIM_H
+
+#include <cstdint>
+#include <cmath>
+#include <climits>
+#include <vector>
+#include <algorithm>
+
+// Impairments applied by channel_sim. Zero turns an impairment off, as
+// does an infinite SNR
+struct channel_params
+{
+    // Signal to noise ratio in a 3 kHz bandwidth, like FreeDV reports it
+    float    snr_db = INFINITY;
+    float    freq_offset_hz = 0.0f;
+    // The receiver's sample clock runs this much faster than the
+    // transmitter's
+    float    drift_ppm = 0.0f;
+    // Two path Watterson style fading: the Doppler spread of each path and
+    // the delay of the second one
+    float    fading_doppler_hz = 0.0f;
+    float    fading_delay_ms = 2.0f;
+    // Dropouts per second on average, and how long each one is
+    float    dropout_rate = 0.0f;
+    float    dropout_ms = 100.0f;
+    uint64_t seed = 1;
+};
+
+// Simulates an HF channel between the transmitter's modem output and the
+// receiver's modem input, both real audio at the modem sample rate.
+//
+// The signal is made analytic with a Hilbert transformer so fading and the
+// frequency offset can be applied as complex gains, then dropouts zero it,
+// the sample clock drift resamples it and noise is added. The noise level
+// is set from signal_power, the mean power of the undisturbed signal,
+// since measuring it on the way would make the SNR follow the fading
+class channel_sim
+{
+public:
+    channel_sim(uint sample_rate, float signal_power, const channel_params& parms)
+        : m_parms(parms),
+          m_sample_rate(sample_rate),
+          m_rng(parms.seed != 0 ? parms.seed : 1),
+          m_pos(0),
+          m_osc_phase(0.0),
+          m_dropout_left(0),
+          m_resample_pos(0.0),
+          m_last(0.0f)
+    {
+        // Windowed ideal Hilbert transformer. The odd taps are zero
+        m_hilbert.assign(HILBERT_TAPS, 0.0f);
+        const int center = HILBERT_TAPS / 2;
+        for (int k = 0; k < HILBERT_TAPS; ++k)
+        {
+            const int n = k - center;
+            if (n % 2 != 0)
+            {
+                const double window = 0.54 - 0.46 * cos(2.0 * M_PI * k / (HILBERT_TAPS - 1));
+                m_hilbert[k] = static_cast<float>(2.0 / (M_PI * n) * window);
+            }
+        }
+        m_history.assign(2 * HILBERT_TAPS, 0.0f);
+        m_history_pos = 0;
+
+        m_delay.assign(std::max<size_t>(1, sample_rate * parms.fading_delay_ms / 1000.0f), 0.0f);
+        m_delay_i.assign(m_delay.size(), 0.0f);
+        m_delay_pos = 0;
+        m_fade_coeff = exp(-2.0 * M_PI * parms.fading_doppler_hz / sample_rate);
+        for (int p = 0; p < 2; ++p)
+        {
+            m_fade_re[p] = gaussian();
+            m_fade_im[p] = gaussian();
+        }
+
+        // FreeDV measures noise in 3 kHz, the noise here fills the whole
+        // band up to half the sample rate
+        m_noise_sigma = std::isinf(parms.snr_db) ?
+            0.0 :
+            sqrt(signal_power / pow(10.0, parms.snr_db / 10.0) * (sample_rate / 2.0) / 3000.0);
+    }
+
+    // Appends the channel output for count input samples to out. With
+    // clock drift there are slightly more or fewer output samples than
+    // input samples
+    void process(const short* in, size_t count, std::vector<short>& out)
+    {
+        const double step = 1.0 / (1.0 + m_parms.drift_ppm * 1e-6);
+        const int center = HILBERT_TAPS / 2;
+
+        for (size_t i = 0; i < count; ++i, ++m_pos)
+        {
+            // Analytic signal, the real part delayed to match the Hilbert
+            // transformer. The history is stored twice so the last
+            // HILBERT_TAPS samples are always contiguous
+            m_history[m_history_pos] = in[i];
+            m_history[m_history_pos + HILBERT_TAPS] = in[i];
+            m_history_pos = (m_history_pos + 1) % HILBERT_TAPS;
+            const float* window = &m_history[m_history_pos];
+
+            double re = window[center];
+            double im = 0.0;
+            for (int k = 0; k < HILBERT_TAPS; ++k)
+            {
+                im += m_hilbert[k] * window[HILBERT_TAPS - 1 - k];
+            }
+
+            if (m_parms.fading_doppler_hz > 0.0f)
+            {
+                fade(re, im);
+            }
+
+            if (m_parms.freq_offset_hz != 0.0f)
+            {
+                const double c = cos(m_osc_phase);
+                const double s = sin(m_osc_phase);
+                const double shifted = re * c - im * s;
+                im = re * s + im * c;
+                re = shifted;
+                m_osc_phase = fmod(m_osc_phase + 2.0 * M_PI * m_parms.freq_offset_hz / m_sample_rate,
+                                   2.0 * M_PI);
+            }
+
+            float sample = static_cast<float>(re);
+            if (dropout())
+            {
+                sample = 0.0f;
+            }
+
+            // Linear interpolation between the last sample and this one
+            // for every output sample falling in between
+            while (m_resample_pos <= 1.0)
+            {
+                const double val = m_last + (sample - m_last) * m_resample_pos +
+                                   m_noise_sigma * gaussian();
+                out.push_back(static_cast<short>(std::min<double>(SHRT_MAX,
+                                                                  std::max<double>(SHRT_MIN, lrint(val)))));
+                m_resample_pos += step;
+            }
+            m_resample_pos -= 1.0;
+            m_last = sample;
+        }
+    }
+
+private:
+    // Sum of a direct and a delayed path, each with a complex gain that
+    // wanders at the Doppler spread. Each path carries half of the power
+    void fade(double& re, double& im)
+    {
+        const double innovation = sqrt(1.0 - m_fade_coeff * m_fade_coeff);
+        for (int p = 0; p < 2; ++p)
+        {
+            m_fade_re[p] = m_fade_coeff * m_fade_re[p] + innovation * gaussian();
+            m_fade_im[p] = m_fade_coeff * m_fade_im[p] + innovation * gaussian();
+        }
+
+        const double delayed_re = m_delay[m_delay_pos];
+        const double delayed_im = m_delay_i[m_delay_pos];
+        m_delay[m_delay_pos] = static_cast<float>(re);
+        m_delay_i[m_delay_pos] = static_cast<float>(im);
+        m_delay_pos = (m_delay_pos + 1) % m_delay.size();
+
+        // Each gain has a mean power of 2
+        const double scale = 0.5;
+        const double out_re = scale * (m_fade_re[0] * re - m_fade_im[0] * im +
+                                       m_fade_re[1] * delayed_re - m_fade_im[1] * delayed_im);
+        const double out_im = scale * (m_fade_re[0] * im + m_fade_im[0] * re +
+                                       m_fade_re[1] * delayed_im + m_fade_im[1] * delayed_re);
+        re = out_re;
+        im = out_im;
+    }
+
+    bool dropout()
+    {
+        if (m_dropout_left > 0)
+        {
+            --m_dropout_left;
+            return true;
+        }
+
+        if (m_parms.dropout_rate > 0.0f &&
+            uniform() < m_parms.dropout_rate / m_sample_rate)
+        {
+            m_dropout_left = static_cast<uint64_t>(m_sample_rate * m_parms.dropout_ms / 1000.0f);
+            return m_dropout_left > 0;
+        }
+
+        return false;
+    }
+
+    // xorshift64*
+    uint64_t next()
+    {
+        m_rng ^= m_rng >> 12;
+        m_rng ^= m_rng << 25;
+        m_rng ^= m_rng >> 27;
+        return m_rng * 2685821657736338717ull;
+    }
+
+    // In (0, 1]
+    double uniform()
+    {
+        return ((next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+    }
+
+    // Unit variance, by Box-Muller
+    double gaussian()
+    {
+        return sqrt(-2.0 * log(uniform())) * cos(2.0 * M_PI * uniform());
+    }
+
+private:
+    static const int HILBERT_TAPS = 127;
+
+    channel_params m_parms;
+    uint           m_sample_rate;
+    uint64_t       m_rng;
+    uint64_t       m_pos;
+
+    std::vector<float> m_hilbert;
+    std::vector<float> m_history;
+    size_t             m_history_pos;
+
+    std::vector<float> m_delay;
+    std::vector<float> m_delay_i;
+    size_t             m_delay_pos;
+    double             m_fade_coeff;
+    double             m_fade_re[2];
+    double             m_fade_im[2];
+
+    double   m_osc_phase;
+    uint64_t m_dropout_left;
+    double   m_noise_sigma;
+
+    double m_resample_pos;
+    float  m_last;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "crypto_cfg.h"
+
+// Compiles a text config file into the binary image read_config() uses
+// when it is up to date. Run it whenever the text file changes
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <config file>\n", argv[0]);
+        return 1;
+    }
+
+    struct config cfg;
+    read_config_text(argv[1], &cfg);
+    if (!write_config_blob(argv[1], &cfg))
+    {
+        fprintf(stderr, "Could not write the image of %s\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
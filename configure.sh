@@ -1104,21 +1104,23 @@ write_device_image()
             TMP_CRYPTO_INI=`mktemp`
             cp "$CRYPTO_INI_USR" "$TMP_CRYPTO_INI"
 
-            iniset Config ConfigPassword '*' "$TMP_CRYPTO_INI"
+            CONFIG_ENABLED=0
             if test "$2" -ne 0
             then
-                iniset Config Enabled 1 "$TMP_CRYPTO_INI"
-            else
-                iniset Config Enabled 0 "$TMP_CRYPTO_INI"
+                CONFIG_ENABLED=1
             fi
 
+            KEY_FILL_ONLY=0
             if test "$3" -ne 0
             then
-                iniset Config KeyFillOnly 1 "$TMP_CRYPTO_INI"
-            else
-                iniset Config KeyFillOnly 0 "$TMP_CRYPTO_INI"
+                KEY_FILL_ONLY=1
             fi
 
+            iniset -b "$TMP_CRYPTO_INI" -- \
+                Config ConfigPassword '*' \
+                Config Enabled "$CONFIG_ENABLED" \
+                Config KeyFillOnly "$KEY_FILL_ONLY"
+
             rm -f "$ASOUND_CFG" && alsactl store
 
             TMP_DOS_IMG=`mktemp`
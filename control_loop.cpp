@@ -0,0 +1,230 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+
+#include <cstdint>
+#include <cstring>
+
+#include "control_loop.h"
+
+using namespace std;
+
+static sigset_t make_sigset(const vector<int>& signals)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int sig : signals)
+    {
+        sigaddset(&mask, sig);
+    }
+
+    return mask;
+}
+
+static bool add_to_epoll(int epoll_fd, int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+control_loop::control_loop()
+    : m_epoll_fd(-1),
+      m_signal_fd(-1),
+      m_event_fd(-1),
+      m_inotify_fd(-1)
+{
+}
+
+control_loop::~control_loop()
+{
+    close();
+}
+
+void control_loop::block_signals(const vector<int>& signals)
+{
+    const sigset_t mask = make_sigset(signals);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+}
+
+bool control_loop::open(const vector<int>& signals, const char* config_file)
+{
+    close();
+
+    const sigset_t mask = make_sigset(signals);
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epoll_fd < 0 || m_signal_fd < 0 || m_event_fd < 0 ||
+        !add_to_epoll(m_epoll_fd, m_signal_fd) ||
+        !add_to_epoll(m_epoll_fd, m_event_fd))
+    {
+        close();
+        return false;
+    }
+
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify_fd >= 0 && !add_to_epoll(m_epoll_fd, m_inotify_fd))
+    {
+        ::close(m_inotify_fd);
+        m_inotify_fd = -1;
+    }
+
+    // Signals still work without the watch
+    if (config_file != nullptr)
+    {
+        watch_file(config_file);
+    }
+
+    return true;
+}
+
+bool control_loop::watch_file(const char* file)
+{
+    if (m_inotify_fd < 0 || file == nullptr || *file == '\0')
+    {
+        return false;
+    }
+
+    // Editors and iniset replace the file rather than writing it in place,
+    // so watch the directory for the file name
+    const char* slash = strrchr(file, '/');
+    const string dir = slash == nullptr ? "." :
+        slash == file ? "/" : string(file, slash - file);
+    const string name = slash == nullptr ? file : slash + 1;
+
+    // Watching a directory again returns the same descriptor
+    const int wd = inotify_add_watch(m_inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0)
+    {
+        return false;
+    }
+
+    for (const watched_file& w : m_watched)
+    {
+        if (w.wd == wd && w.name == name)
+        {
+            return true;
+        }
+    }
+    m_watched.push_back({ wd, name });
+    return true;
+}
+
+void control_loop::close()
+{
+    for (int* fd : { &m_inotify_fd, &m_event_fd, &m_signal_fd, &m_epoll_fd })
+    {
+        if (*fd >= 0)
+        {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+    m_watched.clear();
+}
+
+void control_loop::notify()
+{
+    const uint64_t one = 1;
+    if (m_event_fd >= 0)
+    {
+        // Fails only if the counter would overflow, in which case the main
+        // thread has a wakeup pending anyway
+        ssize_t ret = write(m_event_fd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+bool control_loop::wait(int timeout_ms, control_events& events)
+{
+    events.signals.clear();
+    events.notified = false;
+    events.config_changed = false;
+
+    struct epoll_event ready[3];
+    int n;
+    do
+    {
+        n = epoll_wait(m_epoll_fd, ready, 3, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (ready[i].data.fd == m_signal_fd)
+        {
+            read_signals(events);
+        }
+        else if (ready[i].data.fd == m_event_fd)
+        {
+            read_notify(events);
+        }
+        else if (ready[i].data.fd == m_inotify_fd)
+        {
+            read_inotify(events);
+        }
+    }
+
+    return n > 0;
+}
+
+void control_loop::read_signals(control_events& events)
+{
+    struct signalfd_siginfo info;
+    while (read(m_signal_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        events.signals.push_back(static_cast<int>(info.ssi_signo));
+    }
+}
+
+void control_loop::read_notify(control_events& events)
+{
+    uint64_t count = 0;
+    if (read(m_event_fd, &count, sizeof(count)) == sizeof(count) && count > 0)
+    {
+        events.notified = true;
+    }
+}
+
+void control_loop::read_inotify(control_events& events)
+{
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t len;
+    while ((len = read(m_inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t offset = 0; offset < len; )
+        {
+            const struct inotify_event* ev =
+                reinterpret_cast<const struct inotify_event*>(buffer + offset);
+            for (const watched_file& w : m_watched)
+            {
+                if (ev->len > 0 && w.wd == ev->wd && w.name == ev->name)
+                {
+                    events.config_changed = true;
+                }
+            }
+            offset += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
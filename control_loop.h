@@ -0,0 +1,83 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONTROL_LOOP_H
+#define CONTROL_LOOP_H
+
+#include <signal.h>
+
+#include <string>
+#include <vector>
+
+struct control_events
+{
+    // Signals received, in the order they arrived
+    std::vector<int> signals;
+    // notify() was called
+    bool             notified = false;
+    // The config file or another watched file was written or replaced
+    bool             config_changed = false;
+};
+
+// Waits on the main thread for signals, wakeups from the realtime thread
+// and changes to the config file, all through one epoll set, so they are
+// handled as soon as they happen instead of on the next poll
+class control_loop
+{
+public:
+    control_loop();
+    ~control_loop();
+
+    // Blocks signals so they are only delivered through the control loop.
+    // Must be called before any other threads are started, so that every
+    // thread inherits the blocked mask
+    static void block_signals(const std::vector<int>& signals);
+
+    // signals must have been blocked with block_signals(). config_file may
+    // be null
+    bool open(const std::vector<int>& signals, const char* config_file);
+    void close();
+
+    // Also reports changes to file, eg. the key file named by the config,
+    // as config_changed. Files stay watched until close()
+    bool watch_file(const char* file);
+
+    // Wakes up wait(). Realtime safe
+    void notify();
+
+    // Returns false if nothing happened within timeout_ms. A negative
+    // timeout waits forever
+    bool wait(int timeout_ms, control_events& events);
+
+private:
+    struct watched_file
+    {
+        int         wd;
+        std::string name;
+    };
+
+private:
+    void read_signals(control_events& events);
+    void read_notify(control_events& events);
+    void read_inotify(control_events& events);
+
+private:
+    int                       m_epoll_fd;
+    int                       m_signal_fd;
+    int                       m_event_fd;
+    int                       m_inotify_fd;
+    std::vector<watched_file> m_watched;
+};
+
+#endif
@@ -1,6 +1,15 @@
+#include <ctype.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "gpiod.h"
 #include "freedv_api.h"
@@ -50,176 +59,425 @@ void get_key_path(char* buffer, size_t buffer_size, uint key_index)
     buffer[buffer_size - 1] = '\0';
 }
 
-static int ini_callback(const mTCHAR *Section, const mTCHAR *Key, const mTCHAR *Value, void *UserData) {
-    struct config *cfg = (struct config*)UserData;
+int get_num_modem_in_ports(const struct config* cfg)
+{
+    // The first port is always used, even if it isn't configured
+    int num_ports = 1;
+    while (num_ports < MAX_MODEM_IN_PORTS &&
+           str_has_value(cfg->jack_modem_in_port[num_ports]))
+    {
+        ++num_ports;
+    }
 
-    if (strcasecmp(Section, "Crypto") ==0) {
-        if (strcasecmp(Key, "AutoRekey") == 0) {
-            cfg->rekey_period = atoi(Value);
-        }
-        else if (strcasecmp(Key, "Enabled") == 0) {
-            cfg->crypto_enabled = atoi(Value);
-        }
-        else if (strcasecmp(Key, "KeyIndex") == 0) {
-            get_key_path(cfg->key_file, sizeof(cfg->key_file), atoi(Value));
-        }
+    return num_ports;
+}
+
+// Compares one field and copies it from prev to next, so whatever is left
+// different at the end belongs to no group
+#define DIFF_FIELD(group, field)                                        \
+    if (memcmp(&prev->field, &next->field, sizeof(prev->field)) != 0)   \
+    {                                                                   \
+        diff |= (group);                                                \
+        memcpy(&next->field, &prev->field, sizeof(prev->field));        \
     }
-    else if (strcasecmp(Section, "Audio") == 0) {
-        if (strcasecmp(Key, "ModemQuietMaxThresh") == 0) {
-            cfg->modem_quiet_max_thresh = atoi(Value);
-        }
-        else if (strcasecmp(Key, "ModemSignalMinThresh") == 0) {
-            cfg->modem_signal_min_thresh = atoi(Value);
-        }
-        else if (strcasecmp(Key, "ModemNumQuietFlushFrames") == 0) {
-            cfg->modem_num_quiet_flush_frames = atoi(Value);
-        }
+
+static int diff_config_groups(const struct config* prev, struct config* next)
+{
+    int diff = 0;
+
+    DIFF_FIELD(CONFIG_DIFF_SQUELCH, modem_quiet_max_thresh);
+    DIFF_FIELD(CONFIG_DIFF_SQUELCH, modem_signal_min_thresh);
+    DIFF_FIELD(CONFIG_DIFF_SQUELCH, modem_num_quiet_flush_frames);
+    DIFF_FIELD(CONFIG_DIFF_SQUELCH, freedv_squelch_enabled);
+    DIFF_FIELD(CONFIG_DIFF_SQUELCH, freedv_squelch_thresh_700c);
+    DIFF_FIELD(CONFIG_DIFF_SQUELCH, freedv_squelch_thresh_700d);
+    DIFF_FIELD(CONFIG_DIFF_SQUELCH, freedv_squelch_thresh_700e);
+
+    DIFF_FIELD(CONFIG_DIFF_KEY, key_file);
+    DIFF_FIELD(CONFIG_DIFF_KEY, crypto_enabled);
+    DIFF_FIELD(CONFIG_DIFF_KEY, rekey_period);
+
+    DIFF_FIELD(CONFIG_DIFF_MODE, freedv_enabled);
+    DIFF_FIELD(CONFIG_DIFF_MODE, freedv_mode);
+    DIFF_FIELD(CONFIG_DIFF_MODE, iq_enabled);
+    DIFF_FIELD(CONFIG_DIFF_MODE, iq_sample_rate);
+    DIFF_FIELD(CONFIG_DIFF_MODE, iq_offset_hz);
+
+    DIFF_FIELD(CONFIG_DIFF_PORTS, jack_voice_in_port);
+    DIFF_FIELD(CONFIG_DIFF_PORTS, jack_modem_out_port);
+    DIFF_FIELD(CONFIG_DIFF_PORTS, jack_modem_in_port);
+    DIFF_FIELD(CONFIG_DIFF_PORTS, jack_modem_in_q_port);
+    DIFF_FIELD(CONFIG_DIFF_PORTS, jack_voice_out_port);
+    DIFF_FIELD(CONFIG_DIFF_PORTS, jack_notify_out_port);
+
+    DIFF_FIELD(CONFIG_DIFF_PTT, ptt_enabled);
+    DIFF_FIELD(CONFIG_DIFF_PTT, ptt_gpio_num);
+    DIFF_FIELD(CONFIG_DIFF_PTT, ptt_active_low);
+    DIFF_FIELD(CONFIG_DIFF_PTT, ptt_gpio_bias);
+    DIFF_FIELD(CONFIG_DIFF_PTT, ptt_output_gpio_num);
+    DIFF_FIELD(CONFIG_DIFF_PTT, ptt_output_active_low);
+    DIFF_FIELD(CONFIG_DIFF_PTT, ptt_output_bias);
+    DIFF_FIELD(CONFIG_DIFF_PTT, ptt_output_drive);
+
+    return diff;
+}
+
+#undef DIFF_FIELD
+
+int diff_config(const struct config* prev, const struct config* next)
+{
+    struct config rest;
+    memcpy(&rest, next, sizeof(rest));
+
+    int diff = diff_config_groups(prev, &rest);
+
+    // Diversity branches come and go with the modem input ports
+    if (get_num_modem_in_ports(prev) != get_num_modem_in_ports(next))
+    {
+        diff |= CONFIG_DIFF_MODE;
     }
-    else if (strcasecmp(Section, "PTT") == 0) {
-        if (strcasecmp(Key, "Enabled") == 0) {
-            cfg->ptt_enabled = atoi(Value);
-        }
-        else if (strcasecmp(Key, "GPIONum") == 0) {
-            cfg->ptt_gpio_num = atoi(Value);
-        }
-        else if (strcasecmp(Key, "ActiveLow") == 0) {
-            cfg->ptt_active_low = active_flags(Value);
-        }
-        else if (strcasecmp(Key, "Bias") == 0) {
-            cfg->ptt_gpio_bias = bias_flags(Value);
-        }
-        else if (strcasecmp(Key, "OutputGPIONum") == 0) {
-            cfg->ptt_output_gpio_num = atoi(Value);
-        }
-        else if (strcasecmp(Key, "OutputActiveLow") == 0) {
-            cfg->ptt_output_active_low = active_flags(Value);
-        }
-        else if (strcasecmp(Key, "OutputBias") == 0) {
-            cfg->ptt_output_bias = bias_flags(Value);
-        }
-        else if (strcasecmp(Key, "OutputDrive") == 0) {
-            cfg->ptt_output_drive = drive_flags(Value);
-        }
+
+    // Logging, telemetry, JACK periods and notification sounds
+    if (memcmp(prev, &rest, sizeof(rest)) != 0)
+    {
+        diff |= CONFIG_DIFF_OTHER;
     }
-    else if (strcasecmp(Section, "Diagnostics") ==0) {
-        if (strcasecmp(Key, "LogFile") == 0) {
-            strncpy(cfg->log_file, Value, sizeof(cfg->log_file) - 1);
-        }
-        else if (strcasecmp(Key, "LogLevel") == 0) {
-            cfg->log_level = atoi(Value);
-        }
+
+    return diff;
+}
+
+// Converts a value from the config file into the field it is stored in
+typedef void (*cfg_parser)(void* field, size_t size, const char* value);
+
+static void parse_int(void* field, size_t size, const char* value) {
+    *(int*)field = atoi(value);
+}
+
+static void parse_float(void* field, size_t size, const char* value) {
+    *(float*)field = atof(value);
+}
+
+static void parse_string(void* field, size_t size, const char* value) {
+    strncpy((char*)field, value, size - 1);
+}
+
+static void parse_key_index(void* field, size_t size, const char* value) {
+    get_key_path((char*)field, size, atoi(value));
+}
+
+static void parse_active(void* field, size_t size, const char* value) {
+    *(int*)field = active_flags(value);
+}
+
+static void parse_bias(void* field, size_t size, const char* value) {
+    *(int*)field = bias_flags(value);
+}
+
+static void parse_drive(void* field, size_t size, const char* value) {
+    *(int*)field = drive_flags(value);
+}
+
+static void parse_mode(void* field, size_t size, const char* value) {
+    int* mode = (int*)field;
+    if (!strcasecmp(value,"1600")) *mode = FREEDV_MODE_1600;
+    if (!strcasecmp(value,"700C")) *mode = FREEDV_MODE_700C;
+    if (!strcasecmp(value,"700D")) *mode = FREEDV_MODE_700D;
+    if (!strcasecmp(value,"700E")) *mode = FREEDV_MODE_700E;
+    if (!strcasecmp(value,"2400A")) *mode = FREEDV_MODE_2400A;
+    if (!strcasecmp(value,"2400B")) *mode = FREEDV_MODE_2400B;
+    if (!strcasecmp(value,"800XA")) *mode = FREEDV_MODE_800XA;
+}
+
+struct cfg_option {
+    const char* section;
+    const char* key;
+    size_t      offset;
+    size_t      size;
+    cfg_parser  parse;
+};
+
+#define CFG_OPTION(section, key, field, parse) \
+    { section, key, offsetof(struct config, field), sizeof(((struct config*)0)->field), parse }
+
+// Adding an option to the config file only takes an entry here. Section and
+// key names are case insensitive
+static const struct cfg_option cfg_options[] = {
+    CFG_OPTION("Crypto", "AutoRekey", rekey_period, parse_int),
+    CFG_OPTION("Crypto", "Enabled", crypto_enabled, parse_int),
+    CFG_OPTION("Crypto", "KeyIndex", key_file, parse_key_index),
+
+    CFG_OPTION("Audio", "ModemQuietMaxThresh", modem_quiet_max_thresh, parse_int),
+    CFG_OPTION("Audio", "ModemSignalMinThresh", modem_signal_min_thresh, parse_int),
+    CFG_OPTION("Audio", "ModemNumQuietFlushFrames", modem_num_quiet_flush_frames, parse_int),
+
+    CFG_OPTION("PTT", "Enabled", ptt_enabled, parse_int),
+    CFG_OPTION("PTT", "GPIONum", ptt_gpio_num, parse_int),
+    CFG_OPTION("PTT", "ActiveLow", ptt_active_low, parse_active),
+    CFG_OPTION("PTT", "Bias", ptt_gpio_bias, parse_bias),
+    CFG_OPTION("PTT", "OutputGPIONum", ptt_output_gpio_num, parse_int),
+    CFG_OPTION("PTT", "OutputActiveLow", ptt_output_active_low, parse_active),
+    CFG_OPTION("PTT", "OutputBias", ptt_output_bias, parse_bias),
+    CFG_OPTION("PTT", "OutputDrive", ptt_output_drive, parse_drive),
+
+    CFG_OPTION("Diagnostics", "LogFile", log_file, parse_string),
+    CFG_OPTION("Diagnostics", "LogLevel", log_level, parse_int),
+    CFG_OPTION("Diagnostics", "TelemetryFile", telemetry_file, parse_string),
+    CFG_OPTION("Diagnostics", "TelemetryRecords", telemetry_records, parse_int),
+    CFG_OPTION("Diagnostics", "TraceFile", trace_file, parse_string),
+
+    CFG_OPTION("Codec", "Mode", freedv_mode, parse_mode),
+    CFG_OPTION("Codec", "SquelchEnabled", freedv_squelch_enabled, parse_int),
+    CFG_OPTION("Codec", "SquelchThresh700C", freedv_squelch_thresh_700c, parse_float),
+    CFG_OPTION("Codec", "SquelchThresh700D", freedv_squelch_thresh_700d, parse_float),
+    CFG_OPTION("Codec", "SquelchThresh700E", freedv_squelch_thresh_700e, parse_float),
+    CFG_OPTION("Codec", "Enabled", freedv_enabled, parse_int),
+
+    CFG_OPTION("IQ", "Enabled", iq_enabled, parse_int),
+    CFG_OPTION("IQ", "SampleRate", iq_sample_rate, parse_int),
+    CFG_OPTION("IQ", "OffsetHz", iq_offset_hz, parse_float),
+
+    CFG_OPTION("JACK", "TXPeriod700C", jack_tx_period_700c, parse_int),
+    CFG_OPTION("JACK", "TXPeriod700D", jack_tx_period_700d, parse_int),
+    CFG_OPTION("JACK", "TXPeriod700E", jack_tx_period_700e, parse_int),
+    CFG_OPTION("JACK", "TXPeriod800XA", jack_tx_period_800xa, parse_int),
+    CFG_OPTION("JACK", "TXPeriod1600", jack_tx_period_1600, parse_int),
+    CFG_OPTION("JACK", "TXPeriod2400B", jack_tx_period_2400b, parse_int),
+
+    CFG_OPTION("JACK", "RXPeriod700C", jack_rx_period_700c, parse_int),
+    CFG_OPTION("JACK", "RXPeriod700D", jack_rx_period_700d, parse_int),
+    CFG_OPTION("JACK", "RXPeriod700E", jack_rx_period_700e, parse_int),
+    CFG_OPTION("JACK", "RXPeriod800XA", jack_rx_period_800xa, parse_int),
+    CFG_OPTION("JACK", "RXPeriod1600", jack_rx_period_1600, parse_int),
+    CFG_OPTION("JACK", "RXPeriod2400B", jack_rx_period_2400b, parse_int),
+
+    CFG_OPTION("JACK", "SecureNotifyFile", jack_secure_notify_file, parse_string),
+    CFG_OPTION("JACK", "InsecureNotifyFile", jack_insecure_notify_file, parse_string),
+
+    CFG_OPTION("JACK", "VoiceInPort", jack_voice_in_port, parse_string),
+    CFG_OPTION("JACK", "ModemOutPort", jack_modem_out_port, parse_string),
+    // ModemInPort2, ModemInPort3, ... are additional diversity inputs
+    CFG_OPTION("JACK", "ModemInPort", jack_modem_in_port[0], parse_string),
+    CFG_OPTION("JACK", "ModemInPort2", jack_modem_in_port[1], parse_string),
+    CFG_OPTION("JACK", "ModemInPort3", jack_modem_in_port[2], parse_string),
+    CFG_OPTION("JACK", "ModemInPort4", jack_modem_in_port[3], parse_string),
+    CFG_OPTION("JACK", "ModemInQPort", jack_modem_in_q_port[0], parse_string),
+    CFG_OPTION("JACK", "ModemInQPort2", jack_modem_in_q_port[1], parse_string),
+    CFG_OPTION("JACK", "ModemInQPort3", jack_modem_in_q_port[2], parse_string),
+    CFG_OPTION("JACK", "ModemInQPort4", jack_modem_in_q_port[3], parse_string),
+    CFG_OPTION("JACK", "VoiceOutPort", jack_voice_out_port, parse_string),
+    CFG_OPTION("JACK", "NotifyOutPort", jack_notify_out_port, parse_string),
+};
+
+#define NUM_CFG_OPTIONS (sizeof(cfg_options) / sizeof(cfg_options[0]))
+
+_Static_assert(MAX_MODEM_IN_PORTS == 4, "Update the ModemInPort options");
+
+// Every option hashes to its own slot, so a lookup is one hash and one
+// string comparison however many options there are. The table is built
+// the first time a config file is read by searching for a seed with no
+// collisions, which takes a few tries with the table this sparse
+#define CFG_HASH_SLOTS 512 // Must be a power of two
+
+static unsigned char  cfg_slots[CFG_HASH_SLOTS]; // Option index + 1, or 0
+static uint32_t       cfg_seed;
+static pthread_once_t cfg_once = PTHREAD_ONCE_INIT;
+
+_Static_assert(NUM_CFG_OPTIONS < 255, "Option indexes must fit cfg_slots");
+
+static uint32_t cfg_hash(uint32_t seed, const char* section, const char* key) {
+    // FNV-1a over the lower case "section/key"
+    uint32_t hash = 2166136261u ^ seed;
+    for (const char* c = section; *c; ++c) {
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*c)) * 16777619u;
     }
-    else if (strcasecmp(Section, "Codec") == 0) {
-        if (strcasecmp(Key, "Mode") == 0) {
-            if (!strcasecmp(Value,"1600")) cfg->freedv_mode = FREEDV_MODE_1600;
-            if (!strcasecmp(Value,"700C")) cfg->freedv_mode = FREEDV_MODE_700C;
-            if (!strcasecmp(Value,"700D")) cfg->freedv_mode = FREEDV_MODE_700D;
-            if (!strcasecmp(Value,"700E")) cfg->freedv_mode = FREEDV_MODE_700E;
-            if (!strcasecmp(Value,"2400A")) cfg->freedv_mode = FREEDV_MODE_2400A;
-            if (!strcasecmp(Value,"2400B")) cfg->freedv_mode = FREEDV_MODE_2400B;
-            if (!strcasecmp(Value,"800XA")) cfg->freedv_mode = FREEDV_MODE_800XA;
-        }
-        else if (strcasecmp(Key, "SquelchEnabled") == 0 ) {
-            cfg->freedv_squelch_enabled = atoi(Value);
-        }
-        else if (strcasecmp(Key, "SquelchThresh700C") == 0 ) {
-            cfg->freedv_squelch_thresh_700c = atof(Value);
-        }
-        else if (strcasecmp(Key, "SquelchThresh700D") == 0 ) {
-            cfg->freedv_squelch_thresh_700d = atof(Value);
-        }
-        else if (strcasecmp(Key, "SquelchThresh700E") == 0 ) {
-            cfg->freedv_squelch_thresh_700e = atof(Value);
-        }
-        else if (strcasecmp(Key, "Enabled") == 0 ) {
-            cfg->freedv_enabled = atoi(Value);
-        }
+    hash = (hash ^ '/') * 16777619u;
+    for (const char* c = key; *c; ++c) {
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*c)) * 16777619u;
     }
-    else if (strcasecmp(Section, "JACK") == 0) {
-        if (strcasecmp(Key, "TXPeriod700C") == 0) {
-            cfg->jack_tx_period_700c = atoi(Value);
-        }
-        else if (strcasecmp(Key, "TXPeriod700D") == 0){
-            cfg->jack_tx_period_700d = atoi(Value);
-        }
-        else if (strcasecmp(Key, "TXPeriod700E") == 0){
-            cfg->jack_tx_period_700e = atoi(Value);
-        }
-        else if (strcasecmp(Key, "TXPeriod800XA") == 0){
-            cfg->jack_tx_period_800xa = atoi(Value);
-        }
-        else if (strcasecmp(Key, "TXPeriod1600") == 0){
-            cfg->jack_tx_period_1600 = atoi(Value);
-        }
-        else if (strcasecmp(Key, "TXPeriod2400B") == 0){
-            cfg->jack_tx_period_2400b = atoi(Value);
-        }
 
-        else if (strcasecmp(Key, "RXPeriod700C") == 0) {
-            cfg->jack_rx_period_700c = atoi(Value);
-        }
-        else if (strcasecmp(Key, "RXPeriod700D") == 0){
-            cfg->jack_rx_period_700d = atoi(Value);
-        }
-        else if (strcasecmp(Key, "RXPeriod700E") == 0){
-            cfg->jack_rx_period_700e = atoi(Value);
-        }
-        else if (strcasecmp(Key, "RXPeriod800XA") == 0){
-            cfg->jack_rx_period_800xa = atoi(Value);
-        }
-        else if (strcasecmp(Key, "RXPeriod1600") == 0){
-            cfg->jack_rx_period_1600 = atoi(Value);
-        }
-        else if (strcasecmp(Key, "RXPeriod2400B") == 0){
-            cfg->jack_rx_period_2400b = atoi(Value);
-        }
+    return (hash ^ (hash >> 16)) & (CFG_HASH_SLOTS - 1);
+}
 
-        else if (strcasecmp(Key, "SecureNotifyFile") == 0) {
-            strncpy(cfg->jack_secure_notify_file,
-                    Value,
-                    sizeof(cfg->jack_secure_notify_file) - 1);
-        }
-        else if (strcasecmp(Key, "InsecureNotifyFile") == 0) {
-            strncpy(cfg->jack_insecure_notify_file,
-                    Value,
-                    sizeof(cfg->jack_insecure_notify_file) - 1);
-        }
+static void build_cfg_slots(void) {
+    for (uint32_t seed = 0; ; ++seed) {
+        memset(cfg_slots, 0, sizeof(cfg_slots));
 
-        else if (strcasecmp(Key, "VoiceInPort") == 0) {
-            strncpy(cfg->jack_voice_in_port,
-                    Value,
-                    sizeof(cfg->jack_voice_in_port) - 1);
+        size_t i;
+        for (i = 0; i < NUM_CFG_OPTIONS; ++i) {
+            const uint32_t slot = cfg_hash(seed, cfg_options[i].section, cfg_options[i].key);
+            if (cfg_slots[slot] != 0) {
+                break;
+            }
+            cfg_slots[slot] = (unsigned char)(i + 1);
         }
-        else if (strcasecmp(Key, "ModemOutPort") == 0) {
-            strncpy(cfg->jack_modem_out_port,
-                    Value,
-                    sizeof(cfg->jack_modem_out_port) - 1);
-        }
-        else if (strcasecmp(Key, "ModemInPort") == 0) {
-            strncpy(cfg->jack_modem_in_port,
-                    Value,
-                    sizeof(cfg->jack_modem_in_port) - 1);
-        }
-        else if (strcasecmp(Key, "VoiceOutPort") == 0) {
-            strncpy(cfg->jack_voice_out_port,
-                    Value,
-                    sizeof(cfg->jack_voice_out_port) - 1);
-        }
-        else if (strcasecmp(Key, "NotifyOutPort") == 0) {
-            strncpy(cfg->jack_notify_out_port,
-                    Value,
-                    sizeof(cfg->jack_notify_out_port) - 1);
+
+        if (i == NUM_CFG_OPTIONS) {
+            cfg_seed = seed;
+            return;
         }
     }
+}
+
+static const struct cfg_option* find_cfg_option(const char* section, const char* key) {
+    const unsigned char idx = cfg_slots[cfg_hash(cfg_seed, section, key)];
+    if (idx == 0) {
+        return NULL;
+    }
+
+    const struct cfg_option* option = &cfg_options[idx - 1];
+    if (strcasecmp(option->section, section) != 0 || strcasecmp(option->key, key) != 0) {
+        return NULL;
+    }
+
+    return option;
+}
+
+static int ini_callback(const mTCHAR *Section, const mTCHAR *Key, const mTCHAR *Value, void *UserData) {
+    struct config *cfg = (struct config*)UserData;
+
+    const struct cfg_option* option = find_cfg_option(Section, Key);
+    if (option != NULL) {
+        option->parse((char*)cfg + option->offset, option->size, Value);
+    }
 
     return 1;
 }
 
-void read_config(const char* config_file, struct config* cfg) {
+// Header of the binary image of struct config written by compile_config.
+// The source file's identity is recorded so an image that is older than
+// the text config is never used
+#define CONFIG_BLOB_MAGIC "CRYPTCFG"
+
+struct config_blob_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t config_size;
+    uint64_t source_size;
+    uint64_t source_ino;
+    int64_t  source_mtime_ns;
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+static uint32_t config_checksum(const void* data, size_t size) {
+    // FNV-1a
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void set_source_identity(struct config_blob_header* header, const struct stat* st) {
+    header->source_size = (uint64_t)st->st_size;
+    header->source_ino = (uint64_t)st->st_ino;
+    header->source_mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000ll + st->st_mtim.tv_nsec;
+}
+
+void get_config_blob_path(char* buffer, size_t buffer_size, const char* config_file) {
+    snprintf(buffer, buffer_size, "%s.bin", config_file);
+}
+
+int read_config_blob(const char* config_file, struct config* cfg) {
+    char blob_file[PATH_MAX];
+    get_config_blob_path(blob_file, sizeof(blob_file), config_file);
+
+    struct stat source_st;
+    if (stat(config_file, &source_st) != 0) {
+        return 0;
+    }
+
+    const int fd = open(blob_file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    const size_t blob_size = sizeof(struct config_blob_header) + sizeof(struct config);
+    struct stat blob_st;
+    if (fstat(fd, &blob_st) != 0 || (size_t)blob_st.st_size != blob_size) {
+        close(fd);
+        return 0;
+    }
+
+    void* map = mmap(NULL, blob_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    const struct config_blob_header* header = (const struct config_blob_header*)map;
+    const struct config* blob_cfg = (const struct config*)(header + 1);
+
+    struct config_blob_header expected;
+    memset(&expected, 0, sizeof(expected));
+    set_source_identity(&expected, &source_st);
+
+    const int valid = memcmp(header->magic, CONFIG_BLOB_MAGIC, sizeof(header->magic)) == 0 &&
+                      header->version == CONFIG_BLOB_VERSION &&
+                      header->config_size == sizeof(struct config) &&
+                      header->source_size == expected.source_size &&
+                      header->source_ino == expected.source_ino &&
+                      header->source_mtime_ns == expected.source_mtime_ns &&
+                      header->checksum == config_checksum(blob_cfg, sizeof(struct config));
+    if (valid) {
+        memcpy(cfg, blob_cfg, sizeof(struct config));
+    }
+
+    munmap(map, blob_size);
+    return valid;
+}
+
+int write_config_blob(const char* config_file, const struct config* cfg) {
+    char blob_file[PATH_MAX];
+    char tmp_file[PATH_MAX + 4];
+    get_config_blob_path(blob_file, sizeof(blob_file), config_file);
+    snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", blob_file);
+
+    struct stat source_st;
+    if (stat(config_file, &source_st) != 0) {
+        return 0;
+    }
+
+    struct config_blob_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CONFIG_BLOB_MAGIC, sizeof(header.magic));
+    header.version = CONFIG_BLOB_VERSION;
+    header.config_size = sizeof(struct config);
+    set_source_identity(&header, &source_st);
+    header.checksum = config_checksum(cfg, sizeof(struct config));
+
+    FILE* f = fopen(tmp_file, "wb");
+    if (f == NULL) {
+        return 0;
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(cfg, sizeof(struct config), 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+
+    // Readers only ever see a complete image
+    if (!ok || rename(tmp_file, blob_file) != 0) {
+        unlink(tmp_file);
+        return 0;
+    }
+
+    return 1;
+}
+
+void read_config_text(const char* config_file, struct config* cfg) {
+    pthread_once(&cfg_once, build_cfg_slots);
+
     memset(cfg, 0, sizeof(struct config));
     ini_browse(ini_callback, (void*)cfg, config_file);
 }
 
+void read_config(const char* config_file, struct config* cfg) {
+    if (!read_config_blob(config_file, cfg)) {
+        read_config_text(config_file, cfg);
+    }
+}
+
 size_t read_key_file(const char* key_file, unsigned char key[]) {
     memset(key, 0, FREEDV_MASTER_KEY_LENGTH);
 
@@ -5,6 +5,13 @@
 extern "C" {
 #endif
 
+// Number of modem inputs supported for diversity reception
+#define MAX_MODEM_IN_PORTS 4
+
+// Version of the binary config image written by compile_config. Bump it
+// whenever struct config changes
+#define CONFIG_BLOB_VERSION 1
+
 struct config
 {
     char key_file[80];
@@ -12,6 +19,11 @@ struct config
     char log_file[80];
     int  log_level;
 
+    char telemetry_file[80];
+    int  telemetry_records;
+
+    char trace_file[80];
+
     int modem_quiet_max_thresh;
     int modem_signal_min_thresh;
     int modem_num_quiet_flush_frames;
@@ -36,6 +48,10 @@ struct config
     float freedv_squelch_thresh_700d;
     float freedv_squelch_thresh_700e;
 
+    int   iq_enabled;
+    int   iq_sample_rate;
+    float iq_offset_hz;
+
     int  jack_tx_period_700c;
     int  jack_tx_period_700d;
     int  jack_tx_period_700e;
@@ -56,12 +72,22 @@ struct config
     char jack_voice_in_port[80];
     char jack_modem_out_port[80];
 
-    char jack_modem_in_port[80];
+    char jack_modem_in_port[MAX_MODEM_IN_PORTS][80];
+    char jack_modem_in_q_port[MAX_MODEM_IN_PORTS][80];
     char jack_voice_out_port[80];
     char jack_notify_out_port[80];
 };
 
+// Uses the binary image of config_file if it is up to date, otherwise
+// parses the text file
 void read_config(const char* config_file, struct config* cfg);
+void read_config_text(const char* config_file, struct config* cfg);
+
+// The image of config_file is stored in <config_file>.bin. Returns 0 if it
+// is missing, corrupt, from another version or older than config_file
+int  read_config_blob(const char* config_file, struct config* cfg);
+int  write_config_blob(const char* config_file, const struct config* cfg);
+void get_config_blob_path(char* buffer, size_t buffer_size, const char* config_file);
 
 size_t read_key_file(const char* key_file, unsigned char key[]);
 
@@ -71,6 +97,20 @@ int active_flags(const char* option);
 
 void get_key_path(char* buffer, size_t buffer_size, uint key_index);
 
+int get_num_modem_in_ports(const struct config* cfg);
+
+// Groups of settings returned by diff_config()
+#define CONFIG_DIFF_SQUELCH 0x01 // Squelch thresholds, applied in place
+#define CONFIG_DIFF_KEY     0x02 // Key file, crypto enable or rekey period
+#define CONFIG_DIFF_MODE    0x04 // Codec mode, IQ input or number of modem inputs
+#define CONFIG_DIFF_PORTS   0x08 // JACK port connections
+#define CONFIG_DIFF_PTT     0x10 // PTT GPIO lines
+#define CONFIG_DIFF_OTHER   0x20 // Everything else
+
+// Returns the CONFIG_DIFF_* groups in which next differs from prev. Both
+// must have been filled in by read_config(), so unused bytes are zero
+int diff_config(const struct config* prev, const struct config* next);
+
 static inline int str_has_value(const char* str) {
     return str != NULL && str[0] != '\0';
 }
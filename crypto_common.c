@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
+#include <math.h>
 
 #include "freedv_api.h"
 
@@ -44,6 +46,37 @@ short rms(const short vals[], size_t len) {
     }
 }
 
+short rms_float(const float vals[], size_t len) {
+    if (len > 0) {
+        double total = 0.0;
+        for (size_t i = 0; i < len; ++i) {
+            total += (double)vals[i] * (double)vals[i];
+        }
+
+        const double val = sqrt(total / len);
+        return val < SHRT_MAX ? (short)val : SHRT_MAX;
+    }
+    else {
+        return 0;
+    }
+}
+
+short rms_complex(const float iq[], size_t len) {
+    // len is the number of complex samples
+    if (len > 0) {
+        double total = 0.0;
+        for (size_t i = 0; i < len * 2; ++i) {
+            total += (double)iq[i] * (double)iq[i];
+        }
+
+        const double val = sqrt(total / len);
+        return val < SHRT_MAX ? (short)val : SHRT_MAX;
+    }
+    else {
+        return 0;
+    }
+}
+
 size_t read_input_file(short* buffer, size_t buffer_elems, FILE* file){
     size_t elems_read = 0;
     do {
@@ -58,26 +91,51 @@ size_t read_input_file(short* buffer, size_t buffer_elems, FILE* file){
     return elems_read;
 }
 
-void configure_freedv(struct freedv* f, const struct config* cfg){
+void configure_freedv_squelch(struct freedv* f, const struct config* cfg){
     freedv_set_squelch_en(f, cfg->freedv_squelch_enabled);
+    switch(freedv_get_mode(f)) {
+        case FREEDV_MODE_700C:
+            freedv_set_snr_squelch_thresh(f, cfg->freedv_squelch_thresh_700c);
+            break;
+        case FREEDV_MODE_700D:
+            freedv_set_snr_squelch_thresh(f, cfg->freedv_squelch_thresh_700d);
+            break;
+        case FREEDV_MODE_700E:
+            freedv_set_snr_squelch_thresh(f, cfg->freedv_squelch_thresh_700e);
+            break;
+    }
+}
+
+float freedv_rx_gain(struct freedv* f){
+    // freedv_rx feeds the OFDM modes to the demodulator with a gain of 2,
+    // to keep the levels of real signals the same as in the codec2 unit
+    // tests
+    switch(freedv_get_mode(f)) {
+        case FREEDV_MODE_700D:
+        case FREEDV_MODE_700E:
+            return 2.0f;
+        default:
+            return 1.0f;
+    }
+}
+
+void configure_freedv(struct freedv* f, const struct config* cfg){
+    configure_freedv_squelch(f, cfg);
     // Settings borrowed from sm1000_main.c
     const int mode = freedv_get_mode(f);
     switch(mode) {
         case FREEDV_MODE_700C:
-            freedv_set_snr_squelch_thresh(f, cfg->freedv_squelch_thresh_700c);
             freedv_set_eq(f, 1);
 
             freedv_set_clip(f, 1);
             break;
         case FREEDV_MODE_700D:
-            freedv_set_snr_squelch_thresh(f, cfg->freedv_squelch_thresh_700d);
             freedv_set_eq(f, 1);
 
             freedv_set_clip(f, 1);
             freedv_set_tx_bpf(f, 1);
             break;
         case FREEDV_MODE_700E:
-            freedv_set_snr_squelch_thresh(f, cfg->freedv_squelch_thresh_700e);
             freedv_set_eq(f, 1);
 
             freedv_set_clip(f, 1);
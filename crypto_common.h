@@ -17,12 +17,25 @@ struct config;
 #define ANALOG_SAMPLE_RATE 8000
 #define ANALOG_SAMPLES_PER_FRAME 320
 
+// Converts normalized floating point samples to the 16-bit range
+#define MODEM_SAMPLE_SCALE 32768.0f
+
 
 short rms(const short vals[], size_t len);
+// Same as rms, but for floating point samples scaled like 16-bit integers
+short rms_float(const float vals[], size_t len);
+// Same as rms_float, but for interleaved I/Q samples
+short rms_complex(const float iq[], size_t len);
 
 size_t read_input_file(short* buffer, size_t buffer_elems, FILE* file);
 
+// The gain freedv_rx applies to 16-bit samples before demodulating them in
+// the mode of freedv. freedv_floatrx and freedv_comprx don't apply it
+float freedv_rx_gain(struct freedv* freedv);
+
 void configure_freedv(struct freedv* freedv, const struct config* cfg);
+// Only the squelch settings, which can be changed while running
+void configure_freedv_squelch(struct freedv* freedv, const struct config* cfg);
 
 #ifdef __cplusplus
 }
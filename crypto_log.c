@@ -1,10 +1,428 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <time.h>
 
 #include "crypto_log.h"
 
+// Messages are not formatted by the caller. Instead the format string, the
+// arguments and a timestamp are copied into a fixed size record in a
+// lock-free ring shared by every logger in the process, and a background
+// thread formats and writes the records in batches. When the ring is full
+// messages are dropped and counted rather than blocking the caller. If the
+// background thread can't be started, messages are written directly
+
+#define LOG_RING_SIZE         256 // Must be a power of two
+#define LOG_MAX_ARGS          8
+#define LOG_STRING_BYTES      160
+#define LOG_DRAIN_INTERVAL_MS 50
+
+typedef union {
+    long long          i;
+    unsigned long long u;
+    double             d;
+    const void*        p;
+    size_t             str_off;
+} log_arg;
+
+typedef struct {
+    // Vyukov bounded queue sequence number. Equal to the ring position when
+    // the slot is free and the position + 1 once the record is published
+    atomic_size_t   seq;
+    FILE*           file;
+    struct timespec time;
+    int             level;
+    int             num_args;
+    // NULL for a record asking the writer to close file
+    const char*     format;
+    log_arg         args[LOG_MAX_ARGS];
+    char            strings[LOG_STRING_BYTES];
+} log_record;
+
+typedef enum {
+    ARG_NONE,
+    ARG_INT,
+    ARG_UINT,
+    ARG_DOUBLE,
+    ARG_STRING,
+    ARG_POINTER
+} arg_type;
+
+typedef struct {
+    const char* flags_start; // Just after the '%'
+    const char* flags_end;   // Start of the length modifier
+    const char* end;         // Just after the conversion character
+    int         length;      // Number of 'l' characters, or 'h', 'z', etc
+    char        conv;
+} log_spec;
+
+static log_record     ring[LOG_RING_SIZE];
+static atomic_size_t  enqueue_pos;
+static atomic_size_t  dequeue_pos;
+static atomic_size_t  written_pos;
+static atomic_ulong   dropped_pending;
+static atomic_ulong   dropped_total;
+
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static int            writer_running;
+// Serializes the direct writes when there is no writer thread
+static pthread_mutex_t direct_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* parse_spec(const char* p, log_spec* spec) {
+    // p points just after the '%'
+    spec->flags_start = p;
+    while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL) {
+        ++p;
+    }
+
+    spec->flags_end = p;
+    spec->length = 0;
+    while (*p != '\0' && strchr("hlLqjzt", *p) != NULL) {
+        spec->length = *p == 'l' ? spec->length + 1 : *p;
+        ++p;
+    }
+
+    spec->conv = *p;
+    spec->end = *p != '\0' ? p + 1 : p;
+    return spec->end;
+}
+
+static arg_type get_arg_type(const log_spec* spec) {
+    switch (spec->conv) {
+        case 'd':
+        case 'i':
+            return ARG_INT;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        case 'c':
+            return ARG_UINT;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            return ARG_DOUBLE;
+        case 's':
+            return ARG_STRING;
+        case 'p':
+            return ARG_POINTER;
+        default:
+            return ARG_NONE;
+    }
+}
+
+static void capture_args(log_record* rec, const char* format, va_list args) {
+    size_t str_used = 0;
+
+    rec->num_args = 0;
+    for (const char* p = format; *p != '\0'; ) {
+        if (*p++ != '%') {
+            continue;
+        }
+        if (*p == '%') {
+            ++p;
+            continue;
+        }
+
+        log_spec spec;
+        p = parse_spec(p, &spec);
+
+        const arg_type type = get_arg_type(&spec);
+        if (type == ARG_NONE || rec->num_args == LOG_MAX_ARGS) {
+            break;
+        }
+
+        log_arg* arg = &rec->args[rec->num_args++];
+        switch (type) {
+            case ARG_INT:
+                if (spec.length == 2) arg->i = va_arg(args, long long);
+                else if (spec.length == 1) arg->i = va_arg(args, long);
+                else if (spec.length == 'z' || spec.length == 't') arg->i = va_arg(args, ptrdiff_t);
+                else if (spec.length == 'j') arg->i = va_arg(args, intmax_t);
+                else arg->i = va_arg(args, int);
+                break;
+            case ARG_UINT:
+                if (spec.length == 2) arg->u = va_arg(args, unsigned long long);
+                else if (spec.length == 1) arg->u = va_arg(args, unsigned long);
+                else if (spec.length == 'z' || spec.length == 't') arg->u = va_arg(args, size_t);
+                else if (spec.length == 'j') arg->u = va_arg(args, uintmax_t);
+                else arg->u = va_arg(args, unsigned int);
+                break;
+            case ARG_DOUBLE:
+                if (spec.length == 'L') arg->d = (double)va_arg(args, long double);
+                else arg->d = va_arg(args, double);
+                break;
+            case ARG_STRING:
+            {
+                // Strings are copied, since the caller's buffer may be
+                // gone by the time the record is formatted
+                const char* str = va_arg(args, const char*);
+                const size_t avail = LOG_STRING_BYTES - str_used;
+                if (str == NULL) str = "(null)";
+                if (avail > 0) {
+                    const size_t len = strnlen(str, avail - 1);
+                    memcpy(rec->strings + str_used, str, len);
+                    rec->strings[str_used + len] = '\0';
+                    arg->str_off = str_used;
+                    str_used += len + 1;
+                }
+                else {
+                    arg->str_off = LOG_STRING_BYTES;
+                }
+                break;
+            }
+            case ARG_POINTER:
+                arg->p = va_arg(args, const void*);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void write_arg(FILE* file, const log_spec* spec, const log_record* rec, int idx) {
+    if (idx >= rec->num_args) {
+        fputs("?", file);
+        return;
+    }
+
+    // Rebuild the conversion with the flags, width and precision from the
+    // original, but with a length modifier matching the stored argument
+    char fmt[32] = "%";
+    const size_t flags_len = spec->flags_end - spec->flags_start;
+    if (flags_len > sizeof(fmt) - 5) {
+        fputs("?", file);
+        return;
+    }
+    memcpy(fmt + 1, spec->flags_start, flags_len);
+    char* conv = fmt + 1 + flags_len;
+
+    const log_arg* arg = &rec->args[idx];
+    switch (get_arg_type(spec)) {
+        case ARG_INT:
+            strcpy(conv, "ll");
+            conv[2] = spec->conv;
+            conv[3] = '\0';
+            fprintf(file, fmt, arg->i);
+            break;
+        case ARG_UINT:
+            if (spec->conv == 'c') {
+                conv[0] = 'c';
+                conv[1] = '\0';
+                fprintf(file, fmt, (int)arg->u);
+            }
+            else {
+                strcpy(conv, "ll");
+                conv[2] = spec->conv;
+                conv[3] = '\0';
+                fprintf(file, fmt, arg->u);
+            }
+            break;
+        case ARG_DOUBLE:
+            conv[0] = spec->conv;
+            conv[1] = '\0';
+            fprintf(file, fmt, arg->d);
+            break;
+        case ARG_STRING:
+            conv[0] = 's';
+            conv[1] = '\0';
+            fprintf(file,
+                    fmt,
+                    arg->str_off < LOG_STRING_BYTES ? rec->strings + arg->str_off : "");
+            break;
+        case ARG_POINTER:
+            conv[0] = 'p';
+            conv[1] = '\0';
+            fprintf(file, fmt, arg->p);
+            break;
+        default:
+            break;
+    }
+}
+
+static const char* level_name(int level) {
+    switch (level) {
+        case LOG_DEBUG:
+            return "DEBUG";
+        case LOG_INFO:
+            return "INFO";
+        case LOG_NOTICE:
+            return "NOTICE";
+        case LOG_WARN:
+            return "WARNING";
+        case LOG_ERROR:
+            return "ERROR";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+static void write_prefix(FILE* file, const struct timespec* ts, int level) {
+    char buf[64] = { 0 };
+
+    struct tm local_time;
+    localtime_r(&ts->tv_sec, &local_time);
+    strftime(buf, sizeof(buf) - 1, "%F %X", &local_time);
+    fprintf(file, "%s %s ", buf, level_name(level));
+}
+
+static void write_record(const log_record* rec) {
+    FILE* file = rec->file;
+
+    write_prefix(file, &rec->time, rec->level);
+
+    int arg_idx = 0;
+    for (const char* p = rec->format; *p != '\0'; ) {
+        if (*p != '%') {
+            fputc(*p++, file);
+            continue;
+        }
+
+        ++p;
+        if (*p == '%') {
+            fputc(*p++, file);
+            continue;
+        }
+
+        log_spec spec;
+        p = parse_spec(p, &spec);
+        write_arg(file, &spec, rec, arg_idx++);
+    }
+
+    fputc('\n', file);
+}
+
+static void write_dropped(FILE* file, unsigned long count) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    write_prefix(file, &now, LOG_WARN);
+    fprintf(file, "%lu log messages dropped\n", count);
+}
+
+static void drain_ring(void) {
+    FILE* files[8];
+    size_t num_files = 0;
+    int flush_all = 0;
+
+    unsigned long drops = atomic_exchange(&dropped_pending, 0);
+
+    size_t pos = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+    while (1) {
+        log_record* rec = &ring[pos & (LOG_RING_SIZE - 1)];
+        if (atomic_load_explicit(&rec->seq, memory_order_acquire) != pos + 1) {
+            break;
+        }
+
+        size_t i = 0;
+        while (i < num_files && files[i] != rec->file) ++i;
+
+        if (rec->format == NULL) {
+            // Every earlier record for this file has been written, and the
+            // logger that owned it is gone
+            fclose(rec->file);
+            if (i < num_files) files[i] = files[--num_files];
+        }
+        else {
+            if (drops > 0) {
+                write_dropped(rec->file, drops);
+                drops = 0;
+            }
+
+            write_record(rec);
+
+            if (i == num_files) {
+                if (num_files < sizeof(files) / sizeof(files[0])) files[num_files++] = rec->file;
+                else flush_all = 1;
+            }
+        }
+
+        // Hand the slot back to the producers
+        atomic_store_explicit(&rec->seq, pos + LOG_RING_SIZE, memory_order_release);
+        ++pos;
+    }
+
+    atomic_store_explicit(&dequeue_pos, pos, memory_order_relaxed);
+
+    // Nothing to attach the report to yet, so try again next time
+    if (drops > 0) {
+        atomic_fetch_add(&dropped_pending, drops);
+    }
+
+    if (flush_all) {
+        fflush(NULL);
+    }
+    else {
+        for (size_t i = 0; i < num_files; ++i) {
+            fflush(files[i]);
+        }
+    }
+
+    atomic_store_explicit(&written_pos, pos, memory_order_release);
+}
+
+static void* writer_main(void* arg) {
+    (void)arg;
+
+    const struct timespec interval = { 0, LOG_DRAIN_INTERVAL_MS * 1000000L };
+    while (1) {
+        drain_ring();
+        nanosleep(&interval, NULL);
+    }
+
+    return NULL;
+}
+
+static void start_writer(void) {
+    for (size_t i = 0; i < LOG_RING_SIZE; ++i) {
+        atomic_init(&ring[i].seq, i);
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, writer_main, NULL) == 0) {
+        pthread_detach(thread);
+        writer_running = 1;
+        atexit(log_flush);
+    }
+}
+
+// Returns the claimed slot and its ring position, or NULL if the ring is
+// full
+static log_record* claim_slot(size_t* pos_out) {
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    while (1) {
+        log_record* rec = &ring[pos & (LOG_RING_SIZE - 1)];
+        const size_t seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+        const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos,
+                                                      &pos,
+                                                      pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                *pos_out = pos;
+                return rec;
+            }
+        }
+        else if (diff < 0) {
+            return NULL;
+        }
+        else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
 crypto_log create_logger(const char* logging_file, int level)
 {
     crypto_log ret;
@@ -21,51 +439,94 @@ crypto_log create_logger(const char* logging_file, int level)
 
     ret.level = level;
 
+    pthread_once(&writer_once, start_writer);
+
     return ret;
 }
 
 void destroy_logger(crypto_log logger) {
-    if (logger.file != stdout && logger.file != stderr) {
+    if (logger.file == NULL || logger.file == stdout || logger.file == stderr) {
+        return;
+    }
+
+    if (!writer_running) {
         fclose(logger.file);
+        return;
     }
+
+    // Records for the file may still be queued, so the writer closes it
+    // once it gets to them. This one can't be dropped, so wait for room
+    const struct timespec interval = { 0, 1000000L };
+    size_t pos;
+    log_record* rec;
+    while ((rec = claim_slot(&pos)) == NULL) {
+        nanosleep(&interval, NULL);
+    }
+
+    rec->file = logger.file;
+    rec->format = NULL;
+    rec->num_args = 0;
+    atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
 }
 
-void log_message(crypto_log logger, int level, const char* format, ...) {
-    if (level >= logger.level) {
-        char buf[256] = { 0 };
+void log_flush(void) {
+    const struct timespec interval = { 0, 1000000L };
 
-        time_t cur_time = time(NULL);
-        struct tm* local_time = localtime(&cur_time);
-        strftime(buf, sizeof(buf) - 1, "%F %X", local_time);
-        fprintf(logger.file, "%s ", buf);
+    // Direct writes are already flushed
+    if (!writer_running) {
+        return;
+    }
 
-        switch (level) {
-            case LOG_DEBUG:
-                fprintf(logger.file, "DEBUG ");
-                break;
-            case LOG_INFO:
-                fprintf(logger.file, "INFO ");
-                break;
-            case LOG_NOTICE:
-                fprintf(logger.file, "NOTICE ");
-                break;
-            case LOG_WARN:
-                fprintf(logger.file, "WARNING ");
-                break;
-            case LOG_ERROR:
-                fprintf(logger.file, "ERROR ");
-                break;
-            default:
-                fprintf(logger.file, "UNKNOWN ");
-                break;
-        }
+    const size_t target = atomic_load(&enqueue_pos);
+    while (atomic_load_explicit(&written_pos, memory_order_acquire) < target) {
+        nanosleep(&interval, NULL);
+    }
+}
+
+unsigned long log_dropped_messages(void) {
+    return atomic_load_explicit(&dropped_total, memory_order_relaxed);
+}
+
+void log_message(crypto_log logger, int level, const char* format, ...) {
+    if (level < logger.level || logger.file == NULL) {
+        return;
+    }
+
+    if (!writer_running) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
 
         va_list args;
         va_start(args, format);
+        pthread_mutex_lock(&direct_lock);
+        write_prefix(logger.file, &now, level);
         vfprintf(logger.file, format, args);
+        fputc('\n', logger.file);
+        fflush(logger.file);
+        pthread_mutex_unlock(&direct_lock);
         va_end(args);
+        return;
+    }
 
-        fprintf(logger.file, "\n");
-        fflush(logger.file);
+    size_t pos;
+    log_record* rec = claim_slot(&pos);
+    if (rec == NULL) {
+        // Full
+        atomic_fetch_add_explicit(&dropped_pending, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&dropped_total, 1, memory_order_relaxed);
+        return;
     }
-}
\ No newline at end of file
+
+    rec->file = logger.file;
+    rec->level = level;
+    rec->format = format;
+    clock_gettime(CLOCK_REALTIME, &rec->time);
+
+    va_list args;
+    va_start(args, format);
+    capture_args(rec, format, args);
+    va_end(args);
+
+    // Publish it
+    atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+}
@@ -9,6 +9,24 @@
 #define LOG_WARN   3
 #define LOG_ERROR  4
 
+// Messages below this level are compiled out of LOG_MESSAGE call sites
+// entirely. Release builds set this from CMake
+#ifndef CRYPTO_LOG_MIN_LEVEL
+#define CRYPTO_LOG_MIN_LEVEL LOG_DEBUG
+#endif
+
+// Checks the level before evaluating any of the message arguments, so
+// expensive arguments cost nothing when the message would be discarded.
+// With a constant level below CRYPTO_LOG_MIN_LEVEL the whole statement is
+// removed by the compiler
+#define LOG_MESSAGE(logger_, level_, ...)                                    \
+    do {                                                                     \
+        if ((level_) >= CRYPTO_LOG_MIN_LEVEL && (level_) >= (logger_).level) \
+        {                                                                    \
+            log_message((logger_), (level_), __VA_ARGS__);                   \
+        }                                                                    \
+    } while (0)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -19,10 +37,23 @@ typedef struct {
 } crypto_log;
 
 crypto_log create_logger(const char* logging_file, int level);
+// The file is closed by the background thread once the messages already
+// queued for it are written
 void destroy_logger(crypto_log logger);
 
+// Queues a message to be formatted and written by a background thread.
+// The format string must remain valid for the life of the process
+// (ie. a string literal), and only printf conversions without '*' widths
+// are supported. String arguments are copied. Never blocks: if the queue is
+// full the message is dropped and counted. Without a background thread the
+// message is written directly
 void log_message(crypto_log logger, int level, const char* format, ...);
 
+// Waits until every message queued so far has been written
+void log_flush(void);
+
+unsigned long log_dropped_messages(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,157 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "crypto_metrics.h"
+
+using namespace std;
+
+// How often the server thread checks whether it should exit
+static const int SERVER_POLL_MS = 250;
+
+crypto_metrics::crypto_metrics()
+    : m_running(false),
+      m_listen_fd(-1)
+{
+}
+
+crypto_metrics::~crypto_metrics()
+{
+    stop();
+}
+
+metric_t& crypto_metrics::add(const char* name, const char* type)
+{
+    m_metrics.emplace_back();
+    m_metrics.back().name = name;
+    m_metrics.back().type = type;
+
+    return m_metrics.back().value;
+}
+
+bool crypto_metrics::start(const char* socket_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_listen_fd < 0)
+    {
+        return false;
+    }
+
+    // Clean up after a previous instance that didn't exit cleanly
+    unlink(socket_path);
+    if (bind(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(m_listen_fd, 4) != 0)
+    {
+        close(m_listen_fd);
+        m_listen_fd = -1;
+        return false;
+    }
+
+    m_socket_path = socket_path;
+    m_running = true;
+    m_server = thread(&crypto_metrics::server_main, this);
+
+    return true;
+}
+
+void crypto_metrics::stop()
+{
+    if (!m_running)
+    {
+        return;
+    }
+
+    m_running = false;
+    m_server.join();
+
+    close(m_listen_fd);
+    m_listen_fd = -1;
+    unlink(m_socket_path.c_str());
+}
+
+string crypto_metrics::format() const
+{
+    string out;
+    char line[160];
+    for (const metric& m : m_metrics)
+    {
+        snprintf(line,
+                 sizeof(line),
+                 "%s %s %llu\n",
+                 m.type,
+                 m.name.c_str(),
+                 (unsigned long long)m.value.load(memory_order_relaxed));
+        out += line;
+    }
+
+    return out;
+}
+
+void crypto_metrics::server_main()
+{
+    while (m_running)
+    {
+        struct pollfd pfd;
+        pfd.fd = m_listen_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, SERVER_POLL_MS) <= 0)
+        {
+            continue;
+        }
+
+        const int client_fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd < 0)
+        {
+            continue;
+        }
+
+        const string text = format();
+        size_t written = 0;
+        while (written < text.size())
+        {
+            const ssize_t ret = send(client_fd,
+                                     text.data() + written,
+                                     text.size() - written,
+                                     MSG_NOSIGNAL);
+            if (ret < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (ret <= 0)
+            {
+                break;
+            }
+            written += ret;
+        }
+
+        close(client_fd);
+    }
+}
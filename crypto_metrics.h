@@ -0,0 +1,89 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CRYPTO_METRICS_H
+#define CRYPTO_METRICS_H
+
+#include <time.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+
+typedef std::atomic<uint64_t> metric_t;
+
+// Counters that only ever go up. Clients report the rate of change
+#define METRIC_COUNTER "counter"
+// Values that are overwritten, ie. queue depths
+#define METRIC_GAUGE   "gauge"
+
+// Named counters shared between the realtime thread and a Unix domain
+// socket server thread. The realtime thread only ever touches its counters
+// with relaxed atomic operations. Every client that connects to the socket
+// is sent one "<type> <name> <value>" line per metric and disconnected
+class crypto_metrics
+{
+public:
+    crypto_metrics();
+    ~crypto_metrics();
+
+    // Metrics must all be added before start() is called. The returned
+    // reference stays valid for the life of this object
+    metric_t& add(const char* name, const char* type = METRIC_COUNTER);
+
+    bool start(const char* socket_path);
+    void stop();
+
+private:
+    struct metric
+    {
+        std::string name;
+        const char* type;
+        metric_t    value{0};
+    };
+
+private:
+    void server_main();
+    std::string format() const;
+
+private:
+    std::deque<metric> m_metrics;
+    std::string        m_socket_path;
+    std::thread        m_server;
+    std::atomic<bool>  m_running;
+    int                m_listen_fd;
+};
+
+static inline void metric_add(metric_t& metric, uint64_t n = 1)
+{
+    metric.fetch_add(n, std::memory_order_relaxed);
+}
+
+static inline void metric_set(metric_t& metric, uint64_t val)
+{
+    metric.store(val, std::memory_order_relaxed);
+}
+
+// Used to time stages of the realtime thread. Served from the vDSO, so it
+// doesn't make a system call
+static inline uint64_t metric_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,438 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <getopt.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "crypto_cfg.h"
+#include "crypto_metrics.h"
+#include "capture.h"
+#include "rx_engine.h"
+#include "tx_engine.h"
+
+// Runs the cycles recorded by jack_crypto_tx -c or jack_crypto_rx -c
+// through tx_engine or rx_engine again, one recorded cycle at a time, and
+// reports how long each cycle took and whether the outputs still match
+
+// Feeds the recorded PTT input to the engine and checks the PTT output
+// against the recording
+class replay_ptt : public tx_ptt
+{
+public:
+    bool mic_enabled(crypto_tx_common& crypto_tx) override
+    {
+        return (m_flags & CAPTURE_MIC_ENABLED) != 0;
+    }
+
+    void set_output(bool val) override
+    {
+        m_output = val;
+    }
+
+    void begin_cycle(uint32_t flags)
+    {
+        m_flags = flags;
+    }
+
+    // Whether the PTT output ended up where it was recorded
+    bool output_matches() const
+    {
+        return m_output == ((m_flags & CAPTURE_PTT_OUT) != 0);
+    }
+
+private:
+    uint32_t m_flags = 0;
+    bool     m_output = false;
+};
+
+struct replay_stats
+{
+    unsigned long long cycles = 0;
+    // Cycles missing from the capture because the ring was full
+    unsigned long long missing = 0;
+    unsigned long long xruns = 0;
+    unsigned long long frames = 0;
+    unsigned long long over_period = 0;
+    unsigned long long output_mismatches = 0;
+    unsigned long long ptt_mismatches = 0;
+    unsigned long long first_mismatch_seq = 0;
+    float              max_output_diff = 0.0f;
+
+    std::vector<uint64_t> capture_ns;
+    std::vector<uint64_t> replay_ns;
+};
+
+// The largest difference between the replayed output and the recording
+static float output_diff(const audio_sample_t* replayed, const audio_buffer_t& recorded)
+{
+    float diff = 0.0f;
+    for (size_t i = 0; i < recorded.size(); ++i)
+    {
+        diff = std::max(diff, std::fabs(replayed[i] - recorded[i]));
+    }
+    return diff;
+}
+
+// Counts the cycle as a mismatch if the replayed output differs from the
+// recording
+static void check_output(const capture_cycle&  cycle,
+                         const audio_sample_t* replayed,
+                         const audio_buffer_t& recorded,
+                         replay_stats&         stats)
+{
+    if (recorded.empty())
+    {
+        return;
+    }
+
+    const float diff = output_diff(replayed, recorded);
+    if (diff > 0.0f)
+    {
+        if (stats.output_mismatches++ == 0)
+        {
+            stats.first_mismatch_seq = cycle.seq;
+        }
+        stats.max_output_diff = std::max(stats.max_output_diff, diff);
+    }
+}
+
+class replayer
+{
+public:
+    virtual ~replayer() {}
+
+    // Runs one cycle. Returns false if the capture doesn't fit the config
+    virtual bool process(const capture_cycle&               cycle,
+                         const std::vector<audio_buffer_t>& buffers,
+                         replay_stats&                      stats) = 0;
+};
+
+class tx_replayer : public replayer
+{
+public:
+    tx_replayer(const char* config_file, uint sample_rate)
+        : m_counters(m_metrics),
+          m_engine(m_counters, m_ptt, nullptr),
+          m_sample_rate(sample_rate)
+    {
+        m_engine.state().reset(create_tx_state(config_file, sample_rate));
+    }
+
+    bool process(const capture_cycle&               cycle,
+                 const std::vector<audio_buffer_t>& buffers,
+                 replay_stats&                      stats) override
+    {
+        // voice_in, then modem_out
+        if (buffers[0].empty())
+        {
+            fprintf(stderr, "Cycle %llu has no voice input\n", (unsigned long long)cycle.seq);
+            return false;
+        }
+
+        m_modem_out.resize(cycle.nframes);
+        m_ptt.begin_cycle(cycle.flags);
+
+        const uint64_t start_ns = metric_now_ns();
+        m_engine.process(buffers[0].data(), m_modem_out.data(), cycle.nframes, m_sample_rate);
+        stats.replay_ns.push_back(metric_now_ns() - start_ns);
+
+        if (!m_ptt.output_matches())
+        {
+            ++stats.ptt_mismatches;
+        }
+        check_output(cycle, m_modem_out.data(), buffers[1], stats);
+        return true;
+    }
+
+private:
+    crypto_metrics m_metrics;
+    tx_metrics     m_counters;
+    replay_ptt     m_ptt;
+    tx_engine      m_engine;
+    uint           m_sample_rate;
+    audio_buffer_t m_modem_out;
+};
+
+class rx_replayer : public replayer
+{
+public:
+    rx_replayer(const char* config_file, uint sample_rate, uint buffer_size)
+        : m_counters(m_metrics),
+          m_engine(m_counters, nullptr),
+          m_sample_rate(sample_rate)
+    {
+        m_engine.state().reset(create_rx_state(config_file, sample_rate, buffer_size, 0));
+    }
+
+    bool process(const capture_cycle&               cycle,
+                 const std::vector<audio_buffer_t>& buffers,
+                 replay_stats&                      stats) override
+    {
+        // voice_out, notification_out, the modem inputs, then the modem Q
+        // inputs
+        rx_state& st = m_engine.begin_cycle();
+        const crypto_rx_diversity& rx_diversity = *st.rx_diversity;
+        const audio_sample_t* modem_frames[MAX_MODEM_IN_PORTS] = { nullptr };
+        const audio_sample_t* modem_q_frames[MAX_MODEM_IN_PORTS] = { nullptr };
+        for (size_t i = 0; i < rx_diversity.num_branches(); ++i)
+        {
+            const audio_buffer_t& modem = buffers[2 + i];
+            const audio_buffer_t& modem_q = buffers[2 + MAX_MODEM_IN_PORTS + i];
+            if (modem.empty() || (rx_diversity.iq_input() && modem_q.empty()))
+            {
+                fprintf(stderr,
+                        "Cycle %llu has no input for modem branch %u\n",
+                        (unsigned long long)cycle.seq,
+                        (uint)(i + 1));
+                return false;
+            }
+            modem_frames[i] = modem.data();
+            modem_q_frames[i] = rx_diversity.iq_input() ? modem_q.data() : nullptr;
+        }
+
+        m_voice_out.resize(cycle.nframes);
+        m_notification_out.resize(cycle.nframes);
+
+        const uint64_t start_ns = metric_now_ns();
+        m_engine.process(st,
+                         modem_frames,
+                         modem_q_frames,
+                         m_voice_out.data(),
+                         m_notification_out.data(),
+                         cycle.nframes,
+                         m_sample_rate);
+        stats.replay_ns.push_back(metric_now_ns() - start_ns);
+
+        // The notification sounds aren't loaded, so only the voice is
+        // compared
+        check_output(cycle, m_voice_out.data(), buffers[0], stats);
+        return true;
+    }
+
+private:
+    crypto_metrics m_metrics;
+    rx_metrics     m_counters;
+    rx_engine      m_engine;
+    uint           m_sample_rate;
+    audio_buffer_t m_voice_out;
+    audio_buffer_t m_notification_out;
+};
+
+static double percentile_us(std::vector<uint64_t> ns, size_t pct)
+{
+    if (ns.empty())
+    {
+        return 0.0;
+    }
+    std::sort(ns.begin(), ns.end());
+    return ns[std::min(ns.size() - 1, ns.size() * pct / 100)] / 1000.0;
+}
+
+static double mean_us(const std::vector<uint64_t>& ns)
+{
+    if (ns.empty())
+    {
+        return 0.0;
+    }
+    uint64_t total = 0;
+    for (uint64_t n : ns)
+    {
+        total += n;
+    }
+    return total / 1000.0 / ns.size();
+}
+
+static void print_times(const char* name, const std::vector<uint64_t>& ns)
+{
+    printf("%s: mean %.1f us, p99 %.1f us, max %.1f us\n",
+           name,
+           mean_us(ns),
+           percentile_us(ns, 99),
+           percentile_us(ns, 100));
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-s <csv file>] ConfigFile CaptureFile\n"
+            "  Runs the cycles recorded by jack_crypto_tx -c or jack_crypto_rx -c\n"
+            "  through the same processing again, with the recorded PTT state,\n"
+            "  and compares the outputs with the recording. ConfigFile should be\n"
+            "  the config the capture was made with. Encrypted transmissions\n"
+            "  pick fresh IVs, so their modem output never matches\n"
+            "  -s  Write a CSV row per cycle with the recorded and replayed\n"
+            "      processing times\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* csv_file = nullptr;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': csv_file = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* config_file = argv[optind];
+    const char* capture_file = argv[optind + 1];
+
+    capture_reader reader;
+    if (!reader.open(capture_file))
+    {
+        fprintf(stderr, "%s is not a capture file\n", capture_file);
+        return 1;
+    }
+    const capture_header& header = reader.header();
+
+    FILE* csv = nullptr;
+    if (csv_file != nullptr)
+    {
+        csv = fopen(csv_file, "w");
+        if (csv == nullptr)
+        {
+            fprintf(stderr, "Could not open %s\n", csv_file);
+            return 1;
+        }
+        fprintf(csv, "seq,nframes,flags,capture_process_us,replay_process_us\n");
+    }
+
+    replay_stats stats;
+    capture_cycle cycle;
+    std::vector<audio_buffer_t> buffers;
+    std::unique_ptr<replayer> engine;
+    uint64_t next_seq = 0;
+    bool ok = true;
+
+    while (ok && reader.next(cycle, buffers))
+    {
+        // The receiver sizes its buffers from the cycle size, so the engine
+        // is built once the first cycle is known
+        if (!engine)
+        {
+            try
+            {
+                if (strcmp(header.client, "crypto_tx") == 0 && header.num_ports == 2)
+                {
+                    engine.reset(new tx_replayer(config_file, header.sample_rate));
+                }
+                else if (strcmp(header.client, "crypto_rx") == 0 &&
+                         header.num_ports == 2 + 2 * MAX_MODEM_IN_PORTS)
+                {
+                    engine.reset(new rx_replayer(config_file, header.sample_rate, cycle.nframes));
+                }
+                else
+                {
+                    fprintf(stderr, "%s was recorded by an unknown client\n", capture_file);
+                    ok = false;
+                    break;
+                }
+            }
+            catch (const std::exception& ex)
+            {
+                fprintf(stderr, "%s", ex.what());
+                ok = false;
+                break;
+            }
+        }
+
+        stats.missing += cycle.seq - next_seq;
+        next_seq = cycle.seq + 1;
+        ++stats.cycles;
+        stats.frames += cycle.nframes;
+        if ((cycle.flags & CAPTURE_XRUN) != 0)
+        {
+            ++stats.xruns;
+        }
+
+        stats.capture_ns.push_back(cycle.process_ns);
+        ok = engine->process(cycle, buffers, stats);
+        if (!ok)
+        {
+            break;
+        }
+
+        const uint64_t period_ns = cycle.nframes * 1000000000ull / header.sample_rate;
+        if (stats.replay_ns.back() > period_ns)
+        {
+            ++stats.over_period;
+        }
+
+        if (csv != nullptr)
+        {
+            fprintf(csv,
+                    "%llu,%u,%u,%.1f,%.1f\n",
+                    (unsigned long long)cycle.seq,
+                    cycle.nframes,
+                    cycle.flags,
+                    cycle.process_ns / 1000.0,
+                    stats.replay_ns.back() / 1000.0);
+        }
+    }
+
+    if (csv != nullptr && fclose(csv) != 0)
+    {
+        fprintf(stderr, "Could not write %s\n", csv_file);
+        ok = false;
+    }
+
+    printf("%s capture at %u Hz: %llu cycles, %.1f s of audio, %llu cycles missing, %llu xruns\n",
+           header.client,
+           header.sample_rate,
+           stats.cycles,
+           header.sample_rate > 0 ? static_cast<double>(stats.frames) / header.sample_rate : 0.0,
+           stats.missing,
+           stats.xruns);
+    print_times("recorded", stats.capture_ns);
+    print_times("replayed", stats.replay_ns);
+    printf("replayed cycles longer than the cycle period: %llu\n", stats.over_period);
+    if (stats.output_mismatches == 0)
+    {
+        printf("output: matches the recording\n");
+    }
+    else
+    {
+        printf("output: differs in %llu cycles, first at cycle %llu, by up to %g\n",
+               stats.output_mismatches,
+               stats.first_mismatch_seq,
+               stats.max_output_diff);
+    }
+    if (stats.ptt_mismatches > 0)
+    {
+        printf("PTT output: differs in %llu cycles\n", stats.ptt_mismatches);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -21,12 +21,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <getopt.h>
 #include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "crypto_rx_common.h"
 #include "crypto_common.h"
 #include "crypto_cfg.h"
 #include "crypto_log.h"
+#include "stream_io.h"
 
 static volatile sig_atomic_t reload_config = 0;
 
@@ -34,21 +38,65 @@ static void handle_sighup(int sig) {
     reload_config = 1;
 }
 
+/* The number of input values to read for the next frame */
+static int get_needed_samples(HCRYPTO_RX* crypto_rx) {
+    if (crypto_rx_iq_input(crypto_rx)) {
+        return crypto_rx_needed_iq_samples(crypto_rx) * 2;
+    }
+    else {
+        return crypto_rx_needed_modem_samples(crypto_rx);
+    }
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-b <block size>] [-F block|frame] [-i <file>] [-o <file>] [-P] ConfigFile\n"
+            "  -b  Size of the blocks read from stdin and written to stdout,\n"
+            "      ie. 64k or 1M. The default is 1M\n"
+            "  -F  Write to stdout after every frame (the default), for\n"
+            "      playing the speech live, or when a block is full\n"
+            "  -i  Read the modem signal from a file, mapped into memory,\n"
+            "      instead of stdin\n"
+            "  -o  Write speech to a file, mapped into memory, instead of stdout\n"
+            "  -P  Read and write on threads of their own, so I/O overlaps with\n"
+            "      the codec. Mapped files are read ahead by the kernel anyway\n"
+            "  The throughput is printed at the end when -i or -o is given\n",
+            prog);
+}
+
 int main(int argc, char *argv[]) {
-    FILE* fin = stdin;
-    FILE* fout = stdout;
+    size_t block_size = STREAM_DEFAULT_BLOCK_SIZE;
+    int flush = STREAM_FLUSH_FRAME;
+    const char* input_file = NULL;
+    const char* output_file = NULL;
+    int pipelined = 0;
+    int opt;
 
     HCRYPTO_RX* crypto_rx = NULL;
     int         nin, nout;
     
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s ConfigFile\n", argv[0]);
+    while ((opt = getopt(argc, argv, "b:F:i:o:Ph")) != -1) {
+        switch (opt) {
+        case 'b': block_size = parse_stream_size(optarg); break;
+        case 'F': flush = parse_stream_flush(optarg); break;
+        case 'i': input_file = optarg; break;
+        case 'o': output_file = optarg; break;
+        case 'P': pipelined = 1; break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (optind >= argc || block_size == 0 || flush < 0) {
+        usage(argv[0]);
         exit(1);
     }
+    const char* config_file = argv[optind];
 
     signal(SIGHUP, handle_sighup);
 
-    crypto_rx = crypto_rx_create("crypto_rx", argv[1]);
+    crypto_rx = crypto_rx_create("crypto_rx", config_file);
     if (crypto_rx == NULL) {
         fprintf(stderr, "Could not create crypto_rx object");
         exit(1);
@@ -56,42 +104,102 @@ int main(int argc, char *argv[]) {
 
     /* note use of API functions to tell us how big our buffers need to be -----*/
     
-    short* speech_out = malloc(sizeof(short) * crypto_rx_max_speech_samples_per_frame(crypto_rx));
-    short* demod_in = malloc(sizeof(short) * crypto_rx_max_modem_samples_per_frame(crypto_rx));
+    int max_speech_samples = crypto_rx_max_speech_samples_per_frame(crypto_rx);
+    /* In IQ mode the input is interleaved 16-bit I/Q at the IQ sample rate */
+    float* iq_float = malloc(sizeof(float) * 2 * crypto_rx_max_iq_samples_per_frame(crypto_rx));
+    nin = get_needed_samples(crypto_rx);
+
+    struct stream_reader* fin;
+    if (input_file != NULL) {
+        fin = stream_reader_open_file(input_file, block_size, pipelined);
+    }
+    else if (pipelined) {
+        fin = stream_reader_open_pipelined(STDIN_FILENO, block_size);
+    }
+    else {
+        fin = stream_reader_open(STDIN_FILENO, block_size);
+    }
+    if (fin == NULL) {
+        fprintf(stderr, "Could not open %s\n", input_file != NULL ? input_file : "stdin");
+        exit(1);
+    }
 
-    nin = crypto_rx_needed_modem_samples(crypto_rx);
-    while(read_input_file(demod_in, nin, fin) == nin) {
-        nout = crypto_rx_receive(crypto_rx, speech_out, demod_in);
+    /* At most one speech frame per modem frame. The output file is
+       truncated to what was decoded at the end */
+    const size_t output_size_hint =
+        stream_reader_size(fin) / (sizeof(short) * nin) *
+        sizeof(short) * max_speech_samples;
+    struct stream_writer* fout;
+    if (output_file != NULL) {
+        fout = stream_writer_open_file(output_file, output_size_hint, block_size, flush, pipelined);
+    }
+    else if (pipelined) {
+        fout = stream_writer_open_pipelined(STDOUT_FILENO, block_size, flush);
+    }
+    else {
+        fout = stream_writer_open(STDOUT_FILENO, block_size, flush);
+    }
+    if (fout == NULL) {
+        fprintf(stderr, "Could not open %s\n", output_file != NULL ? output_file : "stdout");
+        exit(1);
+    }
+
+    unsigned long long frames = 0;
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    /* Modem frames are demodulated straight from the input block into the
+       output block */
+    const short* demod_in;
+    while((demod_in = stream_reader_next(fin, sizeof(short) * nin)) != NULL) {
+        short* speech_out = stream_writer_reserve(fout, sizeof(short) * max_speech_samples);
+        if (speech_out == NULL) {
+            break;
+        }
+
+        if (crypto_rx_iq_input(crypto_rx)) {
+            for (int i = 0; i < nin; ++i) {
+                iq_float[i] = demod_in[i] / 32768.0f;
+            }
+            nout = crypto_rx_receive_iq(crypto_rx, speech_out, iq_float);
+        }
+        else {
+            nout = crypto_rx_receive(crypto_rx, speech_out, demod_in);
+        }
 
-        fwrite(speech_out, sizeof(short) * nout, 1, fout);
-        fflush(fout);
+        if (!stream_writer_commit(fout, sizeof(short) * nout)) {
+            break;
+        }
+        ++frames;
 
         if (reload_config != 0) {
             reload_config = 0;
 
             crypto_rx_destroy(crypto_rx);
-            crypto_rx = crypto_rx_create("crypto_rx", argv[1]);
+            crypto_rx = crypto_rx_create("crypto_rx", config_file);
             if (crypto_rx == NULL) {
                 fprintf(stderr, "Could not create crypto_rx object");
                 exit(1);
             }
 
-            speech_out = realloc(speech_out, sizeof(short) * crypto_rx_max_speech_samples_per_frame(crypto_rx));
-            demod_in = realloc(demod_in, sizeof(short) * crypto_rx_max_modem_samples_per_frame(crypto_rx));
+            max_speech_samples = crypto_rx_max_speech_samples_per_frame(crypto_rx);
+            iq_float = realloc(iq_float, sizeof(float) * 2 * crypto_rx_max_iq_samples_per_frame(crypto_rx));
         }
 
         /* IMPORTANT: don't forget to do this in the while loop to
            ensure we fread the correct number of samples: ie update
            "nin" before every call to freedv_rx()/freedv_comprx() */
-        nin = crypto_rx_needed_modem_samples(crypto_rx);
+        nin = get_needed_samples(crypto_rx);
     }
 
-    free(speech_out);
-    free(demod_in);
-    fclose(fin);
-    fclose(fout);
+    free(iq_float);
+    stream_reader_close(fin);
+    const int ok = stream_writer_close(fout);
+
+    if (input_file != NULL || output_file != NULL) {
+        print_stream_throughput(frames, &start_time);
+    }
     crypto_rx_destroy(crypto_rx);
 
-    return 0;
+    return ok ? 0 : 1;
 }
-
@@ -0,0 +1,406 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+
+#include "crypto_rx_common.h"
+#include "stream_io.h"
+
+// Decodes many modem recordings at once, one receiver per worker thread,
+// and summarizes each one as a CSV row
+
+struct decode_result
+{
+    bool               ok = false;
+    unsigned long long modem_frames = 0;
+    // Frames demodulated into speech while the modem was synced
+    unsigned long long frames_decoded = 0;
+    // Seconds of input before the modem first synced, or negative if it
+    // never did
+    double             sync_time = -1.0;
+    double             snr_sum = 0.0;
+    encryption_status  crypto_status = CRYPTO_STATUS_PLAIN;
+};
+
+struct batch_state
+{
+    const char*               config_file = nullptr;
+    std::string               output_dir;
+    std::vector<std::string>  files;
+    std::vector<decode_result> results;
+
+    std::atomic<size_t>       next_file{0};
+
+    std::mutex                progress_lock;
+    size_t                    files_done = 0;
+    unsigned long long        frames_done = 0;
+    struct timespec           start_time;
+};
+
+static double elapsed_seconds(const struct timespec* from)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - from->tv_sec) + (now.tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static const char* crypto_status_name(encryption_status status)
+{
+    switch (status)
+    {
+    case CRYPTO_STATUS_ENCRYPTED: return "encrypted";
+    case CRYPTO_STATUS_WEAK_KEY:  return "weak_key";
+    default:                      return "plain";
+    }
+}
+
+// foo/bar.raw is decoded into <output dir>/bar.speech.raw, so decoding into
+// the input directory never overwrites a recording
+static std::string speech_file_name(const std::string& output_dir, const std::string& input_file)
+{
+    std::string name = input_file.substr(input_file.find_last_of('/') + 1);
+    const size_t ext = name.find_last_of('.');
+    if (ext != std::string::npos && ext > 0)
+    {
+        name.erase(ext);
+    }
+
+    return output_dir + "/" + name + ".speech.raw";
+}
+
+static size_t needed_samples(const crypto_rx_common& rx)
+{
+    return rx.iq_input() ? rx.needed_iq_samples() * 2 : rx.needed_modem_samples();
+}
+
+static void decode_file(const batch_state& state,
+                        uint worker,
+                        const std::string& input_file,
+                        decode_result* result)
+{
+    // A receiver of its own for every file, so the statistics of a file
+    // don't depend on what the worker decoded before it
+    crypto_rx_common rx("crypto_rx_batch", state.config_file);
+    rx.set_telemetry_channel(worker);
+    result->crypto_status = rx.get_encryption_status();
+
+    struct stream_reader* fin = stream_reader_open_file(input_file.c_str(),
+                                                         STREAM_DEFAULT_BLOCK_SIZE,
+                                                         0);
+    if (fin == nullptr)
+    {
+        return;
+    }
+
+    const size_t max_speech_samples = rx.max_speech_samples_per_frame();
+    const size_t output_size_hint =
+        stream_reader_size(fin) / (sizeof(short) * needed_samples(rx)) *
+        sizeof(short) * max_speech_samples;
+    struct stream_writer* fout = stream_writer_open_file(speech_file_name(state.output_dir, input_file).c_str(),
+                                                         output_size_hint,
+                                                         STREAM_DEFAULT_BLOCK_SIZE,
+                                                         STREAM_FLUSH_BLOCK,
+                                                         0);
+    if (fout == nullptr)
+    {
+        stream_reader_close(fin);
+        return;
+    }
+
+    // In IQ mode the input is interleaved 16-bit I/Q at the IQ sample rate
+    std::vector<float> iq_float(2 * rx.max_iq_samples_per_frame());
+    const double input_rate = rx.iq_input() ? rx.iq_sample_rate() : rx.modem_sample_rate();
+    unsigned long long samples_read = 0;
+    bool ok = true;
+
+    size_t nin = needed_samples(rx);
+    const short* demod_in;
+    while ((demod_in = static_cast<const short*>(stream_reader_next(fin, sizeof(short) * nin))) != nullptr)
+    {
+        short* speech_out = static_cast<short*>(stream_writer_reserve(fout, sizeof(short) * max_speech_samples));
+        if (speech_out == nullptr)
+        {
+            ok = false;
+            break;
+        }
+
+        size_t nout;
+        if (rx.iq_input())
+        {
+            for (size_t i = 0; i < nin; ++i)
+            {
+                iq_float[i] = demod_in[i] / 32768.0f;
+            }
+            nout = rx.receive_iq(speech_out, iq_float.data());
+        }
+        else
+        {
+            nout = rx.receive(speech_out, demod_in);
+        }
+
+        if (!stream_writer_commit(fout, sizeof(short) * nout))
+        {
+            ok = false;
+            break;
+        }
+
+        samples_read += rx.iq_input() ? nin / 2 : nin;
+        ++result->modem_frames;
+        if (rx.is_synced() && rx.has_signal())
+        {
+            if (result->sync_time < 0.0)
+            {
+                result->sync_time = samples_read / input_rate;
+            }
+            if (nout > 0)
+            {
+                ++result->frames_decoded;
+                result->snr_sum += rx.snr_estimate();
+            }
+        }
+
+        nin = needed_samples(rx);
+    }
+
+    stream_reader_close(fin);
+    result->ok = stream_writer_close(fout) && ok;
+}
+
+static void report_progress(batch_state* state, const std::string& input_file, const decode_result& result)
+{
+    std::lock_guard<std::mutex> lock(state->progress_lock);
+
+    ++state->files_done;
+    state->frames_done += result.modem_frames;
+    const double seconds = elapsed_seconds(&state->start_time);
+    fprintf(stderr,
+            "[%zu/%zu] %s: %s, %.1f frames/s overall\n",
+            state->files_done,
+            state->files.size(),
+            input_file.c_str(),
+            result.ok ? "done" : "failed",
+            seconds > 0.0 ? state->frames_done / seconds : 0.0);
+}
+
+static void worker_main(batch_state* state, uint worker)
+{
+    size_t idx;
+    while ((idx = state->next_file++) < state->files.size())
+    {
+        try
+        {
+            decode_file(*state, worker, state->files[idx], &state->results[idx]);
+        }
+        catch (...)
+        {
+            state->results[idx].ok = false;
+        }
+        report_progress(state, state->files[idx], state->results[idx]);
+    }
+}
+
+// One file name per line. Blank lines and lines starting with # are
+// skipped
+static bool read_manifest(const char* path, std::vector<std::string>* files)
+{
+    FILE* f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (f == nullptr)
+    {
+        return false;
+    }
+
+    char* line = nullptr;
+    size_t line_size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_size, f)) >= 0)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        {
+            line[--len] = '\0';
+        }
+        if (len > 0 && line[0] != '#')
+        {
+            files->emplace_back(line);
+        }
+    }
+
+    free(line);
+    if (f != stdin)
+    {
+        fclose(f);
+    }
+    return true;
+}
+
+static void write_csv_string(FILE* f, const std::string& str)
+{
+    fputc('"', f);
+    for (char c : str)
+    {
+        if (c == '"')
+        {
+            fputc('"', f);
+        }
+        fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void write_summary(FILE* f, const batch_state& state)
+{
+    fprintf(f, "file,status,modem_frames,frames_decoded,sync_time_s,mean_snr_db,crypto\n");
+    for (size_t i = 0; i < state.files.size(); ++i)
+    {
+        const decode_result& r = state.results[i];
+        write_csv_string(f, state.files[i]);
+        fprintf(f, ",%s,%llu,%llu,", r.ok ? "ok" : "error", r.modem_frames, r.frames_decoded);
+        if (r.sync_time >= 0.0)
+        {
+            fprintf(f, "%.3f", r.sync_time);
+        }
+        fprintf(f, ",");
+        if (r.frames_decoded > 0)
+        {
+            fprintf(f, "%.2f", r.snr_sum / r.frames_decoded);
+        }
+        fprintf(f, ",%s\n", crypto_status_name(r.crypto_status));
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-j <jobs>] [-m <manifest>] [-d <dir>] [-s <csv file>] ConfigFile [file ...]\n"
+            "  -j  Files decoded at once. The default is one per CPU\n"
+            "  -m  Also decode the files listed in this file, one per line,\n"
+            "      or - for stdin\n"
+            "  -d  Write the speech of foo.raw to <dir>/foo.speech.raw. The\n"
+            "      default is the current directory. Files whose names only\n"
+            "      differ in their directory or extension are refused, as\n"
+            "      they would be decoded into the same file\n"
+            "  -s  Write the summary to this file instead of stdout\n"
+            "  The summary has one CSV row per file: the modem frames read,\n"
+            "  the frames decoded while synced, the seconds of input before\n"
+            "  the first sync, the mean SNR of the decoded frames and the\n"
+            "  encryption status. Progress is reported on stderr\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    batch_state state;
+    state.output_dir = ".";
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char* summary_file = nullptr;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:m:d:s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j': jobs = atol(optarg); break;
+        case 'm':
+            if (!read_manifest(optarg, &state.files))
+            {
+                fprintf(stderr, "Could not read %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd': state.output_dir = optarg; break;
+        case 's': summary_file = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc || jobs < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    state.config_file = argv[optind];
+    for (int i = optind + 1; i < argc; ++i)
+    {
+        state.files.emplace_back(argv[i]);
+    }
+    state.results.resize(state.files.size());
+
+    // Two workers writing the same output file at once would corrupt it,
+    // and both rows would still say ok
+    std::map<std::string, size_t> outputs;
+    for (size_t i = 0; i < state.files.size(); ++i)
+    {
+        const std::string output = speech_file_name(state.output_dir, state.files[i]);
+        const auto inserted = outputs.emplace(output, i);
+        if (!inserted.second)
+        {
+            fprintf(stderr,
+                    "%s and %s would both be decoded into %s\n",
+                    state.files[inserted.first->second].c_str(),
+                    state.files[i].c_str(),
+                    output.c_str());
+            return 1;
+        }
+    }
+
+    FILE* summary = summary_file != nullptr ? fopen(summary_file, "w") : stdout;
+    if (summary == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", summary_file);
+        return 1;
+    }
+
+    jobs = std::min<long>(jobs, std::max<size_t>(state.files.size(), 1));
+    clock_gettime(CLOCK_MONOTONIC, &state.start_time);
+
+    std::vector<std::thread> workers;
+    for (long i = 0; i < jobs; ++i)
+    {
+        workers.emplace_back(worker_main, &state, static_cast<uint>(i));
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    write_summary(summary, state);
+    bool ok = fflush(summary) == 0;
+    if (summary != stdout)
+    {
+        ok = fclose(summary) == 0 && ok;
+    }
+
+    for (const decode_result& result : state.results)
+    {
+        ok = ok && result.ok;
+    }
+
+    return ok ? 0 : 1;
+}
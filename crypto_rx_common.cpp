@@ -22,15 +22,20 @@
 #include <cmath>
 #include <climits>
 #include <string>
+#include <vector>
 #include <memory>
+#include <algorithm>
 #include <stdexcept>
 
 #include "freedv_api.h"
 #include "crypto_cfg.h"
 #include "crypto_log.h"
+#include "crypto_telemetry.h"
+#include "crypto_trace.h"
 
 #include "crypto_common.h"
 #include "crypto_rx_common.h"
+#include "iq_downconverter.h"
 
 using namespace std;
 
@@ -45,13 +50,20 @@ struct crypto_rx_common::rx_parms
     {
         if (cur != nullptr) free(cur);
         if (freedv != nullptr) freedv_close(freedv);
+        telemetry_close(telemetry);
         destroy_logger(logger);
     }
 
     const string      config_file;
     struct config*    cur = nullptr;
     struct freedv*    freedv = nullptr;
+
+    unique_ptr<iq_downconverter> downconverter;
+    vector<COMP>                 iq_modem;
+
     crypto_log        logger;
+    crypto_telemetry* telemetry = nullptr;
+    uint8_t           telemetry_channel = 0;
     encryption_status crypto_status = CRYPTO_STATUS_PLAIN;
     bool              modem_has_signal = false;
     int               modem_flush_frames = 0;
@@ -78,11 +90,22 @@ crypto_rx_common::crypto_rx_common(const char* name, const char* config_file)
     m_parms->logger = create_logger(config_file_name.c_str(),
                                     m_parms->cur->log_level);
 
+    m_parms->telemetry = telemetry_open_writer(m_parms->cur->telemetry_file,
+                                               m_parms->cur->telemetry_records);
+    if (str_has_value(m_parms->cur->telemetry_file) && m_parms->telemetry == nullptr)
+    {
+        LOG_MESSAGE(m_parms->logger,
+                    LOG_WARN,
+                    "Could not open telemetry file %s. If it already holds a "
+                    "ring with a different TelemetryRecords, remove it first",
+                    m_parms->cur->telemetry_file);
+    }
+
     if (m_parms->cur->freedv_enabled != 0)
     {
         m_parms->freedv = freedv_open(m_parms->cur->freedv_mode);
         if (m_parms->freedv == NULL) {
-            log_message(m_parms->logger, LOG_ERROR, "Could not initialize voice demodulator");
+            LOG_MESSAGE(m_parms->logger, LOG_ERROR, "Could not initialize voice demodulator");
         }
     }
 
@@ -91,7 +114,7 @@ crypto_rx_common::crypto_rx_common(const char* name, const char* config_file)
         size_t key_bytes_read = read_key_file(m_parms->cur->key_file, key);
         if (str_has_value(m_parms->cur->key_file) &&
             key_bytes_read != FREEDV_MASTER_KEY_LENGTH) {
-            log_message(m_parms->logger,
+            LOG_MESSAGE(m_parms->logger,
                         LOG_WARN,
                         "Truncated decryption key: Only %d bytes of a possible %d",
                         (int)key_bytes_read,
@@ -105,7 +128,7 @@ crypto_rx_common::crypto_rx_common(const char* name, const char* config_file)
         }
         else {
             m_parms->crypto_status = CRYPTO_STATUS_PLAIN;
-            log_message(m_parms->logger, LOG_WARN, "Encryption disabled");
+            LOG_MESSAGE(m_parms->logger, LOG_WARN, "Encryption disabled");
         }
 
         configure_freedv(m_parms->freedv, m_parms->cur);
@@ -116,6 +139,11 @@ crypto_rx_common::crypto_rx_common(const char* name, const char* config_file)
     }
 
     m_parms->modem_flush_frames = m_parms->cur->modem_num_quiet_flush_frames;
+
+    if (m_parms->cur->iq_enabled)
+    {
+        set_iq_sample_rate(m_parms->cur->iq_sample_rate);
+    }
 }
 
 bool crypto_rx_common::using_freedv() const
@@ -183,6 +211,40 @@ size_t crypto_rx_common::needed_modem_samples() const
     }
 }
 
+bool crypto_rx_common::iq_input() const
+{
+    return m_parms->downconverter != nullptr;
+}
+
+uint crypto_rx_common::iq_sample_rate() const
+{
+    return iq_input() ? m_parms->cur->iq_sample_rate : modem_sample_rate();
+}
+
+void crypto_rx_common::set_iq_sample_rate(uint sample_rate)
+{
+    m_parms->downconverter.reset(new iq_downconverter(sample_rate,
+                                                      modem_sample_rate(),
+                                                      m_parms->cur->iq_offset_hz,
+                                                      MODEM_SAMPLE_SCALE));
+    m_parms->iq_modem.resize(max_modem_samples_per_frame());
+    m_parms->cur->iq_sample_rate = sample_rate;
+}
+
+size_t crypto_rx_common::max_iq_samples_per_frame() const
+{
+    return iq_input() ?
+        max_modem_samples_per_frame() * m_parms->downconverter->decimation() :
+        0;
+}
+
+size_t crypto_rx_common::needed_iq_samples() const
+{
+    return iq_input() ?
+        needed_modem_samples() * m_parms->downconverter->decimation() :
+        0;
+}
+
 bool crypto_rx_common::is_synced() const
 {
     if (using_freedv())
@@ -195,6 +257,29 @@ bool crypto_rx_common::is_synced() const
     }
 }
 
+bool crypto_rx_common::has_signal() const
+{
+    if (using_freedv())
+    {
+        return m_parms->modem_has_signal;
+    }
+    else
+    {
+        return true;
+    }
+}
+
+float crypto_rx_common::snr_estimate() const
+{
+    float snr_est = 0.0;
+    if (using_freedv())
+    {
+        freedv_get_modem_stats(m_parms->freedv, nullptr, &snr_est);
+    }
+
+    return snr_est;
+}
+
 encryption_status crypto_rx_common::get_encryption_status() const
 {
     return m_parms->crypto_status;
@@ -224,14 +309,71 @@ uint crypto_rx_common::modem_sample_rate() const
     }
 }
 
+float crypto_rx_common::modem_gain() const
+{
+    if (using_freedv())
+    {
+        return freedv_rx_gain(m_parms->freedv);
+    }
+    else
+    {
+        return 1.0f;
+    }
+}
+
 const struct config* crypto_rx_common::get_config() const
 {
     return m_parms->cur;
 }
 
+void crypto_rx_common::update_squelch(const struct config& cfg)
+{
+    m_parms->cur->modem_quiet_max_thresh = cfg.modem_quiet_max_thresh;
+    m_parms->cur->modem_signal_min_thresh = cfg.modem_signal_min_thresh;
+    m_parms->cur->modem_num_quiet_flush_frames = cfg.modem_num_quiet_flush_frames;
+    m_parms->cur->freedv_squelch_enabled = cfg.freedv_squelch_enabled;
+    m_parms->cur->freedv_squelch_thresh_700c = cfg.freedv_squelch_thresh_700c;
+    m_parms->cur->freedv_squelch_thresh_700d = cfg.freedv_squelch_thresh_700d;
+    m_parms->cur->freedv_squelch_thresh_700e = cfg.freedv_squelch_thresh_700e;
+
+    if (m_parms->freedv != nullptr)
+    {
+        configure_freedv_squelch(m_parms->freedv, m_parms->cur);
+    }
+}
+
 void crypto_rx_common::log_to_logger(int level, const char* msg)
 {
-    log_message(m_parms->logger, level, "%s", msg);
+    LOG_MESSAGE(m_parms->logger, level, "%s", msg);
+}
+
+void crypto_rx_common::set_telemetry_channel(uint channel)
+{
+    m_parms->telemetry_channel = static_cast<uint8_t>(channel);
+}
+
+void crypto_rx_common::write_telemetry(uint nin, size_t nout, short modem_rms, bool demodulated)
+{
+    if (m_parms->telemetry == nullptr)
+    {
+        return;
+    }
+
+    crypto_telemetry_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.mode = using_freedv() ? m_parms->cur->freedv_mode : -1;
+    rec.nin = nin;
+    rec.nout = static_cast<uint32_t>(nout);
+    rec.snr_est = demodulated ? snr_estimate() : 0.0f;
+    rec.rms = modem_rms;
+    rec.direction = TELEMETRY_DIR_RX;
+    rec.channel = m_parms->telemetry_channel;
+    rec.crypto_status = static_cast<uint8_t>(m_parms->crypto_status);
+    rec.flags = (is_synced() ? TELEMETRY_FLAG_SYNC : 0) |
+                (has_signal() ? TELEMETRY_FLAG_SIGNAL : 0) |
+                (demodulated ? TELEMETRY_FLAG_DEMOD : 0);
+
+    telemetry_write(m_parms->telemetry, &rec);
 }
 
 int crypto_rx_common::modem_frames_per_second() const
@@ -239,15 +381,115 @@ int crypto_rx_common::modem_frames_per_second() const
     return modem_sample_rate() / modem_samples_per_frame();
 }
 
+static short modem_rms(const short* demod_in, size_t nin)
+{
+    return rms(demod_in, nin);
+}
+
+static short modem_rms(const float* demod_in, size_t nin)
+{
+    return rms_float(demod_in, nin);
+}
+
+static int demodulate(struct freedv* freedv, short* speech_out, const short* demod_in)
+{
+    return freedv_rx(freedv, speech_out, const_cast<short*>(demod_in));
+}
+
+// Hands the samples to FreeDV without converting them to short first.
+// freedv_rx converts them right back to floats internally, multiplied by
+// freedv_rx_gain(), which the caller has already applied
+static int demodulate(struct freedv* freedv, short* speech_out, const float* demod_in)
+{
+    return freedv_floatrx(freedv, speech_out, const_cast<float*>(demod_in));
+}
+
+static short modem_rms(const COMP* demod_in, size_t nin)
+{
+    return rms_complex(reinterpret_cast<const float*>(demod_in), nin);
+}
+
+static int demodulate(struct freedv* freedv, short* speech_out, const COMP* demod_in)
+{
+    return freedv_comprx(freedv, speech_out, const_cast<COMP*>(demod_in));
+}
+
+static void copy_analog(short* speech_out, const short* demod_in, size_t nin)
+{
+    memcpy(speech_out, demod_in, nin * sizeof(short));
+}
+
+static short to_short(float val)
+{
+    return static_cast<short>(std::min<long>(SHRT_MAX,
+                                             std::max<long>(SHRT_MIN, lrintf(val))));
+}
+
+static void copy_analog(short* speech_out, const float* demod_in, size_t nin)
+{
+    for (size_t i = 0; i < nin; ++i)
+    {
+        speech_out[i] = to_short(demod_in[i]);
+    }
+}
+
+// With the channel mixed down to 0 Hz, the real part is the audio
+static void copy_analog(short* speech_out, const COMP* demod_in, size_t nin)
+{
+    for (size_t i = 0; i < nin; ++i)
+    {
+        speech_out[i] = to_short(demod_in[i].real);
+    }
+}
+
 size_t crypto_rx_common::receive(short* speech_out, const short* demod_in)
 {
+    return do_receive(speech_out, demod_in, 1.0f);
+}
+
+size_t crypto_rx_common::receive(short* speech_out, const float* demod_in)
+{
+    return do_receive(speech_out, demod_in, modem_gain());
+}
+
+size_t crypto_rx_common::receive_iq(short* speech_out, const float* iq_in)
+{
+    if (!iq_input())
+    {
+        throw runtime_error("IQ input is not enabled");
+    }
+
+    // Convert to complex samples at the modem rate and hand them to
+    // FreeDV's complex receive path
+    const size_t nin = needed_modem_samples();
+    {
+        TRACE_SCOPE("downconvert");
+        m_parms->downconverter->process(iq_in,
+                                        reinterpret_cast<float*>(m_parms->iq_modem.data()),
+                                        nin);
+    }
+
+    return do_receive(speech_out, static_cast<const COMP*>(m_parms->iq_modem.data()), 1.0f);
+}
+
+template<class T>
+size_t crypto_rx_common::do_receive(short* speech_out, const T* demod_in, float gain)
+{
+    TRACE_SCOPE("receive");
+
     const int nin = needed_modem_samples();
     size_t nout = 0;
+    short modem_rms = 0;
+    bool demodulated = false;
 
     if (using_freedv())
     {
         // Only do the modem squelch when using digital
-        const short modem_rms = rms(demod_in, nin);
+        modem_rms = ::modem_rms(demod_in, nin);
+        if (gain != 1.0f)
+        {
+            modem_rms = static_cast<short>(modem_rms / gain);
+        }
 
         // RMS-based modem squelch with hysteresis. The built in squelch
         // in FreeDV (especially with the 2400B mode) can sometimes fail at very
@@ -283,20 +525,20 @@ size_t crypto_rx_common::receive(short* speech_out, const short* demod_in)
         if (m_parms->modem_has_signal == true ||
             m_parms->modem_flush_frames <= m_parms->cur->modem_num_quiet_flush_frames)
         {
-            nout = freedv_rx(m_parms->freedv, speech_out, const_cast<short*>(demod_in));
+            nout = demodulate(m_parms->freedv, speech_out, demod_in);
+            demodulated = true;
             if (m_parms->modem_has_signal == false && nout > 0)
             {
                 // If we are flushing frames, Call freedv_rx but discard the output
                 zeroize_frames(speech_out, nout);
             }
 
-            float snr_est = 0.0;
-            freedv_get_modem_stats(m_parms->freedv, nullptr, &snr_est);
-            log_message(m_parms->logger,
+            // The SNR is only looked up if the message will be logged
+            LOG_MESSAGE(m_parms->logger,
                         LOG_DEBUG,
                         "nout: %u, SNR est.: %f, modem RMS: %d",
                         (uint)nout,
-                        snr_est,
+                        snr_estimate(),
                         (int)modem_rms);
         }
         // When the transition from "signal" to "no signal" occurs, signal the modem
@@ -311,10 +553,12 @@ size_t crypto_rx_common::receive(short* speech_out, const short* demod_in)
     }
     else
     {
-        memcpy(speech_out, demod_in, nin * sizeof(short));
+        copy_analog(speech_out, demod_in, nin);
         nout = nin;
     }
 
+    write_telemetry(nin, nout, modem_rms, demodulated);
+
     return nout;
 }
 
@@ -350,6 +594,26 @@ int crypto_rx_needed_modem_samples(HCRYPTO_RX* hnd)
     return reinterpret_cast<crypto_rx_common*>(hnd)->needed_modem_samples();
 }
 
+float crypto_rx_modem_gain(HCRYPTO_RX* hnd)
+{
+    return reinterpret_cast<crypto_rx_common*>(hnd)->modem_gain();
+}
+
+int crypto_rx_iq_input(HCRYPTO_RX* hnd)
+{
+    return reinterpret_cast<crypto_rx_common*>(hnd)->iq_input();
+}
+
+int crypto_rx_max_iq_samples_per_frame(HCRYPTO_RX* hnd)
+{
+    return reinterpret_cast<crypto_rx_common*>(hnd)->max_iq_samples_per_frame();
+}
+
+int crypto_rx_needed_iq_samples(HCRYPTO_RX* hnd)
+{
+    return reinterpret_cast<crypto_rx_common*>(hnd)->needed_iq_samples();
+}
+
 const struct config* crypto_rx_get_config(HCRYPTO_RX* hnd)
 {
     return reinterpret_cast<crypto_rx_common*>(hnd)->get_config();
@@ -364,3 +628,20 @@ int crypto_rx_receive(HCRYPTO_RX* hnd, short* speech_out, const short* demod_in)
 {
     return reinterpret_cast<crypto_rx_common*>(hnd)->receive(speech_out, demod_in);
 }
+
+int crypto_rx_receive_float(HCRYPTO_RX* hnd, short* speech_out, const float* demod_in)
+{
+    return reinterpret_cast<crypto_rx_common*>(hnd)->receive(speech_out, demod_in);
+}
+
+int crypto_rx_receive_iq(HCRYPTO_RX* hnd, short* speech_out, const float* iq_in)
+{
+    try
+    {
+        return reinterpret_cast<crypto_rx_common*>(hnd)->receive_iq(speech_out, iq_in);
+    }
+    catch (...)
+    {
+        return -1;
+    }
+}
@@ -27,17 +27,45 @@ public:
 
     size_t needed_modem_samples() const;
 
+    // Complex IQ input, used when enabled in the config file. IQ samples
+    // are interleaved, normalized floats at iq_sample_rate()
+    bool iq_input() const;
+    uint iq_sample_rate() const;
+    // Overrides the IQ sample rate from the config file
+    void set_iq_sample_rate(uint sample_rate);
+    size_t max_iq_samples_per_frame() const;
+    size_t needed_iq_samples() const;
+
     bool is_synced() const;
+    bool has_signal() const;
+    float snr_estimate() const;
     encryption_status get_encryption_status() const;
 
     uint speech_sample_rate() const;
     uint modem_sample_rate() const;
+    // The gain freedv_rx gives 16-bit samples in the current mode, which
+    // the float receive() expects its samples to carry already
+    float modem_gain() const;
 
     const struct config* get_config() const;
 
+    // Applies the squelch settings of cfg without reinitializing the
+    // demodulator. Must be called from the thread that calls receive()
+    void update_squelch(const struct config& cfg);
+
     void log_to_logger(int level, const char* msg);
 
+    // Tags telemetry records from this receiver, ie. with its diversity
+    // branch
+    void set_telemetry_channel(uint channel);
+
     size_t receive(short* speech_out, const short* demod_in);
+    // demod_in is scaled like 16-bit integer samples, as FreeDV expects,
+    // and multiplied by modem_gain(). Callers fold that into the scaling
+    // they do anyway, so the float path decodes exactly like the short one
+    size_t receive(short* speech_out, const float* demod_in);
+    // Takes needed_iq_samples() interleaved I/Q samples
+    size_t receive_iq(short* speech_out, const float* iq_in);
 
 private:
     struct rx_parms;
@@ -46,6 +74,13 @@ private:
     int modem_frames_per_second() const;
     bool using_freedv() const;
 
+    // gain is what demod_in has been multiplied by, which is taken out of
+    // the squelch level
+    template<class T>
+    size_t do_receive(short* speech_out, const T* demod_in, float gain);
+
+    void write_telemetry(uint nin, size_t nout, short modem_rms, bool demodulated);
+
 private:
     const std::unique_ptr<rx_parms> m_parms;
 };
@@ -64,12 +99,19 @@ int crypto_rx_max_speech_samples_per_frame(HCRYPTO_RX* hnd);
 int crypto_rx_max_modem_samples_per_frame(HCRYPTO_RX* hnd);
 
 int crypto_rx_needed_modem_samples(HCRYPTO_RX* hnd);
+float crypto_rx_modem_gain(HCRYPTO_RX* hnd);
+
+int crypto_rx_iq_input(HCRYPTO_RX* hnd);
+int crypto_rx_max_iq_samples_per_frame(HCRYPTO_RX* hnd);
+int crypto_rx_needed_iq_samples(HCRYPTO_RX* hnd);
 
 const struct config* crypto_rx_get_config(HCRYPTO_RX* hnd);
 
 void crypto_rx_log_to_logger(HCRYPTO_RX* hnd, int level, const char* msg);
 
 int crypto_rx_receive(HCRYPTO_RX* hnd, short* speech_out, const short* demod_in);
+int crypto_rx_receive_float(HCRYPTO_RX* hnd, short* speech_out, const float* demod_in);
+int crypto_rx_receive_iq(HCRYPTO_RX* hnd, short* speech_out, const float* iq_in);
 
 #ifdef __cplusplus
 } // extern "C"
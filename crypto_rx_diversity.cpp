@@ -0,0 +1,552 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+#include <stdexcept>
+
+#include "crypto_cfg.h"
+#include "crypto_common.h"
+#include "resampler.h"
+#include "crypto_trace.h"
+#include "rx_timeline.h"
+#include "crypto_rx_diversity.h"
+
+using namespace std;
+
+static const size_t NO_BRANCH = static_cast<size_t>(-1);
+
+struct crypto_rx_diversity::frame_info
+{
+    // Nominal frame period of the shared input timeline this frame ends in
+    uint64_t slot;
+    size_t   offset;
+    size_t   nout;
+    float  snr_est;
+    bool   synced;
+    bool   has_signal;
+};
+
+struct crypto_rx_diversity::branch
+{
+    branch()
+    {
+        sem_init(&start, 0, 0);
+    }
+    ~branch()
+    {
+        sem_destroy(&start);
+    }
+
+    unique_ptr<crypto_rx_common> rx;
+    unique_ptr<resampler>        input_resampler;
+    // Interleaved I/Q samples waiting to be demodulated, in IQ mode
+    vector<float>                iq_queue;
+
+    // Everything decoded but not combined yet. Each entry of frames
+    // describes the output of one call to receive(), in slot order
+    vector<short>      speech;
+    vector<frame_info> frames;
+    // Most frames held, counting the one being decoded. speech and frames
+    // are reserved for this many, so they never grow on the realtime or
+    // worker threads
+    size_t             max_frames = 0;
+    // Frames decoded during the current cycle
+    size_t             cycle_frames = 0;
+    // Where the frames decoded so far belong in the input stream
+    rx_timeline        timeline;
+
+    const float* input = nullptr;
+    const float* input_q = nullptr;
+    size_t       input_len = 0;
+
+    thread worker;
+    sem_t  start;
+
+    atomic<uint64_t> frames_decoded{0};
+    atomic<uint64_t> frames_selected{0};
+    atomic<uint64_t> input_queue{0};
+    atomic<float>    snr_est{0.0f};
+    atomic<bool>     synced{false};
+    atomic<bool>     has_signal{false};
+    atomic<bool>     selected{false};
+};
+
+static void wait_sem(sem_t* sem)
+{
+    while (sem_wait(sem) != 0 && errno == EINTR)
+    {
+    }
+}
+
+// Ranks a frame by sync state first. SNR is only compared between frames
+// with the same rank
+static int frame_rank(bool has_signal, bool synced)
+{
+    return (has_signal ? 1 : 0) + (has_signal && synced ? 1 : 0);
+}
+
+static void configure_worker(thread& t, size_t cpu, int rt_priority)
+{
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus > 1)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu % num_cpus, &cpus);
+        pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus);
+    }
+
+    // Workers hold up the realtime thread, so they need to run at the
+    // same priority. This fails harmlessly on systems without realtime
+    // scheduling
+    if (rt_priority > 0)
+    {
+        struct sched_param parm;
+        parm.sched_priority = rt_priority;
+        pthread_setschedparam(t.native_handle(), SCHED_FIFO, &parm);
+    }
+}
+
+crypto_rx_diversity::crypto_rx_diversity(const char* name,
+                                         const char* config_file_path,
+                                         uint        input_sample_rate,
+                                         size_t      prime_frames,
+                                         int         rt_priority)
+    : m_selected(0),
+      m_next_slot(0),
+      m_running(true)
+{
+    sem_init(&m_done, 0, 0);
+
+    unique_ptr<crypto_rx_common> primary_rx(new crypto_rx_common(name, config_file_path));
+    const size_t branches = get_num_modem_in_ports(primary_rx->get_config());
+
+    for (size_t i = 0; i < branches; ++i)
+    {
+        unique_ptr<branch> b(new branch());
+        if (i == 0)
+        {
+            b->rx = std::move(primary_rx);
+        }
+        else
+        {
+            b->rx.reset(new crypto_rx_common(name, config_file_path));
+        }
+        b->rx->set_telemetry_channel(i);
+
+        if (b->rx->iq_input())
+        {
+            // IQ goes straight from the port to the downconverter,
+            // which takes care of the sample rate change
+            b->rx->set_iq_sample_rate(input_sample_rate);
+            b->iq_queue.reserve((b->rx->max_iq_samples_per_frame() + prime_frames) * 2);
+        }
+
+        const uint modem_sample_rate = b->rx->modem_sample_rate();
+        const size_t modem_frames =
+            get_max_resampled_frames(b->rx->max_modem_samples_per_frame(),
+                                     modem_sample_rate,
+                                     input_sample_rate);
+
+        b->input_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, modem_frames * 2));
+        b->input_resampler->set_sample_rates(input_sample_rate, modem_sample_rate);
+
+        // Pre-initialize the resampler with null data to "prime" it, then
+        // discard the results. The resampler delays the output by some
+        // number of samples, and we want to make sure that we always have the
+        // same number of bytes available coming out as went in
+        b->input_resampler->enqueue_zeroes(prime_frames);
+        b->input_resampler->clear();
+
+        // Room for a cycle's worth of frames plus the ones held back
+        // waiting for the other branches
+        const size_t cycle_modem_samples =
+            get_max_resampled_frames(prime_frames, input_sample_rate, modem_sample_rate);
+        b->max_frames = cycle_modem_samples / b->rx->modem_samples_per_frame() + 2 +
+                        DIVERSITY_MAX_HELD_FRAMES;
+        b->speech.reserve(b->rx->max_speech_samples_per_frame() * b->max_frames);
+        b->frames.reserve(b->max_frames);
+
+        m_branches.push_back(std::move(b));
+    }
+
+    m_crossfade.resize(primary().max_speech_samples_per_frame());
+
+    for (size_t i = 1; i < m_branches.size(); ++i)
+    {
+        branch& b = *m_branches[i];
+        b.worker = thread(&crypto_rx_diversity::worker_main, this, std::ref(b));
+        configure_worker(b.worker, i, rt_priority);
+    }
+}
+
+crypto_rx_diversity::~crypto_rx_diversity()
+{
+    m_running = false;
+    for (size_t i = 1; i < m_branches.size(); ++i)
+    {
+        sem_post(&m_branches[i]->start);
+        m_branches[i]->worker.join();
+    }
+
+    sem_destroy(&m_done);
+}
+
+bool crypto_rx_diversity::iq_input() const
+{
+    return primary().iq_input();
+}
+
+size_t crypto_rx_diversity::num_branches() const
+{
+    return m_branches.size();
+}
+
+void crypto_rx_diversity::update_squelch(const struct config& cfg)
+{
+    // The workers are idle between calls to process()
+    for (auto& b : m_branches)
+    {
+        b->rx->update_squelch(cfg);
+    }
+}
+
+crypto_rx_common& crypto_rx_diversity::primary()
+{
+    return *m_branches.front()->rx;
+}
+
+const crypto_rx_common& crypto_rx_diversity::primary() const
+{
+    return *m_branches.front()->rx;
+}
+
+rx_branch_stats crypto_rx_diversity::get_branch_stats(size_t idx) const
+{
+    const branch& b = *m_branches.at(idx);
+
+    rx_branch_stats stats;
+    stats.frames_decoded = b.frames_decoded.load(memory_order_relaxed);
+    stats.frames_selected = b.frames_selected.load(memory_order_relaxed);
+    stats.input_queue = b.input_queue.load(memory_order_relaxed);
+    stats.snr_est = b.snr_est.load(memory_order_relaxed);
+    stats.synced = b.synced.load(memory_order_relaxed);
+    stats.has_signal = b.has_signal.load(memory_order_relaxed);
+    stats.selected = b.selected.load(memory_order_relaxed);
+
+    return stats;
+}
+
+void crypto_rx_diversity::worker_main(branch& b)
+{
+    // Trace thread names have to be string literals
+    static const char* const WORKER_NAMES[MAX_MODEM_IN_PORTS] =
+        { "rx_branch_1", "rx_branch_2", "rx_branch_3", "rx_branch_4" };
+    size_t idx = 0;
+    while (m_branches[idx].get() != &b)
+    {
+        ++idx;
+    }
+
+    while (true)
+    {
+        wait_sem(&b.start);
+        if (!m_running)
+        {
+            break;
+        }
+
+        TRACE_THREAD(WORKER_NAMES[idx % MAX_MODEM_IN_PORTS]);
+
+        demodulate(b);
+        sem_post(&m_done);
+    }
+}
+
+void crypto_rx_diversity::drop_frames(branch& b, size_t n)
+{
+    const size_t speech_done = n < b.frames.size() ? b.frames[n].offset : b.speech.size();
+    b.frames.erase(b.frames.begin(), b.frames.begin() + n);
+    b.speech.erase(b.speech.begin(), b.speech.begin() + speech_done);
+    for (frame_info& info : b.frames)
+    {
+        info.offset -= speech_done;
+    }
+}
+
+size_t crypto_rx_diversity::begin_frame(branch& b)
+{
+    // A branch that has run ahead of the others loses its oldest frame
+    // rather than growing the buffers
+    if (b.frames.size() >= b.max_frames)
+    {
+        drop_frames(b, 1);
+    }
+
+    const size_t offset = b.speech.size();
+    b.speech.resize(offset + b.rx->max_speech_samples_per_frame(), 0);
+    return offset;
+}
+
+void crypto_rx_diversity::add_frame(branch& b, size_t nin, size_t nout)
+{
+    frame_info frame;
+    frame.slot = b.timeline.add_frame(nin, b.rx->modem_samples_per_frame());
+    frame.offset = b.speech.size() - nout;
+    frame.nout = nout;
+    frame.synced = b.rx->is_synced();
+    frame.has_signal = b.rx->has_signal();
+    frame.snr_est = b.rx->snr_estimate();
+
+    b.frames.push_back(frame);
+    ++b.cycle_frames;
+}
+
+void crypto_rx_diversity::demodulate(branch& b)
+{
+    TRACE_SCOPE("demodulate");
+
+    b.cycle_frames = 0;
+
+    if (b.rx->iq_input())
+    {
+        // IQ samples per modem sample
+        const size_t decimation = b.rx->iq_sample_rate() / b.rx->modem_sample_rate();
+
+        const size_t prev_size = b.iq_queue.size();
+        b.iq_queue.resize(prev_size + b.input_len * 2);
+        for (size_t i = 0; i < b.input_len; ++i)
+        {
+            b.iq_queue[prev_size + 2 * i] = b.input[i];
+            b.iq_queue[prev_size + 2 * i + 1] = b.input_q[i];
+        }
+
+        size_t consumed = 0;
+        size_t nin = b.rx->needed_iq_samples() * 2;
+        while (b.iq_queue.size() - consumed >= nin)
+        {
+            const size_t offset = begin_frame(b);
+            const size_t nout = b.rx->receive_iq(b.speech.data() + offset,
+                                                 b.iq_queue.data() + consumed);
+            b.speech.resize(offset + nout);
+            add_frame(b, nin / 2 / decimation, nout);
+
+            consumed += nin;
+            nin = b.rx->needed_iq_samples() * 2;
+        }
+
+        b.iq_queue.erase(b.iq_queue.begin(), b.iq_queue.begin() + consumed);
+        return;
+    }
+
+    b.input_resampler->enqueue(b.input, b.input_len);
+
+    const size_t n_max_modem_samples = b.rx->max_modem_samples_per_frame();
+
+    size_t nin = b.rx->needed_modem_samples();
+    while (b.input_resampler->available_elems() >= nin)
+    {
+        // Stay in floating point all the way to the demodulator, scaled
+        // to the 16-bit range FreeDV expects and by the gain freedv_rx
+        // would apply in this mode
+        float demod_in[n_max_modem_samples];
+        b.input_resampler->dequeue(demod_in, nin, MODEM_SAMPLE_SCALE * b.rx->modem_gain());
+
+        const size_t offset = begin_frame(b);
+        const size_t nout = b.rx->receive(b.speech.data() + offset, demod_in);
+        b.speech.resize(offset + nout);
+        add_frame(b, nin, nout);
+
+        /* IMPORTANT: don't forget to do this in the while loop to
+           ensure we fread the correct number of samples: ie update
+           "nin" before every call to freedv_rx()/freedv_comprx() */
+        nin = b.rx->needed_modem_samples();
+    }
+}
+
+const crypto_rx_diversity::frame_info*
+crypto_rx_diversity::get_frame(size_t idx, uint64_t slot) const
+{
+    if (idx >= m_branches.size())
+    {
+        return nullptr;
+    }
+
+    for (const frame_info& info : m_branches[idx]->frames)
+    {
+        if (info.slot == slot)
+        {
+            return info.nout > 0 ? &info : nullptr;
+        }
+        if (info.slot > slot)
+        {
+            break;
+        }
+    }
+    return nullptr;
+}
+
+size_t crypto_rx_diversity::select_branch(uint64_t slot) const
+{
+    size_t best = NO_BRANCH;
+    int best_rank = -1;
+    float best_snr = 0.0f;
+    for (size_t i = 0; i < m_branches.size(); ++i)
+    {
+        const frame_info* info = get_frame(i, slot);
+        if (info == nullptr)
+        {
+            continue;
+        }
+
+        const int rank = frame_rank(info->has_signal, info->synced);
+        if (rank > best_rank || (rank == best_rank && info->snr_est > best_snr))
+        {
+            best = i;
+            best_rank = rank;
+            best_snr = info->snr_est;
+        }
+    }
+
+    // Stay on the current branch unless the best one is clearly better
+    const frame_info* cur = get_frame(m_selected, slot);
+    if (best != NO_BRANCH && best != m_selected && cur != nullptr)
+    {
+        const int cur_rank = frame_rank(cur->has_signal, cur->synced);
+        if (cur_rank == best_rank &&
+            best_snr < cur->snr_est + DIVERSITY_SNR_HYSTERESIS_DB)
+        {
+            return m_selected;
+        }
+    }
+
+    return best;
+}
+
+size_t crypto_rx_diversity::combine(resampler& speech_out)
+{
+    TRACE_SCOPE("combine");
+
+    // A slot is only played once every branch has decoded past it, so a
+    // branch whose queue is a frame behind holds the slot back until the
+    // next cycle rather than being left out of the choice
+    uint64_t end_slot = m_branches.front()->timeline.next_slot();
+    for (const auto& b : m_branches)
+    {
+        end_slot = std::min(end_slot, b->timeline.next_slot());
+    }
+
+    size_t n_selected = 0;
+    for (; m_next_slot < end_slot; ++m_next_slot)
+    {
+        const size_t sel = select_branch(m_next_slot);
+        if (sel == NO_BRANCH)
+        {
+            continue;
+        }
+
+        branch& b = *m_branches[sel];
+        const frame_info& info = *get_frame(sel, m_next_slot);
+        const short* speech = b.speech.data() + info.offset;
+
+        // When changing branches, fade from the old decoder's output to the
+        // new one over the course of the frame so the switch is not audible
+        const frame_info* prev = get_frame(m_selected, m_next_slot);
+        if (sel != m_selected &&
+            prev != nullptr &&
+            prev->nout == info.nout &&
+            info.nout <= m_crossfade.size())
+        {
+            const short* prev_speech = m_branches[m_selected]->speech.data() + prev->offset;
+            const int32_t n = static_cast<int32_t>(info.nout);
+            for (int32_t i = 0; i < n; ++i)
+            {
+                m_crossfade[i] = static_cast<short>(
+                    ((int32_t)prev_speech[i] * (n - i) + (int32_t)speech[i] * i) / n);
+            }
+            speech = m_crossfade.data();
+        }
+
+        speech_out.enqueue(speech, info.nout);
+
+        m_selected = sel;
+        b.frames_selected.fetch_add(1, memory_order_relaxed);
+        ++n_selected;
+    }
+
+    for (size_t i = 0; i < m_branches.size(); ++i)
+    {
+        branch& b = *m_branches[i];
+        if (b.cycle_frames > 0)
+        {
+            const frame_info& last = b.frames.back();
+            b.frames_decoded.fetch_add(b.cycle_frames, memory_order_relaxed);
+            b.snr_est.store(last.snr_est, memory_order_relaxed);
+            b.synced.store(last.synced, memory_order_relaxed);
+            b.has_signal.store(last.has_signal, memory_order_relaxed);
+        }
+        b.selected.store(i == m_selected, memory_order_relaxed);
+        b.input_queue.store(b.rx->iq_input() ?
+                                b.iq_queue.size() / 2 :
+                                b.input_resampler->available_elems(),
+                            memory_order_relaxed);
+
+        // Drop the frames that have been played or passed over, keeping the
+        // ones still waiting on the other branches
+        size_t n_done = 0;
+        while (n_done < b.frames.size() && b.frames[n_done].slot < m_next_slot)
+        {
+            ++n_done;
+        }
+        if (n_done > 0)
+        {
+            drop_frames(b, n_done);
+        }
+    }
+
+    return n_selected;
+}
+
+size_t crypto_rx_diversity::process(const float* const* inputs,
+                                    const float* const* inputs_q,
+                                    size_t              nframes,
+                                    resampler&          speech_out)
+{
+    for (size_t i = 0; i < m_branches.size(); ++i)
+    {
+        m_branches[i]->input = inputs[i];
+        m_branches[i]->input_q = iq_input() ? inputs_q[i] : nullptr;
+        m_branches[i]->input_len = nframes;
+    }
+
+    for (size_t i = 1; i < m_branches.size(); ++i)
+    {
+        sem_post(&m_branches[i]->start);
+    }
+
+    demodulate(*m_branches.front());
+
+    for (size_t i = 1; i < m_branches.size(); ++i)
+    {
+        wait_sem(&m_done);
+    }
+
+    return combine(speech_out);
+}
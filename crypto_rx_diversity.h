@@ -0,0 +1,119 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CRYPTO_RX_DIVERSITY_H
+#define CRYPTO_RX_DIVERSITY_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <semaphore.h>
+
+#include "crypto_rx_common.h"
+
+class resampler;
+
+// Only switch to a branch with the same sync state if its SNR estimate is
+// at least this much better, so two receivers with nearly identical signals
+// don't cause the output to flip back and forth every frame
+#define DIVERSITY_SNR_HYSTERESIS_DB 1.0f
+
+// Frames a branch holds on top of a cycle's worth while waiting for the
+// other branches to decode the same slots. Past that its oldest frames are
+// dropped
+#define DIVERSITY_MAX_HELD_FRAMES 4
+
+struct rx_branch_stats
+{
+    uint64_t frames_decoded;
+    uint64_t frames_selected;
+    // Input samples waiting for the demodulator at the end of the last
+    // cycle
+    uint64_t input_queue;
+    float    snr_est;
+    bool     synced;
+    bool     has_signal;
+    bool     selected;
+};
+
+// Runs one demodulator per modem input and, for every decoded frame, plays
+// the output of the branch with the best sync state and SNR. Frames are
+// matched across branches by where they end in the input stream (see
+// rx_timeline), not by their order within a cycle. Branch 0 is
+// demodulated on the calling (realtime) thread and every other branch on
+// its own worker thread
+class crypto_rx_diversity
+{
+public:
+    crypto_rx_diversity(const char* name,
+                        const char* config_file_path,
+                        uint        input_sample_rate,
+                        size_t      prime_frames,
+                        int         rt_priority);
+    ~crypto_rx_diversity();
+
+    size_t num_branches() const;
+
+    // The first branch, which is also used to answer questions about
+    // sample rates, frame sizes, configuration and encryption status
+    crypto_rx_common& primary();
+    const crypto_rx_common& primary() const;
+
+    // Demodulates nframes samples from each of the num_branches() buffers
+    // in inputs and enqueues the selected speech onto speech_out. In IQ
+    // mode inputs carries the I samples and inputs_q the Q samples,
+    // otherwise inputs_q is ignored. Returns the number of speech frames
+    // enqueued
+    size_t process(const float* const* inputs,
+                 const float* const* inputs_q,
+                 size_t              nframes,
+                 resampler&          speech_out);
+
+    bool iq_input() const;
+
+    // Applies the squelch settings of cfg to every branch. Call from the
+    // thread that calls process(), between calls
+    void update_squelch(const struct config& cfg);
+
+    rx_branch_stats get_branch_stats(size_t branch) const;
+
+private:
+    struct frame_info;
+    struct branch;
+
+private:
+    void worker_main(branch& b);
+    void demodulate(branch& b);
+    void drop_frames(branch& b, size_t n);
+    size_t begin_frame(branch& b);
+    void add_frame(branch& b, size_t nin, size_t nout);
+    size_t combine(resampler& speech_out);
+
+    const frame_info* get_frame(size_t branch, uint64_t slot) const;
+    size_t select_branch(uint64_t slot) const;
+
+private:
+    std::vector<std::unique_ptr<branch>> m_branches;
+    std::vector<short>                   m_crossfade;
+
+    size_t            m_selected;
+    // The next slot to be played
+    uint64_t          m_next_slot;
+    std::atomic<bool> m_running;
+    sem_t             m_done;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Reads the metrics served by jack_crypto_tx and jack_crypto_rx. With an
+// interval, counters are shown as the rate of change between polls
+
+#define MAX_METRICS 64
+
+struct metric
+{
+    char               type[16];
+    char               name[64];
+    unsigned long long value;
+};
+
+static int read_metrics(const char* socket_path, struct metric metrics[], int max_metrics)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    FILE* f = fdopen(fd, "r");
+    if (f == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    int count = 0;
+    char line[160];
+    while (count < max_metrics && fgets(line, sizeof(line), f) != NULL) {
+        struct metric* m = &metrics[count];
+        if (sscanf(line, "%15s %63s %llu", m->type, m->name, &m->value) == 3) {
+            ++count;
+        }
+    }
+
+    fclose(f);
+    return count;
+}
+
+static double elapsed_seconds(const struct timespec* from, const struct timespec* to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static int ends_with(const char* str, const char* suffix)
+{
+    const size_t len = strlen(str);
+    const size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(str + len - suffix_len, suffix) == 0;
+}
+
+static void print_rates(const struct metric prev[],
+                        const struct metric cur[],
+                        int                 count,
+                        double              seconds)
+{
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(cur[i].type, "counter") != 0) {
+            printf("  %-20s %12llu\n", cur[i].name, cur[i].value);
+            continue;
+        }
+
+        // Counters start over when the program is restarted
+        const double delta = cur[i].value >= prev[i].value ?
+            (double)(cur[i].value - prev[i].value) : (double)cur[i].value;
+        if (ends_with(cur[i].name, "_ns")) {
+            // Time spent in a stage, as a share of wall clock time
+            printf("  %-20s %11.2f%%\n", cur[i].name, 100.0 * delta / (seconds * 1e9));
+        }
+        else if (ends_with(cur[i].name, "_us")) {
+            printf("  %-20s %11.2f%%\n", cur[i].name, 100.0 * delta / (seconds * 1e6));
+        }
+        else {
+            printf("  %-20s %10.1f/s\n", cur[i].name, delta / seconds);
+        }
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-i <seconds>] [-c <count>] [socket]\n"
+            "  With no interval the current values are printed once.\n"
+            "  The default socket is /var/run/crypto_rx.sock\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* socket_path = "/var/run/crypto_rx.sock";
+    double interval = 0.0;
+    long iterations = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:c:h")) != -1) {
+        switch (opt) {
+        case 'i': interval = atof(optarg); break;
+        case 'c': iterations = atol(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        socket_path = argv[optind];
+    }
+
+    struct metric prev[MAX_METRICS];
+    struct metric cur[MAX_METRICS];
+    struct timespec prev_time;
+    struct timespec cur_time;
+
+    int count = read_metrics(socket_path, prev, MAX_METRICS);
+    clock_gettime(CLOCK_MONOTONIC, &prev_time);
+    if (count < 0) {
+        fprintf(stderr, "Could not read metrics from %s\n", socket_path);
+        return 1;
+    }
+
+    if (interval <= 0.0) {
+        for (int i = 0; i < count; ++i) {
+            printf("%s %llu\n", prev[i].name, prev[i].value);
+        }
+        return 0;
+    }
+
+    for (long n = 0; iterations < 0 || n < iterations; ++n) {
+        usleep((useconds_t)(interval * 1e6));
+
+        const int cur_count = read_metrics(socket_path, cur, MAX_METRICS);
+        clock_gettime(CLOCK_MONOTONIC, &cur_time);
+        if (cur_count < 0) {
+            fprintf(stderr, "Could not read metrics from %s\n", socket_path);
+            return 1;
+        }
+
+        // The set of metrics only changes if the program was restarted
+        if (cur_count == count) {
+            printf("%s (%.1f s)\n", socket_path, elapsed_seconds(&prev_time, &cur_time));
+            print_rates(prev, cur, count, elapsed_seconds(&prev_time, &cur_time));
+            fflush(stdout);
+        }
+
+        memcpy(prev, cur, sizeof(cur));
+        prev_time = cur_time;
+        count = cur_count;
+    }
+
+    return 0;
+}
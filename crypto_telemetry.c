@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "crypto_telemetry.h"
+
+_Static_assert(sizeof(crypto_telemetry_record) == 40, "Telemetry record layout changed");
+_Static_assert(sizeof(crypto_telemetry_header) == 64, "Telemetry header layout changed");
+
+struct crypto_telemetry {
+    crypto_telemetry_header* header;
+    crypto_telemetry_record* records;
+    size_t                   map_size;
+};
+
+static size_t map_size_for(uint64_t capacity) {
+    return sizeof(crypto_telemetry_header) + capacity * sizeof(crypto_telemetry_record);
+}
+
+static int header_valid(const crypto_telemetry_header* header) {
+    return memcmp(header->magic, TELEMETRY_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == TELEMETRY_VERSION &&
+           header->record_size == sizeof(crypto_telemetry_record) &&
+           header->capacity > 0;
+}
+
+static crypto_telemetry* map_file(int fd, size_t map_size, int prot) {
+    crypto_telemetry* telem = calloc(1, sizeof(crypto_telemetry));
+    if (telem == NULL) {
+        return NULL;
+    }
+
+    // Writers fault every page in now so the realtime thread never has to
+    int flags = MAP_SHARED | ((prot & PROT_WRITE) ? MAP_POPULATE : 0);
+    void* mem = mmap(NULL, map_size, prot, flags, fd, 0);
+    if (mem == MAP_FAILED) {
+        free(telem);
+        return NULL;
+    }
+
+    telem->header = (crypto_telemetry_header*)mem;
+    telem->records = (crypto_telemetry_record*)((char*)mem + sizeof(crypto_telemetry_header));
+    telem->map_size = map_size;
+
+    return telem;
+}
+
+crypto_telemetry* telemetry_open_writer(const char* path, size_t capacity) {
+    if (path == NULL || path[0] == '\0' || capacity == 0) {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // Serialize with any other process creating the same file
+    flock(fd, LOCK_EX);
+
+    crypto_telemetry_header header;
+    memset(&header, 0, sizeof(header));
+
+    struct stat st;
+    const int valid = fstat(fd, &st) == 0 &&
+                      pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                      header_valid(&header);
+    const int reuse = valid &&
+                      header.capacity == capacity &&
+                      (size_t)st.st_size == map_size_for(capacity);
+
+    // Resizing or clearing a ring another process has mapped would corrupt
+    // its records or fault it with SIGBUS, so only files that don't hold a
+    // ring yet are initialized
+    if (valid && !reuse) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return NULL;
+    }
+
+    if (!reuse && ftruncate(fd, map_size_for(capacity)) != 0) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return NULL;
+    }
+
+    crypto_telemetry* telem = map_file(fd, map_size_for(capacity), PROT_READ | PROT_WRITE);
+    if (telem != NULL && !reuse) {
+        memset(telem->header, 0, telem->map_size);
+        memcpy(telem->header->magic, TELEMETRY_MAGIC, sizeof(telem->header->magic));
+        telem->header->version = TELEMETRY_VERSION;
+        telem->header->record_size = sizeof(crypto_telemetry_record);
+        telem->header->capacity = capacity;
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    return telem;
+}
+
+crypto_telemetry* telemetry_open_reader(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    crypto_telemetry_header header;
+    struct stat st;
+    crypto_telemetry* telem = NULL;
+    if (pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        header_valid(&header) &&
+        fstat(fd, &st) == 0 &&
+        (size_t)st.st_size >= map_size_for(header.capacity)) {
+        telem = map_file(fd, map_size_for(header.capacity), PROT_READ);
+    }
+
+    close(fd);
+
+    return telem;
+}
+
+void telemetry_close(crypto_telemetry* telem) {
+    if (telem != NULL) {
+        munmap(telem->header, telem->map_size);
+        free(telem);
+    }
+}
+
+void telemetry_write(crypto_telemetry* telem, const crypto_telemetry_record* rec) {
+    if (telem == NULL) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    const uint64_t index = __atomic_fetch_add(&telem->header->head, 1, __ATOMIC_RELAXED);
+    crypto_telemetry_record* slot = &telem->records[index % telem->header->capacity];
+
+    // A per-record seqlock. Readers discard the record unless seq holds the
+    // expected value both before and after they copy it
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy((char*)slot + sizeof(slot->seq),
+           (const char*)rec + sizeof(rec->seq),
+           sizeof(*rec) - sizeof(rec->seq));
+    slot->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+
+    __atomic_store_n(&slot->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t telemetry_head(const crypto_telemetry* telem) {
+    return __atomic_load_n(&telem->header->head, __ATOMIC_ACQUIRE);
+}
+
+uint64_t telemetry_capacity(const crypto_telemetry* telem) {
+    return telem->header->capacity;
+}
+
+int telemetry_read(const crypto_telemetry* telem, uint64_t index, crypto_telemetry_record* rec) {
+    const crypto_telemetry_record* slot = &telem->records[index % telem->header->capacity];
+
+    const uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq != index + 1) {
+        return 0;
+    }
+
+    memcpy(rec, slot, sizeof(*rec));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
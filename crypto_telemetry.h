@@ -0,0 +1,90 @@
+#ifndef CRYPTO_TELEMETRY_H
+#define CRYPTO_TELEMETRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per-frame modem telemetry is written as fixed size binary records into a
+// circular, memory-mapped file. Writing a record is a handful of stores into
+// shared memory, so it is safe to do from the realtime thread, and the file
+// can be read by telemetry_dump while the radio is running. Several writers
+// (ie. jack_crypto_tx and jack_crypto_rx) may share one file
+
+#define TELEMETRY_MAGIC   "CTELEM\0\0"
+#define TELEMETRY_VERSION 1
+
+#define TELEMETRY_DIR_RX 0
+#define TELEMETRY_DIR_TX 1
+
+// Values for crypto_telemetry_record.flags
+#define TELEMETRY_FLAG_SYNC   0x01 // Demodulator is in sync
+#define TELEMETRY_FLAG_SIGNAL 0x02 // RMS squelch is open
+#define TELEMETRY_FLAG_DEMOD  0x04 // The demodulator ran for this frame
+#define TELEMETRY_FLAG_REKEY  0x08 // A new initialization vector was used
+
+typedef struct {
+    // Index of the record + 1 once it is completely written. 0 while a
+    // writer is filling it in
+    uint64_t seq;
+    // CLOCK_MONOTONIC
+    uint64_t timestamp_ns;
+    // FreeDV mode, or -1 for analog
+    int32_t  mode;
+    uint32_t nin;
+    uint32_t nout;
+    float    snr_est;
+    int16_t  rms;
+    uint8_t  direction;
+    // Diversity branch for RX records
+    uint8_t  channel;
+    uint8_t  flags;
+    // encryption_status of the frame
+    uint8_t  crypto_status;
+    uint8_t  reserved[2];
+} crypto_telemetry_record;
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;
+    // Total number of records ever claimed by writers. The record for
+    // index i is stored in slot i % capacity
+    uint64_t head;
+    uint8_t  reserved[32];
+} crypto_telemetry_header;
+
+typedef struct crypto_telemetry crypto_telemetry;
+
+// Maps the telemetry file, creating it if it doesn't exist or doesn't hold
+// a telemetry ring. An existing ring with the same capacity is appended to.
+// Returns NULL if path is empty, the file cannot be mapped, or it already
+// holds a ring with a different capacity, which another process may still
+// have mapped
+crypto_telemetry* telemetry_open_writer(const char* path, size_t capacity);
+
+// Maps an existing telemetry file read only
+crypto_telemetry* telemetry_open_reader(const char* path);
+
+void telemetry_close(crypto_telemetry* telem);
+
+// Stamps the record with the time and sequence number and stores it.
+// Never blocks. Does nothing if telem is NULL
+void telemetry_write(crypto_telemetry* telem, const crypto_telemetry_record* rec);
+
+uint64_t telemetry_head(const crypto_telemetry* telem);
+uint64_t telemetry_capacity(const crypto_telemetry* telem);
+
+// Copies the record with the given index. Returns 0 if the record has been
+// overwritten or is still being written
+int telemetry_read(const crypto_telemetry* telem, uint64_t index, crypto_telemetry_record* rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
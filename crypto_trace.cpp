@@ -0,0 +1,254 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "crypto_trace.h"
+
+using namespace std;
+
+#define TRACE_MAX_THREADS       16
+#define TRACE_EVENTS_PER_THREAD 4096 // Must be a power of two
+
+// Marks an event without a duration
+static const uint64_t INSTANT = UINT64_MAX;
+
+struct trace_event
+{
+    const char* name;
+    uint64_t    start_ns;
+    uint64_t    dur_ns;
+};
+
+struct trace_buffer
+{
+    // Total events written by the owning threads, only ever by the current
+    // one
+    atomic<uint64_t>    head{0};
+    // The first event of the current owner
+    atomic<uint64_t>    base{0};
+    // Owned by a running thread
+    atomic<bool>        in_use{false};
+    atomic<bool>        ready{false};
+    atomic<const char*> name{nullptr};
+    atomic<pid_t>       tid{0};
+    trace_event         events[TRACE_EVENTS_PER_THREAD];
+};
+
+// Gives the buffer back when its thread exits. The events stay in the
+// dump until another thread takes the buffer over
+struct trace_owner
+{
+    ~trace_owner()
+    {
+        if (buffer != nullptr)
+        {
+            buffer->in_use.store(false, memory_order_release);
+        }
+    }
+
+    trace_buffer* buffer = nullptr;
+};
+
+atomic<bool> trace_enabled_flag{false};
+
+// Buffers are handed out to threads the first time they record an event,
+// so the realtime thread only claims one once. Threads that find every
+// buffer taken are counted and not traced
+static trace_buffer               buffers[TRACE_MAX_THREADS];
+static atomic<uint64_t>           untraced_threads{0};
+static thread_local trace_owner   thread_owner;
+static thread_local bool          thread_no_buffer = false;
+
+static trace_buffer* get_thread_buffer()
+{
+    if (thread_owner.buffer == nullptr && !thread_no_buffer)
+    {
+        for (trace_buffer& b : buffers)
+        {
+            bool expected = false;
+            if (b.in_use.load(memory_order_relaxed) ||
+                !b.in_use.compare_exchange_strong(expected, true, memory_order_acquire))
+            {
+                continue;
+            }
+
+            // Hide the previous owner's events from trace_dump() while the
+            // buffer changes hands
+            b.ready.store(false, memory_order_relaxed);
+            b.name.store(nullptr, memory_order_relaxed);
+            b.tid.store(static_cast<pid_t>(syscall(SYS_gettid)), memory_order_relaxed);
+            b.base.store(b.head.load(memory_order_relaxed), memory_order_relaxed);
+            b.ready.store(true, memory_order_release);
+            thread_owner.buffer = &b;
+            return &b;
+        }
+
+        untraced_threads.fetch_add(1, memory_order_relaxed);
+        thread_no_buffer = true;
+    }
+
+    return thread_owner.buffer;
+}
+
+static void add_event(const char* name, uint64_t start_ns, uint64_t dur_ns)
+{
+    trace_buffer* b = get_thread_buffer();
+    if (b == nullptr)
+    {
+        return;
+    }
+
+    const uint64_t idx = b->head.load(memory_order_relaxed);
+    trace_event& ev = b->events[idx & (TRACE_EVENTS_PER_THREAD - 1)];
+    ev.name = name;
+    ev.start_ns = start_ns;
+    ev.dur_ns = dur_ns;
+    b->head.store(idx + 1, memory_order_release);
+}
+
+void trace_enable(bool enabled)
+{
+    trace_enabled_flag.store(enabled, memory_order_relaxed);
+}
+
+void trace_thread_name(const char* name)
+{
+    trace_buffer* b = get_thread_buffer();
+    if (b != nullptr && b->name.load(memory_order_relaxed) == nullptr)
+    {
+        b->name.store(name, memory_order_relaxed);
+    }
+}
+
+void trace_complete(const char* name, uint64_t start_ns, uint64_t end_ns)
+{
+    add_event(name, start_ns, end_ns - start_ns);
+}
+
+void trace_instant(const char* name)
+{
+    add_event(name, trace_now_ns(), INSTANT);
+}
+
+// Copies the events of a buffer that are not being overwritten while we
+// copy them
+static void copy_events(const trace_buffer& b, vector<trace_event>& out)
+{
+    const uint64_t head = b.head.load(memory_order_acquire);
+    const uint64_t base = b.base.load(memory_order_relaxed);
+    const uint64_t first = std::max(base,
+                                    head > TRACE_EVENTS_PER_THREAD ?
+                                        head - TRACE_EVENTS_PER_THREAD : 0);
+
+    vector<trace_event> events;
+    events.reserve(head - first);
+    for (uint64_t i = first; i < head; ++i)
+    {
+        events.push_back(b.events[i & (TRACE_EVENTS_PER_THREAD - 1)]);
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    const uint64_t head_after = b.head.load(memory_order_relaxed);
+    const uint64_t valid_from = head_after > TRACE_EVENTS_PER_THREAD ?
+        head_after - TRACE_EVENTS_PER_THREAD : 0;
+
+    for (uint64_t i = std::max(first, valid_from); i < head; ++i)
+    {
+        out.push_back(events[i - first]);
+    }
+}
+
+bool trace_dump(const char* path)
+{
+    const string tmp_path = string(path) + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "w");
+    if (f == nullptr)
+    {
+        return false;
+    }
+
+    const int pid = getpid();
+    bool first = true;
+
+    const uint64_t untraced = untraced_threads.load(memory_order_relaxed);
+    if (untraced > 0)
+    {
+        fprintf(stderr,
+                "%llu threads were not traced, all %d trace buffers were in use\n",
+                (unsigned long long)untraced,
+                TRACE_MAX_THREADS);
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (const trace_buffer& b : buffers)
+    {
+        if (!b.ready.load(memory_order_acquire))
+        {
+            continue;
+        }
+        const int tid = b.tid.load(memory_order_relaxed);
+
+        const char* thread_name = b.name.load(memory_order_relaxed);
+        if (thread_name != nullptr)
+        {
+            fprintf(f,
+                    "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n",
+                    pid,
+                    tid,
+                    thread_name);
+            first = false;
+        }
+
+        vector<trace_event> events;
+        copy_events(b, events);
+        for (const trace_event& ev : events)
+        {
+            if (ev.dur_ns == INSTANT)
+            {
+                fprintf(f,
+                        "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                        first ? "" : ",\n",
+                        ev.name,
+                        ev.start_ns / 1000.0,
+                        pid,
+                        tid);
+            }
+            else
+            {
+                fprintf(f,
+                        "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                        first ? "" : ",\n",
+                        ev.name,
+                        ev.start_ns / 1000.0,
+                        ev.dur_ns / 1000.0,
+                        pid,
+                        tid);
+            }
+            first = false;
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    const bool ok = fclose(f) == 0;
+    return ok && rename(tmp_path.c_str(), path) == 0;
+}
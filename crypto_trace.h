@@ -0,0 +1,140 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CRYPTO_TRACE_H
+#define CRYPTO_TRACE_H
+
+#include <time.h>
+
+#include <atomic>
+#include <cstdint>
+
+// Scoped trace points for finding out which stage of a JACK cycle ran long.
+// Each thread records into its own preallocated ring of events, so tracing
+// never allocates or takes a lock. trace_dump() writes the most recent
+// events of every thread as Chrome trace event JSON, which can be opened in
+// chrome://tracing or https://ui.perfetto.dev
+//
+// Trace points cost one relaxed load while tracing is disabled at runtime,
+// and nothing when CRYPTO_TRACE_ENABLED is 0
+#ifndef CRYPTO_TRACE_ENABLED
+#define CRYPTO_TRACE_ENABLED 1
+#endif
+
+extern std::atomic<bool> trace_enabled_flag;
+
+static inline bool trace_enabled()
+{
+    return trace_enabled_flag.load(std::memory_order_relaxed);
+}
+
+static inline uint64_t trace_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+void trace_enable(bool enabled);
+
+// Names the calling thread in the trace. Only the first call per thread
+// has any effect. name must be a string literal
+void trace_thread_name(const char* name);
+
+// name must be a string literal
+void trace_complete(const char* name, uint64_t start_ns, uint64_t end_ns);
+void trace_instant(const char* name);
+
+// Writes the buffered events to path. Not realtime safe
+bool trace_dump(const char* path);
+
+class trace_scope
+{
+public:
+    explicit trace_scope(const char* name)
+        : m_name(name),
+          m_start(trace_enabled() ? trace_now_ns() : 0)
+    {
+    }
+
+    ~trace_scope()
+    {
+        if (m_start != 0)
+        {
+            trace_complete(m_name, m_start, trace_now_ns());
+        }
+    }
+
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+
+private:
+    const char* m_name;
+    uint64_t    m_start;
+};
+
+// Splits a function into consecutive stages without adding scopes. Each
+// call to next() ends the current stage and starts another
+class trace_stages
+{
+public:
+    trace_stages()
+        : m_name(nullptr),
+          m_start(0)
+    {
+    }
+
+    ~trace_stages()
+    {
+        next(nullptr);
+    }
+
+    void next(const char* name)
+    {
+        const uint64_t now = (m_start != 0 || trace_enabled()) ? trace_now_ns() : 0;
+        if (m_start != 0)
+        {
+            trace_complete(m_name, m_start, now);
+        }
+
+        m_name = name;
+        m_start = (name != nullptr && trace_enabled()) ? now : 0;
+    }
+
+    trace_stages(const trace_stages&) = delete;
+    trace_stages& operator=(const trace_stages&) = delete;
+
+private:
+    const char* m_name;
+    uint64_t    m_start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT_(a, b)
+
+#if CRYPTO_TRACE_ENABLED
+#define TRACE_SCOPE(name)      trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_STAGES(var)      trace_stages var
+#define TRACE_STAGE(var, name) var.next(name)
+#define TRACE_INSTANT(name)    do { if (trace_enabled()) trace_instant(name); } while (0)
+#define TRACE_THREAD(name)     do { if (trace_enabled()) trace_thread_name(name); } while (0)
+#else
+#define TRACE_SCOPE(name)      do { } while (0)
+#define TRACE_STAGES(var)      do { } while (0)
+#define TRACE_STAGE(var, name) do { } while (0)
+#define TRACE_INSTANT(name)    do { } while (0)
+#define TRACE_THREAD(name)     do { } while (0)
+#endif
+
+#endif
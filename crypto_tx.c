@@ -21,7 +21,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <getopt.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -29,6 +31,8 @@
 #include "crypto_common.h"
 #include "crypto_cfg.h"
 #include "crypto_log.h"
+#include "stream_io.h"
+#include "tx_parallel.h"
 
 static volatile sig_atomic_t reload_config = 0;
 
@@ -36,20 +40,68 @@ static void handle_sighup(int sig) {
     reload_config = 1;
 }
 
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-b <block size>] [-F block|frame] [-i <file>] [-o <file>] [-P] [-j <jobs>] ConfigFile\n"
+            "  -b  Size of the blocks read from stdin and written to stdout,\n"
+            "      ie. 64k or 1M. The default is 1M\n"
+            "  -F  Write to stdout when a block is full (the default) or\n"
+            "      after every frame\n"
+            "  -i  Read speech from a file, mapped into memory, instead of stdin\n"
+            "  -o  Write the modem signal to a file, mapped into memory, instead\n"
+            "      of stdout\n"
+            "  -P  Read and write on threads of their own, so I/O overlaps with\n"
+            "      the codec. Mapped files are read ahead by the kernel anyway\n"
+            "  -j, --jobs\n"
+            "      Encode a recording on this many threads. The input is cut\n"
+            "      into segments of one rekey period, each encoded as if the\n"
+            "      transmitter was restarted there: a new IV and a new modem,\n"
+            "      so a receiver may resync at every seam. The output has one\n"
+            "      modem frame per speech frame, in order. Needs encryption\n"
+            "      with a rekey period, and SIGHUP is ignored\n"
+            "  The throughput is printed at the end when -i or -o is given\n",
+            prog);
+}
+
 int main(int argc, char *argv[]) {
-    FILE *fin = stdin;
-    FILE *fout = stdout;
+    size_t block_size = STREAM_DEFAULT_BLOCK_SIZE;
+    int flush = STREAM_FLUSH_BLOCK;
+    const char* input_file = NULL;
+    const char* output_file = NULL;
+    int pipelined = 0;
+    int jobs = 1;
+    int opt;
+
+    static const struct option long_options[] = {
+        {"jobs", required_argument, NULL, 'j'},
+        {NULL,   0,                 NULL, 0}
+    };
 
     HCRYPTO_TX* crypto_tx = NULL;
 
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s ConfigFile\n", argv[0]);
+    while ((opt = getopt_long(argc, argv, "b:F:i:o:Pj:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'b': block_size = parse_stream_size(optarg); break;
+        case 'F': flush = parse_stream_flush(optarg); break;
+        case 'i': input_file = optarg; break;
+        case 'o': output_file = optarg; break;
+        case 'P': pipelined = 1; break;
+        case 'j': jobs = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (optind >= argc || block_size == 0 || flush < 0 || jobs < 1) {
+        usage(argv[0]);
         exit(1);
     }
+    const char* config_file = argv[optind];
 
     signal(SIGHUP, handle_sighup);
 
-    crypto_tx = crypto_tx_create("crypto_tx", argv[1]);
+    crypto_tx = crypto_tx_create("crypto_tx", config_file);
     if (crypto_tx == NULL) {
         fprintf(stderr, "Could not create crypto_tx object");
         exit(1);
@@ -59,19 +111,84 @@ int main(int argc, char *argv[]) {
        returns freedv_get_n_nom_modem_samples() (unlike rx side) */
     int n_speech_samples = crypto_tx_speech_samples_per_frame(crypto_tx);
     int n_nom_modem_samples = crypto_tx_modem_samples_per_frame(crypto_tx);
-    short* speech_in = malloc(sizeof(short) * n_speech_samples);
-    short* mod_out = malloc(sizeof(short) * n_nom_modem_samples);
+
+    if (jobs > 1 && crypto_tx_rekey_frames(crypto_tx) == 0) {
+        fprintf(stderr, "No rekey period to split the input at, encoding on one thread\n");
+        jobs = 1;
+    }
+
+    struct stream_reader* fin;
+    if (input_file != NULL) {
+        fin = stream_reader_open_file(input_file, block_size, pipelined);
+    }
+    else if (pipelined) {
+        fin = stream_reader_open_pipelined(STDIN_FILENO, block_size);
+    }
+    else {
+        fin = stream_reader_open(STDIN_FILENO, block_size);
+    }
+    if (fin == NULL) {
+        fprintf(stderr, "Could not open %s\n", input_file != NULL ? input_file : "stdin");
+        exit(1);
+    }
+
+    /* Every speech frame becomes one modem frame */
+    const size_t output_size_hint =
+        stream_reader_size(fin) / (sizeof(short) * n_speech_samples) *
+        sizeof(short) * n_nom_modem_samples;
+    struct stream_writer* fout;
+    if (output_file != NULL) {
+        fout = stream_writer_open_file(output_file, output_size_hint, block_size, flush, pipelined);
+    }
+    else if (pipelined) {
+        fout = stream_writer_open_pipelined(STDOUT_FILENO, block_size, flush);
+    }
+    else {
+        fout = stream_writer_open(STDOUT_FILENO, block_size, flush);
+    }
+    if (fout == NULL) {
+        fprintf(stderr, "Could not open %s\n", output_file != NULL ? output_file : "stdout");
+        exit(1);
+    }
+
+    unsigned long long frames = 0;
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    if (jobs > 1) {
+        crypto_tx_destroy(crypto_tx);
+
+        const long long encoded = tx_parallel_encode(config_file, jobs, fin, fout);
+        stream_reader_close(fin);
+        const int ok = stream_writer_close(fout) && encoded >= 0;
+
+        if (encoded >= 0 && (input_file != NULL || output_file != NULL)) {
+            print_stream_throughput(encoded, &start_time);
+        }
+
+        return ok ? 0 : 1;
+    }
 
     /* OK main loop  --------------------------------------- */
-    while(read_input_file(speech_in, n_speech_samples, fin) == n_speech_samples) {
+    /* Frames are encoded straight from the input block into the output
+       block */
+    const short* speech_in;
+    while((speech_in = stream_reader_next(fin, sizeof(short) * n_speech_samples)) != NULL) {
+        short* mod_out = stream_writer_reserve(fout, sizeof(short) * n_nom_modem_samples);
+        if (mod_out == NULL) {
+            break;
+        }
         crypto_tx_transmit(crypto_tx, mod_out, speech_in);
-        fwrite(mod_out, sizeof(short), n_nom_modem_samples, fout);
+        if (!stream_writer_commit(fout, sizeof(short) * n_nom_modem_samples)) {
+            break;
+        }
+        ++frames;
 
         if (reload_config != 0) {
             reload_config = 0;
 
             crypto_tx_destroy(crypto_tx);
-            crypto_tx = crypto_tx_create("crypto_tx", argv[1]);
+            crypto_tx = crypto_tx_create("crypto_tx", config_file);
             if (crypto_tx == NULL) {
                 fprintf(stderr, "Could not create crypto_tx object");
                 exit(1);
@@ -79,16 +196,16 @@ int main(int argc, char *argv[]) {
 
             n_speech_samples = crypto_tx_speech_samples_per_frame(crypto_tx);
             n_nom_modem_samples = crypto_tx_modem_samples_per_frame(crypto_tx);
-
-            speech_in = realloc(speech_in, sizeof(short) * n_speech_samples);
-            mod_out = realloc(mod_out, sizeof(short) * n_nom_modem_samples);
         }
     }
     
-    free(speech_in);
-    free(mod_out);
+    stream_reader_close(fin);
+    const int ok = stream_writer_close(fout);
+
+    if (input_file != NULL || output_file != NULL) {
+        print_stream_throughput(frames, &start_time);
+    }
     crypto_tx_destroy(crypto_tx);
     
-    return 0;
+    return ok ? 0 : 1;
 }
-
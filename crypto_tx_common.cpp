@@ -29,8 +29,11 @@
 #include "freedv_api.h"
 #include "crypto_cfg.h"
 #include "crypto_log.h"
+#include "crypto_telemetry.h"
+#include "crypto_trace.h"
 
 #include "crypto_tx_common.h"
+#include "crypto_rx_common.h"
 #include "crypto_common.h"
 
 using namespace std;
@@ -45,13 +48,17 @@ struct crypto_tx_common::tx_parms
     {
         if (cur != nullptr) free(cur);
         if (freedv != nullptr) freedv_close(freedv);
+        telemetry_close(telemetry);
         destroy_logger(logger);
     }
 
-    struct config* cur = nullptr;
-    struct freedv* freedv = nullptr;
-    crypto_log     logger;
+    struct config*    cur = nullptr;
+    struct freedv*    freedv = nullptr;
+    crypto_log        logger;
+    crypto_telemetry* telemetry = nullptr;
+    encryption_status crypto_status = CRYPTO_STATUS_PLAIN;
     unsigned short frames_since_rekey = 0;
+    uint64_t       rekeys = 0;
     bool           force_rekey = false;
 };
 
@@ -76,11 +83,22 @@ crypto_tx_common::crypto_tx_common(const char* name, const char* config_file)
     m_parms->logger = create_logger(config_file_name.c_str(),
                                     m_parms->cur->log_level);
 
+    m_parms->telemetry = telemetry_open_writer(m_parms->cur->telemetry_file,
+                                               m_parms->cur->telemetry_records);
+    if (str_has_value(m_parms->cur->telemetry_file) && m_parms->telemetry == nullptr)
+    {
+        LOG_MESSAGE(m_parms->logger,
+                    LOG_WARN,
+                    "Could not open telemetry file %s. If it already holds a "
+                    "ring with a different TelemetryRecords, remove it first",
+                    m_parms->cur->telemetry_file);
+    }
+
     if (m_parms->cur->freedv_enabled)
     {
         m_parms->freedv = freedv_open(m_parms->cur->freedv_mode);
         if (m_parms->freedv == NULL) {
-            log_message(m_parms->logger, LOG_ERROR, "Could not initialize voice modulator");
+            LOG_MESSAGE(m_parms->logger, LOG_ERROR, "Could not initialize voice modulator");
         }
     }
 
@@ -89,17 +107,17 @@ crypto_tx_common::crypto_tx_common(const char* name, const char* config_file)
         // Use getrandom with the urandom device because it will block until the
         // entropy pool is initialized
         if (getrandom(iv, sizeof(iv), 0) != sizeof(iv)) {
-            log_message(m_parms->logger, LOG_WARN, "Did not fully read initialization vector");
+            LOG_MESSAGE(m_parms->logger, LOG_WARN, "Did not fully read initialization vector");
         }
         else {
-            log_message(m_parms->logger, LOG_INFO, "Read initialization vector");
+            LOG_MESSAGE(m_parms->logger, LOG_INFO, "Read initialization vector");
         }
 
         const size_t key_bytes_read = read_key_file(m_parms->cur->key_file, key);
         if (str_has_value(m_parms->cur->key_file) &&
             key_bytes_read != FREEDV_MASTER_KEY_LENGTH)
         {
-            log_message(m_parms->logger,
+            LOG_MESSAGE(m_parms->logger,
                         LOG_WARN,
                         "Truncated encryption key: Only %d bytes of a possible %d",
                         (int)key_bytes_read,
@@ -108,9 +126,11 @@ crypto_tx_common::crypto_tx_common(const char* name, const char* config_file)
 
         if (str_has_value(m_parms->cur->key_file) && m_parms->cur->crypto_enabled) {
             freedv_set_crypto(m_parms->freedv, key, iv);
+            m_parms->crypto_status = key_bytes_read == FREEDV_MASTER_KEY_LENGTH ?
+                CRYPTO_STATUS_ENCRYPTED : CRYPTO_STATUS_WEAK_KEY;
         }
         else {
-            log_message(m_parms->logger, LOG_WARN, "Encryption disabled");
+            LOG_MESSAGE(m_parms->logger, LOG_WARN, "Encryption disabled");
         }
 
         configure_freedv(m_parms->freedv, m_parms->cur);
@@ -177,7 +197,22 @@ const struct config* crypto_tx_common::get_config() const
 
 void crypto_tx_common::log_to_logger(int level, const char* msg)
 {
-    log_message(m_parms->logger, level, "%s", msg);
+    LOG_MESSAGE(m_parms->logger, level, "%s", msg);
+}
+
+void crypto_tx_common::write_telemetry(size_t nout, short speech_rms, bool rekeyed)
+{
+    crypto_telemetry_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.mode = using_freedv() ? m_parms->cur->freedv_mode : -1;
+    rec.nin = static_cast<uint32_t>(speech_samples_per_frame());
+    rec.nout = static_cast<uint32_t>(nout);
+    rec.rms = speech_rms;
+    rec.direction = TELEMETRY_DIR_TX;
+    rec.crypto_status = static_cast<uint8_t>(m_parms->crypto_status);
+    rec.flags = rekeyed ? TELEMETRY_FLAG_REKEY : 0;
+
+    telemetry_write(m_parms->telemetry, &rec);
 }
 
 void crypto_tx_common::force_rekey_next_frame()
@@ -185,12 +220,36 @@ void crypto_tx_common::force_rekey_next_frame()
     m_parms->force_rekey = true;
 }
 
+uint64_t crypto_tx_common::num_rekeys() const
+{
+    return m_parms->rekeys;
+}
+
+int crypto_tx_common::rekey_frames() const
+{
+    if (!using_freedv() ||
+        !str_has_value(m_parms->cur->key_file) ||
+        !m_parms->cur->crypto_enabled)
+    {
+        return 0;
+    }
+
+    const int speech_frames_per_second = speech_sample_rate() / speech_samples_per_frame();
+    return speech_frames_per_second * m_parms->cur->rekey_period;
+}
+
+void crypto_tx_common::set_rekey_period(int seconds)
+{
+    m_parms->cur->rekey_period = seconds;
+}
+
 size_t crypto_tx_common::transmit(short* mod_out, const short* speech_in)
 {
+    TRACE_SCOPE("transmit");
+
     const int n_speech_samples = speech_samples_per_frame();
     const int n_nom_modem_samples = modem_samples_per_frame();
-    const int speech_samples_per_second = speech_sample_rate();
-    const int speech_frames_per_second = speech_samples_per_second / n_speech_samples;
+    bool rekeyed = false;
 
     if (using_freedv() &&
         str_has_value(m_parms->cur->key_file) &&
@@ -200,11 +259,10 @@ size_t crypto_tx_common::transmit(short* mod_out, const short* speech_in)
 
         bool reset_iv = m_parms->force_rekey;
         // Reset IV at regular intervals (if configured)
-        const int rekey_frames = speech_frames_per_second *
-                                 m_parms->cur->rekey_period;
-        if (rekey_frames > 0 && (m_parms->frames_since_rekey % rekey_frames) == 0)
+        const int rekey_interval = rekey_frames();
+        if (rekey_interval > 0 && (m_parms->frames_since_rekey % rekey_interval) == 0)
         {
-            log_message(m_parms->logger,
+            LOG_MESSAGE(m_parms->logger,
                         LOG_INFO,
                         "New initialization vector due to auto rekey");
             reset_iv = true;
@@ -219,17 +277,19 @@ size_t crypto_tx_common::transmit(short* mod_out, const short* speech_in)
             // Use getrandom with the urandom device because it will block
             // until the entropy pool is initialized
             if (getrandom(iv, sizeof(iv), 0) != sizeof(iv)) {
-                log_message(m_parms->logger,
+                LOG_MESSAGE(m_parms->logger,
                             LOG_WARN,
                             "Did not fully read initialization vector");
             }
             else {
-                log_message(m_parms->logger,
+                LOG_MESSAGE(m_parms->logger,
                             LOG_INFO,
                             "Read initialization vector");
             }
 
             freedv_set_crypto(m_parms->freedv, NULL, iv);
+            rekeyed = true;
+            ++m_parms->rekeys;
         }
     }
 
@@ -242,6 +302,11 @@ size_t crypto_tx_common::transmit(short* mod_out, const short* speech_in)
         memcpy(mod_out, speech_in, n_speech_samples * sizeof(short));
     }
 
+    if (m_parms->telemetry != nullptr)
+    {
+        write_telemetry(n_nom_modem_samples, rms(speech_in, n_speech_samples), rekeyed);
+    }
+
     return n_nom_modem_samples;
 }
 
@@ -282,6 +347,16 @@ void crypto_tx_log_to_logger(HCRYPTO_TX* hnd, int level, const char* msg)
     return reinterpret_cast<crypto_tx_common*>(hnd)->log_to_logger(level, msg);
 }
 
+int crypto_tx_rekey_frames(HCRYPTO_TX* hnd)
+{
+    return reinterpret_cast<crypto_tx_common*>(hnd)->rekey_frames();
+}
+
+void crypto_tx_set_rekey_period(HCRYPTO_TX* hnd, int seconds)
+{
+    reinterpret_cast<crypto_tx_common*>(hnd)->set_rekey_period(seconds);
+}
+
 int crypto_tx_transmit(HCRYPTO_TX* hnd, short* mod_out, const short* speech_in)
 {
     try
@@ -6,6 +6,7 @@ struct config;
 #ifdef __cplusplus
 
 #include <memory>
+#include <cstdint>
 
 class crypto_tx_common
 {
@@ -25,6 +26,16 @@ public:
 
     void force_rekey_next_frame();
 
+    // Number of times a new initialization vector has been used
+    uint64_t num_rekeys() const;
+
+    // Speech frames between automatic rekeys, or 0 if the IV is never
+    // changed on its own, ie. because encryption is off
+    int rekey_frames() const;
+    // Overrides the rekey period from the config file. 0 disables
+    // automatic rekeying
+    void set_rekey_period(int seconds);
+
     size_t transmit(short* mod_out, const short* speech_in);
 
 private:
@@ -32,6 +43,7 @@ private:
 
 private:
     bool using_freedv() const;
+    void write_telemetry(size_t nout, short speech_rms, bool rekeyed);
 
 private:
     const std::unique_ptr<tx_parms> m_parms;
@@ -54,6 +66,9 @@ const struct config* crypto_tx_get_config(HCRYPTO_TX* hnd);
 
 void crypto_tx_log_to_logger(HCRYPTO_TX* hnd, int level, const char* msg);
 
+int crypto_tx_rekey_frames(HCRYPTO_TX* hnd);
+void crypto_tx_set_rekey_period(HCRYPTO_TX* hnd, int seconds);
+
 int crypto_tx_transmit(HCRYPTO_TX* hnd, short* mod_out, const short* speech_in);
 
 #ifdef __cplusplus
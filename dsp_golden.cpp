@@ -0,0 +1,929 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <getopt.h>
+
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "freedv_api.h"
+#include "crypto_common.h"
+#include "iq_downconverter.h"
+#include "resampler.h"
+
+// Runs the DSP kernels of the audio paths on canned input: the resampler
+// as tx_engine, rx_engine and crypto_rx_diversity drive it for every mode
+// and port sample rate, the sample conversions, rms(), rms_float(),
+// rms_complex() and iq_downconverter. The outputs are either written out
+// as golden vectors, or compared with golden vectors written earlier, so an
+// optimized kernel can be checked against the scalar code it replaces.
+// Needs no JACK or GPIO
+
+#define GOLDEN_MAGIC   "JCGOLDN"
+#define GOLDEN_VERSION 2
+
+// How a golden vector is stored and compared
+enum golden_kind
+{
+    // float32, compared within the sample tolerance
+    GOLDEN_FLOAT = 0,
+    // int32, compared within the integer tolerance
+    GOLDEN_INT   = 1,
+};
+
+struct golden_vector
+{
+    golden_kind         kind;
+    std::vector<double> values;
+};
+
+typedef std::map<std::string, golden_vector> golden_set;
+
+struct golden_mode
+{
+    const char* name;
+    int         mode;
+};
+
+static const golden_mode GOLDEN_MODES[] =
+{
+    { "700C",  FREEDV_MODE_700C },
+    { "700D",  FREEDV_MODE_700D },
+    { "700E",  FREEDV_MODE_700E },
+    { "800XA", FREEDV_MODE_800XA },
+    { "1600",  FREEDV_MODE_1600 },
+    { "2400B", FREEDV_MODE_2400B },
+};
+
+// The vectors whose values come from libsamplerate. They are only
+// compared when the golden file was written with the libsamplerate version
+// in use, as its filters change between releases
+static const char* const LIBSAMPLERATE_PREFIXES[] =
+{
+    "tx_input/", "tx_output/", "rx_input/", "rx_output/", "complete/", "convert/",
+};
+
+// Port sample rates the modes are resampled to and from
+static const uint PORT_RATES[] = { 8000, 16000, 22050, 44100, 48000, 96000 };
+
+// Cycle size the resampler paths are driven with
+static const uint CYCLE_FRAMES = 256;
+
+// Audio run through every resampler path
+static const double PATH_SECONDS = 0.2;
+
+// Modem signal decoded by both receive paths, long enough for the OFDM
+// modes to sync
+static const double FLOAT_RX_SECONDS = 3.0;
+
+// A triangle wave with noise and a full scale burst every so often. Made
+// with integer arithmetic only, so it is the same on every platform
+static std::vector<short> canned_shorts(size_t count, uint32_t seed)
+{
+    std::vector<short> out(count);
+    uint32_t rng = seed != 0 ? seed : 1;
+    for (size_t i = 0; i < count; ++i)
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+
+        const int phase = static_cast<int>(i % 97);
+        const int triangle = (phase < 49 ? phase : 97 - phase) * 500 - 12000;
+        const int noise = static_cast<int>(rng >> 21) - 1024;
+        int val = triangle + noise;
+        if (i % 1000 < 16)
+        {
+            val = (i & 1) ? SHRT_MIN : SHRT_MAX;
+        }
+        out[i] = static_cast<short>(val);
+    }
+    return out;
+}
+
+// The same signal as JACK samples. The scaling is exact
+static std::vector<float> canned_floats(size_t count, uint32_t seed)
+{
+    const std::vector<short> shorts = canned_shorts(count, seed);
+    std::vector<float> out(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = shorts[i] / 32768.0f;
+    }
+    return out;
+}
+
+static void add_float(golden_set& set, const std::string& name, const float* vals, size_t count)
+{
+    golden_vector& vec = set[name];
+    vec.kind = GOLDEN_FLOAT;
+    vec.values.assign(vals, vals + count);
+}
+
+static void add_int(golden_set& set, const std::string& name, const std::vector<double>& vals)
+{
+    golden_vector& vec = set[name];
+    vec.kind = GOLDEN_INT;
+    vec.values = vals;
+}
+
+// tx_engine: port rate voice in, speech rate shorts out to the encoder,
+// then flushed as on the falling edge of a transmission
+static void run_tx_input(golden_set& set,
+                         const std::string& name,
+                         uint port_rate,
+                         uint speech_rate,
+                         size_t n_speech)
+{
+    const size_t count = static_cast<size_t>(port_rate * PATH_SECONDS);
+    const std::vector<float> input = canned_floats(count, port_rate);
+
+    resampler r(SRC_SINC_FASTEST, 1, get_nom_resampled_frames(n_speech, speech_rate, port_rate) * 2);
+    r.set_sample_rates(port_rate, speech_rate);
+    r.enqueue_zeroes(CYCLE_FRAMES);
+    r.clear();
+
+    std::vector<double> out;
+    std::vector<short> speech(n_speech);
+    for (size_t pos = 0; pos < count; pos += CYCLE_FRAMES)
+    {
+        r.enqueue(input.data() + pos, std::min((size_t)CYCLE_FRAMES, count - pos));
+        while (r.available_elems() >= n_speech)
+        {
+            r.dequeue(speech.data(), n_speech);
+            out.insert(out.end(), speech.begin(), speech.end());
+        }
+    }
+
+    r.flush(n_speech * 2);
+    while (r.available_elems() != 0)
+    {
+        std::fill(speech.begin(), speech.end(), 0);
+        r.dequeue(speech.data(), std::min(n_speech, r.available_elems()));
+        out.insert(out.end(), speech.begin(), speech.end());
+    }
+
+    add_int(set, name, out);
+}
+
+// tx_engine: modem rate shorts from the encoder, port rate modem out
+static void run_tx_output(golden_set& set,
+                          const std::string& name,
+                          uint modem_rate,
+                          uint port_rate,
+                          size_t n_modem)
+{
+    const size_t frames = static_cast<size_t>(modem_rate * PATH_SECONDS) / n_modem + 1;
+    const std::vector<short> input = canned_shorts(frames * n_modem, modem_rate + 1);
+
+    resampler r(SRC_SINC_FASTEST, 1, get_nom_resampled_frames(n_modem, modem_rate, port_rate) * 2);
+    r.set_sample_rates(modem_rate, port_rate);
+    r.enqueue_zeroes(n_modem);
+    r.clear();
+
+    std::vector<float> out;
+    float cycle[CYCLE_FRAMES];
+    for (size_t i = 0; i < frames; ++i)
+    {
+        r.enqueue(input.data() + i * n_modem, n_modem);
+        while (r.available_elems() >= CYCLE_FRAMES)
+        {
+            r.dequeue(cycle, CYCLE_FRAMES);
+            out.insert(out.end(), cycle, cycle + CYCLE_FRAMES);
+        }
+    }
+
+    r.flush(CYCLE_FRAMES * 2);
+    const size_t left = r.available_elems();
+    out.resize(out.size() + left);
+    r.dequeue(out.data() + out.size() - left, left);
+
+    add_float(set, name, out.data(), out.size());
+}
+
+// crypto_rx_diversity: port rate modem in, scaled modem rate samples out to
+// the demodulator, with the level of each block
+static void run_rx_input(golden_set& set,
+                         const std::string& name,
+                         uint port_rate,
+                         uint modem_rate,
+                         size_t n_modem)
+{
+    const size_t count = static_cast<size_t>(port_rate * PATH_SECONDS);
+    const std::vector<float> input = canned_floats(count, port_rate + 2);
+
+    resampler r(SRC_SINC_FASTEST, 1, get_max_resampled_frames(CYCLE_FRAMES, port_rate, modem_rate) * 2);
+    r.set_sample_rates(port_rate, modem_rate);
+    r.enqueue_zeroes(CYCLE_FRAMES);
+    r.clear();
+
+    std::vector<float> out;
+    std::vector<double> levels;
+    std::vector<float> demod_in(n_modem);
+    for (size_t pos = 0; pos < count; pos += CYCLE_FRAMES)
+    {
+        r.enqueue(input.data() + pos, std::min((size_t)CYCLE_FRAMES, count - pos));
+        while (r.available_elems() >= n_modem)
+        {
+            r.dequeue(demod_in.data(), n_modem, MODEM_SAMPLE_SCALE);
+            out.insert(out.end(), demod_in.begin(), demod_in.end());
+            levels.push_back(rms_float(demod_in.data(), n_modem));
+        }
+    }
+
+    add_float(set, name, out.data(), out.size());
+    add_int(set, name + "/rms", levels);
+}
+
+// rx_engine: speech rate shorts from the decoder, port rate voice out
+static void run_rx_output(golden_set& set,
+                          const std::string& name,
+                          uint speech_rate,
+                          uint port_rate,
+                          size_t n_speech)
+{
+    const size_t frames = static_cast<size_t>(speech_rate * PATH_SECONDS) / n_speech + 1;
+    const std::vector<short> input = canned_shorts(frames * n_speech, speech_rate + 3);
+
+    resampler r(SRC_SINC_FASTEST, 1, get_max_resampled_frames(n_speech, speech_rate, port_rate) * 2);
+    r.set_sample_rates(speech_rate, port_rate);
+    r.enqueue_zeroes(n_speech);
+    r.clear();
+
+    std::vector<float> out;
+    float cycle[CYCLE_FRAMES];
+    for (size_t i = 0; i < frames; ++i)
+    {
+        r.enqueue(input.data() + i * n_speech, n_speech);
+        while (r.available_elems() >= CYCLE_FRAMES)
+        {
+            r.dequeue(cycle, CYCLE_FRAMES);
+            out.insert(out.end(), cycle, cycle + CYCLE_FRAMES);
+        }
+    }
+
+    add_float(set, name, out.data(), out.size());
+}
+
+// Returns false if the mode isn't available in this build of codec2
+static bool run_mode(golden_set& set, const golden_mode& mode)
+{
+    struct freedv* freedv = freedv_open(mode.mode);
+    if (freedv == nullptr)
+    {
+        return false;
+    }
+    const uint speech_rate = freedv_get_speech_sample_rate(freedv);
+    const uint modem_rate = freedv_get_modem_sample_rate(freedv);
+    const size_t n_speech = freedv_get_n_speech_samples(freedv);
+    const size_t n_modem = freedv_get_n_nom_modem_samples(freedv);
+    freedv_close(freedv);
+
+    for (uint port_rate : PORT_RATES)
+    {
+        const std::string suffix = std::string("/") + mode.name + "/" + std::to_string(port_rate);
+        run_tx_input(set, "tx_input" + suffix, port_rate, speech_rate, n_speech);
+        run_tx_output(set, "tx_output" + suffix, modem_rate, port_rate, n_modem);
+        run_rx_input(set, "rx_input" + suffix, port_rate, modem_rate, n_modem);
+        run_rx_output(set, "rx_output" + suffix, speech_rate, port_rate, n_speech);
+    }
+    return true;
+}
+
+// jack_common: whole notification sounds resampled in one go
+static void run_complete_buffers(golden_set& set)
+{
+    static const uint FILE_RATES[] = { 8000, 16000, 22050, 44100, 48000 };
+
+    for (uint file_rate : FILE_RATES)
+    {
+        const std::vector<float> input = canned_floats(file_rate / 4, file_rate + 4);
+        for (uint port_rate : PORT_RATES)
+        {
+            std::vector<float> out(get_max_resampled_frames(input.size(), file_rate, port_rate));
+            const size_t n = resample_complete_buffer(SRC_SINC_FASTEST, 1,
+                                                      input.data(), input.size(), file_rate,
+                                                      out.data(), out.size(), port_rate);
+            add_float(set,
+                      "complete/" + std::to_string(file_rate) + "/" + std::to_string(port_rate),
+                      out.data(),
+                      n);
+        }
+    }
+}
+
+// The frame count arithmetic the buffers are sized with
+static void run_frame_counts(golden_set& set)
+{
+    static const size_t FRAMES[] = { 0, 1, 160, 320, 640, 1280, 1920, 4096 };
+    static const uint RATES[] = { 8000, 16000, 22050, 44100, 48000, 96000 };
+
+    std::vector<double> nom;
+    std::vector<double> max;
+    for (size_t frames : FRAMES)
+    {
+        for (uint src_rate : RATES)
+        {
+            for (uint dst_rate : RATES)
+            {
+                nom.push_back(get_nom_resampled_frames(frames, src_rate, dst_rate));
+                max.push_back(get_max_resampled_frames(frames, src_rate, dst_rate));
+            }
+        }
+    }
+    add_int(set, "frames/nom", nom);
+    add_int(set, "frames/max", max);
+}
+
+// The libsamplerate conversions between JACK floats and codec2 shorts,
+// including out of range floats that have to clip
+static void run_conversions(golden_set& set)
+{
+    const std::vector<short> shorts = canned_shorts(4096, 5);
+    std::vector<float> floats(shorts.size());
+    src_short_to_float_array(shorts.data(), floats.data(), shorts.size());
+    add_float(set, "convert/short_to_float", floats.data(), floats.size());
+
+    std::vector<float> input = canned_floats(4096, 6);
+    for (size_t i = 0; i < input.size(); ++i)
+    {
+        // Between -1.5 and 1.5 every few samples
+        if (i % 7 == 0)
+        {
+            input[i] *= 1.5f;
+        }
+    }
+    static const float EDGES[] = { 1.0f, -1.0f, 1.0f - 1.0f / 65536.0f, -1.0f - 1.0f / 65536.0f,
+                                   0.5f / 32768.0f, -0.5f / 32768.0f, 1.5f / 32768.0f, 1e-9f };
+    input.insert(input.end(), EDGES, EDGES + sizeof(EDGES) / sizeof(EDGES[0]));
+
+    std::vector<short> out(input.size());
+    src_float_to_short_array(input.data(), out.data(), input.size());
+    add_int(set, "convert/float_to_short", std::vector<double>(out.begin(), out.end()));
+}
+
+// The signal levels, over the frame sizes used by the modes
+static void run_levels(golden_set& set)
+{
+    static const size_t LENGTHS[] = { 0, 1, 2, 3, 7, 160, 320, 640, 1280, 1920 };
+
+    const std::vector<short> shorts = canned_shorts(2 * 1920, 7);
+    const std::vector<float> floats = canned_floats(2 * 1920, 8);
+    std::vector<float> scaled(floats.size());
+    std::vector<float> over(floats.size());
+    for (size_t i = 0; i < floats.size(); ++i)
+    {
+        scaled[i] = floats[i] * MODEM_SAMPLE_SCALE;
+        // Loud enough that the level clamps
+        over[i] = scaled[i] * 4.0f;
+    }
+    const std::vector<short> full_scale(1920, SHRT_MIN);
+
+    std::vector<double> levels;
+    std::vector<double> levels_float;
+    std::vector<double> levels_complex;
+    for (size_t len : LENGTHS)
+    {
+        levels.push_back(rms(shorts.data(), len));
+        levels.push_back(rms(full_scale.data(), len));
+        levels_float.push_back(rms_float(scaled.data(), len));
+        levels_float.push_back(rms_float(over.data(), len));
+        levels_complex.push_back(rms_complex(scaled.data(), len));
+        levels_complex.push_back(rms_complex(over.data(), len));
+    }
+    add_int(set, "rms/short", levels);
+    add_int(set, "rms/float", levels_float);
+    add_int(set, "rms/complex", levels_complex);
+}
+
+// IQ input decimated to the modem rate, in blocks of changing size so the
+// history carried between blocks is covered
+static void run_downconverter(golden_set& set)
+{
+    static const uint DECIMATIONS[] = { 1, 2, 4, 6, 12 };
+    static const float OFFSETS[] = { 0.0f, 1500.0f, -2750.0f };
+    static const uint MODEM_RATE = 8000;
+
+    for (uint decimation : DECIMATIONS)
+    {
+        for (float offset : OFFSETS)
+        {
+            iq_downconverter dc(MODEM_RATE * decimation, MODEM_RATE, offset, MODEM_SAMPLE_SCALE);
+
+            const size_t count = static_cast<size_t>(MODEM_RATE * PATH_SECONDS);
+            const std::vector<float> iq = canned_floats(count * decimation * 2, decimation + 9);
+            std::vector<float> out(count * 2);
+            size_t pos = 0;
+            for (size_t block = 1; pos < count; ++block)
+            {
+                const size_t n = std::min(count - pos, block * 37 % 500 + 1);
+                dc.process(iq.data() + pos * decimation * 2, out.data() + pos * 2, n);
+                pos += n;
+            }
+
+            char name[64];
+            snprintf(name, sizeof(name), "iq/%u/%g", decimation, offset);
+            add_float(set, name, out.data(), out.size());
+        }
+    }
+}
+
+// freedv_rx, as crypto_rx and crypto_rx_batch use it, against
+// freedv_floatrx fed the same samples multiplied by freedv_rx_gain(), as
+// crypto_rx_diversity scales them. Both have to decode to the same speech
+// with the same sync state and SNR estimate every frame. Returns false if
+// they don't
+static bool check_float_rx(const golden_mode& mode, bool verbose)
+{
+    struct freedv* tx = freedv_open(mode.mode);
+    struct freedv* rx_short = freedv_open(mode.mode);
+    struct freedv* rx_float = freedv_open(mode.mode);
+    if (tx == nullptr || rx_short == nullptr || rx_float == nullptr)
+    {
+        for (struct freedv* freedv : { tx, rx_short, rx_float })
+        {
+            if (freedv != nullptr)
+            {
+                freedv_close(freedv);
+            }
+        }
+        fprintf(stderr, "Mode %s is not available, skipping it\n", mode.name);
+        return true;
+    }
+
+    const size_t n_speech = freedv_get_n_speech_samples(tx);
+    const size_t n_modem = freedv_get_n_nom_modem_samples(tx);
+    const size_t frames = static_cast<size_t>(freedv_get_modem_sample_rate(tx) * FLOAT_RX_SECONDS) / n_modem;
+    std::vector<short> speech = canned_shorts(frames * n_speech, mode.mode + 11);
+    std::vector<short> modem(frames * n_modem);
+    for (size_t i = 0; i < frames; ++i)
+    {
+        freedv_tx(tx, &modem[i * n_modem], &speech[i * n_speech]);
+    }
+
+    const float gain = freedv_rx_gain(rx_float);
+    std::vector<short> out_short(freedv_get_n_max_speech_samples(rx_short));
+    std::vector<short> out_float(out_short.size());
+    std::vector<float> demod_in(freedv_get_n_max_modem_samples(rx_float));
+
+    size_t n_frames = 0;
+    size_t n_synced = 0;
+    size_t n_diff = 0;
+    size_t first_diff = 0;
+    size_t pos = 0;
+    size_t nin;
+    while ((nin = freedv_nin(rx_short)) <= modem.size() - pos)
+    {
+        if (static_cast<size_t>(freedv_nin(rx_float)) != nin)
+        {
+            if (n_diff++ == 0)
+            {
+                first_diff = n_frames;
+            }
+            break;
+        }
+
+        for (size_t i = 0; i < nin; ++i)
+        {
+            demod_in[i] = modem[pos + i] * gain;
+        }
+        const int nout_short = freedv_rx(rx_short, out_short.data(), &modem[pos]);
+        const int nout_float = freedv_floatrx(rx_float, out_float.data(), demod_in.data());
+        pos += nin;
+
+        int sync_short = 0;
+        int sync_float = 0;
+        float snr_short = 0.0f;
+        float snr_float = 0.0f;
+        freedv_get_modem_stats(rx_short, &sync_short, &snr_short);
+        freedv_get_modem_stats(rx_float, &sync_float, &snr_float);
+
+        if (nout_short != nout_float ||
+            memcmp(out_short.data(), out_float.data(), nout_short * sizeof(short)) != 0 ||
+            sync_short != sync_float ||
+            snr_short != snr_float)
+        {
+            if (n_diff++ == 0)
+            {
+                first_diff = n_frames;
+            }
+        }
+        n_synced += sync_short != 0 ? 1 : 0;
+        ++n_frames;
+    }
+
+    freedv_close(tx);
+    freedv_close(rx_short);
+    freedv_close(rx_float);
+
+    if (n_diff > 0)
+    {
+        printf("float_rx/%s: FAIL, %zu of %zu frames decode differently, first at %zu\n",
+               mode.name,
+               n_diff,
+               n_frames,
+               first_diff);
+        return false;
+    }
+    if (verbose)
+    {
+        printf("float_rx/%s: ok, %zu frames, %zu synced, gain %g\n", mode.name, n_frames, n_synced, gain);
+    }
+    return true;
+}
+
+static bool uses_libsamplerate(const std::string& name)
+{
+    for (const char* prefix : LIBSAMPLERATE_PREFIXES)
+    {
+        if (name.compare(0, strlen(prefix), prefix) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// src_version is the libsamplerate version the vectors were written with,
+// empty if none of them come from libsamplerate
+static bool write_golden(const char* path, const golden_set& set, const std::string& src_version)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == nullptr)
+    {
+        return false;
+    }
+
+    const uint32_t version = GOLDEN_VERSION;
+    const uint32_t src_version_len = src_version.size();
+    const uint32_t count = set.size();
+    fwrite(GOLDEN_MAGIC, 1, sizeof(GOLDEN_MAGIC), f);
+    fwrite(&version, sizeof(version), 1, f);
+    fwrite(&src_version_len, sizeof(src_version_len), 1, f);
+    fwrite(src_version.data(), 1, src_version_len, f);
+    fwrite(&count, sizeof(count), 1, f);
+
+    for (const auto& entry : set)
+    {
+        const uint32_t name_len = entry.first.size();
+        const uint32_t kind = entry.second.kind;
+        const uint32_t n = entry.second.values.size();
+        fwrite(&name_len, sizeof(name_len), 1, f);
+        fwrite(entry.first.data(), 1, name_len, f);
+        fwrite(&kind, sizeof(kind), 1, f);
+        fwrite(&n, sizeof(n), 1, f);
+        for (double val : entry.second.values)
+        {
+            if (kind == GOLDEN_FLOAT)
+            {
+                const float sample = static_cast<float>(val);
+                fwrite(&sample, sizeof(sample), 1, f);
+            }
+            else
+            {
+                const int32_t sample = static_cast<int32_t>(val);
+                fwrite(&sample, sizeof(sample), 1, f);
+            }
+        }
+    }
+
+    const bool ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
+
+static bool read_golden(const char* path, golden_set& set, std::string& src_version)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr)
+    {
+        return false;
+    }
+
+    char magic[sizeof(GOLDEN_MAGIC)];
+    uint32_t version = 0;
+    uint32_t src_version_len = 0;
+    uint32_t count = 0;
+    bool ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+              memcmp(magic, GOLDEN_MAGIC, sizeof(magic)) == 0 &&
+              fread(&version, sizeof(version), 1, f) == 1 &&
+              version == GOLDEN_VERSION &&
+              fread(&src_version_len, sizeof(src_version_len), 1, f) == 1 &&
+              src_version_len < 256;
+    src_version.assign(ok ? src_version_len : 0, '\0');
+    ok = ok &&
+         fread(&src_version[0], 1, src_version_len, f) == src_version_len &&
+         fread(&count, sizeof(count), 1, f) == 1;
+
+    for (uint32_t i = 0; ok && i < count; ++i)
+    {
+        uint32_t name_len = 0;
+        uint32_t kind = 0;
+        uint32_t n = 0;
+        ok = fread(&name_len, sizeof(name_len), 1, f) == 1 && name_len < 256;
+        std::string name(ok ? name_len : 0, '\0');
+        ok = ok &&
+             fread(&name[0], 1, name_len, f) == name_len &&
+             fread(&kind, sizeof(kind), 1, f) == 1 &&
+             (kind == GOLDEN_FLOAT || kind == GOLDEN_INT) &&
+             fread(&n, sizeof(n), 1, f) == 1;
+        if (!ok)
+        {
+            break;
+        }
+
+        golden_vector& vec = set[name];
+        vec.kind = static_cast<golden_kind>(kind);
+        vec.values.resize(n);
+        for (uint32_t j = 0; ok && j < n; ++j)
+        {
+            if (kind == GOLDEN_FLOAT)
+            {
+                float sample;
+                ok = fread(&sample, sizeof(sample), 1, f) == 1;
+                vec.values[j] = sample;
+            }
+            else
+            {
+                int32_t sample;
+                ok = fread(&sample, sizeof(sample), 1, f) == 1;
+                vec.values[j] = sample;
+            }
+        }
+    }
+
+    fclose(f);
+    return ok;
+}
+
+// Returns the number of vectors that don't match
+static size_t check_golden(const golden_set& golden,
+                           const golden_set& current,
+                           double            float_tolerance,
+                           double            int_tolerance,
+                           bool              verbose)
+{
+    size_t failed = 0;
+    for (const auto& entry : golden)
+    {
+        const std::string& name = entry.first;
+        const golden_vector& expected = entry.second;
+
+        const auto it = current.find(name);
+        if (it == current.end())
+        {
+            printf("%s: MISSING\n", name.c_str());
+            ++failed;
+            continue;
+        }
+        const golden_vector& actual = it->second;
+        if (actual.values.size() != expected.values.size())
+        {
+            printf("%s: FAIL, %zu values instead of %zu\n",
+                   name.c_str(),
+                   actual.values.size(),
+                   expected.values.size());
+            ++failed;
+            continue;
+        }
+
+        const double tolerance = expected.kind == GOLDEN_FLOAT ? float_tolerance : int_tolerance;
+        double max_diff = 0.0;
+        size_t first_diff = 0;
+        size_t n_diff = 0;
+        for (size_t i = 0; i < expected.values.size(); ++i)
+        {
+            const double diff = fabs(actual.values[i] - expected.values[i]);
+            if (diff > tolerance)
+            {
+                if (n_diff++ == 0)
+                {
+                    first_diff = i;
+                }
+            }
+            max_diff = std::max(max_diff, diff);
+        }
+
+        if (n_diff > 0)
+        {
+            printf("%s: FAIL, %zu of %zu values differ, first at %zu (%.9g instead of %.9g), by up to %g\n",
+                   name.c_str(),
+                   n_diff,
+                   expected.values.size(),
+                   first_diff,
+                   actual.values[first_diff],
+                   expected.values[first_diff],
+                   max_diff);
+            ++failed;
+        }
+        else if (verbose)
+        {
+            printf("%s: ok, %zu values, max difference %g\n",
+                   name.c_str(),
+                   expected.values.size(),
+                   max_diff);
+        }
+    }
+
+    for (const auto& entry : current)
+    {
+        if (golden.count(entry.first) == 0)
+        {
+            printf("%s: not in the golden vectors\n", entry.first.c_str());
+        }
+    }
+
+    return failed;
+}
+
+// Whether the -k options select name
+static bool selected(const std::vector<std::string>& prefixes, const std::string& name)
+{
+    if (prefixes.empty())
+    {
+        return true;
+    }
+
+    auto matches = [&](const std::string& prefix)
+    {
+        return name.compare(0, prefix.size(), prefix) == 0;
+    };
+    return std::any_of(prefixes.begin(), prefixes.end(), matches);
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-g] [-t <tolerance>] [-i <tolerance>] [-k <prefix>] [-v] GoldenFile\n"
+            "  Runs the resampler paths of every mode at every port sample rate,\n"
+            "  the sample conversions, the rms functions and the IQ downconverter\n"
+            "  on canned input, and compares the outputs with GoldenFile.\n"
+            "  GoldenFile records the libsamplerate version it was written\n"
+            "  with. The resampler and conversion vectors come from\n"
+            "  libsamplerate, so they are skipped when another version is in\n"
+            "  use. Everything else only depends on this tree\n"
+            "  When checking, it also decodes a modem signal in every mode with\n"
+            "  freedv_rx and with freedv_floatrx, and fails unless both give\n"
+            "  the same speech, sync state and SNR. These checks are named\n"
+            "  float_rx/<mode>\n"
+            "  -g  Write the outputs to GoldenFile instead of checking them\n"
+            "  -t  Largest difference allowed in float samples, 0 by default\n"
+            "  -i  Largest difference allowed in integer results, 0 by default\n"
+            "  -k  Only write or check the vectors and checks whose names start\n"
+            "      with prefix, can be given more than once\n"
+            "  -v  List every vector, not only the ones that differ\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    bool generate = false;
+    bool verbose = false;
+    std::vector<std::string> prefixes;
+    double float_tolerance = 0.0;
+    double int_tolerance = 0.0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "gt:i:k:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'g': generate = true; break;
+        case 't': float_tolerance = atof(optarg); break;
+        case 'i': int_tolerance = atof(optarg); break;
+        case 'k': prefixes.push_back(optarg); break;
+        case 'v': verbose = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* golden_file = argv[optind];
+
+    golden_set current;
+    try
+    {
+        for (const golden_mode& mode : GOLDEN_MODES)
+        {
+            if (!run_mode(current, mode))
+            {
+                fprintf(stderr, "Mode %s is not available, skipping it\n", mode.name);
+            }
+        }
+        run_complete_buffers(current);
+        run_frame_counts(current);
+        run_conversions(current);
+        run_levels(current);
+        run_downconverter(current);
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "%s\n", ex.what());
+        return 1;
+    }
+
+    for (auto it = current.begin(); it != current.end();)
+    {
+        it = selected(prefixes, it->first) ? std::next(it) : current.erase(it);
+    }
+
+    if (generate)
+    {
+        const bool any_libsamplerate =
+            std::any_of(current.begin(), current.end(), [](const golden_set::value_type& entry)
+                        {
+                            return uses_libsamplerate(entry.first);
+                        });
+        if (!write_golden(golden_file, current, any_libsamplerate ? src_get_version() : ""))
+        {
+            fprintf(stderr, "Could not write %s\n", golden_file);
+            return 1;
+        }
+        printf("Wrote %zu golden vectors to %s\n", current.size(), golden_file);
+        return 0;
+    }
+
+    golden_set golden;
+    std::string src_version;
+    if (!read_golden(golden_file, golden, src_version))
+    {
+        fprintf(stderr, "Could not read golden vectors from %s\n", golden_file);
+        return 1;
+    }
+    for (auto it = golden.begin(); it != golden.end();)
+    {
+        it = selected(prefixes, it->first) ? std::next(it) : golden.erase(it);
+    }
+
+    if (src_version != src_get_version())
+    {
+        size_t skipped = 0;
+        for (auto it = golden.begin(); it != golden.end();)
+        {
+            if (uses_libsamplerate(it->first))
+            {
+                it = golden.erase(it);
+                ++skipped;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        for (auto it = current.begin(); it != current.end();)
+        {
+            it = uses_libsamplerate(it->first) ? current.erase(it) : std::next(it);
+        }
+
+        if (src_version.empty())
+        {
+            printf("skipped: %s holds no resampler or conversion vectors\n", golden_file);
+        }
+        else if (skipped > 0)
+        {
+            printf("skipped: %zu resampler and conversion vectors, written with %s, running %s\n",
+                   skipped,
+                   src_version.c_str(),
+                   src_get_version());
+        }
+    }
+
+    size_t failed = check_golden(golden, current, float_tolerance, int_tolerance, verbose);
+    printf("%zu golden vectors, %zu failed\n", golden.size(), failed);
+
+    for (const golden_mode& mode : GOLDEN_MODES)
+    {
+        if (selected(prefixes, std::string("float_rx/") + mode.name) && !check_float_rx(mode, verbose))
+        {
+            ++failed;
+        }
+    }
+
+    return failed == 0 ? 0 : 1;
+}
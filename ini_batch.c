@@ -0,0 +1,384 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ini_batch.h"
+
+struct ini_batch
+{
+    char*  filename;
+    // Lines of the file, each with its line terminator
+    char** lines;
+    size_t count;
+    size_t capacity;
+    int    modified;
+};
+
+static int insert_line(struct ini_batch* batch, size_t idx, char* line)
+{
+    if (line == NULL)
+    {
+        return 0;
+    }
+
+    if (batch->count == batch->capacity)
+    {
+        const size_t capacity = batch->capacity ? batch->capacity * 2 : 64;
+        char** lines = realloc(batch->lines, capacity * sizeof(char*));
+        if (lines == NULL)
+        {
+            free(line);
+            return 0;
+        }
+        batch->lines = lines;
+        batch->capacity = capacity;
+    }
+
+    memmove(&batch->lines[idx + 1], &batch->lines[idx], (batch->count - idx) * sizeof(char*));
+    batch->lines[idx] = line;
+    ++batch->count;
+    return 1;
+}
+
+static void remove_line(struct ini_batch* batch, size_t idx)
+{
+    free(batch->lines[idx]);
+    memmove(&batch->lines[idx], &batch->lines[idx + 1], (batch->count - idx - 1) * sizeof(char*));
+    --batch->count;
+}
+
+static const char* skip_leading(const char* str)
+{
+    while (*str != '\0' && *str <= ' ')
+    {
+        ++str;
+    }
+    return str;
+}
+
+// The same section and key matching as minIni: names are case insensitive
+// and keys are separated from their values by '=' or ':'
+static int is_section(const char* line, const char* section)
+{
+    const char* sp = skip_leading(line);
+    const char* ep = strrchr(sp, ']');
+    if (*sp != '[' || ep == NULL)
+    {
+        return 0;
+    }
+
+    const size_t len = strlen(section);
+    return (size_t)(ep - sp - 1) == len && strncasecmp(sp + 1, section, len) == 0;
+}
+
+static int is_any_section(const char* line)
+{
+    const char* sp = skip_leading(line);
+    return *sp == '[' && strrchr(sp, ']') != NULL;
+}
+
+static int is_key(const char* line, const char* key)
+{
+    const char* sp = skip_leading(line);
+    const char* ep = strchr(sp, '=');
+    if (ep == NULL)
+    {
+        ep = strchr(sp, ':');
+    }
+    if (ep == NULL)
+    {
+        return 0;
+    }
+
+    while (ep > sp && ep[-1] <= ' ')
+    {
+        --ep;
+    }
+
+    const size_t len = strlen(key);
+    return len > 0 && (size_t)(ep - sp) == len && strncasecmp(sp, key, len) == 0;
+}
+
+// Formats a key the way minIni's writekey() does, quoting values that
+// would otherwise be read back differently
+static char* format_key(const char* key, const char* value)
+{
+    const size_t len = strlen(value);
+    const int quote = strpbrk(value, "\";#") != NULL || (len > 0 && value[len - 1] == ' ');
+
+    char* line = malloc(strlen(key) + 2 * len + 5);
+    if (line == NULL)
+    {
+        return NULL;
+    }
+
+    char* p = line + sprintf(line, "%s=", key);
+    if (quote)
+    {
+        *p++ = '"';
+        for (const char* c = value; *c; ++c)
+        {
+            if (*c == '"')
+            {
+                *p++ = '\\';
+            }
+            *p++ = *c;
+        }
+        *p++ = '"';
+    }
+    else
+    {
+        strcpy(p, value);
+        p += len;
+    }
+    strcpy(p, "\n");
+
+    return line;
+}
+
+static char* format_section(const char* section)
+{
+    char* line = malloc(strlen(section) + 4);
+    if (line != NULL)
+    {
+        sprintf(line, "[%s]\n", section);
+    }
+    return line;
+}
+
+// Makes sure a line added to the end of the file starts on a line of its own
+static int terminate_last_line(struct ini_batch* batch)
+{
+    if (batch->count == 0)
+    {
+        return 1;
+    }
+
+    char* last = batch->lines[batch->count - 1];
+    const size_t len = strlen(last);
+    if (len > 0 && last[len - 1] == '\n')
+    {
+        return 1;
+    }
+
+    last = realloc(last, len + 2);
+    if (last == NULL)
+    {
+        return 0;
+    }
+    strcpy(last + len, "\n");
+    batch->lines[batch->count - 1] = last;
+    return 1;
+}
+
+struct ini_batch* ini_batch_open(const char* filename)
+{
+    struct ini_batch* batch = calloc(1, sizeof(struct ini_batch));
+    if (batch == NULL || (batch->filename = strdup(filename)) == NULL)
+    {
+        free(batch);
+        return NULL;
+    }
+
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        if (errno == ENOENT)
+        {
+            return batch;
+        }
+        ini_batch_close(batch);
+        return NULL;
+    }
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, f) >= 0)
+    {
+        if (!insert_line(batch, batch->count, strdup(line)))
+        {
+            free(line);
+            fclose(f);
+            ini_batch_close(batch);
+            return NULL;
+        }
+    }
+    free(line);
+    fclose(f);
+
+    return batch;
+}
+
+int ini_batch_puts(struct ini_batch* batch, const char* section, const char* key, const char* value)
+{
+    if (key == NULL || *key == '\0')
+    {
+        return 0;
+    }
+    if (section == NULL)
+    {
+        section = "";
+    }
+
+    // Keys before the first section heading belong to the "" section
+    size_t start = 0;
+    if (*section != '\0')
+    {
+        while (start < batch->count && !is_section(batch->lines[start], section))
+        {
+            ++start;
+        }
+
+        if (start == batch->count)
+        {
+            if (value == NULL)
+            {
+                return 1;
+            }
+
+            // Add the section to the end of the file
+            if (!terminate_last_line(batch))
+            {
+                return 0;
+            }
+            batch->modified = 1;
+            return insert_line(batch, batch->count, format_section(section)) &&
+                   insert_line(batch, batch->count, format_key(key, value));
+        }
+        ++start;
+    }
+
+    size_t end = start;
+    while (end < batch->count && !is_any_section(batch->lines[end]))
+    {
+        if (is_key(batch->lines[end], key))
+        {
+            if (value == NULL)
+            {
+                remove_line(batch, end);
+                batch->modified = 1;
+                return 1;
+            }
+
+            char* line = format_key(key, value);
+            if (line == NULL)
+            {
+                return 0;
+            }
+            if (strcmp(line, batch->lines[end]) == 0)
+            {
+                free(line);
+                return 1;
+            }
+
+            free(batch->lines[end]);
+            batch->lines[end] = line;
+            batch->modified = 1;
+            return 1;
+        }
+        ++end;
+    }
+
+    if (value == NULL)
+    {
+        return 1;
+    }
+
+    // The key goes after the last setting in the section rather than after
+    // the blank lines separating it from the next one
+    while (end > start && *skip_leading(batch->lines[end - 1]) == '\0')
+    {
+        --end;
+    }
+    if (end == batch->count && !terminate_last_line(batch))
+    {
+        return 0;
+    }
+    batch->modified = 1;
+    return insert_line(batch, end, format_key(key, value));
+}
+
+// fsyncs the directory so the rename itself survives a power cut
+static void sync_dir(const char* filename)
+{
+    char dir[PATH_MAX];
+    const char* slash = strrchr(filename, '/');
+    if (slash == NULL)
+    {
+        strcpy(dir, ".");
+    }
+    else
+    {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash == filename ? 1 : slash - filename), filename);
+    }
+
+    const int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+int ini_batch_commit(struct ini_batch* batch)
+{
+    if (!batch->modified)
+    {
+        return 1;
+    }
+
+    // The same temporary name minIni uses
+    char tmp_name[PATH_MAX];
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s", batch->filename) >= (int)sizeof(tmp_name) ||
+        tmp_name[0] == '\0')
+    {
+        return 0;
+    }
+    tmp_name[strlen(tmp_name) - 1] = '~';
+
+    FILE* f = fopen(tmp_name, "wb");
+    if (f == NULL)
+    {
+        return 0;
+    }
+
+    int ok = 1;
+    for (size_t i = 0; ok && i < batch->count; ++i)
+    {
+        ok = fputs(batch->lines[i], f) >= 0;
+    }
+    ok = fflush(f) == 0 && ok;
+    ok = fsync(fileno(f)) == 0 && ok;
+    ok = fclose(f) == 0 && ok;
+
+    if (!ok || rename(tmp_name, batch->filename) != 0)
+    {
+        unlink(tmp_name);
+        return 0;
+    }
+
+    sync_dir(batch->filename);
+    batch->modified = 0;
+    return 1;
+}
+
+void ini_batch_close(struct ini_batch* batch)
+{
+    if (batch == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < batch->count; ++i)
+    {
+        free(batch->lines[i]);
+    }
+    free(batch->lines);
+    free(batch->filename);
+    free(batch);
+}
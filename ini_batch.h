@@ -0,0 +1,32 @@
+#ifndef INI_BATCH_H
+#define INI_BATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Applies many ini_puts()-style updates to one INI file with a single
+// read-modify-write. The file is read once by ini_batch_open(), updated in
+// memory, and ini_batch_commit() writes it to a temporary file, fsyncs it
+// and renames it over the original, so readers see either all of the
+// updates or none of them
+struct ini_batch;
+
+// A missing file is treated as empty. Returns NULL if it can't be read
+struct ini_batch* ini_batch_open(const char* filename);
+
+// Same semantics as ini_puts(): a NULL value erases the key, and a key that
+// doesn't exist is added at the end of its section, which is created if
+// necessary
+int ini_batch_puts(struct ini_batch* batch, const char* section, const char* key, const char* value);
+
+// Returns 1 if the file was written or nothing changed, 0 on error
+int ini_batch_commit(struct ini_batch* batch);
+
+void ini_batch_close(struct ini_batch* batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,29 +1,714 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 #include "minIni.h"
+#include "ini_batch.h"
 
 char buffer[1024] = {0};
 
-int iniget(int argc, char* argv[])
+// How long the daemon waits on a client that stops sending or reading,
+// and how long a client waits to connect to and hear from the daemon
+// before reading the files itself. The client waits longer, so a stuck
+// client ahead of it in the queue doesn't make it give up
+#define DAEMON_CLIENT_TIMEOUT_MS 1000
+#define CLIENT_DAEMON_TIMEOUT_MS 3000
+
+// Every setting of one config file, in file order
+struct ini_file
+{
+    const char* path;
+    char**      sections;
+    char**      keys;
+    char**      values;
+    size_t      count;
+    size_t      capacity;
+};
+
+static char* xstrdup(const char* str)
+{
+    char* dup = strdup(str);
+    if (dup == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return dup;
+}
+
+static int add_setting(const mTCHAR* section, const mTCHAR* key, const mTCHAR* value, void* user_data)
+{
+    struct ini_file* file = (struct ini_file*)user_data;
+    if (file->count == file->capacity)
+    {
+        file->capacity = file->capacity ? file->capacity * 2 : 64;
+        file->sections = realloc(file->sections, file->capacity * sizeof(char*));
+        file->keys = realloc(file->keys, file->capacity * sizeof(char*));
+        file->values = realloc(file->values, file->capacity * sizeof(char*));
+        if (file->sections == NULL || file->keys == NULL || file->values == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    file->sections[file->count] = xstrdup(section);
+    file->keys[file->count] = xstrdup(key);
+    file->values[file->count] = xstrdup(value);
+    ++file->count;
+
+    return 1;
+}
+
+static void free_ini_file(struct ini_file* file)
+{
+    for (size_t i = 0; i < file->count; ++i)
+    {
+        free(file->sections[i]);
+        free(file->keys[i]);
+        free(file->values[i]);
+    }
+    free(file->sections);
+    free(file->keys);
+    free(file->values);
+
+    const char* path = file->path;
+    memset(file, 0, sizeof(*file));
+    file->path = path;
+}
+
+// A missing file is the same as an empty one
+static void load_ini_file(struct ini_file* file)
+{
+    free_ini_file(file);
+    ini_browse(add_setting, file, file->path);
+}
+
+// Same result as calling ini_gets() on each file in turn until one of them
+// has a value: the first occurrence of the key in a file wins, and an empty
+// value falls through to the next file
+static const char* lookup(const struct ini_file files[], size_t num_files,
+                          const char* section, const char* key)
 {
-    if (argc < 4)
+    for (size_t f = 0; f < num_files; ++f)
     {
-        fprintf(stderr, "usage: %s <Section> <Key> <Filename> ...\n", argv[0]);
+        for (size_t i = 0; i < files[f].count; ++i)
+        {
+            if (strcasecmp(files[f].sections[i], section) == 0 &&
+                strcasecmp(files[f].keys[i], key) == 0)
+            {
+                if (*files[f].values[i])
+                {
+                    return files[f].values[i];
+                }
+                break;
+            }
+        }
+    }
+
+    return "";
+}
+
+// A query is [VAR=]Section:Key. Without VAR the variable is named
+// Section_Key
+struct query
+{
+    char var[64];
+    char section[64];
+    char key[64];
+};
+
+// Names that don't fit are rejected rather than truncated, as two
+// truncated names could refer to the same variable or setting
+static int parse_query(const char* arg, struct query* q)
+{
+    const char* eq = strchr(arg, '=');
+    const char* spec = eq ? eq + 1 : arg;
+    const char* colon = strchr(spec, ':');
+    if (colon == NULL || colon == spec || colon[1] == '\0')
+    {
+        return 0;
+    }
+
+    const size_t section_len = colon - spec;
+    const size_t key_len = strlen(colon + 1);
+    const size_t var_len = eq ? (size_t)(eq - arg) : section_len + 1 + key_len;
+    if (section_len >= sizeof(q->section) ||
+        key_len >= sizeof(q->key) ||
+        var_len >= sizeof(q->var))
+    {
+        return 0;
+    }
+
+    memcpy(q->section, spec, section_len);
+    q->section[section_len] = '\0';
+    memcpy(q->key, colon + 1, key_len + 1);
+    if (eq)
+    {
+        memcpy(q->var, arg, var_len);
+        q->var[var_len] = '\0';
+    }
+    else
+    {
+        memcpy(q->var, q->section, section_len);
+        q->var[section_len] = '_';
+        memcpy(q->var + section_len + 1, q->key, key_len + 1);
+    }
+
+    for (char* c = q->var; *c; ++c)
+    {
+        if (!isalnum((unsigned char)*c))
+        {
+            *c = '_';
+        }
+    }
+
+    return q->var[0] != '\0' && !isdigit((unsigned char)q->var[0]);
+}
+
+static void print_shell_assignment(const char* var, const char* value)
+{
+    printf("%s='", var);
+    for (const char* c = value; *c; ++c)
+    {
+        if (*c == '\'')
+        {
+            fputs("'\\''", stdout);
+        }
+        else
+        {
+            putchar(*c);
+        }
+    }
+    printf("'\n");
+}
+
+/*
+ * Daemon protocol, one request per connection. The client sends
+ *   F <filename>\n             for each file, in order
+ *   G <section>\t<key>\n       for each value
+ * and shuts down its side. If the files match the ones the daemon serves,
+ * it answers each G line with "V <value>\n". Otherwise it answers "E\n"
+ * and the client reads the files itself. Either side gives up on the other
+ * after a timeout, the client then reading the files itself too
+ */
+static void set_socket_timeouts(int fd, int timeout_ms)
+{
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// The send timeout also bounds connect(), which waits while the daemon's
+// backlog is full
+static int connect_socket(const char* socket_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    set_socket_timeouts(fd, CLIENT_DAEMON_TIMEOUT_MS);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Returns 1 and fills values[] if the daemon answered
+static int query_daemon(const char* socket_path,
+                        char* const files[], int num_files,
+                        const struct query queries[], int num_queries,
+                        char* values[])
+{
+    const int fd = connect_socket(socket_path);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    FILE* f = fdopen(fd, "r+");
+    if (f == NULL)
+    {
+        close(fd);
+        return 0;
+    }
+
+    for (int i = 0; i < num_files; ++i)
+    {
+        fprintf(f, "F %s\n", files[i]);
+    }
+    for (int i = 0; i < num_queries; ++i)
+    {
+        fprintf(f, "G %s\t%s\n", queries[i].section, queries[i].key);
+    }
+    if (fflush(f) != 0)
+    {
+        fclose(f);
+        return 0;
+    }
+    shutdown(fd, SHUT_WR);
+
+    int answered = 0;
+    char line[INI_BUFFERSIZE + 8];
+    while (answered < num_queries && fgets(line, sizeof(line), f) != NULL)
+    {
+        if (strncmp(line, "V ", 2) != 0)
+        {
+            break;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        values[answered++] = xstrdup(line + 2);
+    }
+    fclose(f);
+
+    if (answered != num_queries)
+    {
+        for (int i = 0; i < answered; ++i)
+        {
+            free(values[i]);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static void get_values(const char* socket_path,
+                       char* const files[], int num_files,
+                       const struct query queries[], int num_queries,
+                       char* values[])
+{
+    if (socket_path != NULL &&
+        query_daemon(socket_path, files, num_files, queries, num_queries, values))
+    {
+        return;
+    }
+
+    // Each file is read once no matter how many values are asked for
+    struct ini_file ini_files[num_files];
+    memset(ini_files, 0, sizeof(ini_files));
+    for (int i = 0; i < num_files; ++i)
+    {
+        ini_files[i].path = files[i];
+        load_ini_file(&ini_files[i]);
+    }
+
+    for (int i = 0; i < num_queries; ++i)
+    {
+        values[i] = xstrdup(lookup(ini_files, num_files, queries[i].section, queries[i].key));
+    }
+
+    for (int i = 0; i < num_files; ++i)
+    {
+        free_ini_file(&ini_files[i]);
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-s <socket>] <Section> <Key> <Filename> ...\n"
+            "       %s -e [-s <socket>] <Filename> ... -- [VAR=]<Section>:<Key> ...\n"
+            "       %s -d <socket> <Filename> ...\n"
+            "  -e  prints VAR='value' lines for eval\n"
+            "  -s  asks a running %s -d first\n"
+            "  -d  keeps the files in memory and answers queries on socket\n",
+            prog, prog, prog, prog);
+}
+
+static int find_separator(int argc, char* argv[], int first)
+{
+    for (int i = first; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int iniget_batch(const char* socket_path, int argc, char* argv[], int first)
+{
+    const int sep = find_separator(argc, argv, first);
+    if (sep <= first || sep == argc - 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const int num_queries = argc - sep - 1;
+    struct query* queries = calloc(num_queries, sizeof(struct query));
+    char** values = calloc(num_queries, sizeof(char*));
+    if (queries == NULL || values == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
         return 1;
     }
 
-    for (int i = 3; *buffer == '\0' && i < argc; ++i)
+    for (int i = 0; i < num_queries; ++i)
     {
-        ini_gets(argv[1], argv[2], "", buffer, sizeof(buffer) - 1, argv[i]);
+        if (!parse_query(argv[sep + 1 + i], &queries[i]))
+        {
+            fprintf(stderr, "Invalid query: %s\n", argv[sep + 1 + i]);
+            return 1;
+        }
     }
 
-    printf("%s", buffer);
+    get_values(socket_path, argv + first, sep - first, queries, num_queries, values);
+    for (int i = 0; i < num_queries; ++i)
+    {
+        print_shell_assignment(queries[i].var, values[i]);
+        free(values[i]);
+    }
+
+    free(values);
+    free(queries);
     return 0;
 }
 
+static int iniget_single(const char* socket_path, int argc, char* argv[], int first)
+{
+    if (argc - first < 3)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Names too long for a query are looked up directly rather than
+    // truncated
+    struct query q;
+    if (socket_path == NULL ||
+        strlen(argv[first]) >= sizeof(q.section) ||
+        strlen(argv[first + 1]) >= sizeof(q.key))
+    {
+        for (int i = first + 2; *buffer == '\0' && i < argc; ++i)
+        {
+            ini_gets(argv[first], argv[first + 1], "", buffer, sizeof(buffer) - 1, argv[i]);
+        }
+
+        printf("%s", buffer);
+        return 0;
+    }
+
+    strcpy(q.section, argv[first]);
+    strcpy(q.key, argv[first + 1]);
+    q.var[0] = '\0';
+
+    char* value = NULL;
+    get_values(socket_path, argv + first + 2, argc - first - 2, &q, 1, &value);
+    printf("%s", value);
+    free(value);
+    return 0;
+}
+
+// Marks the files stale whenever one of them is written, replaced or removed
+static int watch_files(struct ini_file files[], int num_files)
+{
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < num_files; ++i)
+    {
+        char dir[PATH_MAX];
+        const char* slash = strrchr(files[i].path, '/');
+        if (slash == NULL)
+        {
+            strcpy(dir, ".");
+        }
+        else
+        {
+            snprintf(dir, sizeof(dir), "%.*s",
+                     (int)(slash == files[i].path ? 1 : slash - files[i].path), files[i].path);
+        }
+        inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                                   IN_CREATE | IN_DELETE);
+    }
+
+    return fd;
+}
+
+static int config_changed(int inotify_fd, const struct ini_file files[], int num_files)
+{
+    int changed = 0;
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(inotify_fd, events, sizeof(events))) > 0)
+    {
+        for (ssize_t offset = 0; offset < len; )
+        {
+            const struct inotify_event* ev = (const struct inotify_event*)(events + offset);
+            for (int i = 0; ev->len > 0 && i < num_files; ++i)
+            {
+                const char* slash = strrchr(files[i].path, '/');
+                if (strcmp(slash ? slash + 1 : files[i].path, ev->name) == 0)
+                {
+                    changed = 1;
+                }
+            }
+            offset += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    return changed;
+}
+
+static void serve_request(int client_fd, struct ini_file files[], int num_files)
+{
+    FILE* f = fdopen(client_fd, "r+");
+    if (f == NULL)
+    {
+        close(client_fd);
+        return;
+    }
+
+    int file_idx = 0;
+    int files_match = 1;
+    char line[INI_BUFFERSIZE + 8];
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        // A line cut short by the timeout is not a request
+        const size_t len = strcspn(line, "\n");
+        if (line[len] != '\n')
+        {
+            break;
+        }
+        line[len] = '\0';
+        if (strncmp(line, "F ", 2) == 0)
+        {
+            if (file_idx >= num_files || strcmp(files[file_idx].path, line + 2) != 0)
+            {
+                files_match = 0;
+            }
+            ++file_idx;
+            continue;
+        }
+
+        char* tab = strchr(line, '\t');
+        if (strncmp(line, "G ", 2) != 0 || tab == NULL || !files_match || file_idx != num_files)
+        {
+            fputs("E\n", f);
+            break;
+        }
+
+        *tab = '\0';
+        fprintf(f, "V %s\n", lookup(files, num_files, line + 2, tab + 1));
+    }
+
+    fclose(f);
+}
+
+static int iniget_daemon(const char* socket_path, int argc, char* argv[], int first)
+{
+    const int num_files = argc - first;
+    if (num_files < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct ini_file files[num_files];
+    memset(files, 0, sizeof(files));
+    for (int i = 0; i < num_files; ++i)
+    {
+        files[i].path = argv[first + i];
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socket_path);
+    if (listen_fd < 0 ||
+        bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 16) != 0)
+    {
+        fprintf(stderr, "Could not listen on %s\n", socket_path);
+        return 1;
+    }
+
+    const int inotify_fd = watch_files(files, num_files);
+    if (inotify_fd < 0)
+    {
+        fprintf(stderr, "Could not watch config files\n");
+        unlink(socket_path);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // Reread lazily, so a burst of writes only costs one reload
+    int stale = 1;
+    for (;;)
+    {
+        struct pollfd pfds[2];
+        pfds[0].fd = listen_fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = inotify_fd;
+        pfds[1].events = POLLIN;
+        if (poll(pfds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if ((pfds[1].revents & POLLIN) && config_changed(inotify_fd, files, num_files))
+        {
+            stale = 1;
+        }
+
+        if (pfds[0].revents & POLLIN)
+        {
+            const int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (client_fd < 0)
+            {
+                continue;
+            }
+            set_socket_timeouts(client_fd, DAEMON_CLIENT_TIMEOUT_MS);
+
+            // Pick up changes that raced with the request
+            if (config_changed(inotify_fd, files, num_files))
+            {
+                stale = 1;
+            }
+            if (stale)
+            {
+                for (int i = 0; i < num_files; ++i)
+                {
+                    load_ini_file(&files[i]);
+                }
+                stale = 0;
+            }
+
+            serve_request(client_fd, files, num_files);
+        }
+    }
+
+    unlink(socket_path);
+    return 1;
+}
+
+int iniget(int argc, char* argv[])
+{
+    const char* socket_path = NULL;
+    const char* daemon_socket = NULL;
+    int batch = 0;
+    int opt;
+
+    // Stop at the first non-option so Section and Key can't be mistaken
+    // for options
+    while ((opt = getopt(argc, argv, "+es:d:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'e': batch = 1; break;
+        case 's': socket_path = optarg; break;
+        case 'd': daemon_socket = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (daemon_socket != NULL)
+    {
+        return iniget_daemon(daemon_socket, argc, argv, optind);
+    }
+    else if (batch)
+    {
+        return iniget_batch(socket_path, argc, argv, optind);
+    }
+    else
+    {
+        return iniget_single(socket_path, argc, argv, optind);
+    }
+}
+
+// Applies every <Section> <Key> <Value> triple to each file with one
+// rewrite of the file
+static int iniset_batch(int argc, char* argv[], int first)
+{
+    const int sep = find_separator(argc, argv, first);
+    if (sep <= first || sep == argc - 1 || (argc - sep - 1) % 3 != 0)
+    {
+        fprintf(stderr,
+                "usage: %s -b <Filename> ... -- <Section> <Key> <Value> ...\n",
+                argv[0]);
+        return 1;
+    }
+
+    int ret = 0;
+    for (int f = first; f < sep; ++f)
+    {
+        struct ini_batch* batch = ini_batch_open(argv[f]);
+        if (batch == NULL)
+        {
+            fprintf(stderr, "Could not read %s\n", argv[f]);
+            ret = 1;
+            continue;
+        }
+
+        int ok = 1;
+        for (int i = sep + 1; ok && i < argc; i += 3)
+        {
+            const char* val = *argv[i + 2] ? argv[i + 2] : NULL;
+            ok = ini_batch_puts(batch, argv[i], argv[i + 1], val);
+        }
+
+        // Nothing is written unless every update could be applied
+        if (!ok || !ini_batch_commit(batch))
+        {
+            fprintf(stderr, "Could not write %s\n", argv[f]);
+            ret = 1;
+        }
+        ini_batch_close(batch);
+    }
+
+    return ret;
+}
+
 int iniset(int argc, char* argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "-b") == 0)
+    {
+        return iniset_batch(argc, argv, 2);
+    }
+
     if (argc < 5)
     {
         fprintf(stderr, "usage: %s <Section> <Key> <Value> <Filename> ...\n", argv[0]);
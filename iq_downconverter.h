@@ -0,0 +1,192 @@
+#ifndef IQ_DOWNCONVERTER_H
+#define IQ_DOWNCONVERTER_H
+
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <stdexcept>
+
+// Four floats processed at once. GCC and Clang map this onto NEON or SSE
+typedef float iq_v4sf __attribute__((vector_size(16)));
+
+// Converts complex IQ samples at a high sample rate into complex samples at
+// the modem sample rate. The channel at offset_hz from the center of the IQ
+// stream is moved to 0 Hz, low pass filtered and decimated by an integer
+// factor.
+//
+// Instead of mixing every input sample and then filtering, the filter taps
+// are shifted up to offset_hz, making a band pass filter centered on the
+// channel, and only the decimated output samples are mixed down. The result
+// is the same, but the mixer runs at the output rate
+class iq_downconverter
+{
+public:
+    iq_downconverter(uint  input_rate,
+                     uint  output_rate,
+                     float offset_hz,
+                     float gain)
+        : m_phase(0.0)
+    {
+        if (output_rate == 0 || input_rate % output_rate != 0)
+        {
+            throw std::runtime_error("IQ sample rate must be a multiple of the modem sample rate");
+        }
+
+        m_decimation = input_rate / output_rate;
+
+        // No filtering is needed when not decimating. Otherwise round the
+        // number of taps up to a multiple of the vector width
+        const size_t num_taps = m_decimation == 1 ? 1 : ((m_decimation * 10 + 3) / 4) * 4;
+
+        // Windowed sinc with a cutoff just under the output Nyquist
+        // frequency. Stored in reverse so each output is a straight dot
+        // product with the input history
+        const double cutoff = 0.45 / m_decimation;
+        const double center = (num_taps - 1) / 2.0;
+        const double omega = 2.0 * M_PI * offset_hz / input_rate;
+
+        std::vector<double> taps(num_taps, 1.0);
+        double taps_sum = 0.0;
+        for (size_t k = 0; k < num_taps && num_taps > 1; ++k)
+        {
+            const double t = k - center;
+            const double sinc = t == 0.0 ?
+                2.0 * cutoff :
+                sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+            const double window = 0.42 -
+                                  0.5 * cos(2.0 * M_PI * k / (num_taps - 1)) +
+                                  0.08 * cos(4.0 * M_PI * k / (num_taps - 1));
+            taps[k] = sinc * window;
+            taps_sum += taps[k];
+        }
+
+        m_taps_re.resize(num_taps);
+        m_taps_im.resize(num_taps);
+        for (size_t k = 0; k < num_taps; ++k)
+        {
+            const double tap = num_taps > 1 ? gain * taps[k] / taps_sum : gain;
+            m_taps_re[num_taps - 1 - k] = static_cast<float>(tap * cos(omega * k));
+            m_taps_im[num_taps - 1 - k] = static_cast<float>(tap * sin(omega * k));
+        }
+
+        m_phase_step = fmod(omega * m_decimation, 2.0 * M_PI);
+
+        m_hist_i.assign(num_taps - 1, 0.0f);
+        m_hist_q.assign(num_taps - 1, 0.0f);
+    }
+
+    uint decimation() const
+    {
+        return m_decimation;
+    }
+
+    // Consumes count * decimation() interleaved I/Q input samples and
+    // writes count interleaved I/Q output samples
+    void process(const float* iq_in, float* iq_out, size_t count)
+    {
+        const size_t num_taps = m_taps_re.size();
+        const size_t history = num_taps - 1;
+        const size_t n_in = count * m_decimation;
+
+        m_hist_i.resize(history + n_in);
+        m_hist_q.resize(history + n_in);
+        for (size_t n = 0; n < n_in; ++n)
+        {
+            m_hist_i[history + n] = iq_in[2 * n];
+            m_hist_q[history + n] = iq_in[2 * n + 1];
+        }
+
+        for (size_t m = 0; m < count; ++m)
+        {
+            // Window ending on the last input sample of this output period
+            const size_t start = m * m_decimation + m_decimation - 1;
+            const float* x_i = m_hist_i.data() + start;
+            const float* x_q = m_hist_q.data() + start;
+
+            float rr, qi, ri, qr;
+            dot4(x_i, x_q, num_taps, rr, qi, ri, qr);
+
+            const float y_re = rr - qi;
+            const float y_im = ri + qr;
+
+            // Mix the channel down to 0 Hz
+            const float lo_re = static_cast<float>(cos(m_phase));
+            const float lo_im = static_cast<float>(-sin(m_phase));
+            iq_out[2 * m] = y_re * lo_re - y_im * lo_im;
+            iq_out[2 * m + 1] = y_re * lo_im + y_im * lo_re;
+
+            m_phase += m_phase_step;
+            if (m_phase >= 2.0 * M_PI)
+            {
+                m_phase -= 2.0 * M_PI;
+            }
+        }
+
+        m_hist_i.erase(m_hist_i.begin(), m_hist_i.begin() + n_in);
+        m_hist_q.erase(m_hist_q.begin(), m_hist_q.begin() + n_in);
+    }
+
+private:
+    // Computes the four real dot products making up a complex dot product
+    // of the input window with the taps
+    void dot4(const float* x_i,
+              const float* x_q,
+              size_t       n,
+              float&       rr,
+              float&       qi,
+              float&       ri,
+              float&       qr) const
+    {
+        const float* h_re = m_taps_re.data();
+        const float* h_im = m_taps_im.data();
+
+        iq_v4sf acc_rr = {0.0f, 0.0f, 0.0f, 0.0f};
+        iq_v4sf acc_qi = acc_rr;
+        iq_v4sf acc_ri = acc_rr;
+        iq_v4sf acc_qr = acc_rr;
+
+        size_t k = 0;
+        for (; k + 4 <= n; k += 4)
+        {
+            iq_v4sf vi, vq, vhr, vhi;
+            memcpy(&vi, x_i + k, sizeof(vi));
+            memcpy(&vq, x_q + k, sizeof(vq));
+            memcpy(&vhr, h_re + k, sizeof(vhr));
+            memcpy(&vhi, h_im + k, sizeof(vhi));
+
+            acc_rr += vi * vhr;
+            acc_qi += vq * vhi;
+            acc_ri += vi * vhi;
+            acc_qr += vq * vhr;
+        }
+
+        rr = acc_rr[0] + acc_rr[1] + acc_rr[2] + acc_rr[3];
+        qi = acc_qi[0] + acc_qi[1] + acc_qi[2] + acc_qi[3];
+        ri = acc_ri[0] + acc_ri[1] + acc_ri[2] + acc_ri[3];
+        qr = acc_qr[0] + acc_qr[1] + acc_qr[2] + acc_qr[3];
+
+        for (; k < n; ++k)
+        {
+            rr += x_i[k] * h_re[k];
+            qi += x_q[k] * h_im[k];
+            ri += x_i[k] * h_im[k];
+            qr += x_q[k] * h_re[k];
+        }
+    }
+
+private:
+    uint m_decimation;
+
+    std::vector<float> m_taps_re;
+    std::vector<float> m_taps_im;
+
+    // The last (taps - 1) input samples followed by the current block
+    std::vector<float> m_hist_i;
+    std::vector<float> m_hist_q;
+
+    double m_phase;
+    double m_phase_step;
+};
+
+#endif
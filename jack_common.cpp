@@ -12,6 +12,9 @@
   along with this program; if not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <errno.h>
+#include <string.h>
+
 #include <sndfile.h>
 #include <freedv_api.h>
 
@@ -111,7 +114,9 @@ bool connect_input_ports(jack_client_t* client,
         const char* out_port_name = jack_port_name(output_port);
         for (size_t i = 0; playback_ports[i] != NULL; ++i)
         {
-            if (jack_connect(client, out_port_name, playback_ports[i]) != 0)
+            // Ports stay connected when the config is reloaded
+            const int ret = jack_connect(client, out_port_name, playback_ports[i]);
+            if (ret != 0 && ret != EEXIST)
             {
                 fprintf(stderr,
                         "Could not connect %s port to %s port\n",
@@ -133,3 +138,44 @@ bool connect_input_ports(jack_client_t* client,
     }
 }
 
+std::string get_trace_file(const struct config* cfg, const char* name)
+{
+    std::string trace_file(cfg->trace_file);
+    const size_t name_idx = trace_file.find("{name}");
+    if (name_idx != std::string::npos)
+    {
+        trace_file.replace(name_idx, 6, name);
+    }
+
+    return trace_file;
+}
+
+void read_config_snapshot(const char* config_file, config_snapshot& snapshot)
+{
+    memset(&snapshot, 0, sizeof(snapshot));
+    read_config(config_file, &snapshot.cfg);
+
+    struct stat st;
+    if (str_has_value(snapshot.cfg.key_file) && stat(snapshot.cfg.key_file, &st) == 0)
+    {
+        snapshot.key_dev = st.st_dev;
+        snapshot.key_ino = st.st_ino;
+        snapshot.key_size = st.st_size;
+        snapshot.key_mtime = st.st_mtim;
+    }
+}
+
+int diff_config_snapshot(const config_snapshot& prev, const config_snapshot& next)
+{
+    int diff = diff_config(&prev.cfg, &next.cfg);
+    if (prev.key_dev != next.key_dev ||
+        prev.key_ino != next.key_ino ||
+        prev.key_size != next.key_size ||
+        prev.key_mtime.tv_sec != next.key_mtime.tv_sec ||
+        prev.key_mtime.tv_nsec != next.key_mtime.tv_nsec)
+    {
+        diff |= CONFIG_DIFF_KEY;
+    }
+
+    return diff;
+}
@@ -16,18 +16,42 @@
 #define JACK_COMMON_H
 
 #include <vector>
+#include <string>
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <jack/jack.h>
 
-struct config;
-typedef std::vector<jack_default_audio_sample_t> audio_buffer_t;
+#include "crypto_cfg.h"
+#include "audio_backend.h"
 
 int get_jack_period(const struct config* cfg);
 
+// The configured trace file with {name} replaced, or an empty string if
+// tracing is disabled
+std::string get_trace_file(const struct config* cfg, const char* name);
+
 bool connect_input_ports(jack_client_t* client,
                          jack_port_t*   output_port,
                          const char*    input_port_regex);
 
+// The config file as it was last read, along with the identity of the key
+// file it names, so that replacing the key counts as a change too
+struct config_snapshot
+{
+    struct config   cfg;
+    dev_t           key_dev;
+    ino_t           key_ino;
+    off_t           key_size;
+    struct timespec key_mtime;
+};
+
+void read_config_snapshot(const char* config_file, config_snapshot& snapshot);
+
+// The CONFIG_DIFF_* groups that differ between prev and next
+int diff_config_snapshot(const config_snapshot& prev, const config_snapshot& next);
+
 bool read_wav_file(const char*     filepath,
                    jack_nframes_t  jack_sample_rate,
                    audio_buffer_t& buffer_out);
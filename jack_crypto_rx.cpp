@@ -18,17 +18,18 @@
   along with this program; if not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <vector>
-#include <deque>
 #include <memory>
 
-#include <jack/jack.h>
 #include <samplerate.h>
 #include <sndfile.h>
 
@@ -36,222 +37,151 @@
 
 #include "crypto_log.h"
 #include "crypto_rx_common.h"
+#include "crypto_rx_diversity.h"
 #include "crypto_common.h"
 #include "crypto_cfg.h"
 #include "resampler.h"
 #include "jack_common.h"
-
-static std::unique_ptr<crypto_rx_common> crypto_rx;
-
-static jack_port_t* voice_port = nullptr;
-static jack_port_t* modem_port = nullptr;
-static jack_port_t* notification_port = nullptr;
-static jack_client_t* client = nullptr;
-
-static std::unique_ptr<resampler> input_resampler;
-static std::unique_ptr<resampler> output_resampler;
-
-static audio_buffer_t crypto_startup;
-static audio_buffer_t plain_startup;
-static audio_buffer_t wave_sound;
-
-static std::deque<jack_default_audio_sample_t> notification_buffer;
-
-static volatile sig_atomic_t reload_config = 0;
-static volatile sig_atomic_t read_wav = 0;
-static volatile sig_atomic_t initialized = 0;
-static volatile sig_atomic_t play_wav = 0;
+#include "crypto_metrics.h"
+#include "crypto_trace.h"
+#include "rt_handoff.h"
+#include "control_loop.h"
+#include "audio_backend.h"
+#include "rx_engine.h"
+#include "capture.h"
+
+static const char* METRICS_SOCKET = "/var/run/crypto_rx.sock";
+
+static crypto_metrics metrics;
+static rx_metrics     counters(metrics);
+
+// Handled by the main thread through the control loop
+static const std::vector<int> CONTROL_SIGNALS =
+    { SIGHUP, SIGUSR1, SIGUSR2, SIGINT, SIGQUIT, SIGTERM };
+static control_loop control;
+
+static rx_engine engine(counters, &control);
+static rt_handoff<rx_state>& state = engine.state();
+static rt_handoff<struct config>& squelch_update = engine.squelch_update();
+// The config the running demodulators were built from
+static config_snapshot running_config;
+
+// Records every cycle when started with -c. The capture has a slot for
+// every port that could be registered: the voice and notification outputs,
+// then the modem inputs and then the modem Q inputs
+static capture_writer capture;
+
+static std::unique_ptr<audio_backend> backend;
+static int voice_port = -1;
+// -1 until registered. Only used by the main thread, the realtime thread
+// takes the ports from the rx_state it is running
+static int modem_ports[MAX_MODEM_IN_PORTS];
+static int modem_q_ports[MAX_MODEM_IN_PORTS];
+static int notification_port = -1;
 
 static const char* config_file = nullptr;
+static std::string trace_file;
 
 static bool read_wav_file(const char* filepath, audio_buffer_t& buffer_out)
 {
-    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-    return read_wav_file(filepath, jack_sample_rate, buffer_out);
+    return read_wav_file(filepath, backend->sample_rate(), buffer_out);
 }
 
-static void signal_handler(int sig)
+static void write_trace()
 {
-    jack_client_close(client);
-    fprintf(stderr, "signal received, exiting ...\n");
-    exit(0);
+    if (!trace_file.empty())
+    {
+        trace_dump(trace_file.c_str());
+    }
 }
 
-static void handle_sighup(int sig)
+static void initialize_tracing(const struct config* cfg)
 {
-    reload_config = 1;
+    trace_file = get_trace_file(cfg, "crypto_rx");
+    trace_enable(!trace_file.empty());
 }
 
-static void handle_sigusr1(int sig)
+// The backend stopped calling process(). Running out of input is a normal
+// end for the file backend, anything else is fatal
+static void backend_shutdown(bool finished, void* arg)
 {
-    read_wav = 1;
+    if (finished)
+    {
+        kill(getpid(), SIGTERM);
+    }
+    else
+    {
+        exit (1);
+    }
 }
 
-/**
- * JACK calls this shutdown_callback if the server ever shuts down or
- * decides to disconnect the client.
- */
-void jack_shutdown(void *arg)
+static int backend_xrun(void* arg)
 {
-    exit (1);
+    metric_add(counters.xruns);
+    TRACE_INSTANT("xrun");
+    capture.xrun();
+    return 0;
 }
 
-/**
- * The process callback for this JACK application is called in a
- * special realtime thread once for each audio cycle.
- *
- * This client follows a simple rule: when the JACK transport is
- * running, copy the input port to the output.  When it stops, exit.
- */
-int process(jack_nframes_t nframes, void *arg)
+// Called by the backend on its audio thread once for each cycle. The modem
+// ports come with the state, so a reload that adds branches switches over
+// to the new ports in the same cycle as the new demodulators
+static int process(uint nframes, void* arg)
 {
-    const jack_default_audio_sample_t* const modem_frames =
-        (jack_default_audio_sample_t*)jack_port_get_buffer(modem_port, nframes);
-    bool play_notification_sound = false;
-    bool play_wave_sound = false;
-
-    if (initialized != 0) {
-        initialized = 0;
-
-        play_notification_sound = true;
-    }
-
-    if (play_wav != 0) {
-        play_wav = 0;
-
-        play_wave_sound = true;
-    }
-
-    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-    const uint voice_sample_rate = crypto_rx->speech_sample_rate();
-    const uint modem_sample_rate = crypto_rx->modem_sample_rate();
-    const int n_nom_speech_samples = crypto_rx->speech_samples_per_frame();
-
-    const uint modem_resampled_frames =
-            get_nom_resampled_frames(crypto_rx->modem_samples_per_frame(),
-                                     modem_sample_rate,
-                                     jack_sample_rate);
-
-    input_resampler->set_sample_rates(jack_sample_rate, modem_sample_rate);
-    output_resampler->set_sample_rates(voice_sample_rate, jack_sample_rate);
-
-    input_resampler->enqueue(modem_frames, nframes);
-
-    const size_t n_max_modem_samples = crypto_rx->max_modem_samples_per_frame();
-    const size_t n_max_speech_samples = crypto_rx->max_speech_samples_per_frame();
+    const uint64_t start_ns = metric_now_ns();
+    rx_state& st = engine.begin_cycle();
 
-    size_t nout_this_cycle = 0;
-    size_t nin = crypto_rx->needed_modem_samples();
-    while (input_resampler->available_elems() >= nin)
+    const audio_sample_t* modem_frames[MAX_MODEM_IN_PORTS] = { nullptr };
+    const audio_sample_t* modem_q_frames[MAX_MODEM_IN_PORTS] = { nullptr };
+    for (size_t i = 0; i < MAX_MODEM_IN_PORTS; ++i)
     {
-        short demod_in[n_max_modem_samples];
-        short voice_out[n_max_speech_samples] = {0};
-
-        input_resampler->dequeue(demod_in, nin);
-
-        const size_t nout = crypto_rx->receive(voice_out, demod_in);
-        output_resampler->enqueue(voice_out, nout);
-        nout_this_cycle += nout;
-
-        /* IMPORTANT: don't forget to do this in the while loop to
-           ensure we fread the correct number of samples: ie update
-           "nin" before every call to freedv_rx()/freedv_comprx() */
-        nin = crypto_rx->needed_modem_samples();
-    }
-
-    // If modem data going into the demodulator this cycle
-    // results in voice data coming out, or there is no modem
-    // data going into the demodulator this cycle (which can
-    // happen if) the jack buffer size is smaller than the modem
-    // frame size, then consider the output "active"
-    // The first time modem data going into the demodulator results
-    // in no voice data coming out, that indicates a gap in
-    // transmission
-    jack_default_audio_sample_t* const voice_frames =
-        (jack_default_audio_sample_t*)jack_port_get_buffer(voice_port, nframes);
-
-    // When the radio is active and modem data is coming in we
-    // are mostly concerned about having enough data to put onto the
-    // voice port during the next time this process runs without
-    // underflowing. So make sure the output buffer is "primed"
-    // before starting to output data onto the port
-    const uint voice_resampled_frames =
-        get_nom_resampled_frames(n_nom_speech_samples,
-                                 voice_sample_rate,
-                                 jack_sample_rate);
-    const size_t to_deque = std::min(output_resampler->available_elems(),
-                                     (size_t)nframes);
-    const size_t to_fill = nframes - to_deque;
-    output_resampler->dequeue(voice_frames, to_deque);
-    if (to_fill > 0)
-    {
-        zeroize_frames(voice_frames + to_deque, to_fill);
-    }
-
-    if (play_notification_sound)
-    {
-        const encryption_status crypto_stat = crypto_rx->get_encryption_status();
-        if (crypto_stat == CRYPTO_STATUS_ENCRYPTED) {
-            notification_buffer.insert(notification_buffer.cend(),
-                                       crypto_startup.cbegin(),
-                                       crypto_startup.cend());
+        if (st.modem_ports[i] >= 0)
+        {
+            modem_frames[i] = backend->port_buffer(st.modem_ports[i], nframes);
         }
-        else {
-            notification_buffer.insert(notification_buffer.cend(),
-                                       plain_startup.cbegin(),
-                                       plain_startup.cend());
+        if (st.modem_q_ports[i] >= 0)
+        {
+            modem_q_frames[i] = backend->port_buffer(st.modem_q_ports[i], nframes);
         }
     }
 
-    if (play_wave_sound)
-    {
-        notification_buffer.insert(notification_buffer.cend(),
-                                   wave_sound.cbegin(),
-                                   wave_sound.cend());
-    }
+    audio_sample_t* const voice_frames = backend->port_buffer(voice_port, nframes);
+    audio_sample_t* const notification_frames = backend->port_buffer(notification_port, nframes);
 
-    jack_default_audio_sample_t* const notification_frames =
-        (jack_default_audio_sample_t*)jack_port_get_buffer(notification_port, nframes);
-    if (notification_buffer.empty() == false)
-    {
-        const jack_nframes_t n_notification_frames =
-            std::min(nframes, static_cast<jack_nframes_t>(notification_buffer.size()));
-        const auto notification_end = notification_buffer.cbegin() + n_notification_frames;
-        std::copy(notification_buffer.cbegin(), notification_end, notification_frames);
-        notification_buffer.erase(notification_buffer.cbegin(), notification_end);
-        if (n_notification_frames < nframes)
-        {
-            zeroize_frames(notification_frames + n_notification_frames,
-                           nframes - n_notification_frames);
-        }
-    }
-    else
+    engine.process(st,
+                   modem_frames,
+                   modem_q_frames,
+                   voice_frames,
+                   notification_frames,
+                   nframes,
+                   backend->sample_rate());
+
+    if (capture.is_open())
     {
-        zeroize_frames(notification_frames, nframes);
+        const audio_sample_t* buffers[2 + 2 * MAX_MODEM_IN_PORTS];
+        buffers[0] = voice_frames;
+        buffers[1] = notification_frames;
+        std::copy(modem_frames, modem_frames + MAX_MODEM_IN_PORTS, buffers + 2);
+        std::copy(modem_q_frames, modem_q_frames + MAX_MODEM_IN_PORTS, buffers + 2 + MAX_MODEM_IN_PORTS);
+        capture.write_cycle(nframes, 0, metric_now_ns() - start_ns, buffers);
     }
-
     return 0;
 }
 
-static bool connect_input_ports(jack_port_t* output_port,
-                                const char* input_port_regex)
-{
-    return connect_input_ports(client, output_port, input_port_regex);
-}
-
-static void activate_client()
+static void set_buffer_size(const rx_state& st)
 {
     char buffer[128] = {0};
+    crypto_rx_common* crypto_rx = st.crypto_rx;
     const struct config* cfg = crypto_rx->get_config();
 
-    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
+    const uint sample_rate = backend->sample_rate();
     const uint speech_sample_rate = crypto_rx->speech_sample_rate();
     const uint speech_samples_per_frame = crypto_rx->speech_samples_per_frame();
     const uint speech_period = get_nom_resampled_frames(speech_samples_per_frame,
                                                         speech_sample_rate,
-                                                        jack_sample_rate);
+                                                        sample_rate);
 
-    jack_nframes_t period = get_jack_period(cfg);
+    uint period = get_jack_period(cfg);
     if (period == 0)
     {
         period = speech_period;
@@ -268,166 +198,365 @@ static void activate_client()
     }
 
     crypto_rx->log_to_logger(LOG_INFO, buffer);
-    jack_set_buffer_size(client, period);
+    backend->set_buffer_size(period);
+}
 
-    /* Tell the JACK server that we are ready to roll.  Our
-     * process() callback will start running now. */
-    if (jack_activate (client))
+// Returns false if any port could not be connected
+static bool connect_ports(const rx_state& st, const struct config* cfg)
+{
+    /* Get the ports from which we will get data */
+    for (size_t i = 0; i < st.rx_diversity->num_branches(); ++i)
     {
-        fprintf (stderr, "cannot activate client");
-        exit (1);
-    }
+        const char* capture_port_name =
+            *cfg->jack_modem_in_port[i] ? cfg->jack_modem_in_port[i] : "system:capture_1";
+        if (!backend->connect(st.modem_ports[i], capture_port_name))
+        {
+            fprintf(stderr, "Could not connect modem port to %s\n", capture_port_name);
+            return false;
+        }
 
-    /* Get the port from which we will get data */
-    const char* capture_port_name =
-        *cfg->jack_modem_in_port ? cfg->jack_modem_in_port : "system:capture_1";
-    if (jack_connect(client, capture_port_name, jack_port_name(modem_port)) != 0)
-    {
-        fprintf(stderr, "Could not connect modem port");
-        exit (1);
+        if (st.rx_diversity->iq_input())
+        {
+            const char* capture_q_port_name =
+                *cfg->jack_modem_in_q_port[i] ? cfg->jack_modem_in_q_port[i] : "system:capture_2";
+            if (!backend->connect(st.modem_q_ports[i], capture_q_port_name))
+            {
+                fprintf(stderr, "Could not connect modem Q port to %s\n", capture_q_port_name);
+                return false;
+            }
+        }
     }
 
     const char* voice_playback_port_regex =
         *cfg->jack_voice_out_port ? cfg->jack_voice_out_port : "system:playback_*";
-    if (!connect_input_ports(voice_port, voice_playback_port_regex))
+    if (!backend->connect(voice_port, voice_playback_port_regex))
     {
-        exit(1);
+        fprintf(stderr, "Could not connect voice port to %s\n", voice_playback_port_regex);
+        return false;
     }
 
     const char* notify_playback_port_regex =
         *cfg->jack_notify_out_port ? cfg->jack_notify_out_port : "system:playback_*";
-    if (!connect_input_ports(notification_port, notify_playback_port_regex))
+    if (!backend->connect(notification_port, notify_playback_port_regex))
+    {
+        fprintf(stderr, "Could not connect notification port to %s\n", notify_playback_port_regex);
+        return false;
+    }
+
+    return true;
+}
+
+static void activate_client()
+{
+    const rx_state& st = *state.active();
+    set_buffer_size(st);
+
+    /* Tell the backend that we are ready to roll.  Our
+     * process() callback will start running now. */
+    if (!backend->activate())
+    {
+        fprintf (stderr, "cannot activate client");
+        exit (1);
+    }
+
+    if (!connect_ports(st, st.crypto_rx->get_config()))
     {
         exit(1);
     }
+}
 
-    initialized = 1;
+static void disconnect_ports()
+{
+    for (size_t i = 0; i < MAX_MODEM_IN_PORTS; ++i)
+    {
+        if (modem_ports[i] >= 0)
+        {
+            backend->disconnect(modem_ports[i]);
+        }
+        if (modem_q_ports[i] >= 0)
+        {
+            backend->disconnect(modem_q_ports[i]);
+        }
+    }
+    backend->disconnect(voice_port);
+    backend->disconnect(notification_port);
 }
 
-static void initialize_crypto()
+// Goes back to the connections of the running config when those of a new
+// one can't be made, so a mistyped port name doesn't take the client down
+static void restore_ports()
 {
-    crypto_rx = nullptr;
-    input_resampler = nullptr;
-    output_resampler = nullptr;
+    state.active()->crypto_rx->log_to_logger(LOG_ERROR,
+                                             "Could not connect the ports of the new config, "
+                                             "keeping the current connections");
+    disconnect_ports();
+    connect_ports(*state.active(), &running_config.cfg);
+}
 
-    crypto_rx.reset(new crypto_rx_common("crypto_rx", config_file));
+static std::string modem_port_name(size_t idx, bool q_port)
+{
+    char port_name[32];
+    if (idx == 0)
+    {
+        snprintf(port_name, sizeof(port_name), "modem_in%s", q_port ? "_q" : "");
+    }
+    else
+    {
+        snprintf(port_name,
+                 sizeof(port_name),
+                 "modem_in_%u%s",
+                 (uint)(idx + 1),
+                 q_port ? "_q" : "");
+    }
 
-    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-    const uint speech_sample_rate = crypto_rx->speech_sample_rate();
-    const uint modem_sample_rate = crypto_rx->modem_sample_rate();
-
-    const size_t speech_frames =
-        get_max_resampled_frames(crypto_rx->max_speech_samples_per_frame(),
-                                 speech_sample_rate,
-                                 jack_sample_rate);
-    const size_t modem_frames =
-        get_max_resampled_frames(crypto_rx->max_modem_samples_per_frame(),
-                                 modem_sample_rate,
-                                 jack_sample_rate);
-
-    input_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, modem_frames * 2));
-    output_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, speech_frames * 2));
-
-    input_resampler->set_sample_rates(jack_sample_rate, modem_sample_rate);
-    output_resampler->set_sample_rates(speech_sample_rate, jack_sample_rate);
-
-    // Pre-initialize the resamplers with null data to "prime" the resampler,
-    // then discard the results. The resampler delays the output by some
-    // number of samples, and we want to make sure that we always have the
-    // same number of bytes available coming out as went in
-    input_resampler->enqueue_zeroes(jack_get_buffer_size(client));
-    input_resampler->clear();
-
-    output_resampler->enqueue_zeroes(crypto_rx->max_speech_samples_per_frame());
-    output_resampler->clear();
+    return port_name;
 }
 
-int main(int argc, char *argv[])
+static int register_modem_port(size_t idx, bool q_port)
 {
-    const char* client_name = "crypto_rx";
-    const char* server_name = nullptr;
-    jack_options_t options = JackNullOption;
-    jack_status_t status;
+    const int port = backend->register_port(modem_port_name(idx, q_port).c_str(), false);
+    if (port < 0)
+    {
+        fprintf(stderr, "no more ports available\n");
+        exit (1);
+    }
+
+    return port;
+}
 
-    if (argc > 2)
+static void register_modem_ports(size_t num_ports, bool iq_input)
+{
+    // Ports for additional diversity inputs and Q inputs are registered the
+    // first time they are configured and then left alone
+    for (size_t i = 0; i < num_ports; ++i)
     {
-        server_name = argv[1];
-        options = (jack_options_t)(JackNullOption | JackServerName | JackNoStartServer);
+        if (modem_ports[i] < 0)
+        {
+            modem_ports[i] = register_modem_port(i, false);
+        }
+        if (iq_input && modem_q_ports[i] < 0)
+        {
+            modem_q_ports[i] = register_modem_port(i, true);
+        }
+    }
+}
+
+static void write_diversity_stats()
+{
+    static const char* STATS_FILE = "/var/run/rx_diversity";
+    static const char* STATS_TMP_FILE = "/var/run/rx_diversity.tmp";
 
-        config_file = argv[2];
+    const crypto_rx_diversity* rx_diversity = state.active()->rx_diversity.get();
+    if (rx_diversity->num_branches() <= 1)
+    {
+        return;
     }
-    else
+
+    FILE* f = fopen(STATS_TMP_FILE, "w");
+    if (f == nullptr)
     {
-        fprintf(stderr, "Usage: jack_crypto_rx <jack server name> <config file>");
-        exit(1);
+        return;
+    }
+
+    for (size_t i = 0; i < rx_diversity->num_branches(); ++i)
+    {
+        const rx_branch_stats stats = rx_diversity->get_branch_stats(i);
+        fprintf(f,
+                "branch=%u selected=%d signal=%d synced=%d snr=%.1f "
+                "frames_decoded=%llu frames_selected=%llu\n",
+                (uint)(i + 1),
+                (int)stats.selected,
+                (int)stats.has_signal,
+                (int)stats.synced,
+                stats.snr_est,
+                (unsigned long long)stats.frames_decoded,
+                (unsigned long long)stats.frames_selected);
+    }
+
+    fclose(f);
+    rename(STATS_TMP_FILE, STATS_FILE);
+}
+
+static rx_state* create_state()
+{
+    rx_state* st = create_rx_state(config_file,
+                                   backend->sample_rate(),
+                                   backend->buffer_size(),
+                                   backend->realtime_priority());
+    register_modem_ports(st->rx_diversity->num_branches(), st->rx_diversity->iq_input());
+    std::copy(modem_ports, modem_ports + MAX_MODEM_IN_PORTS, st->modem_ports);
+    std::copy(modem_q_ports, modem_q_ports + MAX_MODEM_IN_PORTS, st->modem_q_ports);
+
+    return st;
+}
+
+// Builds new demodulators from the config file while the current ones keep
+// running, then hands them to the realtime thread, which switches over at
+// the start of its next cycle. The old ones are destroyed by
+// state.reclaim() once the realtime thread is done with them
+static void reload_crypto(const config_snapshot& next_config, bool reconnect)
+{
+    std::unique_ptr<rx_state> next;
+    try
+    {
+        next.reset(create_state());
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "%s", ex.what());
+        state.active()->crypto_rx->log_to_logger(LOG_ERROR,
+                                                 "Could not reload config, keeping the current one");
+        return;
     }
 
-    fprintf(stderr, "Server name: %s\n", server_name ? server_name : "");
+    if (reconnect)
+    {
+        disconnect_ports();
+    }
+    if (!connect_ports(*next, next->crypto_rx->get_config()))
+    {
+        restore_ports();
+        return;
+    }
+    set_buffer_size(*next);
+    initialize_tracing(next->crypto_rx->get_config());
+    // Replaces any squelch update still queued for the old demodulators,
+    // which would otherwise be applied to the new ones
+    squelch_update.publish(new config(next_config.cfg));
+    state.publish(next.release());
+
+    running_config = next_config;
+    control.watch_file(running_config.cfg.key_file);
+}
 
-    /* open a client connection to the JACK server */
+// Applies only what changed in the config and key files. Squelch settings
+// and port connections are changed on the running demodulators, anything
+// else needs new ones
+static void apply_config_changes(bool force_reload)
+{
+    config_snapshot next;
+    read_config_snapshot(config_file, next);
+
+    const int diff = diff_config_snapshot(running_config, next);
+    const int rebuild_diff = CONFIG_DIFF_KEY | CONFIG_DIFF_MODE | CONFIG_DIFF_OTHER;
+    // A squelch update can't be applied to demodulators the realtime
+    // thread hasn't switched to yet, so those are replaced again instead
+    if (force_reload || (diff & rebuild_diff) != 0 ||
+        (diff != 0 && state.swap_pending()))
+    {
+        reload_crypto(next, (diff & CONFIG_DIFF_PORTS) != 0);
+        return;
+    }
+
+    if ((diff & CONFIG_DIFF_SQUELCH) != 0)
+    {
+        squelch_update.publish(new config(next.cfg));
+        state.active()->crypto_rx->log_to_logger(LOG_INFO, "Updated squelch settings");
+    }
 
-    client = jack_client_open (client_name, options, &status, server_name);
-    if (client == NULL)
+    if ((diff & CONFIG_DIFF_PORTS) != 0)
     {
-        fprintf (stderr,
-                 "jack_client_open() failed, "
-                 "status = 0x%2.0x\n",
-                 status);
-        if (status & JackServerFailed)
+        disconnect_ports();
+        if (!connect_ports(*state.active(), &next.cfg))
         {
-            fprintf (stderr, "Unable to connect to JACK server\n");
+            restore_ports();
+            return;
+        }
+    }
+
+    running_config = next;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: jack_crypto_rx [-c <capture file>] <jack server name> <config file>\n"
+            "       jack_crypto_rx [-c <capture file>] -f <dir> [-r <sample rate>] <config file>\n"
+            "       jack_crypto_rx [-c <capture file>] -n [-r <sample rate>] <config file>\n"
+            "  -c  Record the ports of every cycle to this file, for\n"
+            "      crypto_replay\n"
+            "  -f  Run without JACK, reading modem_in.wav from dir and writing\n"
+            "      voice_out.wav and notification_out.wav to it as fast as\n"
+            "      possible. Exits at the end of the input\n"
+            "  -n  Run without JACK, with a timer for a sound card and silence\n"
+            "      for the modem input\n"
+            "  -r  The sample rate of the ports without JACK. The default is\n"
+            "      48000\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char* file_dir = nullptr;
+    const char* capture_file = nullptr;
+    bool null_audio = false;
+    uint sample_rate = 48000;
+    int opt;
+
+    control_loop::block_signals(CONTROL_SIGNALS);
+
+    while ((opt = getopt(argc, argv, "c:f:nr:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c': capture_file = optarg; break;
+        case 'f': file_dir = optarg; break;
+        case 'n': null_audio = true; break;
+        case 'r': sample_rate = strtoul(optarg, nullptr, 0); break;
+        default:
+            usage();
+            exit(1);
         }
-        exit (1);
     }
-    if (status & JackServerStarted)
+
+    const bool use_jack = file_dir == nullptr && !null_audio;
+    if (argc - optind != (use_jack ? 2 : 1) || sample_rate == 0)
+    {
+        usage();
+        exit(1);
+    }
+
+    if (use_jack)
     {
-        fprintf (stderr, "JACK server started\n");
+        backend = open_jack_backend("crypto_rx", argv[optind]);
     }
-    if (status & JackNameNotUnique)
+    else if (file_dir != nullptr)
     {
-        client_name = jack_get_client_name(client);
-        fprintf (stderr, "unique name `%s' assigned\n", client_name);
+        backend = open_file_backend(file_dir, sample_rate);
     }
+    else
+    {
+        backend = open_null_backend(sample_rate);
+    }
+    config_file = argv[argc - 1];
 
-    /* tell the JACK server to call `process()' whenever
-       there is work to be done.
-    */
-    jack_set_process_callback (client, process, nullptr);
+    if (!backend)
+    {
+        exit (1);
+    }
 
-    /* tell the JACK server to call `jack_shutdown()' if
-       it ever shuts down, either entirely, or if it
-       just decides to stop calling us.
+    /* tell the backend to call `process()' whenever there is work to be
+       done, and `backend_shutdown()' if it stops calling us.
     */
-    jack_on_shutdown (client, jack_shutdown, 0);
-
-    /* create two ports */
-    voice_port = jack_port_register(client,
-                                    "voice_out",
-                                    JACK_DEFAULT_AUDIO_TYPE,
-                                    JackPortIsOutput,
-                                    0);
-
-    modem_port = jack_port_register(client,
-                                    "modem_in",
-                                    JACK_DEFAULT_AUDIO_TYPE,
-                                    JackPortIsInput,
-                                    0);
-
-    notification_port = jack_port_register(client,
-                                           "notification_out",
-                                           JACK_DEFAULT_AUDIO_TYPE,
-                                           JackPortIsOutput,
-                                           0);
-
-    if ((voice_port == NULL) || (modem_port == NULL) || (notification_port == NULL))
-    {
-        fprintf(stderr, "no more JACK ports available\n");
+    backend->set_callbacks(process, backend_xrun, backend_shutdown, nullptr);
+
+    std::fill_n(modem_ports, MAX_MODEM_IN_PORTS, -1);
+    std::fill_n(modem_q_ports, MAX_MODEM_IN_PORTS, -1);
+
+    /* create three ports */
+    voice_port = backend->register_port("voice_out", true);
+    modem_ports[0] = backend->register_port("modem_in", false);
+    notification_port = backend->register_port("notification_out", true);
+
+    if ((voice_port < 0) || (modem_ports[0] < 0) || (notification_port < 0))
+    {
+        fprintf(stderr, "no more ports available\n");
         exit (1);
     }
 
+    read_config_snapshot(config_file, running_config);
     try
     {
-        initialize_crypto();
+        state.reset(create_state());
     }
     catch (const std::exception& ex)
     {
@@ -435,7 +564,9 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
-    const struct config* cfg = crypto_rx->get_config();
+    const struct config* cfg = state.active()->crypto_rx->get_config();
+    audio_buffer_t crypto_startup;
+    audio_buffer_t plain_startup;
     if (cfg->jack_secure_notify_file[0])
     {
         read_wav_file(cfg->jack_secure_notify_file, crypto_startup);
@@ -444,47 +575,114 @@ int main(int argc, char *argv[])
     {
         read_wav_file(cfg->jack_insecure_notify_file, plain_startup);
     }
+    engine.set_startup_sounds(std::move(crypto_startup), std::move(plain_startup));
+
+    initialize_tracing(cfg);
+    atexit(write_trace);
+
+    if (capture_file != nullptr)
+    {
+        std::vector<capture_port> capture_ports = { { "voice_out", true }, { "notification_out", true } };
+        for (int q_port = 0; q_port <= 1; ++q_port)
+        {
+            for (size_t i = 0; i < MAX_MODEM_IN_PORTS; ++i)
+            {
+                capture_ports.push_back({ modem_port_name(i, q_port), false });
+            }
+        }
+
+        if (!capture.open(capture_file, "crypto_rx", backend->sample_rate(), capture_ports))
+        {
+            fprintf(stderr, "Could not open %s\n", capture_file);
+            exit(1);
+        }
+    }
 
     activate_client();
 
-    signal(SIGQUIT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGHUP, handle_sighup);
-    signal(SIGUSR1, handle_sigusr1);
-    signal(SIGINT, signal_handler);
+    if (!metrics.start(METRICS_SOCKET))
+    {
+        state.active()->crypto_rx->log_to_logger(LOG_WARN, "Could not start metrics server");
+    }
 
-    while (true)
+    if (!control.open(CONTROL_SIGNALS, config_file))
     {
-        if (reload_config != 0)
+        fprintf(stderr, "Could not create control loop\n");
+        exit(1);
+    }
+    control.watch_file(running_config.cfg.key_file);
+
+    static const uint64_t STATS_INTERVAL_NS = 1000000000ull;
+    uint64_t next_stats_ns = 0;
+    bool running = true;
+    control_events events;
+    while (running)
+    {
+        const uint64_t now_ns = metric_now_ns();
+        if (now_ns >= next_stats_ns)
         {
-            reload_config = 0;
+            write_diversity_stats();
+            next_stats_ns = now_ns + STATS_INTERVAL_NS;
+        }
+
+        const int timeout_ms = static_cast<int>((next_stats_ns - now_ns + 999999) / 1000000);
+        control.wait(timeout_ms, events);
 
-            jack_deactivate(client);
-            try
+        bool reload = false;
+        for (int sig : events.signals)
+        {
+            switch (sig)
             {
-                initialize_crypto();
-            }
-            catch (const std::exception& ex)
+            case SIGHUP:
+                reload = true;
+                break;
+            case SIGUSR1:
             {
-                fprintf(stderr, "%s", ex.what());
-                exit(1);
+                audio_buffer_t wave_sound;
+                if (read_wav_file("/tmp/notify.wav", wave_sound))
+                {
+                    engine.play(std::move(wave_sound));
+                }
+                break;
+            }
+            case SIGUSR2:
+                write_trace();
+                break;
+            default:
+                running = false;
+                break;
             }
-            activate_client();
         }
 
-        if (read_wav != 0)
+        // SIGHUP always rebuilds the demodulators, a change to the watched
+        // files only updates what changed
+        if (running && (reload || events.config_changed))
         {
-            read_wav = 0;
+            apply_config_changes(reload);
+        }
 
-            if (read_wav_file("/tmp/notify.wav", wave_sound))
-            {
-                play_wav = 1;
-            }
+        // Frees the previous demodulators, squelch settings and sound once
+        // the realtime thread has switched over
+        state.reclaim();
+        squelch_update.reclaim();
+        engine.reclaim_played();
+    }
+
+    fprintf(stderr, "signal received, exiting ...\n");
+    backend.reset();
+
+    if (capture_file != nullptr)
+    {
+        const uint64_t dropped = capture.dropped();
+        if (!capture.close())
+        {
+            fprintf(stderr, "Could not write %s\n", capture_file);
+        }
+        if (dropped > 0)
+        {
+            fprintf(stderr, "%llu cycles were left out of %s\n", (unsigned long long)dropped, capture_file);
         }
-        sleep(1);
     }
-    
-    jack_client_close (client);
     return 0;
 }
 
@@ -18,19 +18,19 @@
   along with this program; if not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <errno.h>
+#include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include <vector>
-#include <deque>
 #include <memory>
 
 #include <gpiod.h>
 
-#include <jack/jack.h>
-
 #include "freedv_api.h"
 
 #include "resampler.h"
@@ -39,301 +39,178 @@
 #include "crypto_tx_common.h"
 #include "crypto_common.h"
 #include "jack_common.h"
+#include "crypto_metrics.h"
+#include "crypto_trace.h"
+#include "rt_handoff.h"
+#include "control_loop.h"
+#include "audio_backend.h"
+#include "tx_engine.h"
+#include "capture.h"
 
-static std::unique_ptr<crypto_tx_common> crypto_tx;
-
-static jack_port_t* voice_port = nullptr;
-static jack_port_t* modem_port = nullptr;
-static jack_client_t* client = nullptr;
+static const char* METRICS_SOCKET = "/var/run/crypto_tx.sock";
 
-static std::unique_ptr<resampler> input_resampler;
-static std::unique_ptr<resampler> output_resampler;
+static crypto_metrics metrics;
+static tx_metrics     counters(metrics);
 
-static audio_buffer_t tts_file;
-static std::deque<jack_default_audio_sample_t> tts_buffer;
-
-static volatile sig_atomic_t reload_config = 0;
-static volatile sig_atomic_t read_wav = 0;
-static volatile sig_atomic_t play_wav = 0;
+// Handled by the main thread through the control loop. SIGRTMIN toggles
+// the PTT when no PTT GPIO is configured
+static const std::vector<int> CONTROL_SIGNALS =
+    { SIGHUP, SIGUSR1, SIGUSR2, SIGRTMIN, SIGINT, SIGQUIT, SIGTERM };
+static control_loop control;
 
 static volatile sig_atomic_t sig_ptt_val = 0;
 
 static const char* config_file = nullptr;
+static std::string trace_file;
 
 static struct gpiod_line* ptt_in_line = nullptr;
 static struct gpiod_line* ptt_out_line = nullptr;
 
-static void signal_handler(int sig)
-{
-    jack_client_close(client);
-    fprintf(stderr, "signal received, exiting ...\n");
-    exit(0);
-}
-
-static void handle_sighup(int sig)
-{
-    reload_config = 1;
-}
-
-static void handle_sigusr1(int sig)
-{
-    read_wav = 1;
-}
-
-static void handle_sigptt(int sig)
+static void write_trace()
 {
-    sig_ptt_val = !sig_ptt_val;
-}
-
-static bool microphone_enabled(const struct config* cfg)
-{
-    if (cfg->ptt_enabled && cfg->ptt_gpio_num < 0)
-    {
-        return sig_ptt_val != 0;
-    }
-    else if (ptt_in_line != nullptr)
-    {
-        const int result = gpiod_line_get_value(ptt_in_line);
-        if (result < 0)
-        {
-            crypto_tx->log_to_logger(LOG_ERROR, "Error reading PTT IO");
-            return true;
-        }
-        else
-        {
-            return result;
-        }
-    }
-    else
+    if (!trace_file.empty())
     {
-        return true;
+        trace_dump(trace_file.c_str());
     }
 }
 
-static void set_ptt_val(const struct config* cfg, bool val)
+static void initialize_tracing(const struct config* cfg)
 {
-    static int prev_val = -1;
-    const int cur_val = static_cast<int>(val);
-
-    if (ptt_out_line == nullptr)
-    {
-        prev_val = -1;
-        return;
-    }
-    else if (prev_val != cur_val &&
-             gpiod_line_set_value(ptt_out_line, cur_val) == 0)
-    {
-        prev_val = cur_val;
-    }
+    trace_file = get_trace_file(cfg, "crypto_tx");
+    trace_enable(!trace_file.empty());
 }
 
-/**
- * JACK calls this shutdown_callback if the server ever shuts down or
- * decides to disconnect the client.
- */
-void jack_shutdown(void *arg)
+// The PTT GPIO lines, or SIGRTMIN toggling the microphone when there is no
+// PTT input GPIO
+class gpio_ptt : public tx_ptt
 {
-    exit (1);
-}
-
-/**
- * The process callback for this JACK application is called in a
- * special realtime thread once for each audio cycle.
- *
- * This client follows a simple rule: when the JACK transport is
- * running, copy the input port to the output.  When it stops, exit.
- */
-int process(jack_nframes_t nframes, void *arg)
-{
-    const jack_default_audio_sample_t* const voice_frames =
-        (jack_default_audio_sample_t*)jack_port_get_buffer(voice_port, nframes);
-    jack_default_audio_sample_t* const modem_frames =
-            (jack_default_audio_sample_t*)jack_port_get_buffer(modem_port, nframes);
-
-    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-    const uint voice_sample_rate = crypto_tx->speech_sample_rate();
-    const uint modem_sample_rate = crypto_tx->modem_sample_rate();
-
-    input_resampler->set_sample_rates(jack_sample_rate, voice_sample_rate);
-    output_resampler->set_sample_rates(modem_sample_rate, jack_sample_rate);
-
-    const struct config* cfg = crypto_tx->get_config();
-
-    const size_t n_nom_modem_samples = crypto_tx->modem_samples_per_frame();
-    const size_t n_speech_samples = crypto_tx->speech_samples_per_frame();
-
-    if (play_wav != 0)
-    {
-        play_wav = 0;
-
-        // Zero-pad a few frames at the start to give the encryption a
-        // chance to sync
-        tts_buffer.insert(tts_buffer.cend(), nframes * 6, 0.0);
-        tts_buffer.insert(tts_buffer.cend(), tts_file.cbegin(), tts_file.cend());
-    }
-
-    static uint delay_periods = 0;
-    static bool transmitting_prev = false;
-
-    const bool mic_enabled = microphone_enabled(cfg);
-    const bool transmitting_cur = mic_enabled || !tts_buffer.empty();
-    if (transmitting_cur)
+public:
+    bool mic_enabled(crypto_tx_common& crypto_tx) override
     {
-        delay_periods = 0;
-
-        // Only "prime" the resamplers on the "rising edge"
-        if (!transmitting_prev)
-        {
-            input_resampler->enqueue_zeroes(nframes);
-            input_resampler->clear();
-
-            output_resampler->enqueue_zeroes(n_nom_modem_samples);
-            output_resampler->clear();
-        }
-
-        // Turn on the PTT output
-        set_ptt_val(cfg, true);
+        const struct config* cfg = crypto_tx.get_config();
 
-        const size_t tts_to_add = std::min(tts_buffer.size(), (size_t)nframes);
-        if (tts_to_add > 0)
+        if (cfg->ptt_enabled && cfg->ptt_gpio_num < 0)
         {
-            input_resampler->enqueue(tts_buffer.begin(),
-                                     tts_buffer.begin() + tts_to_add);
-            tts_buffer.erase(tts_buffer.begin(), tts_buffer.begin() + tts_to_add);
+            m_mic_enabled = sig_ptt_val != 0;
         }
-
-        // Offset the voice samples so TTS doesn't add delay to the signal
-        const jack_nframes_t voice_to_add = nframes - tts_to_add;
-        // Only add voice if the mic is hot. Otherwise add zeroes
-        if (mic_enabled)
+        else if (ptt_in_line != nullptr)
         {
-            input_resampler->enqueue(voice_frames + tts_to_add, voice_to_add);
+            const int result = gpiod_line_get_value(ptt_in_line);
+            if (result < 0)
+            {
+                crypto_tx.log_to_logger(LOG_ERROR, "Error reading PTT IO");
+                m_mic_enabled = true;
+            }
+            else
+            {
+                m_mic_enabled = result;
+            }
         }
         else
         {
-            input_resampler->enqueue_zeroes(voice_to_add);
+            m_mic_enabled = true;
         }
 
-        // Now add the remaining frames without zero-padding
-        while (input_resampler->available_elems() >= n_speech_samples)
-        {
-            short mod_out[n_nom_modem_samples];
-            short voice_in[n_speech_samples];
-            input_resampler->dequeue(voice_in, n_speech_samples);
-
-            const size_t nout = crypto_tx->transmit(mod_out, voice_in);
+        return m_mic_enabled;
+    }
 
-            output_resampler->enqueue(mod_out, nout);
-        }
+    void set_output(bool val) override
+    {
+        const int cur_val = static_cast<int>(val);
+        m_output = val;
 
-        const uint modem_resampled_frames =
-            get_nom_resampled_frames(n_nom_modem_samples,
-                                     modem_sample_rate,
-                                     jack_sample_rate);
-        const uint required_frames =
-            (modem_resampled_frames + (nframes - 1)) / nframes;
-        const uint required_elems = nframes * required_frames;
-        if (output_resampler->available_elems() >= required_elems)
+        if (ptt_out_line == nullptr)
         {
-            output_resampler->dequeue(modem_frames, nframes);
+            m_prev_val = -1;
+            return;
         }
-        else
+        else if (m_prev_val != cur_val &&
+                 gpiod_line_set_value(ptt_out_line, cur_val) == 0)
         {
-            zeroize_frames(modem_frames, nframes);
+            m_prev_val = cur_val;
         }
     }
-    else
+
+    // The PTT state of the last cycle, for the capture file
+    uint32_t capture_flags() const
     {
-        // Only flush on the "falling edge"
-        if (transmitting_prev)
-        {
-            // When the microphone is off we have to make sure we have flushed
-            // all the voice and modem data out of the system and onto the modem
-            // port.
+        return (m_mic_enabled ? CAPTURE_MIC_ENABLED : 0) |
+               (m_output ? CAPTURE_PTT_OUT : 0);
+    }
 
-            // Flush the input resampler to make sure all internal state is
-            // written out. This will also reset the libsamplerate
-            // state file
-            input_resampler->flush(n_speech_samples * 2);
+private:
+    int  m_prev_val = -1;
+    bool m_mic_enabled = false;
+    bool m_output = false;
+};
 
-            // Run all the input data through the modem
-            while (input_resampler->available_elems() != 0)
-            {
-                short mod_out[n_nom_modem_samples];
-                // Initializing this buffer to zero will zero-fill the end
-                // if there aren't a multiple of n_speech_samples in the
-                // input queue
-                short voice_in[n_speech_samples] = {0};
-                input_resampler->dequeue(voice_in,
-                                         std::min(n_speech_samples,
-                                                  input_resampler->available_elems()));
-
-                const size_t nout = crypto_tx->transmit(mod_out, voice_in);
-
-                output_resampler->enqueue(mod_out, nout);
-            }
+static gpio_ptt ptt;
+static tx_engine engine(counters, ptt, &control);
+static rt_handoff<tx_state>& state = engine.state();
+// The config the running encoder was built from
+static config_snapshot running_config;
 
-            // Now that the output resampler has all the data it will, flush
-            // it to make sure all internal state is written out. This will
-            // also reset the libsamplerate state file
-            output_resampler->flush(nframes * 2);
-        }
+static std::unique_ptr<audio_backend> backend;
+static int voice_port = -1;
+static int modem_port = -1;
 
-        // Write out as much data to the modem port as we can. There may
-        // be a few cycles' worth of data queued.
-        const size_t available_frames =
-            std::min((size_t)nframes, output_resampler->available_elems());
-        const size_t remaining_frames = nframes - available_frames;
-        output_resampler->dequeue(modem_frames, available_frames);
-        if (remaining_frames > 0)
-        {
-            zeroize_frames(modem_frames + available_frames, remaining_frames);
-        }
-
-        // Force a new IV next time the microphone is active now that
-        // the codec is idle
-        crypto_tx->force_rekey_next_frame();
+// Records every cycle when started with -c
+static capture_writer capture;
 
-        // Once the buffer is empty turn off the PTT output after a delay
-        if (available_frames == 0)
-        {
-            static const uint PTT_DEAD_KEY_PERIODS = 4;
-            if (delay_periods == PTT_DEAD_KEY_PERIODS)
-            {
-                set_ptt_val(cfg, false);
-            }
-            else
-            {
-                ++delay_periods;
-            }
-        }
+// The backend stopped calling process(). Running out of input is a normal
+// end for the file backend, anything else is fatal
+static void backend_shutdown(bool finished, void* arg)
+{
+    if (finished)
+    {
+        kill(getpid(), SIGTERM);
     }
+    else
+    {
+        exit (1);
+    }
+}
 
-    transmitting_prev = transmitting_cur;
-
+static int backend_xrun(void* arg)
+{
+    metric_add(counters.xruns);
+    TRACE_INSTANT("xrun");
+    capture.xrun();
     return 0;
 }
 
-static bool connect_input_ports(jack_port_t* output_port,
-                                const char* input_port_regex)
+// Called by the backend on its audio thread once for each cycle
+static int process(uint nframes, void* arg)
 {
-    return connect_input_ports(client, output_port, input_port_regex);
+    const uint64_t start_ns = metric_now_ns();
+    const audio_sample_t* const voice_frames = backend->port_buffer(voice_port, nframes);
+    audio_sample_t* const modem_frames = backend->port_buffer(modem_port, nframes);
+
+    engine.process(voice_frames, modem_frames, nframes, backend->sample_rate());
+
+    if (capture.is_open())
+    {
+        const audio_sample_t* const buffers[] = { voice_frames, modem_frames };
+        capture.write_cycle(nframes, ptt.capture_flags(), metric_now_ns() - start_ns, buffers);
+    }
+    return 0;
 }
 
-static void activate_client()
+static void set_buffer_size(const tx_state& st)
 {
+    crypto_tx_common* crypto_tx = st.crypto_tx.get();
     const struct config* cfg = crypto_tx->get_config();
-    jack_nframes_t period = get_jack_period(cfg);
+    uint period = get_jack_period(cfg);
     char buffer[128] = {0};
     if (period == 0)
     {
-        const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
+        const uint sample_rate = backend->sample_rate();
         const uint modem_sample_rate = crypto_tx->modem_sample_rate();
         const uint modem_samples_per_frame = crypto_tx->modem_samples_per_frame();
 
         period = get_nom_resampled_frames(modem_samples_per_frame,
                                           modem_sample_rate,
-                                          jack_sample_rate);
+                                          sample_rate);
         snprintf(buffer,
                  sizeof(buffer),
                  "Buffer size: %u, Modem frame size: %u, Modem sample rate: %u",
@@ -347,58 +224,77 @@ static void activate_client()
     }
 
     crypto_tx->log_to_logger(LOG_INFO, buffer);
-    jack_set_buffer_size(client, period);
-
-    /* Tell the JACK server that we are ready to roll.  Our
-     * process() callback will start running now. */
-    if (jack_activate (client))
-    {
-        fprintf (stderr, "cannot activate client");
-        exit (1);
-    }
+    backend->set_buffer_size(period);
+}
 
-    /* Get the port from which we will get data */
+// Returns false if any port could not be connected
+static bool connect_ports(const struct config* cfg)
+{
+    /* Get the port from which we will get data. Ports stay connected when
+     * the config is reloaded */
     const char* capture_port_name =
         *cfg->jack_voice_in_port ? cfg->jack_voice_in_port : "system:capture_1";
-    if (jack_connect(client, capture_port_name, jack_port_name(voice_port)) != 0)
+    if (!backend->connect(voice_port, capture_port_name))
     {
-        fprintf(stderr, "Could not connect modem port");
-        exit (1);
+        fprintf(stderr, "Could not connect voice port to %s\n", capture_port_name);
+        return false;
     }
 
     const char* playback_port_regex =
         *cfg->jack_modem_out_port ? cfg->jack_modem_out_port : "system:playback_*";
-    if (!connect_input_ports(modem_port, playback_port_regex))
+    if (!backend->connect(modem_port, playback_port_regex))
     {
-        exit(1);
+        fprintf(stderr, "Could not connect modem port to %s\n", playback_port_regex);
+        return false;
     }
+
+    return true;
 }
 
-static void initialize_crypto()
+// Exits if the client can't be activated. Returns false if it is running
+// but its ports could not be connected
+static bool activate_client()
 {
-    crypto_tx = nullptr;
-    input_resampler = nullptr;
-    output_resampler = nullptr;
-
-    crypto_tx.reset(new crypto_tx_common("crypto_tx", config_file));
-
-    const size_t speech_frames =
-        get_nom_resampled_frames(crypto_tx->speech_samples_per_frame(),
-                                 crypto_tx->speech_sample_rate(),
-                                 jack_get_sample_rate(client));
-    const size_t modem_frames =
-        get_nom_resampled_frames(crypto_tx->modem_samples_per_frame(),
-                                 crypto_tx->modem_sample_rate(),
-                                 jack_get_sample_rate(client));
-
-    input_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, speech_frames * 2));
-    output_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, modem_frames * 2));
+    const tx_state& st = *state.active();
+    set_buffer_size(st);
+
+    /* Tell the backend that we are ready to roll.  Our
+     * process() callback will start running now. */
+    if (!backend->activate())
+    {
+        fprintf (stderr, "cannot activate client");
+        exit (1);
+    }
+
+    return connect_ports(st.crypto_tx->get_config());
 }
 
-static void initialize_ptt()
+static void disconnect_ports()
 {
-    const struct config* cfg = crypto_tx->get_config();
+    backend->disconnect(voice_port);
+    backend->disconnect(modem_port);
+}
+
+// Goes back to the connections of the running config when those of a new
+// one can't be made, so a mistyped port name doesn't take the client down
+static void restore_ports()
+{
+    state.active()->crypto_tx->log_to_logger(LOG_ERROR,
+                                             "Could not connect the ports of the new config, "
+                                             "keeping the current connections");
+    disconnect_ports();
+    connect_ports(&running_config.cfg);
+}
 
+static tx_state* create_state()
+{
+    return create_tx_state(config_file, backend->sample_rate());
+}
+
+// The GPIO lines are read and written by the realtime thread, so they can
+// only be changed while it is stopped
+static void initialize_ptt(const struct config* cfg)
+{
     if (ptt_in_line != nullptr)
     {
         gpiod_line_close_chip(ptt_in_line);
@@ -433,88 +329,175 @@ static void initialize_ptt()
     }
 }
 
-int main(int argc, char *argv[])
+// Builds a new encoder from the config file while the current one keeps
+// running, then hands it to the realtime thread, which switches over at the
+// start of its next cycle. The client is only stopped if the PTT lines
+// changed
+static void reload_crypto(const config_snapshot& next_config, int diff)
 {
-    const char* client_name = "crypto_tx";
-    const char* server_name = nullptr;
-    jack_options_t options = JackNullOption;
-    jack_status_t status;
-
-    struct config *cur = NULL;
-
-    if (argc > 2)
+    std::unique_ptr<tx_state> next;
+    try
+    {
+        next.reset(create_state());
+    }
+    catch (const std::exception& ex)
     {
-        server_name = argv[1];
-        options = (jack_options_t)(JackNullOption | JackServerName | JackNoStartServer);
+        fprintf(stderr, "%s", ex.what());
+        state.active()->crypto_tx->log_to_logger(LOG_ERROR,
+                                                 "Could not reload config, keeping the current one");
+        return;
+    }
 
-        config_file = argv[2];
+    const struct config* cfg = next->crypto_tx->get_config();
+    initialize_tracing(cfg);
+    if ((diff & CONFIG_DIFF_PORTS) != 0)
+    {
+        disconnect_ports();
+    }
+    if ((diff & CONFIG_DIFF_PTT) != 0)
+    {
+        backend->deactivate();
+        state.reset(next.release());
+        initialize_ptt(state.active()->crypto_tx->get_config());
+        // The new encoder is already running. running_config is kept, so
+        // the next change to the config file tries the ports again
+        if (!activate_client())
+        {
+            restore_ports();
+            return;
+        }
     }
     else
     {
-        fprintf(stderr, "Usage: jack_crypto_tx <jack server name> <config file>");
-        exit(1);
+        if (!connect_ports(cfg))
+        {
+            restore_ports();
+            return;
+        }
+        set_buffer_size(*next);
+        state.publish(next.release());
     }
 
-    fprintf(stderr, "Server name: %s\n", server_name ? server_name : "");
+    running_config = next_config;
+    control.watch_file(running_config.cfg.key_file);
+}
 
-    /* open a client connection to the JACK server */
+// Applies only what changed in the config and key files. Port connections
+// are changed on the running encoder, anything else that matters to the
+// transmitter needs a new one. Squelch settings only concern the receiver
+static void apply_config_changes(bool force_reload)
+{
+    config_snapshot next;
+    read_config_snapshot(config_file, next);
 
-    client = jack_client_open (client_name, options, &status, server_name);
-    if (client == NULL)
+    const int diff = diff_config_snapshot(running_config, next);
+    const int rebuild_diff =
+        CONFIG_DIFF_KEY | CONFIG_DIFF_MODE | CONFIG_DIFF_PTT | CONFIG_DIFF_OTHER;
+    if (force_reload || (diff & rebuild_diff) != 0)
     {
-        fprintf (stderr,
-                 "jack_client_open() failed, "
-                 "status = 0x%2.0x\n",
-                 status);
-        if (status & JackServerFailed)
+        reload_crypto(next, diff);
+        return;
+    }
+
+    if ((diff & CONFIG_DIFF_PORTS) != 0)
+    {
+        disconnect_ports();
+        if (!connect_ports(&next.cfg))
         {
-            fprintf (stderr, "Unable to connect to JACK server\n");
+            restore_ports();
+            return;
         }
-        exit (1);
     }
-    if (status & JackServerStarted)
+
+    running_config = next;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: jack_crypto_tx [-c <capture file>] <jack server name> <config file>\n"
+            "       jack_crypto_tx [-c <capture file>] -f <dir> [-r <sample rate>] <config file>\n"
+            "       jack_crypto_tx [-c <capture file>] -n [-r <sample rate>] <config file>\n"
+            "  -c  Record the ports and PTT state of every cycle to this file,\n"
+            "      for crypto_replay\n"
+            "  -f  Run without JACK, reading voice_in.wav from dir and writing\n"
+            "      modem_out.wav to it as fast as possible. Exits at the end of\n"
+            "      the input\n"
+            "  -n  Run without JACK, with a timer for a sound card and silence\n"
+            "      for the voice input\n"
+            "  -r  The sample rate of the ports without JACK. The default is\n"
+            "      48000\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char* file_dir = nullptr;
+    const char* capture_file = nullptr;
+    bool null_audio = false;
+    uint sample_rate = 48000;
+    int opt;
+
+    control_loop::block_signals(CONTROL_SIGNALS);
+
+    while ((opt = getopt(argc, argv, "c:f:nr:h")) != -1)
     {
-        fprintf (stderr, "JACK server started\n");
+        switch (opt)
+        {
+        case 'c': capture_file = optarg; break;
+        case 'f': file_dir = optarg; break;
+        case 'n': null_audio = true; break;
+        case 'r': sample_rate = strtoul(optarg, nullptr, 0); break;
+        default:
+            usage();
+            exit(1);
+        }
     }
-    if (status & JackNameNotUnique)
+
+    const bool use_jack = file_dir == nullptr && !null_audio;
+    if (argc - optind != (use_jack ? 2 : 1) || sample_rate == 0)
     {
-        client_name = jack_get_client_name(client);
-        fprintf (stderr, "unique name `%s' assigned\n", client_name);
+        usage();
+        exit(1);
     }
 
-    /* tell the JACK server to call `process()' whenever
-       there is work to be done.
-    */
-    jack_set_process_callback (client, process, nullptr);
+    if (use_jack)
+    {
+        backend = open_jack_backend("crypto_tx", argv[optind]);
+    }
+    else if (file_dir != nullptr)
+    {
+        backend = open_file_backend(file_dir, sample_rate);
+    }
+    else
+    {
+        backend = open_null_backend(sample_rate);
+    }
+    config_file = argv[argc - 1];
+
+    if (!backend)
+    {
+        exit (1);
+    }
 
-    /* tell the JACK server to call `jack_shutdown()' if
-       it ever shuts down, either entirely, or if it
-       just decides to stop calling us.
+    /* tell the backend to call `process()' whenever there is work to be
+       done, and `backend_shutdown()' if it stops calling us.
     */
-    jack_on_shutdown (client, jack_shutdown, 0);
+    backend->set_callbacks(process, backend_xrun, backend_shutdown, nullptr);
 
     /* create two ports */
-    voice_port = jack_port_register(client,
-                                    "voice_in",
-                                    JACK_DEFAULT_AUDIO_TYPE,
-                                    JackPortIsInput,
-                                    0);
+    voice_port = backend->register_port("voice_in", false);
+    modem_port = backend->register_port("modem_out", true);
 
-    modem_port = jack_port_register(client,
-                                    "modem_out",
-                                    JACK_DEFAULT_AUDIO_TYPE,
-                                    JackPortIsOutput,
-                                    0);
-
-    if ((voice_port == NULL) || (modem_port == NULL))
+    if ((voice_port < 0) || (modem_port < 0))
     {
-        fprintf(stderr, "no more JACK ports available\n");
+        fprintf(stderr, "no more ports available\n");
         exit (1);
     }
 
+    read_config_snapshot(config_file, running_config);
     try
     {
-        initialize_crypto();
+        state.reset(create_state());
     }
     catch (const std::exception& ex)
     {
@@ -522,15 +505,34 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
-    initialize_ptt();
-    activate_client();
+    initialize_ptt(state.active()->crypto_tx->get_config());
+    initialize_tracing(state.active()->crypto_tx->get_config());
+    atexit(write_trace);
+
+    const std::vector<capture_port> capture_ports = { { "voice_in", false }, { "modem_out", true } };
+    if (capture_file != nullptr &&
+        !capture.open(capture_file, "crypto_tx", backend->sample_rate(), capture_ports))
+    {
+        fprintf(stderr, "Could not open %s\n", capture_file);
+        exit(1);
+    }
+
+    if (!activate_client())
+    {
+        exit(1);
+    }
 
-    signal(SIGQUIT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGHUP, handle_sighup);
-    signal(SIGUSR1, handle_sigusr1);
-    signal(SIGRTMIN, handle_sigptt);
-    signal(SIGINT, signal_handler);
+    if (!metrics.start(METRICS_SOCKET))
+    {
+        state.active()->crypto_tx->log_to_logger(LOG_WARN, "Could not start metrics server");
+    }
+
+    if (!control.open(CONTROL_SIGNALS, config_file))
+    {
+        fprintf(stderr, "Could not create control loop\n");
+        exit(1);
+    }
+    control.watch_file(running_config.cfg.key_file);
 
     // Create a zero length file to indicate when the transmitter is
     // initialized
@@ -541,41 +543,73 @@ int main(int argc, char *argv[])
     }
 
 
-    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-    while (true)
+    const uint port_sample_rate = backend->sample_rate();
+    bool running = true;
+    control_events events;
+    while (running)
     {
-        if (reload_config != 0) {
-            reload_config = 0;
+        control.wait(-1, events);
 
-            jack_deactivate(client);
-            crypto_tx = nullptr;
-            try
+        bool reload = false;
+        for (int sig : events.signals)
+        {
+            if (sig == SIGRTMIN)
             {
-                initialize_crypto();
+                sig_ptt_val = !sig_ptt_val;
+                continue;
             }
-            catch (const std::exception& ex)
+
+            switch (sig)
+            {
+            case SIGHUP:
+                reload = true;
+                break;
+            case SIGUSR1:
             {
-                fprintf(stderr, "%s", ex.what());
-                exit(1);
+                audio_buffer_t tts_file;
+                if (read_wav_file("/tmp/tts.wav", port_sample_rate, tts_file))
+                {
+                    engine.play(std::move(tts_file));
+                }
+                break;
+            }
+            case SIGUSR2:
+                write_trace();
+                break;
+            default:
+                running = false;
+                break;
             }
-
-            initialize_ptt();
-            activate_client();
         }
 
-        if (read_wav != 0)
+        // SIGHUP always rebuilds the encoder, a change to the watched files
+        // only updates what changed
+        if (running && (reload || events.config_changed))
         {
-            read_wav = 0;
+            apply_config_changes(reload);
+        }
 
-            if (read_wav_file("/tmp/tts.wav", jack_sample_rate, tts_file))
-            {
-                play_wav = 1;
-            }
+        // Frees the previous encoder and audio once the realtime thread has
+        // switched over
+        state.reclaim();
+        engine.reclaim_played();
+    }
+
+    fprintf(stderr, "signal received, exiting ...\n");
+    backend.reset();
+
+    if (capture_file != nullptr)
+    {
+        const uint64_t dropped = capture.dropped();
+        if (!capture.close())
+        {
+            fprintf(stderr, "Could not write %s\n", capture_file);
+        }
+        if (dropped > 0)
+        {
+            fprintf(stderr, "%llu cycles were left out of %s\n", (unsigned long long)dropped, capture_file);
         }
-        sleep(1);
     }
-    
-    jack_client_close (client);
     return 0;
 }
 
@@ -5,14 +5,14 @@ trap "kill %1; exit 0" INT TERM
 
 wait_initialized
 
-A_PIN=`get_config_val Keypad AGPIONum`
-B_PIN=`get_config_val Keypad BGPIONum`
-D_PIN=`get_config_val Keypad DGPIONum`
-UP_PIN=`get_config_val Keypad UpGPIONum`
-DOWN_PIN=`get_config_val Keypad DownGPIONum`
-BIAS=`get_config_val Keypad Bias`
-ACTIVE=`get_config_val Keypad ActiveLow`
-DEBOUNCE=`get_config_val Keypad Debounce`
+get_config_vals A_PIN=Keypad:AGPIONum \
+                B_PIN=Keypad:BGPIONum \
+                D_PIN=Keypad:DGPIONum \
+                UP_PIN=Keypad:UpGPIONum \
+                DOWN_PIN=Keypad:DownGPIONum \
+                BIAS=Keypad:Bias \
+                ACTIVE=Keypad:ActiveLow \
+                DEBOUNCE=Keypad:Debounce
 
 if key_fill_only
 then
@@ -26,10 +26,8 @@ update_key_idx()
 
     if set_key_index "$1"
     then
-        # Reverse order SIGHUP to give RX more time
-        # to reinitialize before playing TTS
-        /etc/init.d/S31jack_crypto_rx signal SIGHUP
-        /etc/init.d/S30jack_crypto_tx signal SIGHUP
+        # jack_crypto_tx and jack_crypto_rx watch the config and key files
+        # and pick up the change themselves
 
         if has_red_key "$1"
         then
@@ -72,10 +70,8 @@ toggle_digital()
     DIGITAL_EN=$((DIGITAL_EN^1))
     if set_config_val Codec Enabled "$DIGITAL_EN"
     then
-        # Reverse order SIGHUP to give RX more time
-        # to reinitialize before playing TTS
-        /etc/init.d/S31jack_crypto_rx signal SIGHUP
-        /etc/init.d/S30jack_crypto_tx signal SIGHUP
+        # jack_crypto_tx and jack_crypto_rx watch the config and key files
+        # and pick up the change themselves
         CRYPTO_EN=`get_config_val Crypto Enabled`
         if test "$DIGITAL_EN" -ne 0
         then
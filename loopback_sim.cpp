@@ -0,0 +1,506 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crypto_rx_common.h"
+#include "crypto_tx_common.h"
+#include "channel_sim.h"
+#include "speech_synth.h"
+
+// Runs synthetic speech through crypto_tx_common, a simulated channel and
+// crypto_rx_common for every point of a grid of channel parameters, and
+// prints one CSV row per point. The transmitter runs once, every point
+// gets its own channel and receiver on a pool of worker threads
+
+// Speech is compared in blocks this long when lining up the decoded speech
+// with the input, which is the resolution of the latency measurement
+#define ENVELOPE_MS 5
+
+// A decoded speech frame is in error if its segmental SNR against the
+// speech decoded over a clean channel is below this
+#define FRAME_ERROR_SNR_DB 10.0
+
+struct loopback_result
+{
+    bool   ok = false;
+    // Seconds of channel output before the receiver first synced, or
+    // negative if it never did
+    double sync_time = -1.0;
+    long long frames_lost = 0;
+    double frame_error_rate = 1.0;
+    double decode_cpu_seconds = 0.0;
+    double latency_ms = 0.0;
+};
+
+struct loopback_state
+{
+    const char*                  config_file = nullptr;
+
+    // The transmitter's output, shared by all points
+    std::vector<short>           speech;
+    std::vector<short>           modem;
+    uint                         speech_rate = 0;
+    uint                         modem_rate = 0;
+    size_t                       speech_frame = 0;
+    float                        modem_power = 0.0f;
+
+    // Decoded over a clean channel, the reference for the frame errors
+    std::vector<short>           reference;
+    long                         reference_lag = 0;
+
+    std::vector<channel_params>  points;
+    std::vector<loopback_result> results;
+
+    std::atomic<size_t>          next_point{0};
+    std::mutex                   progress_lock;
+    size_t                       points_done = 0;
+};
+
+static double thread_cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// RMS of every ENVELOPE_MS block, less the mean
+static std::vector<double> envelope(const std::vector<short>& speech, uint sample_rate)
+{
+    const size_t block = sample_rate * ENVELOPE_MS / 1000;
+    std::vector<double> env(speech.size() / block);
+    double mean = 0.0;
+    for (size_t b = 0; b < env.size(); ++b)
+    {
+        double sum = 0.0;
+        for (size_t i = b * block; i < (b + 1) * block; ++i)
+        {
+            sum += static_cast<double>(speech[i]) * speech[i];
+        }
+        env[b] = sqrt(sum / block);
+        mean += env[b];
+    }
+
+    mean /= std::max<size_t>(env.size(), 1);
+    for (double& val : env)
+    {
+        val -= mean;
+    }
+    return env;
+}
+
+// The delay of decoded relative to original, in samples, where their
+// envelopes correlate best. Searches delays of up to max_seconds
+static long find_lag(const std::vector<short>& original,
+                     const std::vector<short>& decoded,
+                     uint sample_rate,
+                     double max_seconds)
+{
+    const std::vector<double> env_orig = envelope(original, sample_rate);
+    const std::vector<double> env_dec = envelope(decoded, sample_rate);
+    const size_t max_lag = max_seconds * 1000 / ENVELOPE_MS;
+
+    long best_lag = 0;
+    double best_corr = -INFINITY;
+    for (size_t lag = 0; lag <= max_lag && lag < env_dec.size(); ++lag)
+    {
+        double corr = 0.0;
+        for (size_t b = 0; b < env_orig.size() && b + lag < env_dec.size(); ++b)
+        {
+            corr += env_orig[b] * env_dec[b + lag];
+        }
+        if (corr > best_corr)
+        {
+            best_corr = corr;
+            best_lag = lag;
+        }
+    }
+
+    return best_lag * (sample_rate * ENVELOPE_MS / 1000);
+}
+
+// The offset within an envelope block of offset where decoded matches the
+// reference best
+static long refine_offset(const std::vector<short>& reference,
+                          const std::vector<short>& decoded,
+                          long offset,
+                          uint sample_rate)
+{
+    const long block = sample_rate * ENVELOPE_MS / 1000;
+    long best_offset = offset;
+    double best_err = INFINITY;
+    for (long candidate = offset - block; candidate <= offset + block; ++candidate)
+    {
+        double err = 0.0;
+        for (size_t i = 0; i < reference.size(); ++i)
+        {
+            const long j = static_cast<long>(i) + candidate;
+            const double dec = j >= 0 && j < static_cast<long>(decoded.size()) ? decoded[j] : 0.0;
+            err += (reference[i] - dec) * (reference[i] - dec);
+        }
+        if (err < best_err)
+        {
+            best_err = err;
+            best_offset = candidate;
+        }
+    }
+
+    return best_offset;
+}
+
+// Fraction of the speech frames of the reference, skipping silent ones,
+// that decoded doesn't reproduce. decoded lags the reference by offset
+// samples
+static double frame_error_rate(const std::vector<short>& reference,
+                               const std::vector<short>& decoded,
+                               long offset,
+                               size_t frame)
+{
+    // Well below the level of the synthesized syllables
+    const double silence_power = 300.0 * 300.0;
+
+    size_t frames = 0;
+    size_t errors = 0;
+    for (size_t start = 0; start + frame <= reference.size(); start += frame)
+    {
+        double ref_power = 0.0;
+        double err_power = 0.0;
+        for (size_t i = start; i < start + frame; ++i)
+        {
+            const long j = static_cast<long>(i) + offset;
+            const double dec = j >= 0 && j < static_cast<long>(decoded.size()) ? decoded[j] : 0.0;
+            ref_power += static_cast<double>(reference[i]) * reference[i];
+            err_power += (reference[i] - dec) * (reference[i] - dec);
+        }
+        if (ref_power < silence_power * frame)
+        {
+            continue;
+        }
+
+        ++frames;
+        if (err_power > 0.0 && 10.0 * log10(ref_power / err_power) < FRAME_ERROR_SNR_DB)
+        {
+            ++errors;
+        }
+    }
+
+    return frames > 0 ? static_cast<double>(errors) / frames : 0.0;
+}
+
+static void receive(const loopback_state& state,
+                    const std::vector<short>& channel_out,
+                    std::vector<short>* speech_out,
+                    loopback_result* result)
+{
+    crypto_rx_common rx("loopback_sim", state.config_file);
+    std::vector<short> frame(rx.max_speech_samples_per_frame());
+
+    long long frames_decoded = 0;
+    size_t pos = 0;
+    size_t nin;
+    while ((nin = rx.needed_modem_samples()) <= channel_out.size() - pos)
+    {
+        const double cpu_start = thread_cpu_seconds();
+        const size_t nout = rx.receive(frame.data(), &channel_out[pos]);
+        result->decode_cpu_seconds += thread_cpu_seconds() - cpu_start;
+        pos += nin;
+
+        speech_out->insert(speech_out->end(), frame.begin(), frame.begin() + nout);
+        if (rx.is_synced() && rx.has_signal())
+        {
+            if (result->sync_time < 0.0)
+            {
+                result->sync_time = static_cast<double>(pos) / state.modem_rate;
+            }
+            frames_decoded += nout / state.speech_frame;
+        }
+    }
+
+    const long long frames_sent = state.speech.size() / state.speech_frame;
+    result->frames_lost = std::max(0ll, frames_sent - frames_decoded);
+}
+
+static void run_point(const loopback_state& state, const channel_params& parms, loopback_result* result)
+{
+    channel_sim channel(state.modem_rate, state.modem_power, parms);
+    std::vector<short> channel_out;
+    channel_out.reserve(state.modem.size() + state.modem.size() / 100);
+    channel.process(state.modem.data(), state.modem.size(), channel_out);
+
+    std::vector<short> decoded;
+    receive(state, channel_out, &decoded, result);
+
+    const long lag = find_lag(state.speech, decoded, state.speech_rate, 2.0);
+    result->latency_ms = 1000.0 * lag / state.speech_rate;
+    const long offset = refine_offset(state.reference,
+                                      decoded,
+                                      lag - state.reference_lag,
+                                      state.speech_rate);
+    result->frame_error_rate = frame_error_rate(state.reference,
+                                                decoded,
+                                                offset,
+                                                state.speech_frame);
+    result->ok = true;
+}
+
+static void worker_main(loopback_state* state)
+{
+    size_t idx;
+    while ((idx = state->next_point++) < state->points.size())
+    {
+        try
+        {
+            run_point(*state, state->points[idx], &state->results[idx]);
+        }
+        catch (...)
+        {
+            state->results[idx].ok = false;
+        }
+
+        std::lock_guard<std::mutex> lock(state->progress_lock);
+        fprintf(stderr, "[%zu/%zu]\n", ++state->points_done, state->points.size());
+    }
+}
+
+// Transmits seconds of speech, and decodes it over a channel without
+// impairments for the reference, so it has the same delay as the channel
+static void transmit(loopback_state* state, double seconds)
+{
+    crypto_tx_common tx("loopback_sim", state->config_file);
+    state->speech_rate = tx.speech_sample_rate();
+    state->modem_rate = tx.modem_sample_rate();
+    state->speech_frame = tx.speech_samples_per_frame();
+
+    const size_t n_modem = tx.modem_samples_per_frame();
+    const size_t frames = seconds * state->speech_rate / state->speech_frame;
+    state->speech.resize(frames * state->speech_frame);
+    state->modem.resize(frames * n_modem);
+
+    speech_synth synth(state->speech_rate);
+    synth.generate(state->speech.data(), state->speech.size());
+    for (size_t i = 0; i < frames; ++i)
+    {
+        tx.transmit(&state->modem[i * n_modem], &state->speech[i * state->speech_frame]);
+    }
+
+    double power = 0.0;
+    for (short val : state->modem)
+    {
+        power += static_cast<double>(val) * val;
+    }
+    state->modem_power = power / std::max<size_t>(state->modem.size(), 1);
+
+    channel_sim channel(state->modem_rate, state->modem_power, channel_params());
+    std::vector<short> channel_out;
+    channel.process(state->modem.data(), state->modem.size(), channel_out);
+
+    loopback_result clean;
+    receive(*state, channel_out, &state->reference, &clean);
+    state->reference_lag = find_lag(state->speech, state->reference, state->speech_rate, 2.0);
+}
+
+// Parses a comma separated list of numbers, ie. -5,0,5 or inf
+static bool parse_list(const char* str, std::vector<float>* values)
+{
+    values->clear();
+    while (*str != '\0')
+    {
+        char* end;
+        values->push_back(strtof(str, &end));
+        if (end == str || (*end != ',' && *end != '\0'))
+        {
+            return false;
+        }
+        str = *end == ',' ? end + 1 : end;
+    }
+
+    return !values->empty();
+}
+
+static void print_value(FILE* f, double val, const char* format)
+{
+    if (std::isinf(val))
+    {
+        fprintf(f, "inf");
+    }
+    else
+    {
+        fprintf(f, format, val);
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] ConfigFile\n"
+            "  Every combination of the listed channel parameters is run.\n"
+            "  Lists are comma separated, ie. -s -5,0,5,inf\n"
+            "  -s  SNR in a 3 kHz bandwidth, dB. inf is no noise. The default\n"
+            "      is inf\n"
+            "  -f  Frequency offset, Hz. The default is 0\n"
+            "  -c  Receiver sample clock drift, ppm. The default is 0\n"
+            "  -d  Fading Doppler spread, Hz. 0, the default, is no fading\n"
+            "  -D  Delay of the second fading path, ms. The default is 2\n"
+            "  -r  Dropouts per second. The default is 0\n"
+            "  -R  Length of each dropout, ms. The default is 100\n"
+            "  -t  Seconds of speech to send. The default is 30\n"
+            "  -j  Points run at once. The default is one per CPU\n"
+            "  -S  Seed of the channel noise, fading and dropouts\n"
+            "  -o  Write the results to this file instead of stdout\n"
+            "  For each point the results are the seconds before the receiver\n"
+            "  synced, the speech frames sent but not decoded in sync, the\n"
+            "  fraction of speech frames decoded differently than over a clean\n"
+            "  channel, the CPU time spent in the receiver and the delay\n"
+            "  between the original and the decoded speech, to 5 ms\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<float> snrs = { INFINITY };
+    std::vector<float> offsets = { 0.0f };
+    std::vector<float> drifts = { 0.0f };
+    std::vector<float> dopplers = { 0.0f };
+    std::vector<float> dropout_rates = { 0.0f };
+    float fading_delay_ms = 2.0f;
+    float dropout_ms = 100.0f;
+    double seconds = 30.0;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t seed = 1;
+    const char* output_file = nullptr;
+    bool ok = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:f:c:d:D:r:R:t:j:S:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': ok = parse_list(optarg, &snrs) && ok; break;
+        case 'f': ok = parse_list(optarg, &offsets) && ok; break;
+        case 'c': ok = parse_list(optarg, &drifts) && ok; break;
+        case 'd': ok = parse_list(optarg, &dopplers) && ok; break;
+        case 'D': fading_delay_ms = atof(optarg); break;
+        case 'r': ok = parse_list(optarg, &dropout_rates) && ok; break;
+        case 'R': dropout_ms = atof(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'j': jobs = atol(optarg); break;
+        case 'S': seed = strtoull(optarg, nullptr, 0); break;
+        case 'o': output_file = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!ok || optind >= argc || seconds <= 0.0 || jobs < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    loopback_state state;
+    state.config_file = argv[optind];
+
+    for (float snr : snrs)
+    for (float offset : offsets)
+    for (float drift : drifts)
+    for (float doppler : dopplers)
+    for (float dropout_rate : dropout_rates)
+    {
+        channel_params parms;
+        parms.snr_db = snr;
+        parms.freq_offset_hz = offset;
+        parms.drift_ppm = drift;
+        parms.fading_doppler_hz = doppler;
+        parms.fading_delay_ms = fading_delay_ms;
+        parms.dropout_rate = dropout_rate;
+        parms.dropout_ms = dropout_ms;
+        parms.seed = seed + state.points.size();
+        state.points.push_back(parms);
+    }
+    state.results.resize(state.points.size());
+
+    FILE* out = output_file != nullptr ? fopen(output_file, "w") : stdout;
+    if (out == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", output_file);
+        return 1;
+    }
+
+    try
+    {
+        transmit(&state, seconds);
+    }
+    catch (...)
+    {
+        fprintf(stderr, "Could not transmit\n");
+        return 1;
+    }
+
+    jobs = std::min<long>(jobs, state.points.size());
+    std::vector<std::thread> workers;
+    for (long i = 0; i < jobs; ++i)
+    {
+        workers.emplace_back(worker_main, &state);
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    fprintf(out,
+            "snr_db,freq_offset_hz,drift_ppm,fading_doppler_hz,dropout_rate,"
+            "status,sync_time_s,frames_lost,frame_error_rate,decode_cpu_s,decode_rtf,latency_ms\n");
+    for (size_t i = 0; i < state.points.size(); ++i)
+    {
+        const channel_params& p = state.points[i];
+        const loopback_result& r = state.results[i];
+        print_value(out, p.snr_db, "%.1f");
+        fprintf(out, ",%.1f,%.1f,%.2f,%.2f,%s,", p.freq_offset_hz, p.drift_ppm, p.fading_doppler_hz, p.dropout_rate, r.ok ? "ok" : "error");
+        if (r.sync_time >= 0.0)
+        {
+            fprintf(out, "%.3f", r.sync_time);
+        }
+        fprintf(out,
+                ",%lld,%.4f,%.3f,%.5f,%.0f\n",
+                r.frames_lost,
+                r.frame_error_rate,
+                r.decode_cpu_seconds,
+                r.decode_cpu_seconds / (state.modem.size() / static_cast<double>(state.modem_rate)),
+                r.latency_ms);
+        ok = ok && r.ok;
+    }
+
+    ok = fflush(out) == 0 && ok;
+    if (out != stdout)
+    {
+        ok = fclose(out) == 0 && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -184,6 +184,31 @@ public:
         }
     }
 
+    // Dequeues samples multiplied by scale, which saves a separate pass
+    // when the consumer expects samples in a different range
+    bool dequeue(float* data, size_t count, float scale)
+    {
+        if (count == 0)
+        {
+            return true;
+        }
+        else if (count <= available_elems())
+        {
+            const float* src = m_resampled_data.data();
+            for (size_t i = 0; i < count; ++i)
+            {
+                data[i] = src[i] * scale;
+            }
+            m_resampled_data.erase(m_resampled_data.cbegin(),
+                                   m_resampled_data.cbegin() + count);
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
     bool dequeue(short* data, size_t count)
     {
         if (count == 0)
@@ -0,0 +1,102 @@
+#ifndef RT_HANDOFF_H
+#define RT_HANDOFF_H
+
+#include <atomic>
+
+// Passes an object built on a control thread to the realtime thread, and
+// passes the object it replaces back to the control thread to be destroyed.
+// The realtime thread picks up the new object with rt_acquire() at the
+// start of a cycle, so it never sees a half built object, never blocks and
+// never frees memory
+template<class T>
+class rt_handoff
+{
+public:
+    rt_handoff()
+        : m_active(nullptr),
+          m_pending(nullptr),
+          m_retired(nullptr)
+    {
+    }
+
+    // The realtime thread must be stopped
+    ~rt_handoff()
+    {
+        delete m_pending.exchange(nullptr);
+        delete m_retired.exchange(nullptr);
+        delete m_active.exchange(nullptr);
+    }
+
+    // Replaces the active object directly. Only for use while the realtime
+    // thread is stopped
+    void reset(T* obj)
+    {
+        delete m_pending.exchange(nullptr);
+        delete m_active.exchange(obj);
+    }
+
+    // Control thread. Queues obj to replace the active object. A queued
+    // object the realtime thread hasn't picked up yet is destroyed
+    void publish(T* obj)
+    {
+        delete m_pending.exchange(obj, std::memory_order_acq_rel);
+    }
+
+    // Control thread. Destroys the object replaced by the last swap. The
+    // control thread must not hold on to pointers from active() across
+    // this call
+    void reclaim()
+    {
+        delete m_retired.exchange(nullptr, std::memory_order_acq_rel);
+    }
+
+    bool swap_pending() const
+    {
+        return m_pending.load(std::memory_order_acquire) != nullptr;
+    }
+
+    // Realtime thread. Swaps in a published object, if there is one and the
+    // previous one has been reclaimed, and returns the active object
+    T* rt_acquire(bool* swapped = nullptr)
+    {
+        T* active = m_active.load(std::memory_order_relaxed);
+        if (swapped != nullptr)
+        {
+            *swapped = false;
+        }
+
+        if (m_pending.load(std::memory_order_relaxed) == nullptr ||
+            m_retired.load(std::memory_order_acquire) != nullptr)
+        {
+            return active;
+        }
+
+        T* next = m_pending.exchange(nullptr, std::memory_order_acq_rel);
+        if (next == nullptr)
+        {
+            return active;
+        }
+
+        m_retired.store(active, std::memory_order_release);
+        m_active.store(next, std::memory_order_release);
+        if (swapped != nullptr)
+        {
+            *swapped = true;
+        }
+
+        return next;
+    }
+
+    // The object the realtime thread is using, for the control thread
+    T* active() const
+    {
+        return m_active.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<T*> m_active;
+    std::atomic<T*> m_pending;
+    std::atomic<T*> m_retired;
+};
+
+#endif
@@ -0,0 +1,252 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "crypto_common.h"
+#include "crypto_trace.h"
+#include "control_loop.h"
+#include "rx_engine.h"
+
+rx_state* create_rx_state(const char* config_file,
+                          uint        sample_rate,
+                          uint        buffer_size,
+                          int         rt_priority)
+{
+    std::unique_ptr<rx_state> st(new rx_state());
+
+    st->rx_diversity.reset(new crypto_rx_diversity("crypto_rx",
+                                                   config_file,
+                                                   sample_rate,
+                                                   buffer_size,
+                                                   rt_priority));
+    st->crypto_rx = &st->rx_diversity->primary();
+
+    const uint speech_sample_rate = st->crypto_rx->speech_sample_rate();
+
+    const size_t speech_frames =
+        get_max_resampled_frames(st->crypto_rx->max_speech_samples_per_frame(),
+                                 speech_sample_rate,
+                                 sample_rate);
+
+    st->output_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, speech_frames * 2));
+
+    st->output_resampler->set_sample_rates(speech_sample_rate, sample_rate);
+
+    // Pre-initialize the resampler with null data to "prime" the resampler,
+    // then discard the results. The resampler delays the output by some
+    // number of samples, and we want to make sure that we always have the
+    // same number of bytes available coming out as went in
+    st->output_resampler->enqueue_zeroes(st->crypto_rx->max_speech_samples_per_frame());
+    st->output_resampler->clear();
+
+    return st.release();
+}
+
+rx_engine::rx_engine(rx_metrics& counters, control_loop* control)
+    : m_counters(counters),
+      m_control(control),
+      m_synced_prev(false)
+{
+}
+
+void rx_engine::set_startup_sounds(audio_buffer_t&& secure, audio_buffer_t&& insecure)
+{
+    m_crypto_startup = std::move(secure);
+    m_plain_startup = std::move(insecure);
+}
+
+void rx_engine::play(audio_buffer_t&& audio)
+{
+    m_wave_sound.publish(new audio_buffer_t(std::move(audio)));
+}
+
+void rx_engine::update_branch_metrics(const crypto_rx_diversity& rx_diversity,
+                                    uint                       nframes,
+                                    uint                       sample_rate)
+{
+    bool synced = false;
+    bool has_signal = false;
+    for (size_t i = 0; i < MAX_MODEM_IN_PORTS; ++i)
+    {
+        if (i >= rx_diversity.num_branches())
+        {
+            metric_set(*m_counters.input_queue[i], 0);
+            continue;
+        }
+
+        const rx_branch_stats stats = rx_diversity.get_branch_stats(i);
+        metric_set(*m_counters.input_queue[i], stats.input_queue);
+        if (stats.selected)
+        {
+            synced = stats.synced;
+            has_signal = stats.has_signal;
+        }
+    }
+
+    if (synced && !m_synced_prev)
+    {
+        metric_add(m_counters.sync_acquired);
+    }
+    else if (!synced && m_synced_prev)
+    {
+        metric_add(m_counters.sync_lost);
+    }
+    m_synced_prev = synced;
+
+    if (has_signal)
+    {
+        metric_add(m_counters.squelch_open_us, nframes * 1000000ull / sample_rate);
+    }
+}
+
+rx_state& rx_engine::begin_cycle()
+{
+    // Picks up new demodulators after the config file is reloaded
+    bool state_swapped = false;
+    rx_state* const st = m_state.rt_acquire(&state_swapped);
+    bool squelch_swapped = false;
+    const struct config* squelch = m_squelch_update.rt_acquire(&squelch_swapped);
+    if (squelch_swapped)
+    {
+        st->rx_diversity->update_squelch(*squelch);
+    }
+    if ((state_swapped || squelch_swapped) && m_control != nullptr)
+    {
+        // Let the main thread free the previous state
+        m_control->notify();
+    }
+
+    return *st;
+}
+
+void rx_engine::process(rx_state&                    st,
+                        const audio_sample_t* const* modem_frames,
+                        const audio_sample_t* const* modem_q_frames,
+                        audio_sample_t*              voice_frames,
+                        audio_sample_t*              notification_frames,
+                        uint                         nframes,
+                        uint                         sample_rate)
+{
+    const uint64_t start_ns = metric_now_ns();
+    TRACE_THREAD("jack_crypto_rx");
+    TRACE_SCOPE("process");
+    TRACE_STAGES(stages);
+
+    crypto_rx_diversity* const rx_diversity = st.rx_diversity.get();
+    crypto_rx_common* const crypto_rx = st.crypto_rx;
+    resampler* const output_resampler = st.output_resampler.get();
+
+    bool play_notification_sound = false;
+
+    if (st.announce) {
+        st.announce = false;
+
+        play_notification_sound = true;
+    }
+
+    bool play_wave_sound = false;
+    const audio_buffer_t* const wave_sound = m_wave_sound.rt_acquire(&play_wave_sound);
+    if (play_wave_sound && m_control != nullptr)
+    {
+        // Let the main thread free the previous sound
+        m_control->notify();
+    }
+
+    const uint voice_sample_rate = crypto_rx->speech_sample_rate();
+
+    output_resampler->set_sample_rates(voice_sample_rate, sample_rate);
+
+    // Demodulate every modem input and enqueue the best decoded speech
+    TRACE_STAGE(stages, "demodulate_all");
+    const size_t frames_decoded =
+        rx_diversity->process(modem_frames, modem_q_frames, nframes, *output_resampler);
+    const uint64_t demod_ns = metric_now_ns();
+
+    metric_add(m_counters.frames_decoded, frames_decoded);
+    update_branch_metrics(*rx_diversity, nframes, sample_rate);
+
+    // If modem data going into the demodulator this cycle
+    // results in voice data coming out, or there is no modem
+    // data going into the demodulator this cycle (which can
+    // happen if) the jack buffer size is smaller than the modem
+    // frame size, then consider the output "active"
+    // The first time modem data going into the demodulator results
+    // in no voice data coming out, that indicates a gap in
+    // transmission
+    TRACE_STAGE(stages, "voice_output");
+
+    // When the radio is active and modem data is coming in we
+    // are mostly concerned about having enough data to put onto the
+    // voice port during the next time this process runs without
+    // underflowing. So make sure the output buffer is "primed"
+    // before starting to output data onto the port
+    const size_t to_deque = std::min(output_resampler->available_elems(),
+                                     (size_t)nframes);
+    const size_t to_fill = nframes - to_deque;
+    output_resampler->dequeue(voice_frames, to_deque);
+    if (to_fill > 0)
+    {
+        zeroize_frames(voice_frames + to_deque, to_fill);
+    }
+
+    TRACE_STAGE(stages, "notification");
+    if (play_notification_sound)
+    {
+        const encryption_status crypto_stat = crypto_rx->get_encryption_status();
+        if (crypto_stat == CRYPTO_STATUS_ENCRYPTED) {
+            m_notification_buffer.insert(m_notification_buffer.cend(),
+                                         m_crypto_startup.cbegin(),
+                                         m_crypto_startup.cend());
+        }
+        else {
+            m_notification_buffer.insert(m_notification_buffer.cend(),
+                                         m_plain_startup.cbegin(),
+                                         m_plain_startup.cend());
+        }
+    }
+
+    if (play_wave_sound)
+    {
+        m_notification_buffer.insert(m_notification_buffer.cend(),
+                                     wave_sound->cbegin(),
+                                     wave_sound->cend());
+    }
+
+    if (m_notification_buffer.empty() == false)
+    {
+        const uint n_notification_frames =
+            std::min(nframes, static_cast<uint>(m_notification_buffer.size()));
+        const auto notification_end = m_notification_buffer.cbegin() + n_notification_frames;
+        std::copy(m_notification_buffer.cbegin(), notification_end, notification_frames);
+        m_notification_buffer.erase(m_notification_buffer.cbegin(), notification_end);
+        if (n_notification_frames < nframes)
+        {
+            zeroize_frames(notification_frames + n_notification_frames,
+                           nframes - n_notification_frames);
+        }
+    }
+    else
+    {
+        zeroize_frames(notification_frames, nframes);
+    }
+
+    const uint64_t end_ns = metric_now_ns();
+    metric_add(m_counters.cycles);
+    metric_set(m_counters.output_queue, output_resampler->available_elems());
+    metric_set(m_counters.notification_queue, m_notification_buffer.size());
+    metric_add(m_counters.demod_ns, demod_ns - start_ns);
+    metric_add(m_counters.output_ns, end_ns - demod_ns);
+    metric_add(m_counters.process_ns, end_ns - start_ns);
+}
@@ -0,0 +1,169 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RX_ENGINE_H
+#define RX_ENGINE_H
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include "audio_backend.h"
+#include "crypto_cfg.h"
+#include "crypto_metrics.h"
+#include "crypto_rx_common.h"
+#include "crypto_rx_diversity.h"
+#include "resampler.h"
+#include "rt_handoff.h"
+
+class control_loop;
+
+// Updated by the realtime thread and served by the metrics thread
+struct rx_metrics
+{
+    explicit rx_metrics(crypto_metrics& m)
+        : cycles(m.add("cycles")),
+          xruns(m.add("xruns")),
+          frames_decoded(m.add("frames_decoded")),
+          sync_acquired(m.add("sync_acquired")),
+          sync_lost(m.add("sync_lost")),
+          squelch_open_us(m.add("squelch_open_us")),
+          output_queue(m.add("output_queue", METRIC_GAUGE)),
+          notification_queue(m.add("notification_queue", METRIC_GAUGE)),
+          demod_ns(m.add("demod_ns")),
+          output_ns(m.add("output_ns")),
+          process_ns(m.add("process_ns"))
+    {
+        // One per diversity branch, whether or not the config uses it
+        for (size_t i = 0; i < MAX_MODEM_IN_PORTS; ++i)
+        {
+            const std::string name = "input_queue_" + std::to_string(i + 1);
+            input_queue[i] = &m.add(name.c_str(), METRIC_GAUGE);
+        }
+    }
+
+    metric_t& cycles;
+    metric_t& xruns;
+    metric_t& frames_decoded;
+    metric_t& sync_acquired;
+    metric_t& sync_lost;
+    metric_t& squelch_open_us;
+    metric_t& output_queue;
+    metric_t& notification_queue;
+    metric_t& demod_ns;
+    metric_t& output_ns;
+    metric_t& process_ns;
+    metric_t* input_queue[MAX_MODEM_IN_PORTS];
+};
+
+// Everything that is rebuilt when the config file changes
+struct rx_state
+{
+    rx_state()
+    {
+        std::fill_n(modem_ports, MAX_MODEM_IN_PORTS, -1);
+        std::fill_n(modem_q_ports, MAX_MODEM_IN_PORTS, -1);
+    }
+
+    std::unique_ptr<crypto_rx_diversity> rx_diversity;
+    // The primary demodulator owned by rx_diversity
+    crypto_rx_common*                    crypto_rx = nullptr;
+    std::unique_ptr<resampler>           output_resampler;
+    // Play the secure/insecure notification the first time this state is
+    // used. Only touched by the realtime thread once published
+    bool                                 announce = true;
+    // Backend ports feeding each diversity branch, or -1. Filled in before
+    // the state is published, so the realtime thread never sees a branch
+    // without its ports
+    int                                  modem_ports[MAX_MODEM_IN_PORTS];
+    int                                  modem_q_ports[MAX_MODEM_IN_PORTS];
+};
+
+// Builds the demodulators and the speech resampler for ports running at
+// sample_rate, with cycles of about buffer_size frames. rt_priority is the
+// SCHED_FIFO priority for the diversity workers, or 0. Throws if the config
+// can't be used
+rx_state* create_rx_state(const char* config_file,
+                          uint        sample_rate,
+                          uint        buffer_size,
+                          int         rt_priority);
+
+// One audio cycle of jack_crypto_rx at a time: demodulates the modem
+// inputs, resamples the decoded speech for the voice output and mixes the
+// notification sounds. Works on plain sample buffers, so it runs the same
+// under any audio_backend
+class rx_engine
+{
+public:
+    // control is woken up when the previous state can be reclaimed, and may
+    // be null if the caller reclaims it some other way
+    rx_engine(rx_metrics& counters, control_loop* control);
+
+    // Replaced by the main thread, picked up at the start of a cycle
+    rt_handoff<rx_state>& state() { return m_state; }
+    // Squelch settings applied to the running demodulators, without
+    // replacing them
+    rt_handoff<struct config>& squelch_update() { return m_squelch_update; }
+
+    // Main thread, before the first cycle. The sounds announcing whether
+    // new demodulators are decrypting, at the cycle sample rate
+    void set_startup_sounds(audio_buffer_t&& secure, audio_buffer_t&& insecure);
+
+    // Main thread. Plays audio at the cycle sample rate on the notification
+    // output, starting with the next cycle
+    void play(audio_buffer_t&& audio);
+
+    // Main thread. Frees the audio replaced by the last one played
+    void reclaim_played() { m_wave_sound.reclaim(); }
+
+    // Realtime thread, once at the start of every cycle. Picks up new
+    // demodulators or squelch settings and returns the state the cycle
+    // runs with
+    rx_state& begin_cycle();
+
+    // Realtime thread. st is the state from begin_cycle(). modem_frames
+    // and modem_q_frames hold a buffer for each diversity branch, the Q
+    // buffers are only read in IQ mode
+    void process(rx_state&                    st,
+                 const audio_sample_t* const* modem_frames,
+                 const audio_sample_t* const* modem_q_frames,
+                 audio_sample_t*              voice_frames,
+                 audio_sample_t*              notification_frames,
+                 uint                         nframes,
+                 uint                         sample_rate);
+
+private:
+    // Follows the sync state of the branch currently being played and the
+    // input queue of every branch
+    void update_branch_metrics(const crypto_rx_diversity& rx_diversity,
+                             uint                       nframes,
+                             uint                       sample_rate);
+
+private:
+    rx_metrics&                m_counters;
+    control_loop*              m_control;
+
+    rt_handoff<rx_state>       m_state;
+    rt_handoff<struct config>  m_squelch_update;
+
+    audio_buffer_t             m_crypto_startup;
+    audio_buffer_t             m_plain_startup;
+    rt_handoff<audio_buffer_t> m_wave_sound;
+    std::deque<audio_sample_t> m_notification_buffer;
+
+    bool                       m_synced_prev;
+};
+
+#endif
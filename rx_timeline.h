@@ -0,0 +1,49 @@
+#ifndef RX_TIMELINE_H
+#define RX_TIMELINE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Places the frames a demodulator decodes on the modem sample timeline
+// shared by every diversity branch. A frame belongs to the nominal frame
+// period its input ends closest to, so frames carrying the same speech
+// land in the same slot in every branch even when their nin and resampler
+// queues have drifted apart.
+//
+// When nin runs short of the period, from receiver clock drift or a
+// timing jump at sync, two frames can end closest to the same period. The
+// later one then takes the next free slot, as a slot only ever holds one
+// frame and anything sharing it would never be played
+class rx_timeline
+{
+public:
+    rx_timeline()
+        : m_input_pos(0),
+          m_next_slot(0)
+    {
+    }
+
+    // Returns the slot of a frame whose demodulator call consumed nin
+    // modem samples, period being the nominal modem samples per frame
+    uint64_t add_frame(size_t nin, size_t period)
+    {
+        m_input_pos += nin;
+        const uint64_t slot = std::max<uint64_t>((m_input_pos + period / 2) / period, m_next_slot);
+        m_next_slot = slot + 1;
+        return slot;
+    }
+
+    // The slot after the last frame. No later frame can land in an
+    // earlier slot
+    uint64_t next_slot() const
+    {
+        return m_next_slot;
+    }
+
+private:
+    uint64_t m_input_pos;
+    uint64_t m_next_slot;
+};
+
+#endif
@@ -0,0 +1,96 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdint>
+#include <cstdio>
+
+#include <vector>
+
+#include "rx_timeline.h"
+
+// Feeds rx_timeline the nin sequences a demodulator asks for and checks
+// that every frame gets a slot of its own. crypto_rx_diversity plays at
+// most one frame per slot, so a frame sharing a slot is never heard
+
+static const size_t PERIOD = 640;
+
+// Returns the number of frames that share a slot with an earlier one
+static size_t count_shared(const char* name, const std::vector<size_t>& nins)
+{
+    rx_timeline timeline;
+    std::vector<uint64_t> slots;
+    size_t shared = 0;
+    for (size_t nin : nins)
+    {
+        const uint64_t slot = timeline.add_frame(nin, PERIOD);
+        if (!slots.empty() && slot <= slots.back())
+        {
+            ++shared;
+        }
+        if (timeline.next_slot() != slot + 1)
+        {
+            printf("%s: next_slot is %llu after slot %llu\n",
+                   name,
+                   (unsigned long long)timeline.next_slot(),
+                   (unsigned long long)slot);
+            ++shared;
+        }
+        slots.push_back(slot);
+    }
+
+    printf("%s: %zu frames, %zu sharing a slot\n", name, nins.size(), shared);
+    return shared;
+}
+
+int main()
+{
+    size_t failed = 0;
+
+    // A receiver clock slightly fast, so the demodulator asks for one
+    // sample less than the period every frame
+    failed += count_shared("short", std::vector<size_t>(5000, PERIOD - 1));
+
+    failed += count_shared("nominal", std::vector<size_t>(5000, PERIOD));
+    failed += count_shared("long", std::vector<size_t>(5000, PERIOD + 1));
+
+    // OFDM timing jumps while acquiring sync, then tracking around the
+    // period
+    std::vector<size_t> sync;
+    for (size_t i = 0; i < 5000; ++i)
+    {
+        static const size_t JUMPS[] = { PERIOD, PERIOD / 2, 3, PERIOD * 2, PERIOD - 40, PERIOD + 40 };
+        sync.push_back(i < 60 ? JUMPS[i % 6] : PERIOD - 2 + i % 5);
+    }
+    failed += count_shared("sync", sync);
+
+    // A frame that doesn't end near the period must not throw off the
+    // ones that follow: the timeline picks up where the input really is
+    // once it is past the slots already used
+    rx_timeline timeline;
+    timeline.add_frame(PERIOD, PERIOD);
+    timeline.add_frame(PERIOD / 4, PERIOD);
+    timeline.add_frame(PERIOD * 3, PERIOD);
+    const uint64_t slot = timeline.add_frame(PERIOD, PERIOD);
+    const uint64_t expected = (PERIOD * 5 + PERIOD / 4 + PERIOD / 2) / PERIOD;
+    if (slot != expected)
+    {
+        printf("resync: slot %llu instead of %llu\n",
+               (unsigned long long)slot,
+               (unsigned long long)expected);
+        ++failed;
+    }
+
+    printf("%s\n", failed == 0 ? "ok" : "FAILED");
+    return failed == 0 ? 0 : 1;
+}
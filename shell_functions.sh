@@ -6,6 +6,9 @@ VERSION="0.14.0"
 CRYPTO_INI_SYS=/etc/crypto.ini
 CRYPTO_INI_USR=/etc/crypto.ini.sd
 CRYPTO_INI_ALL=/etc/crypto.ini.all
+# Served by "iniget -d" when it is running. iniget falls back to reading
+# the files when it isn't
+CRYPTO_INI_SOCK=/var/run/iniget.sock
 
 ASOUND_CFG=/var/lib/alsa/asound.state
 SEED_FILE=/var/run/random-seed
@@ -49,8 +52,9 @@ alias seed_rng_with_sd="mcopy_bin_sd ::seed $SEED_FILE && dd if=$SEED_FILE of=/d
 # Saves a new random seed with data from the RNG
 alias save_sd_seed="dd if=/dev/random of=$SEED_FILE bs=512 count=1 && mcopy_bin_sd $SEED_FILE ::seed"
 
-# Generates the crypto.ini.all from the user config and system config
-alias gen_combined_crypto_config="cat $CRYPTO_INI_SYS $CRYPTO_INI_USR > $CRYPTO_INI_ALL"
+# Generates the crypto.ini.all from the user config and system config, and
+# the binary image of it the programs load at startup
+alias gen_combined_crypto_config="cat $CRYPTO_INI_SYS $CRYPTO_INI_USR > $CRYPTO_INI_ALL && compile_config $CRYPTO_INI_ALL"
 
 # Restores ALSA sound config for all sound cards
 alias alsa_restore="aplay_ls | grep -o -E 'USB_[UL][LR]' | xargs restore.sh"
@@ -226,7 +230,21 @@ get_config_val()
         return 1
     fi
 
-    iniget "$1" "$2" "$CRYPTO_INI_USR" "$CRYPTO_INI_SYS"
+    iniget -s "$CRYPTO_INI_SOCK" "$1" "$2" "$CRYPTO_INI_USR" "$CRYPTO_INI_SYS"
+}
+
+# Gets several configuration values at once and assigns them to shell
+# variables, ie. get_config_vals PIN=PTT:OutputGPIONum BIAS=PTT:OutputBias
+get_config_vals()
+{
+    if test -z "$1"
+    then
+        echo "usage: get_config_vals <var>=<section>:<key> ..." >&2
+        return 1
+    fi
+
+    VALS=`iniget -e -s "$CRYPTO_INI_SOCK" "$CRYPTO_INI_USR" "$CRYPTO_INI_SYS" -- "$@"` && \
+        eval "$VALS"
 }
 
 # Gets a configuration value from the user config file, if present
@@ -265,6 +283,19 @@ set_config_val()
     iniset "$1" "$2" "$3" "$CRYPTO_INI_USR" && gen_combined_crypto_config
 }
 
+# Saves several configuration values to the user config file with one
+# rewrite of the file, ie. set_config_vals Codec Enabled 1 Crypto Enabled 1
+set_config_vals()
+{
+    if test -z "$1" || test "$(($# % 3))" -ne 0
+    then
+        echo "usage: set_config_vals <section> <key> <value> ..." >&2
+        return 1
+    fi
+
+    iniset -b "$CRYPTO_INI_USR" -- "$@" && gen_combined_crypto_config
+}
+
 # Saves a configuration value to the system config file
 set_sys_config_val()
 {
@@ -481,7 +512,7 @@ load_sd_crypto_config()
         # Delete the local copy
         else
             rm -f "$CRYPTO_INI_USR"
-            cp "$CRYPTO_INI_SYS" "$CRYPTO_INI_ALL"
+            cp "$CRYPTO_INI_SYS" "$CRYPTO_INI_ALL" && compile_config "$CRYPTO_INI_ALL"
             return 0
         fi
     else
@@ -0,0 +1,86 @@
+#ifndef SPEECH_SYNTH_H
+#define SPEECH_SYNTH_H
+
+#include <cstdint>
+#include <cmath>
+
+// Generates speech-like test audio: syllables of a few harmonics of a
+// slowly gliding pitch, separated by pauses, with a little noise on top.
+// The syllable timing is random but the same for the same seed, which
+// gives the signal an envelope that can be lined up with a decoded copy
+class speech_synth
+{
+public:
+    speech_synth(uint sample_rate, uint32_t seed = 1)
+        : m_sample_rate(sample_rate),
+          m_rng(seed != 0 ? seed : 1),
+          m_pos(0),
+          m_phase(0.0),
+          m_segment_length(0),
+          m_segment_left(0),
+          m_voiced(false)
+    {
+    }
+
+    void generate(short* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i, ++m_pos)
+        {
+            if (m_segment_left == 0)
+            {
+                // Syllables of 100 to 300 ms, pauses of 50 to 400 ms
+                m_voiced = !m_voiced;
+                const uint ms = m_voiced ? 100 + (next() >> 16) % 200 : 50 + (next() >> 16) % 350;
+                m_segment_length = m_sample_rate * ms / 1000;
+                m_segment_left = m_segment_length;
+            }
+
+            // The phase of the fundamental is the integral of the pitch.
+            // Taking pitch(t) * t instead would sweep the frequency far
+            // beyond the pitch as t grows
+            const double t = static_cast<double>(m_pos) / m_sample_rate;
+            const double pitch = 120.0 + 30.0 * sin(2.0 * M_PI * 0.5 * t);
+            m_phase += 2.0 * M_PI * pitch / m_sample_rate;
+            if (m_phase >= 2.0 * M_PI)
+            {
+                m_phase -= 2.0 * M_PI;
+            }
+
+            double val = 0.0;
+            if (m_voiced)
+            {
+                for (int h = 1; h <= 4; ++h)
+                {
+                    val += sin(h * m_phase) / h;
+                }
+
+                // Raised cosine over the syllable, so it fades in and out
+                const double phase = static_cast<double>(m_segment_length - m_segment_left) / m_segment_length;
+                val *= 0.5 - 0.5 * cos(2.0 * M_PI * phase);
+            }
+            --m_segment_left;
+
+            const int noise = static_cast<int>(next() >> 22) - 512;
+            out[i] = static_cast<short>(val * 8000.0 + noise);
+        }
+    }
+
+private:
+    uint32_t next()
+    {
+        m_rng = m_rng * 1664525u + 1013904223u;
+        return m_rng;
+    }
+
+private:
+    uint     m_sample_rate;
+    uint32_t m_rng;
+    uint64_t m_pos;
+    double   m_phase;
+
+    uint     m_segment_length;
+    uint     m_segment_left;
+    bool     m_voiced;
+};
+
+#endif
@@ -12,8 +12,10 @@ then
     exec sleep 365d
 fi
 
-IN_HW=`get_sound_hw_device ModemDevice`
-OUT_HW=`get_sound_hw_device VoiceDevice`
+get_config_vals IN_HW=JACK:ModemDevice \
+                OUT_HW=JACK:VoiceDevice \
+                SAMPLE_RATE=JACK:SampleRateRX \
+                BUFFERS=JACK:NumBuffersRX
 
 echo "Wait for Sound Cards"
 wait_sound_dev_active_all "$IN_HW" "$OUT_HW" &>/dev/null
@@ -25,7 +27,4 @@ else
     HW_ARGS="-C $IN_HW -P $OUT_HW"
 fi
 
-SAMPLE_RATE=`get_config_val JACK SampleRateRX`
-BUFFERS=`get_config_val JACK NumBuffersRX`
-
 exec jackd -n rx -d alsa $HW_ARGS -r "$SAMPLE_RATE" -p 1024 -n "$BUFFERS"
@@ -5,10 +5,10 @@ trap "exit 0" INT TERM
 
 wait_initialized
 
-PIN=`get_config_val PTT OutputGPIONum`
-BIAS=`get_config_val PTT OutputBias`
-ACTIVE=`get_config_val PTT OutputActiveLow`
-DRIVE=`get_config_val PTT OutputDrive`
+get_config_vals PIN=PTT:OutputGPIONum \
+                BIAS=PTT:OutputBias \
+                ACTIVE=PTT:OutputActiveLow \
+                DRIVE=PTT:OutputDrive
 
 if test "$ACTIVE" -ne 0
 then
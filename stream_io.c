@@ -0,0 +1,773 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "stream_io.h"
+
+#define STREAM_ALIGNMENT 4096
+
+// Blocks in flight between the codec and an I/O thread when pipelined
+#define STREAM_PIPELINE_BLOCKS 4
+// Room for every block plus the end of stream marker, so pushing a block
+// never has to wait
+#define STREAM_QUEUE_SLOTS     (STREAM_PIPELINE_BLOCKS + 1)
+
+struct stream_block {
+    char*  data;
+    size_t capacity;
+    size_t len;
+};
+
+// Single producer, single consumer ring of blocks. head and tail only ever
+// increase, and a consumer that finds the ring empty sleeps on head with a
+// futex until the producer moves it
+struct block_queue {
+    struct stream_block* slots[STREAM_QUEUE_SLOTS];
+    atomic_uint          head;
+    atomic_uint          tail;
+};
+
+struct stream_pipeline {
+    pthread_t           thread;
+    // Blocks holding data, from the producer to the consumer, and empty
+    // blocks on their way back
+    struct block_queue  filled;
+    struct block_queue  empty;
+    struct stream_block blocks[STREAM_PIPELINE_BLOCKS];
+    // The block the codec thread is working on
+    struct stream_block* current;
+    atomic_int          failed;
+};
+
+struct stream_reader {
+    int    fd;
+    char*  buffer;
+    size_t capacity;
+    // Unread input is buffer[start, end)
+    size_t start;
+    size_t end;
+    int    eof;
+    // buffer is a mapping of the whole file
+    int    mapped;
+    int    owns_fd;
+    // Blocks are read by a thread of their own. buffer is the current
+    // block, and frames that straddle two blocks are put together in
+    // staging
+    struct stream_pipeline* pipeline;
+    char*                   staging;
+    size_t                  staging_capacity;
+};
+
+struct stream_writer {
+    int               fd;
+    char*             buffer;
+    size_t            capacity;
+    size_t            used;
+    enum stream_flush flush;
+    int               failed;
+    // buffer is a mapping of the file, capacity bytes long
+    int               mapped;
+    int               owns_fd;
+    // Blocks are written by a thread of their own. buffer is the current
+    // block
+    struct stream_pipeline* pipeline;
+};
+
+static char* alloc_block(size_t size) {
+    void* block = NULL;
+    return posix_memalign(&block, STREAM_ALIGNMENT, size) == 0 ? block : NULL;
+}
+
+static void futex_wait(atomic_uint* word, unsigned int value) {
+    syscall(SYS_futex, (unsigned int*)word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* word) {
+    syscall(SYS_futex, (unsigned int*)word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+// Blocks are large, so waking the other side on every push costs next to
+// nothing
+static void queue_push(struct block_queue* queue, struct stream_block* block) {
+    const unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    queue->slots[head % STREAM_QUEUE_SLOTS] = block;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    futex_wake(&queue->head);
+}
+
+static struct stream_block* queue_pop(struct block_queue* queue) {
+    const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned int head;
+    while ((head = atomic_load_explicit(&queue->head, memory_order_acquire)) == tail) {
+        futex_wait(&queue->head, head);
+    }
+
+    struct stream_block* block = queue->slots[tail % STREAM_QUEUE_SLOTS];
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return block;
+}
+
+static struct stream_pipeline* create_pipeline(size_t block_size) {
+    struct stream_pipeline* pipeline = calloc(1, sizeof(struct stream_pipeline));
+    if (pipeline == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < STREAM_PIPELINE_BLOCKS; ++i) {
+        struct stream_block* block = &pipeline->blocks[i];
+        block->data = alloc_block(block_size);
+        block->capacity = block_size;
+        if (block->data == NULL) {
+            for (size_t j = 0; j < i; ++j) {
+                free(pipeline->blocks[j].data);
+            }
+            free(pipeline);
+            return NULL;
+        }
+        queue_push(&pipeline->empty, block);
+    }
+
+    return pipeline;
+}
+
+static void destroy_pipeline(struct stream_pipeline* pipeline) {
+    for (size_t i = 0; i < STREAM_PIPELINE_BLOCKS; ++i) {
+        free(pipeline->blocks[i].data);
+    }
+    free(pipeline);
+}
+
+// Fewer, larger pipe transfers. Best effort, since the kernel caps the
+// size for unprivileged processes
+static void grow_pipe(int fd, size_t size) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) && size <= INT32_MAX) {
+        fcntl(fd, F_SETPIPE_SZ, (int)size);
+    }
+}
+
+struct stream_reader* stream_reader_open(int fd, size_t block_size) {
+    struct stream_reader* reader = calloc(1, sizeof(struct stream_reader));
+    if (reader == NULL) {
+        return NULL;
+    }
+
+    reader->fd = fd;
+    reader->capacity = block_size > 0 ? block_size : STREAM_DEFAULT_BLOCK_SIZE;
+    reader->buffer = alloc_block(reader->capacity);
+    if (reader->buffer == NULL) {
+        free(reader);
+        return NULL;
+    }
+
+    grow_pipe(fd, reader->capacity);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    return reader;
+}
+
+// Hands over whatever each read() returns, so a slow producer isn't held
+// up until a whole block arrives. An empty block marks the end of the input
+static void* reader_main(void* arg) {
+    struct stream_reader* reader = arg;
+    struct stream_pipeline* pipeline = reader->pipeline;
+
+    while (1) {
+        struct stream_block* block = queue_pop(&pipeline->empty);
+        if (block == NULL) {
+            break;
+        }
+
+        ssize_t n;
+        do {
+            n = read(reader->fd, block->data, block->capacity);
+        } while (n < 0 && errno == EINTR);
+
+        block->len = n > 0 ? n : 0;
+        if (n < 0) {
+            atomic_store(&pipeline->failed, 1);
+        }
+        queue_push(&pipeline->filled, block);
+        if (n <= 0) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+struct stream_reader* stream_reader_open_pipelined(int fd, size_t block_size) {
+    struct stream_reader* reader = calloc(1, sizeof(struct stream_reader));
+    if (reader == NULL) {
+        return NULL;
+    }
+
+    reader->fd = fd;
+    reader->capacity = block_size > 0 ? block_size : STREAM_DEFAULT_BLOCK_SIZE;
+    reader->pipeline = create_pipeline(reader->capacity);
+    if (reader->pipeline == NULL) {
+        free(reader);
+        return NULL;
+    }
+
+    grow_pipe(fd, reader->capacity);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (pthread_create(&reader->pipeline->thread, NULL, reader_main, reader) != 0) {
+        destroy_pipeline(reader->pipeline);
+        free(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+struct stream_reader* stream_reader_open_file(const char* path, size_t block_size, int pipelined) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        struct stream_reader* reader = pipelined ?
+            stream_reader_open_pipelined(fd, block_size) :
+            stream_reader_open(fd, block_size);
+        if (reader == NULL) {
+            close(fd);
+            return NULL;
+        }
+        reader->owns_fd = 1;
+        return reader;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    struct stream_reader* reader = map != MAP_FAILED ? calloc(1, sizeof(struct stream_reader)) : NULL;
+    if (reader == NULL) {
+        if (map != MAP_FAILED) {
+            munmap(map, st.st_size);
+        }
+        close(fd);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    // The whole file is already "read"
+    reader->fd = fd;
+    reader->owns_fd = 1;
+    reader->mapped = 1;
+    reader->buffer = map;
+    reader->capacity = st.st_size;
+    reader->end = st.st_size;
+    reader->eof = 1;
+    return reader;
+}
+
+size_t stream_reader_size(const struct stream_reader* reader) {
+    return reader->mapped ? reader->capacity : 0;
+}
+
+void stream_reader_close(struct stream_reader* reader) {
+    if (reader != NULL) {
+        if (reader->pipeline != NULL) {
+            // Stops the thread whether it is waiting for an empty block or
+            // blocked reading
+            queue_push(&reader->pipeline->empty, NULL);
+            pthread_cancel(reader->pipeline->thread);
+            pthread_join(reader->pipeline->thread, NULL);
+            destroy_pipeline(reader->pipeline);
+            free(reader->staging);
+        }
+        else if (reader->mapped) {
+            munmap(reader->buffer, reader->capacity);
+        }
+        else {
+            free(reader->buffer);
+        }
+        if (reader->owns_fd) {
+            close(reader->fd);
+        }
+        free(reader);
+    }
+}
+
+// Makes room for at least bytes bytes from the start of the buffer
+static int make_room(struct stream_reader* reader, size_t bytes) {
+    const size_t pending = reader->end - reader->start;
+    if (bytes > reader->capacity) {
+        char* buffer = alloc_block(bytes);
+        if (buffer == NULL) {
+            return 0;
+        }
+        memcpy(buffer, reader->buffer + reader->start, pending);
+        free(reader->buffer);
+        reader->buffer = buffer;
+        reader->capacity = bytes;
+    }
+    else {
+        memmove(reader->buffer, reader->buffer + reader->start, pending);
+    }
+
+    reader->start = 0;
+    reader->end = pending;
+    return 1;
+}
+
+// Moves on to the next block from the reader thread
+static int next_block(struct stream_reader* reader) {
+    struct stream_pipeline* pipeline = reader->pipeline;
+    if (reader->eof) {
+        return 0;
+    }
+    if (pipeline->current != NULL) {
+        queue_push(&pipeline->empty, pipeline->current);
+    }
+
+    pipeline->current = queue_pop(&pipeline->filled);
+    reader->buffer = pipeline->current->data;
+    reader->start = 0;
+    reader->end = pipeline->current->len;
+    reader->eof = reader->end == 0;
+    return !reader->eof;
+}
+
+static const void* next_pipelined(struct stream_reader* reader, size_t bytes) {
+    while (reader->start == reader->end) {
+        if (!next_block(reader)) {
+            return NULL;
+        }
+    }
+
+    if (reader->end - reader->start >= bytes) {
+        const void* frame = reader->buffer + reader->start;
+        reader->start += bytes;
+        return frame;
+    }
+
+    // The frame continues in the next block(s)
+    if (bytes > reader->staging_capacity) {
+        free(reader->staging);
+        reader->staging = alloc_block(bytes);
+        reader->staging_capacity = reader->staging != NULL ? bytes : 0;
+        if (reader->staging == NULL) {
+            return NULL;
+        }
+    }
+
+    size_t have = reader->end - reader->start;
+    memcpy(reader->staging, reader->buffer + reader->start, have);
+    reader->start = reader->end;
+    while (have < bytes) {
+        if (!next_block(reader)) {
+            return NULL;
+        }
+
+        const size_t n = reader->end < bytes - have ? reader->end : bytes - have;
+        memcpy(reader->staging + have, reader->buffer, n);
+        reader->start = n;
+        have += n;
+    }
+
+    return reader->staging;
+}
+
+const void* stream_reader_next(struct stream_reader* reader, size_t bytes) {
+    if (reader->pipeline != NULL) {
+        return next_pipelined(reader, bytes);
+    }
+
+    if (reader->end - reader->start < bytes) {
+        if (reader->eof) {
+            return NULL;
+        }
+        if (reader->start + bytes > reader->capacity && !make_room(reader, bytes)) {
+            return NULL;
+        }
+
+        // Fill the rest of the block, or as much as a pipe has to give
+        // while there isn't a whole frame yet
+        while (!reader->eof && reader->end - reader->start < bytes) {
+            const ssize_t n = read(reader->fd,
+                                   reader->buffer + reader->end,
+                                   reader->capacity - reader->end);
+            if (n > 0) {
+                reader->end += n;
+            }
+            else if (n == 0 || errno != EINTR) {
+                reader->eof = 1;
+            }
+        }
+
+        if (reader->end - reader->start < bytes) {
+            return NULL;
+        }
+    }
+
+    const void* frame = reader->buffer + reader->start;
+    reader->start += bytes;
+    return frame;
+}
+
+struct stream_writer* stream_writer_open(int fd, size_t block_size, enum stream_flush flush) {
+    struct stream_writer* writer = calloc(1, sizeof(struct stream_writer));
+    if (writer == NULL) {
+        return NULL;
+    }
+
+    writer->fd = fd;
+    writer->flush = flush;
+    writer->capacity = block_size > 0 ? block_size : STREAM_DEFAULT_BLOCK_SIZE;
+    writer->buffer = alloc_block(writer->capacity);
+    if (writer->buffer == NULL) {
+        free(writer);
+        return NULL;
+    }
+
+    grow_pipe(fd, writer->capacity);
+
+    return writer;
+}
+
+// Writes blocks until it is handed NULL. After a failed write the rest of
+// the blocks are just recycled, so the codec thread never waits for them
+static void* writer_main(void* arg) {
+    struct stream_writer* writer = arg;
+    struct stream_pipeline* pipeline = writer->pipeline;
+
+    struct stream_block* block;
+    while ((block = queue_pop(&pipeline->filled)) != NULL) {
+        size_t written = 0;
+        while (!atomic_load_explicit(&pipeline->failed, memory_order_relaxed) &&
+               written < block->len) {
+            const ssize_t n = write(writer->fd, block->data + written, block->len - written);
+            if (n > 0) {
+                written += n;
+            }
+            else if (n < 0 && errno != EINTR) {
+                atomic_store(&pipeline->failed, 1);
+            }
+        }
+
+        queue_push(&pipeline->empty, block);
+    }
+
+    return NULL;
+}
+
+struct stream_writer* stream_writer_open_pipelined(int fd, size_t block_size, enum stream_flush flush) {
+    struct stream_writer* writer = calloc(1, sizeof(struct stream_writer));
+    if (writer == NULL) {
+        return NULL;
+    }
+
+    writer->fd = fd;
+    writer->flush = flush;
+    writer->pipeline = create_pipeline(block_size > 0 ? block_size : STREAM_DEFAULT_BLOCK_SIZE);
+    if (writer->pipeline == NULL) {
+        free(writer);
+        return NULL;
+    }
+
+    grow_pipe(fd, writer->pipeline->blocks[0].capacity);
+
+    if (pthread_create(&writer->pipeline->thread, NULL, writer_main, writer) != 0) {
+        destroy_pipeline(writer->pipeline);
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+struct stream_writer* stream_writer_open_file(const char* path,
+                                              size_t size_hint,
+                                              size_t block_size,
+                                              enum stream_flush flush,
+                                              int pipelined) {
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // Mapped pages need disk blocks behind them before they are written,
+    // or a full disk raises SIGBUS instead of failing a write. Where the
+    // space can't be allocated the file is written in blocks, so write()
+    // reports the error
+    const size_t capacity = size_hint > 0 ? size_hint : STREAM_DEFAULT_BLOCK_SIZE;
+    struct stat st;
+    const int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (!regular || posix_fallocate(fd, 0, capacity) != 0) {
+        if (regular && ftruncate(fd, 0) != 0) {
+            close(fd);
+            return NULL;
+        }
+        struct stream_writer* writer = pipelined ?
+            stream_writer_open_pipelined(fd, block_size, flush) :
+            stream_writer_open(fd, block_size, flush);
+        if (writer == NULL) {
+            close(fd);
+            return NULL;
+        }
+        writer->owns_fd = 1;
+        return writer;
+    }
+
+    struct stream_writer* writer = calloc(1, sizeof(struct stream_writer));
+    if (writer == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    writer->fd = fd;
+    writer->owns_fd = 1;
+    writer->mapped = 1;
+    writer->flush = flush;
+    writer->capacity = capacity;
+    writer->buffer = mmap(NULL, writer->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (writer->buffer == MAP_FAILED) {
+        close(fd);
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+// Grows a mapped file to hold at least size bytes, allocating the disk
+// space first
+static int grow_mapping(struct stream_writer* writer, size_t size) {
+    size_t capacity = writer->capacity;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+
+    // Close to a full disk, only ask for what is needed
+    int err = posix_fallocate(writer->fd, writer->capacity, capacity - writer->capacity);
+    if (err != 0 && capacity > size) {
+        capacity = size;
+        err = posix_fallocate(writer->fd, writer->capacity, capacity - writer->capacity);
+    }
+
+    void* map = err == 0 ?
+        mremap(writer->buffer, writer->capacity, capacity, MREMAP_MAYMOVE) :
+        MAP_FAILED;
+    if (map == MAP_FAILED) {
+        writer->failed = 1;
+        return 0;
+    }
+
+    writer->buffer = map;
+    writer->capacity = capacity;
+    return 1;
+}
+
+// Hands the current block to the writer thread
+static void submit_block(struct stream_writer* writer) {
+    struct stream_pipeline* pipeline = writer->pipeline;
+    if (pipeline->current != NULL && writer->used > 0) {
+        pipeline->current->len = writer->used;
+        queue_push(&pipeline->filled, pipeline->current);
+        pipeline->current = NULL;
+        writer->buffer = NULL;
+        writer->capacity = 0;
+        writer->used = 0;
+    }
+}
+
+int stream_writer_flush(struct stream_writer* writer) {
+    // Mapped output is already in the page cache
+    if (writer->mapped) {
+        return !writer->failed;
+    }
+    if (writer->pipeline != NULL) {
+        submit_block(writer);
+        return !atomic_load(&writer->pipeline->failed);
+    }
+
+    size_t written = 0;
+    while (!writer->failed && written < writer->used) {
+        const ssize_t n = write(writer->fd, writer->buffer + written, writer->used - written);
+        if (n > 0) {
+            written += n;
+        }
+        else if (n < 0 && errno != EINTR) {
+            writer->failed = 1;
+        }
+    }
+
+    writer->used = 0;
+    return !writer->failed;
+}
+
+int stream_writer_close(struct stream_writer* writer) {
+    if (writer == NULL) {
+        return 1;
+    }
+
+    int ok = stream_writer_flush(writer);
+    if (writer->pipeline != NULL) {
+        // The writer thread finishes the blocks queued before the marker
+        struct stream_pipeline* pipeline = writer->pipeline;
+        if (pipeline->current != NULL) {
+            queue_push(&pipeline->empty, pipeline->current);
+        }
+        queue_push(&pipeline->filled, NULL);
+        pthread_join(pipeline->thread, NULL);
+        ok = !atomic_load(&pipeline->failed);
+        destroy_pipeline(pipeline);
+    }
+    else if (writer->mapped) {
+        munmap(writer->buffer, writer->capacity);
+        ok = ftruncate(writer->fd, writer->used) == 0 && ok;
+    }
+    else {
+        free(writer->buffer);
+    }
+    if (writer->owns_fd) {
+        ok = close(writer->fd) == 0 && ok;
+    }
+    free(writer);
+    return ok;
+}
+
+static void* reserve_pipelined(struct stream_writer* writer, size_t bytes) {
+    struct stream_pipeline* pipeline = writer->pipeline;
+    if (writer->used + bytes > writer->capacity) {
+        submit_block(writer);
+    }
+
+    if (pipeline->current == NULL) {
+        struct stream_block* block = queue_pop(&pipeline->empty);
+        if (bytes > block->capacity) {
+            char* data = alloc_block(bytes);
+            if (data == NULL) {
+                queue_push(&pipeline->empty, block);
+                return NULL;
+            }
+            free(block->data);
+            block->data = data;
+            block->capacity = bytes;
+        }
+
+        pipeline->current = block;
+        writer->buffer = block->data;
+        writer->capacity = block->capacity;
+        writer->used = 0;
+    }
+
+    return atomic_load_explicit(&pipeline->failed, memory_order_relaxed) ?
+        NULL : writer->buffer + writer->used;
+}
+
+void* stream_writer_reserve(struct stream_writer* writer, size_t bytes) {
+    if (writer->mapped) {
+        if (writer->used + bytes > writer->capacity &&
+            !grow_mapping(writer, writer->used + bytes)) {
+            return NULL;
+        }
+        return writer->buffer + writer->used;
+    }
+
+    if (writer->pipeline != NULL) {
+        return reserve_pipelined(writer, bytes);
+    }
+
+    if (writer->used + bytes > writer->capacity && !stream_writer_flush(writer)) {
+        return NULL;
+    }
+
+    if (bytes > writer->capacity) {
+        char* buffer = alloc_block(bytes);
+        if (buffer == NULL) {
+            return NULL;
+        }
+        free(writer->buffer);
+        writer->buffer = buffer;
+        writer->capacity = bytes;
+    }
+
+    return writer->buffer + writer->used;
+}
+
+int stream_writer_commit(struct stream_writer* writer, size_t bytes) {
+    writer->used += bytes;
+    if (writer->mapped) {
+        return !writer->failed;
+    }
+    if (writer->pipeline != NULL) {
+        if (writer->flush == STREAM_FLUSH_FRAME || writer->used == writer->capacity) {
+            submit_block(writer);
+        }
+        return !atomic_load_explicit(&writer->pipeline->failed, memory_order_relaxed);
+    }
+    if (writer->flush == STREAM_FLUSH_FRAME || writer->used == writer->capacity) {
+        return stream_writer_flush(writer);
+    }
+
+    return !writer->failed;
+}
+
+int stream_writer_write(struct stream_writer* writer, const void* data, size_t bytes) {
+    void* out = stream_writer_reserve(writer, bytes);
+    if (out == NULL) {
+        return 0;
+    }
+
+    memcpy(out, data, bytes);
+    return stream_writer_commit(writer, bytes);
+}
+
+size_t parse_stream_size(const char* str) {
+    char* end = NULL;
+    const unsigned long long size = strtoull(str, &end, 10);
+    if (end == str) {
+        return 0;
+    }
+
+    switch (*end) {
+        case '\0':
+            return size;
+        case 'k':
+        case 'K':
+            return end[1] == '\0' ? size * 1024 : 0;
+        case 'm':
+        case 'M':
+            return end[1] == '\0' ? size * 1024 * 1024 : 0;
+        default:
+            return 0;
+    }
+}
+
+int parse_stream_flush(const char* str) {
+    if (strcasecmp(str, "block") == 0) {
+        return STREAM_FLUSH_BLOCK;
+    }
+    if (strcasecmp(str, "frame") == 0) {
+        return STREAM_FLUSH_FRAME;
+    }
+
+    return -1;
+}
+
+void print_stream_throughput(unsigned long long frames, const struct timespec* start_time) {
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    const double seconds = (end_time.tv_sec - start_time->tv_sec) +
+                           (end_time.tv_nsec - start_time->tv_nsec) / 1e9;
+    fprintf(stderr,
+            "%llu frames in %.3f s, %.1f frames/s\n",
+            frames,
+            seconds,
+            seconds > 0.0 ? frames / seconds : 0.0);
+}
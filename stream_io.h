@@ -0,0 +1,90 @@
+#ifndef STREAM_IO_H
+#define STREAM_IO_H
+
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default size of the blocks read and written by the streams
+#define STREAM_DEFAULT_BLOCK_SIZE (1024 * 1024)
+
+enum stream_flush {
+    // Write whenever a block fills up, and at the end
+    STREAM_FLUSH_BLOCK,
+    // Write after every frame, for consumers listening live
+    STREAM_FLUSH_FRAME
+};
+
+// Reads a file descriptor in large page aligned blocks and hands out
+// frames from them by pointer, so there is one read() per block instead of
+// one per frame. Pipes are enlarged to the block size where the kernel
+// allows it
+struct stream_reader;
+
+struct stream_reader* stream_reader_open(int fd, size_t block_size);
+// Same, but blocks are read ahead by a thread of their own, so reading
+// overlaps with the codec
+struct stream_reader* stream_reader_open_pipelined(int fd, size_t block_size);
+// Maps a regular file, with MADV_SEQUENTIAL, so frames point straight into
+// the page cache. Anything else, ie. a FIFO, is read in blocks, on a
+// thread of its own if pipelined is set
+struct stream_reader* stream_reader_open_file(const char* path, size_t block_size, int pipelined);
+// The size of a mapped file, otherwise 0
+size_t stream_reader_size(const struct stream_reader* reader);
+void stream_reader_close(struct stream_reader* reader);
+
+// Returns the next bytes bytes of input, or NULL at the end of the input or
+// on an error, in which case any partial frame is dropped. The pointer is
+// aligned for 16-bit samples and valid until the next call
+const void* stream_reader_next(struct stream_reader* reader, size_t bytes);
+
+// Buffers frames written to a file descriptor into large page aligned
+// blocks
+struct stream_writer;
+
+struct stream_writer* stream_writer_open(int fd, size_t block_size, enum stream_flush flush);
+// Same, but full blocks are written by a thread of their own, so writing
+// overlaps with the codec
+struct stream_writer* stream_writer_open_pipelined(int fd, size_t block_size, enum stream_flush flush);
+// Creates or truncates path, allocates size_hint bytes of disk space for it
+// and maps it, so frames are written straight into the page cache. The
+// file grows as needed and is truncated to what was written on close.
+// flush is ignored for mapped files. Space is allocated before it is
+// mapped, so a full disk makes stream_writer_reserve() fail rather than
+// raising SIGBUS. Files that can't be mapped or allocated, ie. FIFOs, are
+// written in blocks, on a thread of their own if pipelined is set
+struct stream_writer* stream_writer_open_file(const char* path,
+                                              size_t size_hint,
+                                              size_t block_size,
+                                              enum stream_flush flush,
+                                              int pipelined);
+// Flushes what is left. Returns 0 if any write failed
+int stream_writer_close(struct stream_writer* writer);
+
+// Returns space for bytes bytes of output, to be filled in and then passed
+// to stream_writer_commit(), which may be given fewer bytes. Returns NULL
+// on error
+void* stream_writer_reserve(struct stream_writer* writer, size_t bytes);
+int stream_writer_commit(struct stream_writer* writer, size_t bytes);
+
+// Copies data into the stream
+int stream_writer_write(struct stream_writer* writer, const void* data, size_t bytes);
+int stream_writer_flush(struct stream_writer* writer);
+
+// Parses sizes like 65536, 64k or 1M. Returns 0 if invalid
+size_t parse_stream_size(const char* str);
+// Parses "block" or "frame". Returns -1 if invalid
+int parse_stream_flush(const char* str);
+
+// Prints the number of frames handled since start_time, taken from
+// CLOCK_MONOTONIC, and the rate to stderr
+void print_stream_throughput(unsigned long long frames, const struct timespec* start_time);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
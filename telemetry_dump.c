@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "freedv_api.h"
+#include "crypto_telemetry.h"
+
+// Dumps, filters and summarizes a telemetry file written by crypto_tx,
+// crypto_rx, jack_crypto_tx or jack_crypto_rx. The file is only read, so
+// this can be run while the radio is operating
+
+#define FOLLOW_POLL_US   100000
+#define MAX_READ_RETRIES 3
+
+struct filter
+{
+    int   direction; // -1 for any
+    int   channel;   // -1 for any
+    int   sync;      // -1 for any, otherwise 0 or 1
+    float min_snr;
+};
+
+struct summary
+{
+    unsigned long records;
+    unsigned long synced;
+    unsigned long signal;
+    unsigned long demodulated;
+    unsigned long rekeys;
+    double        snr_sum;
+    float         snr_min;
+    float         snr_max;
+    double        rms_sum;
+    uint64_t      first_ns;
+    uint64_t      last_ns;
+};
+
+static const char* mode_name(int32_t mode)
+{
+    switch (mode)
+    {
+    case -1:                return "analog";
+    case FREEDV_MODE_1600:  return "1600";
+    case FREEDV_MODE_700C:  return "700C";
+    case FREEDV_MODE_700D:  return "700D";
+    case FREEDV_MODE_700E:  return "700E";
+    case FREEDV_MODE_2400A: return "2400A";
+    case FREEDV_MODE_2400B: return "2400B";
+    case FREEDV_MODE_800XA: return "800XA";
+    default:                return "?";
+    }
+}
+
+static const char* crypto_name(uint8_t status)
+{
+    switch (status)
+    {
+    case 0:  return "plain";
+    case 1:  return "weak";
+    case 2:  return "encrypted";
+    default: return "?";
+    }
+}
+
+static int matches(const struct filter* f, const crypto_telemetry_record* rec)
+{
+    const int synced = (rec->flags & TELEMETRY_FLAG_SYNC) != 0;
+
+    return (f->direction < 0 || rec->direction == f->direction) &&
+           (f->channel < 0 || rec->channel == f->channel) &&
+           (f->sync < 0 || synced == f->sync) &&
+           rec->snr_est >= f->min_snr;
+}
+
+static void print_record(const crypto_telemetry_record* rec)
+{
+    printf("%14.6f %s %2u %-6s %5u %5u %7.2f %6d %c%c%c%c %s\n",
+           rec->timestamp_ns / 1e9,
+           rec->direction == TELEMETRY_DIR_TX ? "tx" : "rx",
+           (unsigned)rec->channel,
+           mode_name(rec->mode),
+           (unsigned)rec->nin,
+           (unsigned)rec->nout,
+           rec->snr_est,
+           (int)rec->rms,
+           (rec->flags & TELEMETRY_FLAG_SYNC) ? 'S' : '-',
+           (rec->flags & TELEMETRY_FLAG_SIGNAL) ? 'Q' : '-',
+           (rec->flags & TELEMETRY_FLAG_DEMOD) ? 'D' : '-',
+           (rec->flags & TELEMETRY_FLAG_REKEY) ? 'K' : '-',
+           crypto_name(rec->crypto_status));
+}
+
+static void add_to_summary(struct summary* s, const crypto_telemetry_record* rec)
+{
+    if (s->records == 0)
+    {
+        s->first_ns = rec->timestamp_ns;
+        s->snr_min = FLT_MAX;
+        s->snr_max = -FLT_MAX;
+    }
+    s->last_ns = rec->timestamp_ns;
+    ++s->records;
+
+    s->rms_sum += rec->rms;
+    if (rec->flags & TELEMETRY_FLAG_SIGNAL) ++s->signal;
+    if (rec->flags & TELEMETRY_FLAG_REKEY) ++s->rekeys;
+    if (rec->flags & TELEMETRY_FLAG_DEMOD) ++s->demodulated;
+
+    // Only count the SNR while synced, the estimate is meaningless otherwise
+    if (rec->flags & TELEMETRY_FLAG_SYNC)
+    {
+        ++s->synced;
+        s->snr_sum += rec->snr_est;
+        if (rec->snr_est < s->snr_min) s->snr_min = rec->snr_est;
+        if (rec->snr_est > s->snr_max) s->snr_max = rec->snr_est;
+    }
+}
+
+static void print_summary(const char* label, const struct summary* s)
+{
+    if (s->records == 0)
+    {
+        return;
+    }
+
+    const double span = (s->last_ns - s->first_ns) / 1e9;
+
+    printf("%s: %lu records over %.1f s", label, s->records, span);
+    if (span > 0.0)
+    {
+        printf(" (%.1f/s)", (s->records - 1) / span);
+    }
+    printf("\n");
+    printf("  mean RMS %.0f, signal %.1f%%, demodulated %.1f%%, synced %.1f%%, rekeys %lu\n",
+           s->rms_sum / s->records,
+           100.0 * s->signal / s->records,
+           100.0 * s->demodulated / s->records,
+           100.0 * s->synced / s->records,
+           s->rekeys);
+    if (s->synced > 0)
+    {
+        printf("  SNR while synced: min %.2f, mean %.2f, max %.2f dB\n",
+               s->snr_min,
+               s->snr_sum / s->synced,
+               s->snr_max);
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] <telemetry file>\n"
+            "  -n <count>   Start with the last <count> records\n"
+            "  -f           Follow the file as new records are written\n"
+            "  -s           Print a summary instead of the records\n"
+            "  -d <rx|tx>   Only records for one direction\n"
+            "  -c <channel> Only records for one diversity branch\n"
+            "  -y           Only records where the demodulator is synced\n"
+            "  -u           Only records where the demodulator is not synced\n"
+            "  -m <snr>     Only records with at least this SNR estimate\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    struct filter f = { -1, -1, -1, -FLT_MAX };
+    unsigned long last_n = 0;
+    int follow = 0;
+    int summarize = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:fsd:c:yum:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': last_n = strtoul(optarg, NULL, 10); break;
+        case 'f': follow = 1; break;
+        case 's': summarize = 1; break;
+        case 'd': f.direction = strcasecmp(optarg, "tx") == 0 ? TELEMETRY_DIR_TX : TELEMETRY_DIR_RX; break;
+        case 'c': f.channel = atoi(optarg); break;
+        case 'y': f.sync = 1; break;
+        case 'u': f.sync = 0; break;
+        case 'm': f.min_snr = atof(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // A summary is printed once every retained record has been read
+    if (summarize)
+    {
+        follow = 0;
+    }
+
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    crypto_telemetry* telem = telemetry_open_reader(argv[optind]);
+    if (telem == NULL)
+    {
+        fprintf(stderr, "Could not open telemetry file %s\n", argv[optind]);
+        return 1;
+    }
+
+    const uint64_t capacity = telemetry_capacity(telem);
+    uint64_t head = telemetry_head(telem);
+    uint64_t next = head > capacity ? head - capacity : 0;
+    if (last_n > 0 && head - next > last_n)
+    {
+        next = head - last_n;
+    }
+
+    struct summary rx_summary;
+    struct summary tx_summary;
+    memset(&rx_summary, 0, sizeof(rx_summary));
+    memset(&tx_summary, 0, sizeof(tx_summary));
+    unsigned long lost = 0;
+    int retries = 0;
+
+    if (!summarize)
+    {
+        printf("# %12s dir ch %-6s %5s %5s %7s %6s flag crypto\n",
+               "time", "mode", "nin", "nout", "snr", "rms");
+    }
+
+    for (;;)
+    {
+        head = telemetry_head(telem);
+
+        // Fell a whole lap behind the writers
+        if (head - next > capacity)
+        {
+            lost += head - capacity - next;
+            next = head - capacity;
+        }
+
+        if (next == head)
+        {
+            if (!follow)
+            {
+                break;
+            }
+
+            fflush(stdout);
+            usleep(FOLLOW_POLL_US);
+            continue;
+        }
+
+        crypto_telemetry_record rec;
+        if (!telemetry_read(telem, next, &rec))
+        {
+            // Either still being written, or overwritten while we read it
+            if (++retries < MAX_READ_RETRIES)
+            {
+                usleep(1000);
+                continue;
+            }
+
+            ++lost;
+        }
+        else if (matches(&f, &rec))
+        {
+            if (summarize)
+            {
+                add_to_summary(rec.direction == TELEMETRY_DIR_TX ? &tx_summary : &rx_summary, &rec);
+            }
+            else
+            {
+                print_record(&rec);
+            }
+        }
+
+        retries = 0;
+        ++next;
+    }
+
+    if (summarize)
+    {
+        print_summary("RX", &rx_summary);
+        print_summary("TX", &tx_summary);
+    }
+
+    if (lost > 0)
+    {
+        fprintf(stderr, "%lu records were overwritten before they could be read\n", lost);
+    }
+
+    telemetry_close(telem);
+
+    return 0;
+}
@@ -0,0 +1,265 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "crypto_common.h"
+#include "crypto_trace.h"
+#include "control_loop.h"
+#include "tx_engine.h"
+
+tx_state* create_tx_state(const char* config_file, uint sample_rate)
+{
+    std::unique_ptr<tx_state> st(new tx_state());
+
+    st->crypto_tx.reset(new crypto_tx_common("crypto_tx", config_file));
+
+    const size_t speech_frames =
+        get_nom_resampled_frames(st->crypto_tx->speech_samples_per_frame(),
+                                 st->crypto_tx->speech_sample_rate(),
+                                 sample_rate);
+    const size_t modem_frames =
+        get_nom_resampled_frames(st->crypto_tx->modem_samples_per_frame(),
+                                 st->crypto_tx->modem_sample_rate(),
+                                 sample_rate);
+
+    st->input_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, speech_frames * 2));
+    st->output_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, modem_frames * 2));
+
+    return st.release();
+}
+
+tx_engine::tx_engine(tx_metrics& counters, tx_ptt& ptt, control_loop* control)
+    : m_counters(counters),
+      m_ptt(ptt),
+      m_control(control),
+      m_delay_periods(0),
+      m_transmitting_prev(false)
+{
+}
+
+void tx_engine::play(audio_buffer_t&& audio)
+{
+    m_tts_file.publish(new audio_buffer_t(std::move(audio)));
+}
+
+void tx_engine::process(const audio_sample_t* voice_frames,
+                        audio_sample_t*       modem_frames,
+                        uint                  nframes,
+                        uint                  sample_rate)
+{
+    // Picks up a new encoder after the config file is reloaded
+    bool state_swapped = false;
+    tx_state* const st = m_state.rt_acquire(&state_swapped);
+    bool tts_swapped = false;
+    const audio_buffer_t* const tts_file = m_tts_file.rt_acquire(&tts_swapped);
+    if ((state_swapped || tts_swapped) && m_control != nullptr)
+    {
+        // Let the main thread free the previous state and audio
+        m_control->notify();
+    }
+    crypto_tx_common* const crypto_tx = st->crypto_tx.get();
+    resampler* const input_resampler = st->input_resampler.get();
+    resampler* const output_resampler = st->output_resampler.get();
+
+    const uint64_t start_ns = metric_now_ns();
+    const uint64_t rekeys_before = crypto_tx->num_rekeys();
+    uint64_t encode_ns = 0;
+    TRACE_THREAD("jack_crypto_tx");
+    TRACE_SCOPE("process");
+    TRACE_STAGES(stages);
+
+    const uint voice_sample_rate = crypto_tx->speech_sample_rate();
+    const uint modem_sample_rate = crypto_tx->modem_sample_rate();
+
+    input_resampler->set_sample_rates(sample_rate, voice_sample_rate);
+    output_resampler->set_sample_rates(modem_sample_rate, sample_rate);
+
+    const size_t n_nom_modem_samples = crypto_tx->modem_samples_per_frame();
+    const size_t n_speech_samples = crypto_tx->speech_samples_per_frame();
+
+    if (tts_swapped)
+    {
+        // Zero-pad a few frames at the start to give the encryption a
+        // chance to sync
+        m_tts_buffer.insert(m_tts_buffer.cend(), nframes * 6, 0.0);
+        m_tts_buffer.insert(m_tts_buffer.cend(), tts_file->cbegin(), tts_file->cend());
+    }
+
+    // The new resamplers need to be primed even if a transmission is in
+    // progress
+    if (state_swapped)
+    {
+        m_transmitting_prev = false;
+    }
+
+    const bool mic_enabled = m_ptt.mic_enabled(*crypto_tx);
+    const bool transmitting_cur = mic_enabled || !m_tts_buffer.empty();
+    if (transmitting_cur)
+    {
+        m_delay_periods = 0;
+
+        metric_add(m_counters.transmit_us, nframes * 1000000ull / sample_rate);
+
+        // Only "prime" the resamplers on the "rising edge"
+        if (!m_transmitting_prev)
+        {
+            metric_add(m_counters.transmissions);
+
+            input_resampler->enqueue_zeroes(nframes);
+            input_resampler->clear();
+
+            output_resampler->enqueue_zeroes(n_nom_modem_samples);
+            output_resampler->clear();
+        }
+
+        // Turn on the PTT output
+        m_ptt.set_output(true);
+
+        TRACE_STAGE(stages, "input_resample");
+        const size_t tts_to_add = std::min(m_tts_buffer.size(), (size_t)nframes);
+        if (tts_to_add > 0)
+        {
+            input_resampler->enqueue(m_tts_buffer.begin(),
+                                     m_tts_buffer.begin() + tts_to_add);
+            m_tts_buffer.erase(m_tts_buffer.begin(), m_tts_buffer.begin() + tts_to_add);
+        }
+
+        // Offset the voice samples so TTS doesn't add delay to the signal
+        const uint voice_to_add = nframes - tts_to_add;
+        // Only add voice if the mic is hot. Otherwise add zeroes
+        if (mic_enabled)
+        {
+            input_resampler->enqueue(voice_frames + tts_to_add, voice_to_add);
+        }
+        else
+        {
+            input_resampler->enqueue_zeroes(voice_to_add);
+        }
+
+        // Now add the remaining frames without zero-padding
+        TRACE_STAGE(stages, "encode");
+        while (input_resampler->available_elems() >= n_speech_samples)
+        {
+            short mod_out[n_nom_modem_samples];
+            short voice_in[n_speech_samples];
+            input_resampler->dequeue(voice_in, n_speech_samples);
+
+            const uint64_t encode_start_ns = metric_now_ns();
+            const size_t nout = crypto_tx->transmit(mod_out, voice_in);
+            encode_ns += metric_now_ns() - encode_start_ns;
+            metric_add(m_counters.frames_encoded);
+
+            output_resampler->enqueue(mod_out, nout);
+        }
+
+        TRACE_STAGE(stages, "output_resample");
+        const uint modem_resampled_frames =
+            get_nom_resampled_frames(n_nom_modem_samples,
+                                     modem_sample_rate,
+                                     sample_rate);
+        const uint required_frames =
+            (modem_resampled_frames + (nframes - 1)) / nframes;
+        const uint required_elems = nframes * required_frames;
+        if (output_resampler->available_elems() >= required_elems)
+        {
+            output_resampler->dequeue(modem_frames, nframes);
+        }
+        else
+        {
+            zeroize_frames(modem_frames, nframes);
+        }
+    }
+    else
+    {
+        // Only flush on the "falling edge"
+        if (m_transmitting_prev)
+        {
+            TRACE_STAGE(stages, "flush");
+
+            // When the microphone is off we have to make sure we have flushed
+            // all the voice and modem data out of the system and onto the modem
+            // port.
+
+            // Flush the input resampler to make sure all internal state is
+            // written out. This will also reset the libsamplerate
+            // state file
+            input_resampler->flush(n_speech_samples * 2);
+
+            // Run all the input data through the modem
+            while (input_resampler->available_elems() != 0)
+            {
+                short mod_out[n_nom_modem_samples];
+                // Initializing this buffer to zero will zero-fill the end
+                // if there aren't a multiple of n_speech_samples in the
+                // input queue
+                short voice_in[n_speech_samples] = {0};
+                input_resampler->dequeue(voice_in,
+                                         std::min(n_speech_samples,
+                                                  input_resampler->available_elems()));
+
+                const uint64_t encode_start_ns = metric_now_ns();
+                const size_t nout = crypto_tx->transmit(mod_out, voice_in);
+                encode_ns += metric_now_ns() - encode_start_ns;
+                metric_add(m_counters.frames_encoded);
+
+                output_resampler->enqueue(mod_out, nout);
+            }
+
+            // Now that the output resampler has all the data it will, flush
+            // it to make sure all internal state is written out. This will
+            // also reset the libsamplerate state file
+            output_resampler->flush(nframes * 2);
+        }
+
+        // Write out as much data to the modem port as we can. There may
+        // be a few cycles' worth of data queued.
+        TRACE_STAGE(stages, "output_resample");
+        const size_t available_frames =
+            std::min((size_t)nframes, output_resampler->available_elems());
+        const size_t remaining_frames = nframes - available_frames;
+        output_resampler->dequeue(modem_frames, available_frames);
+        if (remaining_frames > 0)
+        {
+            zeroize_frames(modem_frames + available_frames, remaining_frames);
+        }
+
+        // Force a new IV next time the microphone is active now that
+        // the codec is idle
+        crypto_tx->force_rekey_next_frame();
+
+        // Once the buffer is empty turn off the PTT output after a delay
+        if (available_frames == 0)
+        {
+            static const uint PTT_DEAD_KEY_PERIODS = 4;
+            if (m_delay_periods == PTT_DEAD_KEY_PERIODS)
+            {
+                m_ptt.set_output(false);
+            }
+            else
+            {
+                ++m_delay_periods;
+            }
+        }
+    }
+
+    m_transmitting_prev = transmitting_cur;
+
+    metric_add(m_counters.cycles);
+    metric_add(m_counters.rekeys, crypto_tx->num_rekeys() - rekeys_before);
+    metric_set(m_counters.input_queue, input_resampler->available_elems());
+    metric_set(m_counters.output_queue, output_resampler->available_elems());
+    metric_add(m_counters.encode_ns, encode_ns);
+    metric_add(m_counters.process_ns, metric_now_ns() - start_ns);
+}
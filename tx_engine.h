@@ -0,0 +1,122 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TX_ENGINE_H
+#define TX_ENGINE_H
+
+#include <deque>
+#include <memory>
+
+#include "audio_backend.h"
+#include "crypto_metrics.h"
+#include "crypto_tx_common.h"
+#include "resampler.h"
+#include "rt_handoff.h"
+
+class control_loop;
+
+// Updated by the realtime thread and served by the metrics thread
+struct tx_metrics
+{
+    explicit tx_metrics(crypto_metrics& m)
+        : cycles(m.add("cycles")),
+          xruns(m.add("xruns")),
+          frames_encoded(m.add("frames_encoded")),
+          rekeys(m.add("rekeys")),
+          transmissions(m.add("transmissions")),
+          transmit_us(m.add("transmit_us")),
+          input_queue(m.add("input_queue", METRIC_GAUGE)),
+          output_queue(m.add("output_queue", METRIC_GAUGE)),
+          encode_ns(m.add("encode_ns")),
+          process_ns(m.add("process_ns"))
+    {
+    }
+
+    metric_t& cycles;
+    metric_t& xruns;
+    metric_t& frames_encoded;
+    metric_t& rekeys;
+    metric_t& transmissions;
+    metric_t& transmit_us;
+    metric_t& input_queue;
+    metric_t& output_queue;
+    metric_t& encode_ns;
+    metric_t& process_ns;
+};
+
+// Everything that is rebuilt when the config file changes
+struct tx_state
+{
+    std::unique_ptr<crypto_tx_common> crypto_tx;
+    std::unique_ptr<resampler>        input_resampler;
+    std::unique_ptr<resampler>        output_resampler;
+};
+
+// Builds the encoder and resamplers for ports running at sample_rate.
+// Throws if the config can't be used
+tx_state* create_tx_state(const char* config_file, uint sample_rate);
+
+// The PTT input that keys the microphone and the PTT output that keys the
+// radio. Both are only used from the realtime thread
+class tx_ptt
+{
+public:
+    virtual ~tx_ptt() {}
+
+    virtual bool mic_enabled(crypto_tx_common& crypto_tx) = 0;
+    virtual void set_output(bool val) = 0;
+};
+
+// One audio cycle of jack_crypto_tx at a time: resamples the voice input,
+// encodes it and resamples the modem signal for the output, keying the PTT
+// output around transmissions. Works on plain sample buffers, so it runs
+// the same under any audio_backend
+class tx_engine
+{
+public:
+    // control is woken up when the previous state can be reclaimed, and may
+    // be null if the caller reclaims it some other way
+    tx_engine(tx_metrics& counters, tx_ptt& ptt, control_loop* control);
+
+    // Replaced by the main thread, picked up at the start of a cycle
+    rt_handoff<tx_state>& state() { return m_state; }
+
+    // Main thread. Transmits audio at the cycle sample rate ahead of the
+    // microphone, starting with the next cycle
+    void play(audio_buffer_t&& audio);
+
+    // Main thread. Frees the audio replaced by the last one played
+    void reclaim_played() { m_tts_file.reclaim(); }
+
+    // Realtime thread
+    void process(const audio_sample_t* voice_frames,
+                 audio_sample_t*       modem_frames,
+                 uint                  nframes,
+                 uint                  sample_rate);
+
+private:
+    tx_metrics&                m_counters;
+    tx_ptt&                    m_ptt;
+    control_loop*              m_control;
+
+    rt_handoff<tx_state>       m_state;
+
+    rt_handoff<audio_buffer_t> m_tts_file;
+    std::deque<audio_sample_t> m_tts_buffer;
+
+    uint                       m_delay_periods;
+    bool                       m_transmitting_prev;
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypto_tx_common.h"
+#include "tx_parallel.h"
+
+// Segments being read, encoded or written, per job. Bounds the memory used
+// when the output can't keep up
+#define SEGMENTS_PER_JOB 2
+
+enum segment_state {
+    SEGMENT_FREE,
+    SEGMENT_READY,
+    SEGMENT_ENCODING,
+    SEGMENT_DONE
+};
+
+struct segment {
+    enum segment_state state;
+    short*             speech;
+    short*             modem;
+    size_t             frames;
+    int                failed;
+};
+
+struct tx_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+
+    const char*     config_file;
+    size_t          speech_samples;
+    size_t          modem_samples;
+    size_t          frames_per_segment;
+
+    struct segment* segments;
+    size_t          num_segments;
+    // Segments are numbered in input order. Segment n lives in
+    // segments[n % num_segments]
+    size_t          num_read;
+    size_t          num_claimed;
+    int             end_of_input;
+};
+
+// Encodes one segment with an encoder of its own. Automatic rekeying is
+// turned off, since the new encoder already started with a new IV
+static int encode_segment(const struct tx_pool* pool, struct segment* seg) {
+    HCRYPTO_TX* crypto_tx = crypto_tx_create("crypto_tx", pool->config_file);
+    if (crypto_tx == NULL) {
+        return 0;
+    }
+    crypto_tx_set_rekey_period(crypto_tx, 0);
+
+    int ok = 1;
+    for (size_t i = 0; ok && i < seg->frames; ++i) {
+        ok = crypto_tx_transmit(crypto_tx,
+                                seg->modem + i * pool->modem_samples,
+                                seg->speech + i * pool->speech_samples) >= 0;
+    }
+
+    crypto_tx_destroy(crypto_tx);
+    return ok;
+}
+
+// Every job takes the oldest segment nobody has claimed yet. The segments
+// are all the same size and independent, so this balances the load as
+// well as per-job queues with stealing would
+static void* job_main(void* arg) {
+    struct tx_pool* pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->num_claimed == pool->num_read && !pool->end_of_input) {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+        if (pool->num_claimed == pool->num_read) {
+            break;
+        }
+
+        struct segment* seg = &pool->segments[pool->num_claimed++ % pool->num_segments];
+        seg->state = SEGMENT_ENCODING;
+        pthread_mutex_unlock(&pool->lock);
+
+        const int ok = encode_segment(pool, seg);
+
+        pthread_mutex_lock(&pool->lock);
+        seg->failed = !ok;
+        seg->state = SEGMENT_DONE;
+        pthread_cond_broadcast(&pool->changed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+// Copies the next segment's speech frames out of the input
+static size_t read_segment(const struct tx_pool* pool, struct stream_reader* in, struct segment* seg) {
+    const size_t frame_bytes = sizeof(short) * pool->speech_samples;
+    size_t frames = 0;
+    const void* frame;
+    while (frames < pool->frames_per_segment &&
+           (frame = stream_reader_next(in, frame_bytes)) != NULL) {
+        memcpy(seg->speech + frames * pool->speech_samples, frame, frame_bytes);
+        ++frames;
+    }
+
+    return frames;
+}
+
+long long tx_parallel_encode(const char* config_file,
+                             int jobs,
+                             struct stream_reader* in,
+                             struct stream_writer* out) {
+    HCRYPTO_TX* crypto_tx = crypto_tx_create("crypto_tx", config_file);
+    if (crypto_tx == NULL) {
+        return -1;
+    }
+
+    struct tx_pool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.config_file = config_file;
+    pool.speech_samples = crypto_tx_speech_samples_per_frame(crypto_tx);
+    pool.modem_samples = crypto_tx_modem_samples_per_frame(crypto_tx);
+    pool.frames_per_segment = crypto_tx_rekey_frames(crypto_tx);
+    crypto_tx_destroy(crypto_tx);
+
+    // Without rekeying there are no boundaries to split at
+    if (pool.frames_per_segment == 0 || jobs < 1) {
+        return -1;
+    }
+
+    pool.num_segments = (size_t)jobs * SEGMENTS_PER_JOB;
+    pool.segments = calloc(pool.num_segments, sizeof(struct segment));
+    if (pool.segments == NULL) {
+        return -1;
+    }
+
+    long long frames_written = 0;
+    int ok = 1;
+    for (size_t i = 0; ok && i < pool.num_segments; ++i) {
+        pool.segments[i].speech = malloc(sizeof(short) * pool.speech_samples * pool.frames_per_segment);
+        pool.segments[i].modem = malloc(sizeof(short) * pool.modem_samples * pool.frames_per_segment);
+        ok = pool.segments[i].speech != NULL && pool.segments[i].modem != NULL;
+    }
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.changed, NULL);
+
+    pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+    int num_threads = 0;
+    while (ok && threads != NULL && num_threads < jobs &&
+           pthread_create(&threads[num_threads], NULL, job_main, &pool) == 0) {
+        ++num_threads;
+    }
+    ok = ok && num_threads > 0;
+
+    // The calling thread reads segments into free slots and writes the
+    // encoded ones out in order
+    size_t num_written = 0;
+    int end_of_input = !ok;
+    while (!end_of_input || num_written < pool.num_read) {
+        struct segment* next_free = &pool.segments[pool.num_read % pool.num_segments];
+        if (!end_of_input && pool.num_read - num_written < pool.num_segments) {
+            // A slot is only reused once its segment has been written, so
+            // it can be filled without the lock
+            next_free->frames = read_segment(&pool, in, next_free);
+            end_of_input = next_free->frames < pool.frames_per_segment;
+
+            pthread_mutex_lock(&pool.lock);
+            if (next_free->frames > 0) {
+                next_free->state = SEGMENT_READY;
+                ++pool.num_read;
+            }
+            pool.end_of_input = end_of_input;
+            pthread_cond_broadcast(&pool.changed);
+            pthread_mutex_unlock(&pool.lock);
+            continue;
+        }
+
+        struct segment* seg = &pool.segments[num_written % pool.num_segments];
+        pthread_mutex_lock(&pool.lock);
+        while (seg->state != SEGMENT_DONE) {
+            pthread_cond_wait(&pool.changed, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        ok = ok && !seg->failed &&
+             stream_writer_write(out, seg->modem, sizeof(short) * pool.modem_samples * seg->frames);
+        if (ok) {
+            frames_written += seg->frames;
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        seg->state = SEGMENT_FREE;
+        pthread_mutex_unlock(&pool.lock);
+        ++num_written;
+
+        // Stop reading after a failure, but let the jobs finish what they
+        // have
+        if (!ok && !end_of_input) {
+            end_of_input = 1;
+            pthread_mutex_lock(&pool.lock);
+            pool.end_of_input = 1;
+            pthread_cond_broadcast(&pool.changed);
+            pthread_mutex_unlock(&pool.lock);
+        }
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.end_of_input = 1;
+    pthread_cond_broadcast(&pool.changed);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    pthread_cond_destroy(&pool.changed);
+    pthread_mutex_destroy(&pool.lock);
+    for (size_t i = 0; i < pool.num_segments; ++i) {
+        free(pool.segments[i].speech);
+        free(pool.segments[i].modem);
+    }
+    free(pool.segments);
+
+    return ok ? frames_written : -1;
+}
@@ -0,0 +1,33 @@
+#ifndef TX_PARALLEL_H
+#define TX_PARALLEL_H
+
+#include "stream_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Encodes a whole recording on jobs threads by cutting it into segments at
+// the rekey boundaries, one rekey period of speech frames each, and
+// encoding every segment with an encoder of its own. The modem output of
+// the segments is written in order, so the output has exactly one modem
+// frame per speech frame, like a sequential run.
+//
+// At each seam the output looks like the transmitter was restarted: the
+// segment starts with a new IV, as it would after a rekey, but also with a
+// freshly initialized FreeDV modulator, so a receiver may have to resync
+// there. Within a segment the IV never changes, so it changes at frames
+// k * rekey frames, where a sequential run changes it one frame earlier.
+//
+// Returns the number of frames encoded, or -1 if an encoder couldn't be
+// created or the output couldn't be written
+long long tx_parallel_encode(const char* config_file,
+                             int jobs,
+                             struct stream_reader* in,
+                             struct stream_writer* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif